@@ -32,9 +32,10 @@ struct dyad_params {
     bool m_async_publish;
     /// Apply fsync after write by producer
     bool m_fsync_write;
-    /// The depth of the key hierarchy for path
+    /// The depth of the key hierarchy for path. 0 to use the layout recorded
+    /// in the namespace by dyad_tune, or else the default one
     unsigned int m_key_depth;
-    /// The number of bins used in key hashing
+    /// The number of bins used in key hashing. 0 as for m_key_depth
     unsigned int m_key_bins;
     /// The number of brokers sharing node-local storage
     unsigned int m_service_mux;
@@ -58,8 +59,8 @@ struct dyad_params {
           m_reinit (false),
           m_async_publish (false),
           m_fsync_write (false),
-          m_key_depth (2u),
-          m_key_bins (256u),
+          m_key_depth (0u),
+          m_key_bins (0u),
           m_service_mux (1u),
           m_dtl_mode (0),
           m_kvs_namespace (""),
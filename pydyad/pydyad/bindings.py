@@ -8,6 +8,9 @@ dft_log = dft_fn("DYAD_PY")
 
 DYAD_LIB_DIR = None
 
+# Outcome of a file outside of the consumer-managed path (see dyad_rc.h)
+DYAD_RC_UNTRACKED = -1005
+
 
 class FluxHandle(ctypes.Structure):
     pass
@@ -51,6 +54,25 @@ class DyadCtxWrapper(ctypes.Structure):
         ("prod_managed_path", ctypes.c_char_p),
         ("cons_managed_path", ctypes.c_char_p),
         ("relative_to_managed_path", ctypes.c_bool),
+        ("inline_threshold", ctypes.c_uint32),
+        ("dtl_switch_size", ctypes.c_uint64),
+        ("md_mode", ctypes.c_int),
+        ("placement_pattern", ctypes.c_char_p),
+        ("placement_cb", ctypes.c_void_p),
+        ("placement_arg", ctypes.c_void_p),
+        ("kvs_shards", ctypes.c_uint32),
+        ("kvs_ttl", ctypes.c_uint32),
+        ("publish_thread", ctypes.c_bool),
+        ("fsync_group", ctypes.c_double),
+        ("publisher", ctypes.c_void_p),
+        ("publisher_fini", ctypes.c_void_p),
+        ("cache_bytes", ctypes.c_uint64),
+        ("cache_used", ctypes.c_int64),
+        ("readers", ctypes.c_uint32),
+        ("drain_path", ctypes.c_char_p),
+        ("fetch_retries", ctypes.c_uint32),
+        ("fetch_backoff", ctypes.c_double),
+        ("last_source", ctypes.c_int),
     ]
 
 
@@ -58,6 +80,12 @@ class DyadMetadataWrapper(ctypes.Structure):
     _fields_ = [
         ("fpath", ctypes.c_char_p),
         ("owner_rank", ctypes.c_uint32),
+        ("file_size", ctypes.c_size_t),
+        ("inline_data", ctypes.c_void_p),
+        ("inline_len", ctypes.c_size_t),
+        ("version", ctypes.c_uint64),
+        ("placed", ctypes.c_bool),
+        ("readers", ctypes.c_uint32),
     ]
 
 
@@ -85,6 +113,9 @@ class DyadMetadata:
 class DTLMode(enum.Enum):
     DYAD_DTL_UCX = "UCX"
     DYAD_DTL_FLUX_RPC = "FLUX_RPC"
+    DYAD_DTL_AUTO = "AUTO"
+    DYAD_DTL_TCP = "TCP"
+    DYAD_DTL_FABRIC = "FABRIC"
 
     def __str__(self):
         return self.value
@@ -106,8 +137,13 @@ class Dyad:
         self.dyad_init = None
         self.dyad_init_env = None
         self.dyad_produce = None
+        self.dyad_produce_version = None
+        self.dyad_produce_dir = None
+        self.dyad_set_readers = None
         self.dyad_consume = None
+        self.dyad_consume_version = None
         self.dyad_consume_w_metadata = None
+        self.dyad_consume_multi = None
         self.dyad_finalize = None
         dyad_core_lib_file = None
         dyad_ctx_lib_file = None
@@ -175,6 +211,29 @@ class Dyad:
         ]
         self.dyad_produce.restype = ctypes.c_int
 
+        self.dyad_produce_version = self.dyad_core_lib.dyad_produce_version
+        self.dyad_produce_version.argtypes = [
+            ctypes.POINTER(DyadCtxWrapper),
+            ctypes.c_char_p,
+            ctypes.c_uint64,
+        ]
+        self.dyad_produce_version.restype = ctypes.c_int
+
+        self.dyad_produce_dir = self.dyad_core_lib.dyad_produce_dir
+        self.dyad_produce_dir.argtypes = [
+            ctypes.POINTER(DyadCtxWrapper),
+            ctypes.c_char_p,
+        ]
+        self.dyad_produce_dir.restype = ctypes.c_int
+
+        self.dyad_set_readers = self.dyad_core_lib.dyad_set_readers
+        self.dyad_set_readers.argtypes = [
+            ctypes.POINTER(DyadCtxWrapper),
+            ctypes.c_char_p,
+            ctypes.c_uint32,
+        ]
+        self.dyad_set_readers.restype = ctypes.c_int
+
         self.dyad_get_metadata = self.dyad_core_lib.dyad_get_metadata
         self.dyad_get_metadata.argtypes = [
             ctypes.POINTER(DyadCtxWrapper),
@@ -197,6 +256,14 @@ class Dyad:
         ]
         self.dyad_consume.restype = ctypes.c_int
 
+        self.dyad_consume_version = self.dyad_core_lib.dyad_consume_version
+        self.dyad_consume_version.argtypes = [
+            ctypes.POINTER(DyadCtxWrapper),
+            ctypes.c_char_p,
+            ctypes.c_uint64,
+        ]
+        self.dyad_consume_version.restype = ctypes.c_int
+
         self.dyad_consume_w_metadata = self.dyad_core_lib.dyad_consume_w_metadata
         self.dyad_consume_w_metadata.argtypes = [
             ctypes.POINTER(DyadCtxWrapper),
@@ -205,6 +272,15 @@ class Dyad:
         ]
         self.dyad_consume_w_metadata.restype = ctypes.c_int
 
+        self.dyad_consume_multi = self.dyad_core_lib.dyad_consume_multi
+        self.dyad_consume_multi.argtypes = [
+            ctypes.POINTER(DyadCtxWrapper),
+            ctypes.POINTER(ctypes.c_char_p),
+            ctypes.c_size_t,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.dyad_consume_multi.restype = ctypes.c_int
+
         self.dyad_finalize = self.dyad_ctx_lib.dyad_finalize
         self.dyad_finalize.argtypes = [
         ]
@@ -223,8 +299,8 @@ class Dyad:
         reinit=False,
         async_publish=False,
         fsync_write=False,
-        key_depth=3,
-        key_bins=1024,
+        key_depth=0,
+        key_bins=0,
         service_mux=1,
         kvs_namespace=None,
         prod_managed_path=None,
@@ -305,19 +381,49 @@ class Dyad:
         self.finalize()
 
     @dft_log.log
-    def produce(self, fname):
+    def produce(self, fname, version=None, readers=None):
         if self.dyad_produce is None:
             warnings.warn(
                 "Trying to produce with DYAD when libdyad_core.so was not found",
                 RuntimeWarning
             )
             return
-        res = self.dyad_produce(
+        if readers is not None:
+            res = self.dyad_set_readers(
+                self.ctx,
+                fname.encode(),
+                readers,
+            )
+            if int(res) != 0:
+                raise RuntimeError("Cannot set the reader count with DYAD!")
+        if version is not None:
+            res = self.dyad_produce_version(
+                self.ctx,
+                fname.encode(),
+                version,
+            )
+        else:
+            res = self.dyad_produce(
+                self.ctx,
+                fname.encode(),
+            )
+        if int(res) != 0:
+            raise RuntimeError("Cannot produce data with DYAD!")
+
+    @dft_log.log
+    def produce_dir(self, dirname):
+        if self.dyad_produce_dir is None:
+            warnings.warn(
+                "Trying to produce with DYAD when libdyad_core.so was not found",
+                RuntimeWarning
+            )
+            return
+        res = self.dyad_produce_dir(
             self.ctx,
-            fname.encode(),
+            dirname.encode(),
         )
         if int(res) != 0:
-            raise RuntimeError("Cannot produce data with DYAD!")
+            raise RuntimeError("Cannot produce directory with DYAD!")
 
     @dft_log.log
     def get_metadata(self, fname, should_wait=False, raw=False):
@@ -352,17 +458,24 @@ class Dyad:
             raise RuntimeError("Could not free DYAD metadata")
 
     @dft_log.log
-    def consume(self, fname):
+    def consume(self, fname, version=None):
         if self.dyad_consume is None:
             warnings.warn(
                 "Trying to consunme with DYAD when libdyad_core.so was not found",
                 RuntimeWarning
             )
             return
-        res = self.dyad_consume(
-            self.ctx,
-            fname.encode(),
-        )
+        if version is not None:
+            res = self.dyad_consume_version(
+                self.ctx,
+                fname.encode(),
+                version,
+            )
+        else:
+            res = self.dyad_consume(
+                self.ctx,
+                fname.encode(),
+            )
         if int(res) != 0:
             raise RuntimeError("Cannot consume data with DYAD!")
 
@@ -382,6 +495,32 @@ class Dyad:
         if int(res) != 0:
             raise RuntimeError("Cannot consume data with metadata with DYAD!")
 
+    @dft_log.log
+    def consume_multi(self, fnames):
+        """Consume several files, fetching the ones of each producer in a
+        single transfer. Returns the list of files that are outside of the
+        consumer-managed path, and so were not consumed."""
+        if self.dyad_consume_multi is None:
+            warnings.warn(
+                "Trying to consume with DYAD when libdyad_core.so was not found",
+                RuntimeWarning
+            )
+            return []
+        num_files = len(fnames)
+        c_fnames = (ctypes.c_char_p * num_files)(*[str(f).encode() for f in fnames])
+        file_rcs = (ctypes.c_int * num_files)()
+        self.dyad_consume_multi(
+            self.ctx,
+            c_fnames,
+            num_files,
+            file_rcs,
+        )
+        failed = [str(f) for f, rc in zip(fnames, file_rcs)
+                  if rc != 0 and rc != DYAD_RC_UNTRACKED]
+        if failed:
+            raise RuntimeError("Cannot consume data with DYAD: {}".format(", ".join(failed)))
+        return [str(f) for f, rc in zip(fnames, file_rcs) if rc == DYAD_RC_UNTRACKED]
+
     @dft_log.log
     def finalize(self):
         if not self.initialized:
@@ -1,25 +1,43 @@
 #ifndef DYAD_COMMON_DYAD_DTL_H
 #define DYAD_COMMON_DYAD_DTL_H
 
+// Installed with dyad_dtl_plugin.h, so it must build without the config
 #if defined(DYAD_HAS_CONFIG)
 #include <dyad/dyad_config.hpp>
-#else
-#error "no config"
 #endif
 
 #ifdef __cplusplus
+#include <cstdint>
+
 extern "C" {
+#else
+#include <stdint.h>
 #endif
 
-
 enum dyad_dtl_mode { DYAD_DTL_UCX = 0,
                      DYAD_DTL_FLUX_RPC = 1,
                      DYAD_DTL_DEFAULT = 1,
-                     DYAD_DTL_END = 2 };
+                     DYAD_DTL_AUTO = 2,  // Both of the above, chosen per transfer
+                     DYAD_DTL_TCP = 3,
+                     DYAD_DTL_FABRIC = 4,
+                     DYAD_DTL_PLUGIN = 5,  // Loaded from a shared object by name
+                     DYAD_DTL_END = 6 };
 typedef enum dyad_dtl_mode dyad_dtl_mode_t;
 
 static const char* dyad_dtl_mode_name[DYAD_DTL_END+1] __attribute__((unused))
-    = {"UCX", "FLUX_RPC", "DTL_UNKNOWN"};
+    = {"UCX", "FLUX_RPC", "AUTO", "TCP", "FABRIC", "PLUGIN", "DTL_UNKNOWN"};
+
+// DTL mode prefix of the name or path of a DTL plugin, e.g. "plugin:mydtl"
+#define DYAD_DTL_PLUGIN_PREFIX "plugin:"
+
+// Capabilities a DTL reports in its `caps' field
+#define DYAD_DTL_CAP_ZERO_COPY (1ul << 0)  // send_file ships files without staging them
+#define DYAD_DTL_CAP_RMA (1ul << 1)        // data moves by one-sided RMA
+#define DYAD_DTL_CAP_CHUNKING (1ul << 2)   // large transfers are split and pipelined
+
+// In DYAD_DTL_AUTO mode, transfers smaller than this many bytes go over
+// Flux RPC and the rest over UCX, unless DYAD_DTL_AUTO_THRESHOLD is set
+#define DYAD_DTL_AUTO_THRESHOLD_DEFAULT (1024u * 1024u)
 
 enum dyad_dtl_comm_mode {
     DYAD_COMM_NONE = 0,  // Sanity check value for when
@@ -32,6 +50,40 @@ typedef enum dyad_dtl_comm_mode dyad_dtl_comm_mode_t;
 
 
 #define DYAD_DTL_RPC_NAME "dyad.fetch"
+// Sent by a consumer once it has pulled the data of a dyad.fetch request
+// with RMA GET, so that the producer can release the exposed memory
+#define DYAD_DTL_RPC_DONE_NAME "dyad.fetch_done"
+// Sent to the module by the broker when a client that used the dyad service
+// goes away, so that what is held for it can be released
+#define DYAD_DTL_RPC_DISCONNECT_NAME "dyad.disconnect"
+// Optional key of a dyad.fetch request that lists every upath to ship
+// back in a single transfer
+#define DYAD_DTL_RPC_UPATHS "upaths"
+// Key of a dyad.fetch request naming, as a dyad_dtl_mode_t, the DTL the
+// consumer receives the data with. A module in DYAD_DTL_AUTO mode serves the
+// request over that DTL.
+#define DYAD_DTL_RPC_MODE "dtl_mode"
+// Optional key of a dyad.fetch request, true if the consumer found the
+// producer by the placement rule. As no record told it that the file is
+// complete, the module waits for the producer to commit it.
+#define DYAD_DTL_RPC_PLACED "placed"
+// Optional key of a dyad.fetch request with the version the consumer found
+// in the record. The module holds the request while the file it has is
+// committed at an older version.
+#define DYAD_DTL_RPC_VERSION "version"
+// Maximum number of files packed into one dyad.fetch transfer
+#define DYAD_DTL_MULTI_MAX 1024u
+
+/**
+ * Index entry of a multi-file transfer. The packed buffer starts with a
+ * uint64_t file count followed by one entry per file, in request order.
+ * The entries are followed by each file's NUL-terminated upath and
+ * contents, again in request order.
+ */
+struct dyad_dtl_multi_entry {
+    uint64_t upath_len;  // length of the upath including the terminating NUL
+    int64_t data_len;    // size of the file, or -1 if it could not be read
+};
 
 struct dyad_dtl;
 
@@ -22,5 +22,29 @@
 #define DYAD_SYNC_DEBUG_ENV "DYAD_SYNC_DEBUG"
 #define DYAD_SERVICE_MUX_ENV "DYAD_SERVICE_MUX"
 #define DYAD_REINIT_ENV "DYAD_REINIT"
+#define DYAD_INLINE_THRESHOLD_ENV "DYAD_INLINE_THRESHOLD"
+#define DYAD_DTL_AUTO_THRESHOLD_ENV "DYAD_DTL_AUTO_THRESHOLD"
+#define DYAD_UCX_STRIPE_SIZE_ENV "DYAD_UCX_STRIPE_SIZE"
+#define DYAD_UCX_RAILS_ENV "DYAD_UCX_RAILS"
+#define DYAD_TCP_HOST_ENV "DYAD_TCP_HOST"
+#define DYAD_TCP_PORT_ENV "DYAD_TCP_PORT"
+#define DYAD_FABRIC_PROVIDER_ENV "DYAD_FABRIC_PROVIDER"
+#define DYAD_FABRIC_RMA_ENV "DYAD_FABRIC_RMA"
+#define DYAD_DTL_PLUGIN_DIR_ENV "DYAD_DTL_PLUGIN_DIR"
+#define DYAD_METADATA_MODE_ENV "DYAD_METADATA_MODE"
+#define DYAD_PLACEMENT_PATTERN_ENV "DYAD_PLACEMENT_PATTERN"
+#define DYAD_KVS_SHARDS_ENV "DYAD_KVS_SHARDS"
+#define DYAD_KVS_TTL_ENV "DYAD_KVS_TTL"
+#define DYAD_KVS_SWEEP_PERIOD_ENV "DYAD_KVS_SWEEP_PERIOD"
+#define DYAD_WATCH_PERIOD_ENV "DYAD_WATCH_PERIOD"
+#define DYAD_PUBLISH_THREAD_ENV "DYAD_PUBLISH_THREAD"
+#define DYAD_FSYNC_GROUP_ENV "DYAD_FSYNC_GROUP"
+#define DYAD_CACHE_BYTES_ENV "DYAD_CACHE_BYTES"
+#define DYAD_READERS_ENV "DYAD_READERS"
+#define DYAD_PATH_DRAIN_ENV "DYAD_PATH_DRAIN"
+#define DYAD_DRAIN_STREAMS_ENV "DYAD_DRAIN_STREAMS"
+#define DYAD_DRAIN_BANDWIDTH_ENV "DYAD_DRAIN_BANDWIDTH"
+#define DYAD_FETCH_RETRIES_ENV "DYAD_FETCH_RETRIES"
+#define DYAD_FETCH_BACKOFF_ENV "DYAD_FETCH_BACKOFF"
 
 #endif  // DYAD_COMMON_DYAD_ENVS_H
@@ -0,0 +1,45 @@
+#ifndef DYAD_COMMON_DYAD_MD_H
+#define DYAD_COMMON_DYAD_MD_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where producers publish, and consumers look up, the location of files
+enum dyad_md_mode { DYAD_MD_KVS = 0,      // the Flux KVS
+                    DYAD_MD_DEFAULT = 0,
+                    DYAD_MD_DHT = 1,      // shards held by the DYAD modules
+                    DYAD_MD_END = 2 };
+typedef enum dyad_md_mode dyad_md_mode_t;
+
+static const char* dyad_md_mode_name[DYAD_MD_END+1] __attribute__((unused))
+    = {"KVS", "DHT", "MD_UNKNOWN"};
+
+// RPCs served by the module that is the home of a key in DYAD_MD_DHT mode
+#define DYAD_MD_RPC_PUBLISH "dyad.md.publish"
+#define DYAD_MD_RPC_LOOKUP "dyad.md.lookup"
+#define DYAD_MD_RPC_UNPUBLISH "dyad.md.unpublish"
+// Seconds a lookup waits for a given version of a record in DYAD_MD_KVS
+// mode, the same as a parked DYAD_MD_DHT lookup, before failing
+#define DYAD_MD_VERSION_WAIT_TIMEOUT 30.0
+
+// Key layout recorded in DYAD_KVS_NAMESPACE by dyad_tune --apply, as
+// {"key_depth": int, "key_bins": int}
+#define DYAD_KVS_CONFIG_KEY "dyad.config"
+
+// Name of shard `i' of the KVS namespace `ns' when DYAD_KVS_SHARDS > 1
+#define DYAD_KVS_SHARD_FMT "%s-%u"
+// Largest accepted DYAD_KVS_SHARDS
+#define DYAD_KVS_SHARDS_MAX 1024u
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_COMMON_DYAD_MD_H */
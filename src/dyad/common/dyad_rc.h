@@ -1,10 +1,9 @@
 #ifndef DYAD_DTL_DYAD_RC_H
 #define DYAD_DTL_DYAD_RC_H
 
+// Installed with dyad_dtl_plugin.h, so it must build without the config
 #if defined(DYAD_HAS_CONFIG)
 #include <dyad/dyad_config.hpp>
-#else
-#error "no config"
 #endif
 
 #if BUILDING_DYAD
@@ -64,6 +63,14 @@ enum dyad_core_return_codes {
     DYAD_RC_UCXRKEY_PACK_FAILED = -3006,     // Failed to perform operations with ucp_mem_map
     DYAD_RC_UCXRKEY_UNPACK_FAILED = -3007,     // Failed to perform operations with ucp_mem_map
 
+    //TCP
+    DYAD_RC_TCPCONN_FAIL = -4001,     // Cannot open or accept a TCP connection
+    DYAD_RC_TCPCOMM_FAIL = -4002,     // TCP send/recv failed or timed out
+
+    //libfabric
+    DYAD_RC_FABRICINIT_FAIL = -5001,  // libfabric initialization failed
+    DYAD_RC_FABRICCOMM_FAIL = -5002,  // libfabric communication routine failed
+
 };
 
 typedef enum dyad_core_return_codes dyad_rc_t;
@@ -14,11 +14,35 @@
 #include <stdint.h>
 #endif
 
+#include <dyad/common/dyad_md.h>
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Map a path relative to the consumer-managed directory to the rank of the
+ * broker that produces it. Returns false if the path does not follow the
+ * placement rule, in which case its location is looked up as usual.
+ */
+typedef bool (*dyad_placement_cb_t) (const char* upath, uint32_t* owner_rank, void* arg);
+
+// Publishes closed files from a background thread (see dyad_publish.h)
+typedef struct dyad_publisher dyad_publisher_t;
+
+// Where a consumed file came from
+enum dyad_source { DYAD_SOURCE_NONE = 0,    // nothing consumed yet
+                   DYAD_SOURCE_LOCAL = 1,   // already readable: shared storage, same node or cached
+                   DYAD_SOURCE_INLINE = 2,  // its metadata record
+                   DYAD_SOURCE_OWNER = 3,   // the module of the producer's broker
+                   DYAD_SOURCE_DRAIN = 4,   // the copy in the drain path
+                   DYAD_SOURCE_END = 5 };
+typedef enum dyad_source dyad_source_t;
+
+static const char* dyad_source_name[DYAD_SOURCE_END + 1] __attribute__ ((unused))
+    = {"NONE", "LOCAL", "INLINE", "OWNER", "DRAIN", "SOURCE_UNKNOWN"};
+
 /**
  * @struct dyad_ctx
  */
@@ -57,6 +81,25 @@ struct dyad_ctx {
     char* prod_managed_path;        // producer path managed by DYAD
     char* cons_managed_path;        // consumer path managed by DYAD
     bool relative_to_managed_path;  // relative path is relative to the managed path
+    uint32_t inline_threshold;      // files up to this size are inlined in the KVS
+    uint64_t dtl_switch_size;       // AUTO DTL: smallest transfer sent over UCX
+    dyad_md_mode_t md_mode;         // where file records are published
+    char* placement_pattern;        // upath pattern giving the owner rank (%r)
+    dyad_placement_cb_t placement_cb;  // maps a upath to its owner rank
+    void* placement_arg;            // argument passed to placement_cb
+    uint32_t kvs_shards;            // number of KVS namespaces keys are spread over
+    uint32_t kvs_ttl;               // seconds a published record lives (0: forever)
+    bool publish_thread;            // publish closed files from a background thread
+    double fsync_group;             // seconds closes are gathered into one flush (0: none)
+    dyad_publisher_t* publisher;    // background publisher, if started
+    void (*publisher_fini) (struct dyad_ctx* ctx);  // drains and stops the publisher
+    uint64_t cache_bytes;           // byte budget of the consumer-managed path (0: none)
+    int64_t cache_used;             // bytes it held when last counted (< 0: not yet)
+    uint32_t readers;               // consumers expected to fetch each produced file (0: keep)
+    char* drain_path;               // parallel file system copy of produced files, if any
+    uint32_t fetch_retries;         // times a failed fetch is retried
+    double fetch_backoff;           // seconds before the first retry, doubled for each next
+    dyad_source_t last_source;      // where the last consumed file came from
 };
 typedef struct dyad_ctx dyad_ctx_t;
 typedef void* ucx_ep_cache_h;
@@ -0,0 +1,211 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  // _GNU_SOURCE
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_cache.h>
+#include <dyad/utils/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+// Most file descriptors nftw () keeps open while counting the cache
+#define DYAD_CACHE_FDS 64
+
+struct cache_entry {
+    char *path;
+    uint64_t size;
+    struct timespec atime;
+    time_t used;  // last read or write
+};
+
+struct cache_walk {
+    struct cache_entry *entries;
+    size_t num_entries;
+    size_t capacity;
+    uint64_t total;
+    bool failed;
+};
+
+// nftw () takes no callback argument
+static __thread struct cache_walk *cache_walk = NULL;
+// Serializes the evictions of the threads of a process
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cache_visit (const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+    struct cache_walk *w = cache_walk;
+    struct cache_entry *entries = NULL;
+
+    // Copies still being written are not in the cache yet, and files DYAD
+    // did not fetch are not in it at all
+    if (typeflag != FTW_F || !S_ISREG (sb->st_mode) || strstr (fpath, ".dyad.") != NULL
+        || getxattr (fpath, DYAD_CACHED_XATTR, NULL, 0ul) < 0) {
+        return 0;
+    }
+    if (w->num_entries == w->capacity) {
+        w->capacity = (w->capacity > 0ul) ? 2ul * w->capacity : 1024ul;
+        entries = (struct cache_entry *)realloc (w->entries, w->capacity * sizeof (*entries));
+        if (entries == NULL) {
+            w->failed = true;
+            return 1;
+        }
+        w->entries = entries;
+    }
+    if ((w->entries[w->num_entries].path = strdup (fpath)) == NULL) {
+        w->failed = true;
+        return 1;
+    }
+    w->entries[w->num_entries].size = (uint64_t)sb->st_size;
+    w->entries[w->num_entries].atime = sb->st_atim;
+    w->entries[w->num_entries].used = (sb->st_atim.tv_sec > sb->st_mtim.tv_sec)
+                                          ? sb->st_atim.tv_sec
+                                          : sb->st_mtim.tv_sec;
+    w->num_entries++;
+    w->total += (uint64_t)sb->st_size;
+    return 0;
+}
+
+static int cmp_cache_atime (const void *a, const void *b)
+{
+    const struct timespec *ta = &((const struct cache_entry *)a)->atime;
+    const struct timespec *tb = &((const struct cache_entry *)b)->atime;
+    if (ta->tv_sec != tb->tv_sec) {
+        return (ta->tv_sec < tb->tv_sec) ? -1 : 1;
+    }
+    return (ta->tv_nsec < tb->tv_nsec) ? -1 : (ta->tv_nsec > tb->tv_nsec);
+}
+
+/* Remove `path' unless a process has it open. A write lease cannot be taken
+ * on a file open elsewhere, and is held over the unlink so that the file is
+ * not opened in between. Where leases are not available, the grace period
+ * alone protects the files in use. */
+static int cache_unlink (const char *path)
+{
+    int fd = dyad_open_raw (path, O_RDONLY | O_NONBLOCK, 0);
+    bool leased = false;
+    int ret = -1;
+    int saved_errno = 0;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fcntl (fd, F_SETLEASE, F_WRLCK) == 0) {
+        leased = true;
+    } else if (errno == EAGAIN) {
+        close (fd);
+        errno = EBUSY;
+        return -1;
+    }
+    ret = unlink (path);
+    saved_errno = errno;
+    if (leased) {
+        fcntl (fd, F_SETLEASE, F_UNLCK);
+    }
+    close (fd);
+    errno = saved_errno;
+    return ret;
+}
+
+/* Count what the directory holds, as consumers in other processes fill it
+ * too, and remove the least recently read files if it is over the budget. */
+static dyad_rc_t cache_evict (dyad_ctx_t *ctx)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    struct cache_walk w = {NULL, 0ul, 0ul, 0ul, false};
+    const uint64_t low = ctx->cache_bytes / 100u * DYAD_CACHE_LOW_PERCENT;
+    size_t evicted = 0ul;
+    const time_t grace = time (NULL) - DYAD_CACHE_GRACE;
+
+    cache_walk = &w;
+    if (nftw (ctx->cons_managed_path, cache_visit, DYAD_CACHE_FDS, FTW_PHYS) != 0 || w.failed) {
+        DYAD_LOG_ERROR (ctx, "DYAD_CACHE: cannot count the files of %s", ctx->cons_managed_path);
+        rc = DYAD_RC_BADFIO;
+        goto cache_evict_done;
+    }
+    if (w.total > ctx->cache_bytes) {
+        qsort (w.entries, w.num_entries, sizeof (*w.entries), cmp_cache_atime);
+        for (size_t i = 0ul; i < w.num_entries && w.total > low; i++) {
+            if (w.entries[i].used > grace) {
+                continue;
+            }
+            // Another consumer may have removed it first
+            if (cache_unlink (w.entries[i].path) == 0 || errno == ENOENT) {
+                w.total -= w.entries[i].size;
+                evicted++;
+            }
+        }
+        DYAD_LOG_INFO (ctx, "DYAD_CACHE: evicted %zu files, %lu bytes remain", evicted,
+                       (unsigned long)w.total);
+    }
+    __atomic_store_n (&ctx->cache_used, (int64_t)w.total, __ATOMIC_RELAXED);
+
+cache_evict_done:;
+    cache_walk = NULL;
+    for (size_t i = 0ul; i < w.num_entries; i++) {
+        free (w.entries[i].path);
+    }
+    free (w.entries);
+    return rc;
+}
+
+void dyad_cache_mark (const dyad_ctx_t *ctx, int fd)
+{
+    const char one = '1';
+
+    if (ctx->cache_bytes > 0ul && fsetxattr (fd, DYAD_CACHED_XATTR, &one, sizeof (one), 0) != 0) {
+        DYAD_LOG_DEBUG (ctx, "DYAD_CACHE: cannot mark a fetched file: %s", strerror (errno));
+    }
+}
+
+void dyad_cache_touch (const dyad_ctx_t *ctx, const char *fname)
+{
+    // The file system may not update access times itself (noatime, relatime)
+    const struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_OMIT}};
+
+    if (ctx->cache_bytes > 0ul && utimensat (AT_FDCWD, fname, times, 0) != 0) {
+        DYAD_LOG_DEBUG (ctx, "DYAD_CACHE: cannot mark %s as read: %s", fname, strerror (errno));
+    }
+}
+
+dyad_rc_t dyad_cache_admit (dyad_ctx_t *ctx, size_t size)
+{
+    DYAD_C_FUNCTION_START ();
+    DYAD_C_FUNCTION_UPDATE_INT ("size", size);
+    dyad_rc_t rc = DYAD_RC_OK;
+    int64_t used = 0;
+
+    if (ctx->cache_bytes == 0ul || ctx->cons_managed_path == NULL) {
+        goto cache_admit_done;
+    }
+    // The directory is only counted when the estimate goes over the budget
+    used = __atomic_add_fetch (&ctx->cache_used, (int64_t)size, __ATOMIC_RELAXED);
+    if (used >= 0 && (uint64_t)used <= ctx->cache_bytes) {
+        goto cache_admit_done;
+    }
+    pthread_mutex_lock (&cache_lock);
+    used = __atomic_load_n (&ctx->cache_used, __ATOMIC_RELAXED);
+    // Another thread may have evicted meanwhile
+    if (used < 0 || (uint64_t)used > ctx->cache_bytes) {
+        rc = cache_evict (ctx);
+    }
+    pthread_mutex_unlock (&cache_lock);
+
+cache_admit_done:;
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
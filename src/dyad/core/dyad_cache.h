@@ -0,0 +1,49 @@
+#ifndef DYAD_CORE_DYAD_CACHE_H
+#define DYAD_CORE_DYAD_CACHE_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* With ctx->cache_bytes, the files DYAD fetched into the consumer-managed
+ * directory are a cache of that many bytes. Once they take more, the ones
+ * read least recently are removed until they are back to
+ * DYAD_CACHE_LOW_PERCENT of the budget. A removed file is fetched again by
+ * the next dyad_consume (). Other files in the directory are left alone, as
+ * are files read or written within the last DYAD_CACHE_GRACE seconds and
+ * files a process has open. */
+#define DYAD_CACHE_LOW_PERCENT 90u
+#define DYAD_CACHE_GRACE 5
+// Extended attribute marking the files DYAD fetched, which it may evict
+#define DYAD_CACHED_XATTR "user.dyad.cached"
+
+// Mark the file fetched into `fd' as one the cache may evict
+void dyad_cache_mark (const dyad_ctx_t *ctx, int fd);
+
+// Mark `fname', which is already in the cache, as just read
+void dyad_cache_touch (const dyad_ctx_t *ctx, const char *fname);
+
+// Account for `size' bytes just fetched, and evict if over the budget.
+// The directory is counted on the first call.
+dyad_rc_t dyad_cache_admit (dyad_ctx_t *ctx, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // DYAD_CORE_DYAD_CACHE_H
@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  // _GNU_SOURCE
+
 #if defined(DYAD_HAS_CONFIG)
 #include <dyad/dyad_config.hpp>
 #else
@@ -9,12 +13,21 @@
 #include <dyad/common/dyad_logging.h>
 #include <dyad/common/dyad_profiler.h>
 #include <dyad/dtl/dyad_dtl_api.h>
+#include <dyad/core/dyad_cache.h>
 #include <dyad/core/dyad_core.h>
+#include <dyad/core/dyad_md_api.h>
 #include <dyad/utils/utils.h>
 #include <dyad/utils/murmur3.h>
+#include <dyad/utils/read_all.h>
+#include <dyad/utils/base64/base64.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <libgen.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
 #include <unistd.h>
 #include <flux/core.h>
 
@@ -27,7 +40,7 @@
 #include <string.h>
 #endif
 
-
+extern const base64_maps_t base64_maps_rfc4648;
 
 
 DYAD_DLL_EXPORTED int gen_path_key (const char* restrict str,
@@ -89,54 +102,174 @@ DYAD_DLL_EXPORTED int gen_path_key (const char* restrict str,
     return 0;
 }
 
-static void future_cleanup_cb (flux_future_t *f, void *arg)
-{
-    if (flux_future_get (f, NULL) < 0) {
-        DYAD_LOG_STDERR ("future_cleanup: future error detected with.%s", "");
-    }
-    flux_future_destroy (f);
-}
-
-DYAD_CORE_FUNC_MODS dyad_rc_t dyad_kvs_commit (const dyad_ctx_t* restrict ctx,
-                                               flux_kvs_txn_t* restrict txn)
+/**
+ * Build the KVS record of a produced file. The record always carries its
+ * format and the owner rank and, when the file can be stat'ed, its size.
+ * With `with_data', files no larger than ctx->inline_threshold also carry
+ * their base64-encoded contents so that consumers can skip the fetch RPC to
+ * the owner's broker. Reading and encoding the file is left to the batched
+ * publishes, which run off the close () path. A non-zero `version' is
+ * recorded so that consumers can wait for that version.
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_pack_record (const dyad_ctx_t* restrict ctx,
+                                              const char* restrict upath,
+                                              uint64_t version,
+                                              bool with_data,
+                                              json_t** restrict record)
 {
     DYAD_C_FUNCTION_START();
-    flux_future_t* f = NULL;
     dyad_rc_t rc = DYAD_RC_OK;
-    DYAD_LOG_INFO (ctx, "Committing transaction to KVS");
-    // Commit the transaction to the Flux KVS
-    f = flux_kvs_commit ((flux_t*) ctx->h, ctx->kvs_namespace, 0, txn);
-    // If the commit failed, log an error and return DYAD_BADCOMMIT
-    if (f == NULL) {
-        DYAD_LOG_ERROR (ctx, "Could not commit transaction to Flux KVS");
-        rc = DYAD_RC_BADCOMMIT;
-        goto kvs_commit_region_finish;
+    char fullpath[PATH_MAX + 1] = {'\0'};
+    struct stat st;
+    int fd = -1;
+    void* data = NULL;
+    char* enc_data = NULL;
+    ssize_t data_len = 0l;
+    ssize_t enc_len = 0l;
+    size_t enc_cap = 0ul;
+    uint32_t readers = 0u;
+
+    *record = NULL;
+    strncpy (fullpath, ctx->prod_managed_path, PATH_MAX - 1);
+    concat_str (fullpath, upath, "/", PATH_MAX);
+    // Called by the publisher thread too, which must not enter the wrapper
+    fd = dyad_open_raw (fullpath, O_RDONLY, 0);
+    if (fd < 0 || fstat (fd, &st) < 0) {
+        DYAD_LOG_DEBUG (ctx, "Cannot stat %s. Publishing the owner rank only", fullpath);
+        *record = json_pack ("{s:i, s:i}", "format", DYAD_RECORD_FORMAT, "rank", (int)ctx->rank);
+        goto pack_record_done;
+    }
+    // The module counts the fetches of files with a reader count (see dyad_gc.h)
+    if (ctx->readers > 0u
+        && fgetxattr (fd, DYAD_READERS_XATTR, NULL, 0ul) < 0 && errno == ENODATA
+        && fsetxattr (fd, DYAD_READERS_XATTR, &ctx->readers, sizeof (ctx->readers), 0) != 0) {
+        DYAD_LOG_DEBUG (ctx, "Cannot set the reader count of %s: %s", fullpath, strerror (errno));
     }
-    if (ctx->async_publish) {
-        if (flux_future_then (f, -1, future_cleanup_cb, NULL) < 0) {
-            DYAD_LOG_ERROR (ctx, "Error with flux_future_then");
+    // Consumers of a file with a reader count tell the module when done
+    if (fgetxattr (fd, DYAD_READERS_XATTR, &readers, sizeof (readers)) != sizeof (readers)) {
+        readers = 0u;
+    }
+    // Tells the module that a file fetched by the placement rule is complete
+    if (fsetxattr (fd, DYAD_COMMITTED_XATTR, &version, sizeof (version), 0) != 0) {
+        DYAD_LOG_DEBUG (ctx, "Cannot mark %s committed: %s", fullpath, strerror (errno));
+    }
+    if (!with_data || ctx->inline_threshold == 0u
+        || st.st_size > (off_t)ctx->inline_threshold) {
+        *record = json_pack ("{s:i, s:i, s:I}",
+                             "format",
+                             DYAD_RECORD_FORMAT,
+                             "rank",
+                             (int)ctx->rank,
+                             "size",
+                             (json_int_t)st.st_size);
+        goto pack_record_done;
+    }
+    if (st.st_size > 0) {
+        data_len = read_all (fd, &data);
+        if (data_len != st.st_size) {
+            DYAD_LOG_ERROR (ctx, "Cannot read %s to inline it into the KVS", fullpath);
+            rc = DYAD_RC_BADFIO;
+            goto pack_record_done;
         }
-    } else {
-        // If the commit is pending, wait for it to complete
-        flux_future_wait_for (f, -1.0);
-        // Once the commit is complete, destroy the future and transaction
-        flux_future_destroy (f);
-        f = NULL;
     }
-    rc = DYAD_RC_OK;
-kvs_commit_region_finish:;
+    enc_cap = base64_encoded_length ((size_t)data_len) + 1;
+    enc_data = (char*)malloc (enc_cap);
+    if (enc_data == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate buffer to encode inline data");
+        rc = DYAD_RC_SYSFAIL;
+        goto pack_record_done;
+    }
+    enc_len = base64_encode_using_maps (&base64_maps_rfc4648,
+                                        enc_data,
+                                        enc_cap,
+                                        (const char*)data,
+                                        (size_t)data_len);
+    if (enc_len < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot encode inline data of %s with base64", fullpath);
+        rc = DYAD_RC_SYSFAIL;
+        goto pack_record_done;
+    }
+    DYAD_LOG_INFO (ctx, "Inlining %zd bytes of %s into the KVS record", data_len, upath);
+    *record = json_pack ("{s:i, s:i, s:I, s:s%}",
+                         "format",
+                         DYAD_RECORD_FORMAT,
+                         "rank",
+                         (int)ctx->rank,
+                         "size",
+                         (json_int_t)data_len,
+                         "data",
+                         enc_data,
+                         (size_t)enc_len);
+
+pack_record_done:;
+    if (!DYAD_IS_ERROR (rc) && *record == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot pack the KVS record of %s", upath);
+        rc = DYAD_RC_SYSFAIL;
+    }
+    if (!DYAD_IS_ERROR (rc) && version > 0u) {
+        json_object_set_new (*record, "version", json_integer ((json_int_t)version));
+    }
+    if (!DYAD_IS_ERROR (rc) && readers > 0u) {
+        json_object_set_new (*record, "readers", json_integer ((json_int_t)readers));
+    }
+    // Records with an expiration time are removed by the module's sweeper
+    if (!DYAD_IS_ERROR (rc) && ctx->kvs_ttl > 0u) {
+        json_object_set_new (*record,
+                             "expires",
+                             json_integer ((json_int_t)time (NULL) + (json_int_t)ctx->kvs_ttl));
+    }
+    if (fd >= 0) {
+        close (fd);
+    }
+    free (data);
+    free (enc_data);
     DYAD_C_FUNCTION_END();
     return rc;
 }
 
+/**
+ * Ask the module of this broker to copy just published files to
+ * ctx->drain_path. The module drains in the background, so this does not
+ * wait for a response, and a lost request only leaves the files undrained.
+ */
+static void dyad_request_drain (const dyad_ctx_t* restrict ctx,
+                                const char* const* upaths,
+                                size_t num_files)
+{
+    flux_future_t* f = NULL;
+    json_t* arr = NULL;
+
+    if (ctx->drain_path == NULL || num_files == 0ul) {
+        return;
+    }
+    if ((arr = json_array ()) == NULL) {
+        return;
+    }
+    for (size_t i = 0ul; i < num_files; i++) {
+        json_array_append_new (arr, json_string (upaths[i]));
+    }
+    f = flux_rpc_pack ((flux_t*)ctx->h,
+                       DYAD_DRAIN_RPC_NAME,
+                       ctx->rank,
+                       FLUX_RPC_NORESPONSE,
+                       "{s:o}",
+                       "upaths",
+                       arr);
+    if (f == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot ask the module to drain %zu files", num_files);
+    }
+    flux_future_destroy (f);
+}
+
 DYAD_CORE_FUNC_MODS dyad_rc_t publish_via_flux (const dyad_ctx_t* restrict ctx,
-                                                const char* restrict upath)
+                                                const char* restrict upath,
+                                                uint64_t version)
 {
     DYAD_C_FUNCTION_START();
     DYAD_C_FUNCTION_UPDATE_STR ("fname", ctx->fname);
     DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
     dyad_rc_t rc = DYAD_RC_OK;
-    flux_kvs_txn_t* txn = NULL;
+    json_t* record = NULL;
     const size_t topic_len = PATH_MAX;
     char topic[PATH_MAX + 1] = {'\0'};
     memset (topic, 0, topic_len + 1);
@@ -145,39 +278,29 @@ DYAD_CORE_FUNC_MODS dyad_rc_t publish_via_flux (const dyad_ctx_t* restrict ctx,
     // the producer-managed directory
     DYAD_LOG_INFO (ctx, "Generating KVS key from path (%s)", upath);
     gen_path_key (upath, topic, topic_len, ctx->key_depth, ctx->key_bins);
-    // Crete and pack a Flux KVS transaction.
-    // The transaction will contain a single key-value pair
-    // with the previously generated key as the key and the
-    // producer's rank as the value
-    DYAD_LOG_INFO (ctx, "Creating KVS transaction under the key %s", topic);
-    txn = flux_kvs_txn_create ();
-    if (txn == NULL) {
-        DYAD_LOG_ERROR (ctx, "Could not create Flux KVS transaction");
-        rc = DYAD_RC_FLUXFAIL;
-        goto publish_done;
-    }
-    if (flux_kvs_txn_pack (txn, 0, topic, "i", ctx->rank) < 0) {
-        DYAD_LOG_ERROR (ctx, "Could not pack Flux KVS transaction");
-        rc = DYAD_RC_FLUXFAIL;
+    // A single produce is on the caller's close () path, so it is not inlined
+    rc = dyad_pack_record (ctx, upath, version, false, &record);
+    if (DYAD_IS_ERROR (rc)) {
         goto publish_done;
     }
-    // Call dyad_kvs_commit to commit the transaction into the Flux KVS
-    rc = dyad_kvs_commit (ctx, txn);
-    // If dyad_kvs_commit failed, log an error and forward the return code
+    rc = dyad_md_backend_get (ctx)->publish (ctx, topic, upath, record);
     if (DYAD_IS_ERROR (rc)) {
-        DYAD_LOG_ERROR (ctx, "dyad_kvs_commit failed!");
+        DYAD_LOG_ERROR (ctx, "Could not publish the record of %s", upath);
         goto publish_done;
     }
+    dyad_request_drain (ctx, (const char* const*)&upath, 1ul);
     rc = DYAD_RC_OK;
 publish_done:;
-    if (txn != NULL) {
-        flux_kvs_txn_destroy (txn);
+    if (record != NULL) {
+        json_decref (record);
     }
     DYAD_C_FUNCTION_END();
     return rc;
 }
 
-DYAD_DLL_EXPORTED dyad_rc_t dyad_commit (dyad_ctx_t* restrict ctx, const char* restrict fname)
+DYAD_CORE_FUNC_MODS dyad_rc_t dyad_commit_version (dyad_ctx_t* restrict ctx,
+                                                   const char* restrict fname,
+                                                   uint64_t version)
 {
     DYAD_C_FUNCTION_START();
     DYAD_C_FUNCTION_UPDATE_STR ("fname", ctx->fname);
@@ -208,11 +331,11 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_commit (dyad_ctx_t* restrict ctx, const char* r
     DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
     DYAD_LOG_INFO (ctx, "Obtained file path relative to producer directory: %s", upath);
     // Call publish_via_flux to actually store information about the file into
-    // the Flux KVS
+    // the metadata backend (the Flux KVS by default)
     // Fence this call with reassignments of reenter so that, if intercepting
     // file I/O API calls, we will not get stuck in infinite recursion
     ctx->reenter = false;
-    rc = publish_via_flux (ctx, upath);
+    rc = publish_via_flux (ctx, upath, version);
     ctx->reenter = true;
 
 commit_done:;
@@ -225,6 +348,164 @@ commit_done:;
     return rc;
 }
 
+DYAD_DLL_EXPORTED dyad_rc_t dyad_commit (dyad_ctx_t* restrict ctx, const char* restrict fname)
+{
+    return dyad_commit_version (ctx, fname, 0ul);
+}
+
+DYAD_DLL_EXPORTED dyad_rc_t dyad_set_readers (dyad_ctx_t* restrict ctx,
+                                              const char* restrict fname,
+                                              uint32_t readers)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_STR ("fname", fname);
+    DYAD_C_FUNCTION_UPDATE_INT ("readers", readers);
+    dyad_rc_t rc = DYAD_RC_OK;
+
+    if (setxattr (fname, DYAD_READERS_XATTR, &readers, sizeof (readers), 0) != 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot set the reader count of %s: %s", fname, strerror (errno));
+        rc = DYAD_RC_BADFIO;
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+/* Key of the drain mark of the file whose record is under `key'. The mark is
+ * a record of its own, rather than a flag merged into the file's record, so
+ * that setting it is a single write that cannot undo a concurrent publish. */
+static void dyad_drained_key (const char* restrict key, char* restrict buf, size_t len)
+{
+    snprintf (buf, len, "%s%s", key, DYAD_DRAINED_KEY_SUFFIX);
+}
+
+DYAD_DLL_EXPORTED dyad_rc_t dyad_mark_drained (dyad_ctx_t* restrict ctx,
+                                               const char* const* upaths,
+                                               const uint64_t* versions,
+                                               size_t num_files)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_INT ("num_files", num_files);
+    dyad_rc_t rc = DYAD_RC_OK;
+    char (*topics)[PATH_MAX + 1] = NULL;
+    const char** key_ptrs = NULL;
+    json_t** records = NULL;
+    char topic[PATH_MAX + 1] = {'\0'};
+    size_t n = 0ul;
+
+    if (num_files == 0ul) {
+        goto mark_drained_done;
+    }
+    topics = calloc (num_files, sizeof (*topics));
+    key_ptrs = (const char**)calloc (num_files, sizeof (char*));
+    records = (json_t**)calloc (num_files, sizeof (json_t*));
+    if (topics == NULL || key_ptrs == NULL || records == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory to mark %zu files drained", num_files);
+        rc = DYAD_RC_SYSFAIL;
+        goto mark_drained_done;
+    }
+    // The mark names the version that was copied, which consumers compare
+    // with the one they look for
+    for (n = 0ul; n < num_files; n++) {
+        gen_path_key (upaths[n], topic, PATH_MAX, ctx->key_depth, ctx->key_bins);
+        dyad_drained_key (topic, topics[n], PATH_MAX);
+        key_ptrs[n] = topics[n];
+        records[n] = json_pack ("{s:I}", "version", (json_int_t)versions[n]);
+        if (records[n] == NULL) {
+            rc = DYAD_RC_BADPACK;
+            goto mark_drained_done;
+        }
+        // Expires with the record of the file
+        if (ctx->kvs_ttl > 0u) {
+            json_object_set_new (records[n],
+                                 "expires",
+                                 json_integer ((json_int_t)time (NULL) + (json_int_t)ctx->kvs_ttl));
+        }
+    }
+    rc = dyad_md_backend_get (ctx)->publish_multi (ctx, key_ptrs, upaths, records, n);
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "Could not mark %zu files drained", n);
+    }
+
+mark_drained_done:;
+    for (size_t i = 0ul; records != NULL && i < num_files; i++) {
+        json_decref (records[i]);
+    }
+    free (topics);
+    free (key_ptrs);
+    free (records);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+DYAD_DLL_EXPORTED dyad_rc_t dyad_unpublish (dyad_ctx_t* restrict ctx,
+                                            const char* const* fnames,
+                                            size_t num_files)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    char (*upaths)[PATH_MAX + 1] = NULL;
+    char (*topics)[PATH_MAX + 1] = NULL;
+    const char** upath_ptrs = NULL;
+    const char** topic_ptrs = NULL;
+    size_t n = 0ul;
+
+    if (!ctx || !ctx->h) {
+        rc = DYAD_RC_NOCTX;
+        goto unpublish_done;
+    }
+    if (ctx->prod_managed_path == NULL) {
+        rc = DYAD_RC_BADMANAGEDPATH;
+        goto unpublish_done;
+    }
+    if (num_files == 0ul) {
+        goto unpublish_done;
+    }
+    // Room for the drain mark of each file too
+    upaths = calloc (num_files, sizeof (*upaths));
+    topics = calloc (2ul * num_files, sizeof (*topics));
+    upath_ptrs = (const char**)calloc (2ul * num_files, sizeof (char*));
+    topic_ptrs = (const char**)calloc (2ul * num_files, sizeof (char*));
+    if (upaths == NULL || topics == NULL || upath_ptrs == NULL || topic_ptrs == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory to unpublish %zu files", num_files);
+        rc = DYAD_RC_SYSFAIL;
+        goto unpublish_done;
+    }
+    ctx->reenter = false;
+    for (size_t i = 0ul; i < num_files; i++) {
+        if (ctx->relative_to_managed_path
+            && (strncmp (fnames[i], DYAD_PATH_DELIM, ctx->delim_len) != 0)) {
+            strncpy (upaths[n], fnames[i], PATH_MAX);
+        } else if (!cmp_canonical_path_prefix (ctx, true, fnames[i], upaths[n], PATH_MAX)) {
+            DYAD_LOG_INFO (ctx, "%s is not in the Producer's managed path", fnames[i]);
+            continue;
+        }
+        gen_path_key (upaths[n], topics[n], PATH_MAX, ctx->key_depth, ctx->key_bins);
+        upath_ptrs[n] = upaths[n];
+        topic_ptrs[n] = topics[n];
+        n++;
+    }
+    for (size_t i = 0ul, num_records = n; i < num_records; i++) {
+        dyad_drained_key (topics[i], topics[n], PATH_MAX);
+        upath_ptrs[n] = upaths[i];
+        topic_ptrs[n] = topics[n];
+        n++;
+    }
+    // All the keys go out in as few transactions (or RPCs) as the backend allows
+    rc = dyad_md_backend_get (ctx)->unpublish (ctx, topic_ptrs, upath_ptrs, n);
+    ctx->reenter = true;
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "Could not unpublish %zu files", n);
+    }
+
+unpublish_done:;
+    free (upaths);
+    free (topics);
+    free (upath_ptrs);
+    free (topic_ptrs);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
 static void print_mdata (const dyad_ctx_t* restrict ctx,
                          const dyad_metadata_t* restrict mdata)
 {
@@ -234,41 +515,123 @@ static void print_mdata (const dyad_ctx_t* restrict ctx,
         DYAD_LOG_INFO (ctx, "Printing contents of DYAD Metadata object");
         DYAD_LOG_INFO (ctx, "fpath = %s", mdata->fpath);
         DYAD_LOG_INFO (ctx, "owner_rank = %u", mdata->owner_rank);
+        DYAD_LOG_INFO (ctx, "file_size = %zu", mdata->file_size);
+        DYAD_LOG_INFO (ctx, "inline_len = %zu%s", mdata->inline_len,
+                       (mdata->inline_data == NULL) ? " (not inlined)" : "");
     }
 }
 
-DYAD_DLL_EXPORTED dyad_rc_t dyad_kvs_read (const dyad_ctx_t* restrict ctx,
-                                             const char* restrict topic,
-                                             const char* restrict upath,
-                                             bool should_wait,
-                                             dyad_metadata_t** restrict mdata)
+/**
+ * Fill in the owner rank, size and inline data of `mdata' from a KVS record.
+ * Records written by older producers consist of the owner rank only. Of a
+ * record in a newer format than DYAD_RECORD_FORMAT, only the owner rank is
+ * trusted, so the file is fetched from its owner.
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_unpack_record (const dyad_ctx_t* restrict ctx,
+                                                json_t* restrict record,
+                                                dyad_metadata_t* restrict mdata)
+{
+    int format = 1;
+    int owner_rank = 0;
+    json_int_t file_size = 0;
+    json_int_t version = 0;
+    json_int_t readers = 0;
+    const char* enc_data = NULL;
+    size_t enc_len = 0ul;
+    ssize_t dec_len = 0l;
+    size_t dec_cap = 0ul;
+
+    if (json_is_integer (record)) {
+        mdata->owner_rank = (uint32_t)json_integer_value (record);
+        return DYAD_RC_OK;
+    }
+    if (json_unpack (record, "{s?i, s:i}", "format", &format, "rank", &owner_rank) < 0) {
+        DYAD_LOG_ERROR (ctx, "Malformed KVS record for %s", mdata->fpath);
+        return DYAD_RC_BADMETADATA;
+    }
+    if (format > DYAD_RECORD_FORMAT) {
+        DYAD_LOG_INFO (ctx,
+                       "The record of %s is in format %d, newer than %d. Using its owner rank only",
+                       mdata->fpath,
+                       format,
+                       DYAD_RECORD_FORMAT);
+        mdata->owner_rank = (uint32_t)owner_rank;
+        return DYAD_RC_OK;
+    }
+    if (json_unpack (record,
+                     "{s:i, s?I, s?I, s?I, s?s%}",
+                     "rank",
+                     &owner_rank,
+                     "size",
+                     &file_size,
+                     "version",
+                     &version,
+                     "readers",
+                     &readers,
+                     "data",
+                     &enc_data,
+                     &enc_len)
+        < 0) {
+        DYAD_LOG_ERROR (ctx, "Malformed KVS record for %s", mdata->fpath);
+        return DYAD_RC_BADMETADATA;
+    }
+    mdata->owner_rank = (uint32_t)owner_rank;
+    mdata->file_size = (size_t)file_size;
+    mdata->version = (uint64_t)version;
+    mdata->readers = (uint32_t)readers;
+    if (enc_data == NULL) {
+        return DYAD_RC_OK;
+    }
+    dec_cap = base64_decoded_length (enc_len) + 1;
+    mdata->inline_data = (char*)malloc (dec_cap);
+    if (mdata->inline_data == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory for inline data of %s", mdata->fpath);
+        return DYAD_RC_SYSFAIL;
+    }
+    dec_len = base64_decode_using_maps (&base64_maps_rfc4648,
+                                        mdata->inline_data,
+                                        dec_cap,
+                                        enc_data,
+                                        enc_len);
+    if (dec_len < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot decode inline data of %s", mdata->fpath);
+        return DYAD_RC_BAD_B64DECODE;
+    }
+    mdata->inline_len = (size_t)dec_len;
+    return DYAD_RC_OK;
+}
+
+/**
+ * Build `mdata' from the record of `upath'. If `min_version' is non-zero and
+ * `should_wait' is set, wait until that version or a later one is published.
+ */
+static dyad_rc_t dyad_md_read (const dyad_ctx_t* restrict ctx,
+                               const char* restrict topic,
+                               const char* restrict upath,
+                               bool should_wait,
+                               uint64_t min_version,
+                               dyad_metadata_t** restrict mdata)
 {
     DYAD_C_FUNCTION_START();
     DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
     dyad_rc_t rc = DYAD_RC_OK;
-    int kvs_lookup_flags = 0;
-    flux_future_t* f = NULL;
+    json_t* record = NULL;
     if (mdata == NULL) {
         DYAD_LOG_ERROR (ctx, "Metadata double pointer is NULL. " \
                         "Cannot correctly create metadata object");
         rc = DYAD_RC_NOTFOUND;
         goto kvs_read_end;
     }
-    // Lookup information about the desired file (represented by kvs_topic)
-    // from the Flux KVS. If there is no information, wait for it to be
-    // made available
-    if (should_wait)
-        kvs_lookup_flags = FLUX_KVS_WAITCREATE;
-    DYAD_LOG_INFO (ctx, "Retrieving information from KVS under the key %s", topic);
-    f = flux_kvs_lookup ((flux_t*) ctx->h, ctx->kvs_namespace, kvs_lookup_flags, topic);
-    // If the KVS lookup failed, log an error and return DYAD_BADLOOKUP
-    if (f == NULL) {
-        DYAD_LOG_ERROR (ctx, "KVS lookup failed!\n");
-        rc = DYAD_RC_NOTFOUND;
+    // Lookup information about the desired file (represented by topic)
+    // from the metadata backend. If there is no information, wait for it
+    // to be made available
+    rc = dyad_md_backend_get (ctx)->lookup (ctx, topic, upath, should_wait, min_version, &record);
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "Metadata lookup failed!\n");
         goto kvs_read_end;
     }
-    // Extract the rank of the producer from the KVS response
-    DYAD_LOG_INFO (ctx, "Building metadata object from KVS entry\n");
+    // Extract the rank of the producer from the record
+    DYAD_LOG_INFO (ctx, "Building metadata object from the record\n");
     if (*mdata != NULL) {
         DYAD_LOG_INFO (ctx, "Metadata object is already allocated. Skipping allocation");
     } else {
@@ -279,6 +642,12 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_kvs_read (const dyad_ctx_t* restrict ctx,
             goto kvs_read_end;
         }
     }
+    (*mdata)->file_size = 0ul;
+    (*mdata)->inline_data = NULL;
+    (*mdata)->inline_len = 0ul;
+    (*mdata)->version = 0ul;
+    (*mdata)->placed = false;
+    (*mdata)->readers = 0u;
     size_t upath_len = strlen (upath);
     (*mdata)->fpath = (char*)malloc (upath_len + 1);
     if ((*mdata)->fpath == NULL) {
@@ -288,11 +657,8 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_kvs_read (const dyad_ctx_t* restrict ctx,
     }
     memset ((*mdata)->fpath, '\0', upath_len + 1);
     memcpy ((*mdata)->fpath, upath, upath_len);
-    rc = flux_kvs_lookup_get_unpack (f, "i", &((*mdata)->owner_rank));
-    // If the extraction did not work, log an error and return DYAD_BADFETCH
-    if (rc < 0) {
-        DYAD_LOG_ERROR (ctx, "Could not unpack owner's rank from KVS response\n");
-        rc = DYAD_RC_BADMETADATA;
+    rc = dyad_unpack_record (ctx, record, *mdata);
+    if (DYAD_IS_ERROR (rc)) {
         goto kvs_read_end;
     }
     DYAD_LOG_INFO (ctx, "Successfully created DYAD Metadata object");
@@ -305,19 +671,90 @@ kvs_read_end:;
     if (DYAD_IS_ERROR (rc) && mdata != NULL && *mdata != NULL) {
         dyad_free_metadata (mdata);
     }
-    if (f != NULL) {
-        flux_future_destroy (f);
-        f = NULL;
+    if (record != NULL) {
+        json_decref (record);
     }
     DYAD_C_FUNCTION_END();
     return rc;
 }
 
+DYAD_DLL_EXPORTED dyad_rc_t dyad_kvs_read (const dyad_ctx_t* restrict ctx,
+                                             const char* restrict topic,
+                                             const char* restrict upath,
+                                             bool should_wait,
+                                             dyad_metadata_t** restrict mdata)
+{
+    return dyad_md_read (ctx, topic, upath, should_wait, 0ul, mdata);
+}
+
 
 
+/**
+ * Match `str' against a placement pattern, in which `%r' matches the decimal
+ * owner rank, `*' matches any run of characters and the rest matches itself.
+ * If `%r' appears more than once, the first one gives the rank.
+ */
+DYAD_DLL_EXPORTED bool dyad_placement_match (const char* pat, const char* str, uint32_t* rank)
+{
+    while (*pat != '\0') {
+        if (*pat == '*') {
+            // Try every suffix of str against the rest of the pattern
+            do {
+                if (dyad_placement_match (pat + 1, str, rank)) {
+                    return true;
+                }
+            } while (*str++ != '\0');
+            return false;
+        }
+        if (pat[0] == '%' && pat[1] == 'r') {
+            // Try the longest run of digits first, then shorter ones, so that
+            // the rest of the pattern can start with a digit too
+            size_t n = 0ul;
+            while (str[n] >= '0' && str[n] <= '9') {
+                n++;
+            }
+            for (; n > 0ul; n--) {
+                unsigned long r = 0ul;
+                for (size_t i = 0ul; i < n && r <= UINT32_MAX; i++) {
+                    r = r * 10ul + (unsigned long)(str[i] - '0');
+                }
+                if (r <= UINT32_MAX && dyad_placement_match (pat + 2, str + n, rank)) {
+                    *rank = (uint32_t)r;
+                    return true;
+                }
+            }
+            return false;
+        }
+        if (*pat != *str) {
+            return false;
+        }
+        pat++;
+        str++;
+    }
+    return (*str == '\0');
+}
+
+/**
+ * Find the owner of `upath' from the placement rule of the context, if any.
+ */
+static bool dyad_placement_owner (const dyad_ctx_t* restrict ctx,
+                                  const char* restrict upath,
+                                  uint32_t* restrict owner_rank)
+{
+    if (ctx->placement_cb != NULL && ctx->placement_cb (upath, owner_rank, ctx->placement_arg)) {
+        return true;
+    }
+    if (ctx->placement_pattern != NULL
+        && dyad_placement_match (ctx->placement_pattern, upath, owner_rank)) {
+        return true;
+    }
+    return false;
+}
+
 DYAD_CORE_FUNC_MODS dyad_rc_t dyad_fetch_metadata (const dyad_ctx_t* restrict ctx,
                                                    const char* restrict fname,
                                                    const char* restrict upath,
+                                                   uint64_t min_version,
                                                    dyad_metadata_t** restrict mdata)
 {
     DYAD_C_FUNCTION_START();
@@ -325,6 +762,7 @@ DYAD_CORE_FUNC_MODS dyad_rc_t dyad_fetch_metadata (const dyad_ctx_t* restrict ct
     dyad_rc_t rc = DYAD_RC_OK;
     const size_t topic_len = PATH_MAX;
     char topic[PATH_MAX+1] = {'\0'};
+    uint32_t owner_rank = 0u;
     *mdata = NULL;
 #if 0
     if (fname == NULL || upath == NULL || strlen (fname) == 0ul || strlen (upath) == 0ul) {
@@ -335,18 +773,39 @@ DYAD_CORE_FUNC_MODS dyad_rc_t dyad_fetch_metadata (const dyad_ctx_t* restrict ct
     // Set reenter to false to avoid recursively performing DYAD operations
     DYAD_LOG_INFO (ctx, "Obtained file path relative to consumer directory: %s\n", upath);
     DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
-    // Generate the KVS key from the file path relative to
-    // the consumer-managed directory
-    gen_path_key (upath, topic, topic_len, ctx->key_depth, ctx->key_bins);
-    DYAD_LOG_INFO (ctx, "Generated KVS key for consumer: %s\n", topic);
-    // Call dyad_kvs_read to retrieve infromation about the file
-    // from the Flux KVS
-    rc = dyad_kvs_read (ctx, topic, upath, true, mdata);
-    // If an error occured in dyad_kvs_read, log it and propagate the return
-    // code
-    if (DYAD_IS_ERROR (rc)) {
-        DYAD_LOG_ERROR (ctx, "dyad_kvs_read failed!\n");
-        goto fetch_done;
+    // With shared storage, the metadata lookup is what tells the consumer
+    // that the file is complete. Otherwise, the producer of a file that
+    // follows the placement rule is known without asking the KVS, unless a
+    // particular version of it is awaited, or the AUTO DTL needs the size
+    // in the record to pick a DTL. The module of the producer holds the
+    // fetch until the file is committed then.
+    if (!ctx->shared_storage && min_version == 0ul && !dyad_dtl_is_auto (ctx)
+        && dyad_placement_owner (ctx, upath, &owner_rank)) {
+        DYAD_LOG_INFO (ctx, "Placement rule maps %s to rank %u\n", upath, owner_rank);
+        *mdata = (dyad_metadata_t*)calloc (1ul, sizeof (struct dyad_metadata));
+        if (*mdata == NULL || (((*mdata)->fpath = strdup (upath)) == NULL)) {
+            DYAD_LOG_ERROR (ctx, "Cannot allocate memory for metadata object");
+            dyad_free_metadata (mdata);
+            rc = DYAD_RC_SYSFAIL;
+            goto fetch_done;
+        }
+        (*mdata)->owner_rank = owner_rank;
+        (*mdata)->placed = true;
+        DYAD_C_FUNCTION_UPDATE_INT ("placed", 1);
+    } else {
+        // Generate the KVS key from the file path relative to
+        // the consumer-managed directory
+        gen_path_key (upath, topic, topic_len, ctx->key_depth, ctx->key_bins);
+        DYAD_LOG_INFO (ctx, "Generated KVS key for consumer: %s\n", topic);
+        // Call dyad_kvs_read to retrieve infromation about the file
+        // from the Flux KVS
+        rc = dyad_md_read (ctx, topic, upath, true, min_version, mdata);
+        // If an error occured in dyad_kvs_read, log it and propagate the return
+        // code
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (ctx, "dyad_kvs_read failed!\n");
+            goto fetch_done;
+        }
     }
     // There are two cases where we do not want to perform file transfer:
     //   1. if the shared storage feature is enabled
@@ -375,28 +834,95 @@ fetch_done:;
     return rc;
 }
 
-DYAD_DLL_EXPORTED dyad_rc_t dyad_get_data (const dyad_ctx_t* restrict ctx,
-                                             const dyad_metadata_t* restrict mdata,
-                                             char** restrict file_data,
-                                             size_t* restrict file_len)
+/**
+ * With the AUTO DTL, send transfers below ctx->dtl_switch_size over Flux RPC,
+ * which has the lowest setup cost, and the rest over UCX. Files whose size
+ * is unknown (published before sizes were recorded) are assumed to be large.
+ */
+DYAD_CORE_FUNC_MODS dyad_rc_t dyad_dtl_select_by_size (dyad_ctx_t* restrict ctx,
+                                                       size_t data_size)
+{
+    dyad_dtl_mode_t mode = DYAD_DTL_UCX;
+    if (data_size > 0ul && data_size < ctx->dtl_switch_size) {
+        mode = DYAD_DTL_FLUX_RPC;
+    }
+    return dyad_dtl_select (ctx, mode);
+}
+
+/**
+ * Fetch `mdata->fpath' from the DYAD module on `mdata->owner_rank'. If
+ * `upaths' is not NULL, it is attached to the request so that the module
+ * packs all the listed files into a single transfer. This function takes
+ * ownership of `upaths'. If `io_fd' is not -1 and the DTL can write into a
+ * file, the data goes straight into `io_fd' and `*file_data' stays NULL.
+ * On failure, errno holds the error the module answered with, or 0 if it
+ * did not answer with one.
+ */
+DYAD_CORE_FUNC_MODS dyad_rc_t dyad_get_data_from (const dyad_ctx_t* restrict ctx,
+                                                  const dyad_metadata_t* restrict mdata,
+                                                  json_t* restrict upaths,
+                                                  int io_fd,
+                                                  char** restrict file_data,
+                                                  size_t* restrict file_len)
 {
     DYAD_C_FUNCTION_START();
     dyad_rc_t rc = DYAD_RC_OK;
     flux_future_t* f = NULL;
     json_t* rpc_payload = NULL;
+    const uint32_t owner_rank = mdata->owner_rank;
+    const char* fpath = mdata->fpath;
+    bool to_file = (io_fd >= 0 && ctx->dtl_handle->recv_file != NULL);
+    int module_errno = 0;
     DYAD_LOG_INFO (ctx, "Packing payload for RPC to DYAD module");
-    DYAD_C_FUNCTION_UPDATE_INT ("owner_rank", mdata->owner_rank);
-    DYAD_C_FUNCTION_UPDATE_STR ("fpath", mdata->fpath);
-    rc = ctx->dtl_handle->rpc_pack (ctx, mdata->fpath, mdata->owner_rank, &rpc_payload);
+    DYAD_C_FUNCTION_UPDATE_INT ("owner_rank", owner_rank);
+    DYAD_C_FUNCTION_UPDATE_STR ("fpath", fpath);
+    rc = ctx->dtl_handle->rpc_pack (ctx, fpath, owner_rank, &rpc_payload);
     if (DYAD_IS_ERROR (rc)) {
         DYAD_LOG_ERROR (ctx, "Cannot create JSON payload for Flux RPC to " \
                              "DYAD module\n");
+        if (upaths != NULL) {
+            json_decref (upaths);
+        }
+        goto get_done;
+    }
+    if (json_object_set_new (rpc_payload,
+                             DYAD_DTL_RPC_MODE,
+                             json_integer ((json_int_t)ctx->dtl_handle->mode))
+        < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot add the DTL mode to the RPC payload\n");
+        json_decref (rpc_payload);
+        if (upaths != NULL) {
+            json_decref (upaths);
+        }
+        rc = DYAD_RC_BADPACK;
+        goto get_done;
+    }
+    if (upaths != NULL && json_object_set_new (rpc_payload, DYAD_DTL_RPC_UPATHS, upaths) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot add the list of upaths to the RPC payload\n");
+        json_decref (rpc_payload);
+        rc = DYAD_RC_BADPACK;
+        goto get_done;
+    }
+    if (mdata->placed && json_object_set_new (rpc_payload, DYAD_DTL_RPC_PLACED, json_true ()) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot flag the RPC payload as placed\n");
+        json_decref (rpc_payload);
+        rc = DYAD_RC_BADPACK;
+        goto get_done;
+    }
+    if (mdata->version > 0ul
+        && json_object_set_new (rpc_payload,
+                                DYAD_DTL_RPC_VERSION,
+                                json_integer ((json_int_t)mdata->version))
+               < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot add the version to the RPC payload\n");
+        json_decref (rpc_payload);
+        rc = DYAD_RC_BADPACK;
         goto get_done;
     }
     DYAD_LOG_INFO (ctx, "Sending payload for RPC to DYAD module");
     f = flux_rpc_pack ((flux_t*) ctx->h,
                        DYAD_DTL_RPC_NAME,
-                       mdata->owner_rank,
+                       owner_rank,
                        FLUX_RPC_STREAMING,
                        "o",
                        rpc_payload);
@@ -417,11 +943,15 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_get_data (const dyad_ctx_t* restrict ctx,
         DYAD_LOG_ERROR (ctx, \
                       "Cannot establish connection with DYAD module on broker " \
                       "%u\n", \
-                      mdata->owner_rank);
+                      owner_rank);
         goto get_done;
     }
     DYAD_LOG_INFO (ctx, "Receive file data via DTL");
-    rc = ctx->dtl_handle->recv (ctx, (void**)file_data, file_len);
+    if (to_file) {
+        rc = ctx->dtl_handle->recv_file (ctx, io_fd, file_len);
+    } else {
+        rc = ctx->dtl_handle->recv (ctx, (void**)file_data, file_len);
+    }
     DYAD_LOG_INFO (ctx, "Close DTL connection with DYAD module");
     ctx->dtl_handle->close_connection (ctx);
     if (DYAD_IS_ERROR (rc)) {
@@ -454,80 +984,303 @@ get_done:;
             rc = DYAD_RC_BADRPC;
         }
     }
-#ifdef DYAD_ENABLE_UCX_RMA
-    ctx->dtl_handle->get_buffer(ctx, 0, (void**)file_data);
-    ssize_t read_len = 0l;
-    memcpy (&read_len, *file_data, sizeof (read_len));
-    if (read_len < 0l) {
-        *file_len = 0ul;
-        DYAD_LOG_DEBUG (ctx, "Not able to read from %s file", mdata->fpath);
-        rc = DYAD_RC_BADFIO;
-    } else {
-        *file_len = (size_t) read_len;
+    if (!to_file && DYAD_DTL_LEN_PREFIX (ctx->dtl_handle) > 0ul) {
+        ctx->dtl_handle->get_buffer(ctx, 0, (void**)file_data);
+        ssize_t read_len = 0l;
+        memcpy (&read_len, *file_data, sizeof (read_len));
+        if (read_len < 0l) {
+            *file_len = 0ul;
+            DYAD_LOG_DEBUG (ctx, "Not able to read from %s file", fpath);
+            rc = DYAD_RC_BADFIO;
+        } else {
+            *file_len = (size_t) read_len;
+        }
+        *file_data = ((char*)*file_data) + sizeof (read_len);
+        DYAD_LOG_INFO (ctx, "Read %zd bytes from %s file", *file_len, fpath);
+    }
+    // The stream ends with the module's error, if it sent one
+    if (DYAD_IS_ERROR (rc) && f != NULL && flux_future_is_ready (f)
+        && flux_future_get (f, NULL) < 0 && errno != ENODATA) {
+        module_errno = errno;
     }
-    *file_data = ((char*)*file_data) + sizeof (read_len);
-    DYAD_LOG_INFO (ctx, "Read %zd bytes from %s file", *file_len, mdata->fpath);
-#endif
     DYAD_LOG_INFO (ctx, "Destroy the Flux future for the RPC\n");
     flux_future_destroy (f);
     DYAD_C_FUNCTION_END();
+    errno = module_errno;
     return rc;
 }
 
-DYAD_CORE_FUNC_MODS dyad_rc_t dyad_cons_store (const dyad_ctx_t* restrict ctx,
-                                               const dyad_metadata_t* restrict mdata,
-                                               int fd, const size_t data_len,
-                                               char* restrict file_data)
+DYAD_DLL_EXPORTED dyad_rc_t dyad_get_data (dyad_ctx_t* restrict ctx,
+                                             const dyad_metadata_t* restrict mdata,
+                                             char** restrict file_data,
+                                             size_t* restrict file_len)
 {
-    DYAD_C_FUNCTION_START();
-    DYAD_C_FUNCTION_UPDATE_INT ("fd", fd);
-    dyad_rc_t rc = DYAD_RC_OK;
-    const char* odir = NULL;
-    char file_path[PATH_MAX + 1] = {'\0'};
-    char file_path_copy[PATH_MAX + 1] = {'\0'};
-    mode_t m = (S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH | S_ISGID);
-    size_t written_len = 0;
-    memset (file_path, 0, PATH_MAX + 1);
-    memset (file_path_copy, 0, PATH_MAX + 1);
+    dyad_rc_t rc = dyad_dtl_select_by_size (ctx, mdata->file_size);
+    if (DYAD_IS_ERROR (rc)) {
+        return rc;
+    }
+    return dyad_get_data_from (ctx, mdata, NULL, -1, file_data, file_len);
+}
 
-    // Build the full path to the file being consumed
-    strncpy (file_path, ctx->cons_managed_path, PATH_MAX - 1);
-    concat_str (file_path, mdata->fpath, "/", PATH_MAX);
-    memcpy (file_path_copy, file_path, PATH_MAX);  // dirname modifies the arg
-    DYAD_C_FUNCTION_UPDATE_STR ("cons_managed_path", ctx->cons_managed_path);
+/**
+ * Read the copy of `mdata->fpath' that the module of its producer drained to
+ * ctx->drain_path. The caller frees `*file_data'.
+ */
+DYAD_CORE_FUNC_MODS dyad_rc_t dyad_get_drained (const dyad_ctx_t* restrict ctx,
+                                                const dyad_metadata_t* restrict mdata,
+                                                char** restrict file_data,
+                                                size_t* restrict file_len)
+{
+    DYAD_C_FUNCTION_START();
     DYAD_C_FUNCTION_UPDATE_STR ("fpath", mdata->fpath);
-    DYAD_C_FUNCTION_UPDATE_STR ("file_path_copy", file_path_copy);
+    dyad_rc_t rc = DYAD_RC_OK;
+    char path[PATH_MAX + 1] = {'\0'};
+    ssize_t len = 0l;
+    int fd = -1;
 
-    DYAD_LOG_INFO (ctx, "Saving retrieved data to %s\n", file_path);
-    // Create the directory as needed
-    // TODO: Need to be consistent with the mode at the source
-    odir = dirname (file_path_copy);
-    if ((strncmp (odir, ".", strlen (".")) != 0) && (mkdir_as_needed (odir, m) < 0)) {
-        DYAD_LOG_ERROR (ctx, "Cannot create needed directories for pulled file\n");
+    strncpy (path, ctx->drain_path, PATH_MAX - 1);
+    concat_str (path, mdata->fpath, "/", PATH_MAX);
+    if ((fd = open (path, O_RDONLY)) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot open the drained copy %s: %s", path, strerror (errno));
         rc = DYAD_RC_BADFIO;
-        goto pull_done;
+        goto get_drained_done;
     }
-
-    // Write the file contents to the location specified by the user
-    written_len = write (fd, file_data, data_len);
-    if (written_len != data_len) {
-        DYAD_LOG_ERROR (ctx, "cons store write of pulled file failed!\n");
+    len = read_all (fd, (void**)file_data);
+    if (len < 0l || (mdata->file_size > 0ul && (size_t)len != mdata->file_size)) {
+        DYAD_LOG_ERROR (ctx, "Cannot read the drained copy %s", path);
         rc = DYAD_RC_BADFIO;
-        goto pull_done;
+        goto get_drained_done;
     }
-    DYAD_C_FUNCTION_UPDATE_INT ("data_len", data_len);
-    rc = DYAD_RC_OK;
+    *file_len = (size_t)len;
+    DYAD_C_FUNCTION_UPDATE_INT ("file_len", *file_len);
 
-pull_done:;
-    // If "check" is set and the operation was successful, set the
-    // DYAD_CHECK_ENV environment variable to "ok"
-    if (rc == DYAD_RC_OK && (ctx && ctx->check))
-        setenv(DYAD_CHECK_ENV, "ok", 1);
+get_drained_done:;
+    if (fd >= 0) {
+        close (fd);
+    }
     DYAD_C_FUNCTION_END();
     return rc;
 }
 
-dyad_rc_t dyad_produce (dyad_ctx_t* restrict ctx, const char* restrict fname)
+/**
+ * Whether the drain path holds version `mdata->version' of `mdata->fpath', or
+ * a later one, as the drain marks once its copy is complete.
+ */
+static bool dyad_lookup_drained (const dyad_ctx_t* restrict ctx,
+                                 const dyad_metadata_t* restrict mdata)
+{
+    char topic[PATH_MAX + 1] = {'\0'};
+    char key[PATH_MAX + 1] = {'\0'};
+    json_t* record = NULL;
+    json_int_t version = -1;
+
+    gen_path_key (mdata->fpath, topic, PATH_MAX, ctx->key_depth, ctx->key_bins);
+    dyad_drained_key (topic, key, PATH_MAX);
+    if (!DYAD_IS_ERROR (
+            dyad_md_backend_get (ctx)->lookup (ctx, key, mdata->fpath, false, 0ul, &record))) {
+        json_unpack (record, "{s:I}", "version", &version);
+        json_decref (record);
+    }
+    return (version >= 0 && (uint64_t)version >= mdata->version);
+}
+
+/**
+ * Whether the module of the owner answered with an error that another
+ * attempt would get again: it does not have the file, or it already held
+ * the request as long as it waits for a file to be complete (ETIMEDOUT, see
+ * dyad_fetch_wait.h), or it could not make sense of the request.
+ */
+static bool dyad_fetch_error_is_final (int module_errno)
+{
+    return (module_errno == ENOENT || module_errno == ETIMEDOUT || module_errno == EPROTO);
+}
+
+/**
+ * Get the data of `mdata' from the first source that has it: the module of
+ * its owner, then the copy drained to ctx->drain_path, then both again, up
+ * to ctx->fetch_retries times, waiting ctx->fetch_backoff seconds before the
+ * first retry and twice as long before each next, up to
+ * DYAD_FETCH_BACKOFF_MAX. Only transient failures are retried (see
+ * dyad_fetch_error_is_final ()). Data from the owner is returned in `*file_data',
+ * to give back to the DTL, and data from the drain path in `*drained_data',
+ * to free. `*source' tells which one holds it. If the DTL can write into a
+ * file, data from the owner goes straight into `io_fd' (see
+ * dyad_get_data_from ()), so that `*file_data' stays NULL.
+ */
+DYAD_CORE_FUNC_MODS dyad_rc_t dyad_get_data_failover (dyad_ctx_t* restrict ctx,
+                                                      const dyad_metadata_t* restrict mdata,
+                                                      int io_fd,
+                                                      char** restrict file_data,
+                                                      char** restrict drained_data,
+                                                      size_t* restrict file_len,
+                                                      dyad_source_t* restrict source)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_STR ("fpath", mdata->fpath);
+    dyad_rc_t rc = DYAD_RC_OK;
+    bool drained = false;
+    double backoff = ctx->fetch_backoff;
+    struct timespec pause;
+    int module_errno = 0;
+
+    *source = DYAD_SOURCE_NONE;
+    for (uint32_t attempt = 0u;; attempt++) {
+        module_errno = 0;
+        rc = dyad_dtl_select_by_size (ctx, mdata->file_size);
+        if (!DYAD_IS_ERROR (rc)) {
+            rc = dyad_get_data_from (ctx, mdata, NULL, io_fd, file_data, file_len);
+            module_errno = DYAD_IS_ERROR (rc) ? errno : 0;
+        }
+        // Drop what a failed transfer left in the file
+        if (DYAD_IS_ERROR (rc) && io_fd >= 0
+            && (lseek (io_fd, 0, SEEK_SET) != 0 || ftruncate (io_fd, 0) < 0)) {
+            DYAD_LOG_ERROR (ctx, "Cannot rewind the copy of %s", mdata->fpath);
+            rc = DYAD_RC_BADFIO;
+            break;
+        }
+        if (!DYAD_IS_ERROR (rc)) {
+            *source = DYAD_SOURCE_OWNER;
+            break;
+        }
+        if (*file_data != NULL) {
+            ctx->dtl_handle->return_buffer (ctx, (void**)file_data);
+            *file_data = NULL;
+        }
+        // The producer's broker may be gone, but not the copy it drained
+        if (!drained && ctx->drain_path != NULL) {
+            drained = dyad_lookup_drained (ctx, mdata);
+        }
+        if (drained && ctx->drain_path != NULL) {
+            DYAD_LOG_INFO (ctx, "Reading '%s' from the drain path instead", mdata->fpath);
+            rc = dyad_get_drained (ctx, mdata, drained_data, file_len);
+            if (!DYAD_IS_ERROR (rc)) {
+                *source = DYAD_SOURCE_DRAIN;
+                break;
+            }
+            free (*drained_data);
+            *drained_data = NULL;
+        }
+        if (dyad_fetch_error_is_final (module_errno)) {
+            DYAD_LOG_ERROR (ctx, "Not retrying '%s': %s", mdata->fpath, strerror (module_errno));
+            break;
+        }
+        if (attempt >= ctx->fetch_retries) {
+            break;
+        }
+        DYAD_LOG_INFO (ctx, "Retrying '%s' in %.2f s (%u of %u)",
+                       mdata->fpath, backoff, attempt + 1u, ctx->fetch_retries);
+        pause.tv_sec = (time_t)backoff;
+        pause.tv_nsec = (long)((backoff - (double)pause.tv_sec) * 1e9);
+        nanosleep (&pause, NULL);
+        backoff = (2.0 * backoff < DYAD_FETCH_BACKOFF_MAX) ? 2.0 * backoff : DYAD_FETCH_BACKOFF_MAX;
+    }
+    DYAD_C_FUNCTION_UPDATE_STR ("source", dyad_source_name[*source]);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+DYAD_DLL_EXPORTED dyad_rc_t dyad_get_data_multi (dyad_ctx_t* restrict ctx,
+                                                   const dyad_metadata_t* const* mdata,
+                                                   size_t num_files,
+                                                   char** restrict file_data,
+                                                   size_t* restrict file_len)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    json_t* upaths = NULL;
+    if (num_files == 0ul || num_files > DYAD_DTL_MULTI_MAX) {
+        DYAD_LOG_ERROR (ctx, "Invalid number of files (%zu) for a single fetch", num_files);
+        rc = DYAD_RC_BADPACK;
+        goto get_multi_done;
+    }
+    upaths = json_array ();
+    if (upaths == NULL) {
+        rc = DYAD_RC_BADPACK;
+        goto get_multi_done;
+    }
+    size_t total_size = 0ul;
+    for (size_t i = 0ul; i < num_files; i++) {
+        total_size += mdata[i]->file_size;
+        if (mdata[i]->owner_rank != mdata[0]->owner_rank) {
+            DYAD_LOG_ERROR (ctx, "Files of a single fetch must have the same owner");
+            json_decref (upaths);
+            rc = DYAD_RC_BADPACK;
+            goto get_multi_done;
+        }
+        if (json_array_append_new (upaths, json_string (mdata[i]->fpath)) < 0) {
+            json_decref (upaths);
+            rc = DYAD_RC_BADPACK;
+            goto get_multi_done;
+        }
+    }
+    DYAD_C_FUNCTION_UPDATE_INT ("num_files", num_files);
+    rc = dyad_dtl_select_by_size (ctx, total_size);
+    if (DYAD_IS_ERROR (rc)) {
+        json_decref (upaths);
+        goto get_multi_done;
+    }
+    rc = dyad_get_data_from (ctx, mdata[0], upaths, -1, file_data, file_len);
+get_multi_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+DYAD_CORE_FUNC_MODS dyad_rc_t dyad_cons_store (const dyad_ctx_t* restrict ctx,
+                                               const dyad_metadata_t* restrict mdata,
+                                               int fd, const size_t data_len,
+                                               char* restrict file_data)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_INT ("fd", fd);
+    dyad_rc_t rc = DYAD_RC_OK;
+    const char* odir = NULL;
+    char file_path[PATH_MAX + 1] = {'\0'};
+    char file_path_copy[PATH_MAX + 1] = {'\0'};
+    mode_t m = (S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH | S_ISGID);
+    size_t written_len = 0;
+    memset (file_path, 0, PATH_MAX + 1);
+    memset (file_path_copy, 0, PATH_MAX + 1);
+
+    // Build the full path to the file being consumed
+    strncpy (file_path, ctx->cons_managed_path, PATH_MAX - 1);
+    concat_str (file_path, mdata->fpath, "/", PATH_MAX);
+    memcpy (file_path_copy, file_path, PATH_MAX);  // dirname modifies the arg
+    DYAD_C_FUNCTION_UPDATE_STR ("cons_managed_path", ctx->cons_managed_path);
+    DYAD_C_FUNCTION_UPDATE_STR ("fpath", mdata->fpath);
+    DYAD_C_FUNCTION_UPDATE_STR ("file_path_copy", file_path_copy);
+
+    DYAD_LOG_INFO (ctx, "Saving retrieved data to %s\n", file_path);
+    // Create the directory as needed
+    // TODO: Need to be consistent with the mode at the source
+    odir = dirname (file_path_copy);
+    if ((strncmp (odir, ".", strlen (".")) != 0) && (mkdir_as_needed (odir, m) < 0)) {
+        DYAD_LOG_ERROR (ctx, "Cannot create needed directories for pulled file\n");
+        rc = DYAD_RC_BADFIO;
+        goto pull_done;
+    }
+
+    // Write the file contents to the location specified by the user
+    written_len = write (fd, file_data, data_len);
+    if (written_len != data_len) {
+        DYAD_LOG_ERROR (ctx, "cons store write of pulled file failed!\n");
+        rc = DYAD_RC_BADFIO;
+        goto pull_done;
+    }
+    DYAD_C_FUNCTION_UPDATE_INT ("data_len", data_len);
+    rc = DYAD_RC_OK;
+
+pull_done:;
+    // If "check" is set and the operation was successful, set the
+    // DYAD_CHECK_ENV environment variable to "ok"
+    if (rc == DYAD_RC_OK && (ctx && ctx->check))
+        setenv(DYAD_CHECK_ENV, "ok", 1);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_produce_version (dyad_ctx_t* restrict ctx,
+                                const char* restrict fname,
+                                uint64_t version)
 {
     DYAD_C_FUNCTION_START();
     ctx->fname = fname;
@@ -551,12 +1304,254 @@ dyad_rc_t dyad_produce (dyad_ctx_t* restrict ctx, const char* restrict fname)
     }
     // If the context is valid, call dyad_commit to perform
     // the producer operation
-    rc = dyad_commit (ctx, fname);
+    rc = dyad_commit_version (ctx, fname, version);
 produce_done:;
     DYAD_C_FUNCTION_END();
     return rc;
 }
 
+dyad_rc_t dyad_produce (dyad_ctx_t* restrict ctx, const char* restrict fname)
+{
+    return dyad_produce_version (ctx, fname, 0ul);
+}
+
+// Most file descriptors nftw () keeps open while walking a tree
+#define DYAD_WALK_FDS 64
+
+/**
+ * Paths, relative to the producer-managed directory, of the regular files
+ * found by dyad_produce_dir (). nftw () takes no callback argument, hence
+ * the thread-local pointer to the walk in progress.
+ */
+struct dyad_dir_walk {
+    const dyad_ctx_t* ctx;
+    char** upaths;
+    size_t num_files;
+    size_t capacity;
+};
+static __thread struct dyad_dir_walk* dyad_walk = NULL;
+
+static int dyad_dir_walk_visit (const char* fpath,
+                                const struct stat* sb,
+                                int typeflag,
+                                struct FTW* ftwbuf)
+{
+    char upath[PATH_MAX + 1] = {'\0'};
+    char** upaths = NULL;
+    if (typeflag != FTW_F || !S_ISREG (sb->st_mode)) {
+        return 0;
+    }
+    if (!cmp_canonical_path_prefix (dyad_walk->ctx, true, fpath, upath, PATH_MAX)) {
+        DYAD_LOG_INFO (dyad_walk->ctx, "%s is not in the Producer's managed path", fpath);
+        return 0;
+    }
+    if (dyad_walk->num_files == dyad_walk->capacity) {
+        dyad_walk->capacity = (dyad_walk->capacity == 0ul) ? 256ul : 2ul * dyad_walk->capacity;
+        upaths = (char**)realloc (dyad_walk->upaths, dyad_walk->capacity * sizeof (char*));
+        if (upaths == NULL) {
+            return -1;
+        }
+        dyad_walk->upaths = upaths;
+    }
+    if ((dyad_walk->upaths[dyad_walk->num_files] = strdup (upath)) == NULL) {
+        return -1;
+    }
+    dyad_walk->num_files++;
+    return 0;
+}
+
+// Files whose records are built and published together by
+// dyad_publish_upaths (), so that a large tree is not held in memory at once
+#define DYAD_PRODUCE_DIR_BATCH 4096ul
+
+/**
+ * Publish the records of the files at `upaths', relative to the
+ * producer-managed directory, with the backend's publish_multi (), in
+ * batches of up to DYAD_PRODUCE_DIR_BATCH files.
+ */
+static dyad_rc_t dyad_publish_upaths (const dyad_ctx_t* restrict ctx,
+                                      char* const* restrict upaths,
+                                      size_t num_files)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_INT ("num_files", num_files);
+    dyad_rc_t rc = DYAD_RC_OK;
+    char topic[PATH_MAX + 1] = {'\0'};
+    const size_t cap = (num_files < DYAD_PRODUCE_DIR_BATCH) ? num_files : DYAD_PRODUCE_DIR_BATCH;
+    char** keys = NULL;
+    json_t** records = NULL;
+    size_t first = 0ul;
+    size_t n = 0ul;
+    size_t i = 0ul;
+
+    if (num_files == 0ul) {
+        goto publish_upaths_done;
+    }
+    keys = (char**)calloc (cap, sizeof (char*));
+    records = (json_t**)calloc (cap, sizeof (json_t*));
+    if (keys == NULL || records == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory to publish %zu files", num_files);
+        rc = DYAD_RC_SYSFAIL;
+        goto publish_upaths_done;
+    }
+    for (first = 0ul; first < num_files && !DYAD_IS_ERROR (rc); first += n) {
+        n = (num_files - first < cap) ? num_files - first : cap;
+        for (i = 0ul; i < n; i++) {
+            memset (topic, '\0', PATH_MAX + 1);
+            gen_path_key (upaths[first + i], topic, PATH_MAX, ctx->key_depth, ctx->key_bins);
+            if ((keys[i] = strdup (topic)) == NULL) {
+                rc = DYAD_RC_SYSFAIL;
+                break;
+            }
+            rc = dyad_pack_record (ctx, upaths[first + i], 0ul, true, &records[i]);
+            if (DYAD_IS_ERROR (rc)) {
+                break;
+            }
+        }
+        if (!DYAD_IS_ERROR (rc)) {
+            rc = dyad_md_backend_get (ctx)->publish_multi (ctx,
+                                                           (const char* const*)keys,
+                                                           (const char* const*)(upaths + first),
+                                                           records,
+                                                           n);
+            if (DYAD_IS_ERROR (rc)) {
+                DYAD_LOG_ERROR (ctx, "Could not publish %zu files", n);
+            } else {
+                dyad_request_drain (ctx, (const char* const*)(upaths + first), n);
+            }
+        }
+        for (i = 0ul; i < n; i++) {
+            free (keys[i]);
+            keys[i] = NULL;
+            if (records[i] != NULL) {
+                json_decref (records[i]);
+                records[i] = NULL;
+            }
+        }
+    }
+
+publish_upaths_done:;
+    free (keys);
+    free (records);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_produce_dir (dyad_ctx_t* restrict ctx, const char* restrict dir)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_STR ("dir", dir);
+    dyad_rc_t rc = DYAD_RC_OK;
+    char root[PATH_MAX + 1] = {'\0'};
+    struct dyad_dir_walk walk = {ctx, NULL, 0ul, 0ul};
+    size_t i = 0ul;
+
+    if (!ctx || !ctx->h) {
+        DYAD_LOG_ERROR (ctx, "No CTX found in dyad_produce_dir");
+        rc = DYAD_RC_NOCTX;
+        goto produce_dir_done;
+    }
+    if (ctx->prod_managed_path == NULL) {
+        DYAD_LOG_ERROR (ctx, "No or empty producer managed path was found");
+        rc = DYAD_RC_BADMANAGEDPATH;
+        goto produce_dir_done;
+    }
+    if (ctx->relative_to_managed_path
+        && (strncmp (dir, DYAD_PATH_DELIM, ctx->delim_len) != 0)) {
+        // dir is relative to the prod_managed_path
+        strncpy (root, ctx->prod_managed_path, PATH_MAX - 1);
+        concat_str (root, dir, "/", PATH_MAX);
+    } else {
+        strncpy (root, dir, PATH_MAX);
+    }
+    ctx->reenter = false;
+    // Collect the files first, so that reading their contents for inlining
+    // does not hold the directory streams of the walk open
+    dyad_walk = &walk;
+    if (nftw (root, dyad_dir_walk_visit, DYAD_WALK_FDS, FTW_PHYS) != 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot walk the directory %s", root);
+        rc = DYAD_RC_BADFIO;
+        goto produce_dir_done;
+    }
+    DYAD_LOG_INFO (ctx, "Publishing %zu files under %s", walk.num_files, root);
+    rc = dyad_publish_upaths (ctx, walk.upaths, walk.num_files);
+
+produce_dir_done:;
+    dyad_walk = NULL;
+    for (i = 0ul; i < walk.num_files; i++) {
+        free (walk.upaths[i]);
+    }
+    free (walk.upaths);
+    if (ctx != NULL) {
+        ctx->reenter = true;
+    }
+    if (rc == DYAD_RC_OK && (ctx && ctx->check)) {
+        setenv (DYAD_CHECK_ENV, "ok", 1);
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_produce_multi (dyad_ctx_t* restrict ctx,
+                              const char* const* restrict fnames,
+                              size_t num_files)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_INT ("num_files", num_files);
+    dyad_rc_t rc = DYAD_RC_OK;
+    char upath[PATH_MAX + 1] = {'\0'};
+    char** upaths = NULL;
+    size_t num_tracked = 0ul;
+    size_t i = 0ul;
+
+    if (!ctx || !ctx->h) {
+        DYAD_LOG_ERROR (ctx, "No CTX found in dyad_produce_multi");
+        rc = DYAD_RC_NOCTX;
+        goto produce_multi_done;
+    }
+    if (ctx->prod_managed_path == NULL) {
+        DYAD_LOG_ERROR (ctx, "No or empty producer managed path was found");
+        rc = DYAD_RC_BADMANAGEDPATH;
+        goto produce_multi_done;
+    }
+    upaths = (char**)calloc ((num_files > 0ul) ? num_files : 1ul, sizeof (char*));
+    if (upaths == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory to publish %zu files", num_files);
+        rc = DYAD_RC_SYSFAIL;
+        goto produce_multi_done;
+    }
+    for (i = 0ul; i < num_files; i++) {
+        memset (upath, '\0', PATH_MAX + 1);
+        if (ctx->relative_to_managed_path
+            && (strncmp (fnames[i], DYAD_PATH_DELIM, ctx->delim_len) != 0)) {
+            // fnames[i] is relative to the prod_managed_path
+            strncpy (upath, fnames[i], PATH_MAX);
+        } else if (!cmp_canonical_path_prefix (ctx, true, fnames[i], upath, PATH_MAX)) {
+            DYAD_LOG_INFO (ctx, "%s is not in the Producer's managed path", fnames[i]);
+            continue;
+        }
+        if ((upaths[num_tracked] = strdup (upath)) == NULL) {
+            rc = DYAD_RC_SYSFAIL;
+            goto produce_multi_done;
+        }
+        num_tracked++;
+    }
+    ctx->reenter = false;
+    rc = dyad_publish_upaths (ctx, upaths, num_tracked);
+    ctx->reenter = true;
+
+produce_multi_done:;
+    for (i = 0ul; i < num_tracked; i++) {
+        free (upaths[i]);
+    }
+    free (upaths);
+    if (rc == DYAD_RC_OK && (ctx && ctx->check)) {
+        setenv (DYAD_CHECK_ENV, "ok", 1);
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
 /** This function is coupled with Python API. This populates `mdata' which
  * is used by `dyad_consume_w_metadata ()'
  */
@@ -632,6 +1627,12 @@ dyad_rc_t dyad_get_metadata (dyad_ctx_t* restrict ctx,
         memset ((*mdata)->fpath, '\0', fname_len + 1);
         memcpy ((*mdata)->fpath, fname, fname_len);
         (*mdata)->owner_rank = ctx->rank;
+        (*mdata)->file_size = 0ul;
+        (*mdata)->inline_data = NULL;
+        (*mdata)->inline_len = 0ul;
+        (*mdata)->version = 0ul;
+        (*mdata)->placed = false;
+        (*mdata)->readers = 0u;
         rc = DYAD_RC_OK;
         goto get_metadata_done;
     }
@@ -664,21 +1665,184 @@ dyad_rc_t dyad_free_metadata (dyad_metadata_t** mdata)
     }
     if ((*mdata)->fpath != NULL)
         free ((*mdata)->fpath);
+    if ((*mdata)->inline_data != NULL)
+        free ((*mdata)->inline_data);
     free (*mdata);
     *mdata = NULL;
     DYAD_C_FUNCTION_END();
     return DYAD_RC_OK;
 }
 
-dyad_rc_t dyad_consume (dyad_ctx_t* restrict ctx, const char* restrict fname)
+/**
+ * The version of a consumed file is kept in an extended attribute of the
+ * local copy, so that a later consume only refetches it once it is stale.
+ * Files without the attribute are at version 0.
+ */
+static uint64_t dyad_local_version (const char* restrict fname)
+{
+    uint64_t version = 0ul;
+    if (getxattr (fname, DYAD_VERSION_XATTR, &version, sizeof (version)) != sizeof (version)) {
+        return 0ul;
+    }
+    return version;
+}
+
+/**
+ * A fetched file only appears under its name once complete (see
+ * dyad_materialize_open ()), so telling whether it needs a fetch takes no
+ * lock, and a fetch that crashed half way leaves nothing behind that looks
+ * complete.
+ */
+static bool dyad_local_stale (const char* restrict fname, uint64_t version)
+{
+    if (access (fname, F_OK) != 0) {
+        return true;
+    }
+    return version > 0ul && dyad_local_version (fname) < version;
+}
+
+// Name, next to `fname', under which a copy in progress is written
+static void dyad_materialize_name (const char* restrict fname, char* restrict tmpname)
+{
+    static unsigned int seq = 0u;
+    snprintf (tmpname, PATH_MAX + 1, "%s.dyad.%d.%u", fname, getpid (),
+              __atomic_fetch_add (&seq, 1u, __ATOMIC_RELAXED));
+}
+
+/**
+ * Open the file a fetched copy of `fname' is written to. It is unnamed
+ * (O_TMPFILE) where the file system allows, and otherwise a temporary name
+ * is returned in `*tmpname' to be freed by the caller.
+ */
+static int dyad_materialize_open (const dyad_ctx_t* restrict ctx,
+                                  const char* restrict fname,
+                                  char** restrict tmpname)
+{
+    char dir[PATH_MAX + 1] = {'\0'};
+    char name[PATH_MAX + 1] = {'\0'};
+    const mode_t m = (S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH | S_ISGID);
+    int fd = -1;
+
+    *tmpname = NULL;
+    strncpy (dir, fname, PATH_MAX);
+    dirname (dir);
+    if ((strcmp (dir, ".") != 0) && (mkdir_as_needed (dir, m) < 0)) {
+        DYAD_LOG_ERROR (ctx, "Cannot create the directory of %s", fname);
+        return -1;
+    }
+#ifdef O_TMPFILE
+    if ((fd = open (dir, O_TMPFILE | O_WRONLY, 0666)) >= 0) {
+        return fd;
+    }
+#endif  // O_TMPFILE
+    dyad_materialize_name (fname, name);
+    if ((fd = open (name, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot create %s: %s", name, strerror (errno));
+        return -1;
+    }
+    if ((*tmpname = strdup (name)) == NULL) {
+        unlink (name);
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Put the copy written to `fd' in place of `fname' if it is `complete', or
+ * discard it, then close `fd' and free `tmpname'. An older copy in place is
+ * replaced atomically.
+ */
+static dyad_rc_t dyad_materialize_finish (const dyad_ctx_t* restrict ctx,
+                                          int fd,
+                                          const char* restrict fname,
+                                          char* restrict tmpname,
+                                          bool complete)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    char name[PATH_MAX + 1] = {'\0'};
+    char fd_path[64] = {'\0'};
+
+    if (complete) {
+        dyad_cache_mark (ctx, fd);
+    }
+    if (complete && tmpname == NULL) {
+        snprintf (fd_path, sizeof (fd_path), "/proc/self/fd/%d", fd);
+        if (linkat (AT_FDCWD, fd_path, AT_FDCWD, fname, AT_SYMLINK_FOLLOW) == 0) {
+            goto materialize_close;
+        }
+        // An older copy is in place. Name this one, then rename it over.
+        dyad_materialize_name (fname, name);
+        if (errno != EEXIST
+            || linkat (AT_FDCWD, fd_path, AT_FDCWD, name, AT_SYMLINK_FOLLOW) != 0) {
+            DYAD_LOG_ERROR (ctx, "Cannot link %s into place: %s", fname, strerror (errno));
+            rc = DYAD_RC_BADFIO;
+            goto materialize_close;
+        }
+        if (rename (name, fname) != 0) {
+            DYAD_LOG_ERROR (ctx, "Cannot rename %s into place: %s", fname, strerror (errno));
+            unlink (name);
+            rc = DYAD_RC_BADFIO;
+        }
+    } else if (complete) {
+        if (rename (tmpname, fname) != 0) {
+            DYAD_LOG_ERROR (ctx, "Cannot rename %s into place: %s", fname, strerror (errno));
+            unlink (tmpname);
+            rc = DYAD_RC_BADFIO;
+        }
+    } else if (tmpname != NULL) {
+        unlink (tmpname);
+    }
+materialize_close:;
+    if (close (fd) != 0) {
+        rc = DYAD_RC_BADFIO;
+    }
+    free (tmpname);
+    return rc;
+}
+
+/**
+ * Tell the module of the owner of `mdata' that this consumer holds the file,
+ * so that it can remove it once all its expected readers do. A placed file
+ * has no record to say whether it has readers, so it is always acknowledged.
+ * No response is awaited.
+ */
+static void dyad_gc_ack (const dyad_ctx_t* restrict ctx, const dyad_metadata_t* restrict mdata)
+{
+    flux_future_t* f = NULL;
+
+    if (mdata == NULL || (mdata->readers == 0u && !mdata->placed)) {
+        return;
+    }
+    f = flux_rpc_pack ((flux_t*)ctx->h,
+                       DYAD_GC_RPC_ACK,
+                       mdata->owner_rank,
+                       FLUX_RPC_NORESPONSE,
+                       "{s:s}",
+                       "upath",
+                       mdata->fpath);
+    if (f == NULL) {
+        DYAD_LOG_DEBUG (ctx, "Cannot acknowledge %s to rank %u", mdata->fpath, mdata->owner_rank);
+    }
+    flux_future_destroy (f);
+}
+
+dyad_rc_t dyad_consume_version (dyad_ctx_t* restrict ctx,
+                                const char* restrict fname,
+                                uint64_t version)
 {
     DYAD_C_FUNCTION_START();
     DYAD_C_FUNCTION_UPDATE_STR ("fname", fname);
+    DYAD_C_FUNCTION_UPDATE_INT ("version", version);
     dyad_rc_t rc = DYAD_RC_OK;
     int lock_fd = -1, io_fd = -1;
     ssize_t file_size = -1;
     char* file_data = NULL;
+    char* drained_data = NULL;
+    char* store_data = NULL;
     size_t data_len = 0ul;
+    uint64_t fetched_version = 0ul;
+    char* tmpname = NULL;
     dyad_metadata_t* mdata = NULL;
     struct flock exclusive_lock;
     char upath[PATH_MAX+1] = {'\0'};
@@ -709,104 +1873,131 @@ dyad_rc_t dyad_consume (dyad_ctx_t* restrict ctx, const char* restrict fname)
         goto consume_close;
     }
     ctx->reenter = false;
+    // Unless it has to be fetched below
+    ctx->last_source = DYAD_SOURCE_LOCAL;
 
-    lock_fd = open (fname, O_RDWR | O_CREAT, 0666);
-    if (lock_fd == -1) {
-        // This could be a system file on which users have no write permission
-        DYAD_LOG_ERROR (ctx, "Cannot create file (%s) for dyad_consume!\n", fname);
-        rc = DYAD_RC_BADFIO;
-        goto consume_close;
-    }
-    rc = dyad_excl_flock (ctx, lock_fd, &exclusive_lock);
-    if (DYAD_IS_ERROR (rc)) {
-        dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-        goto consume_done;
-    }
-    file_size = get_file_size (lock_fd);
     if (ctx->shared_storage) {
+        lock_fd = open (fname, O_RDWR | O_CREAT, 0666);
+        if (lock_fd == -1) {
+            // This could be a system file on which users have no write permission
+            DYAD_LOG_ERROR (ctx, "Cannot create file (%s) for dyad_consume!\n", fname);
+            rc = DYAD_RC_BADFIO;
+            goto consume_close;
+        }
+        rc = dyad_excl_flock (ctx, lock_fd, &exclusive_lock);
+        if (DYAD_IS_ERROR (rc)) {
+            dyad_release_flock (ctx, lock_fd, &exclusive_lock);
+            goto consume_done;
+        }
+        file_size = get_file_size (lock_fd);
         dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-        if (!ctx->use_fs_locks || file_size <= 0) {
+        if (!ctx->use_fs_locks || file_size <= 0 || version > 0ul) {
             // as file size was zero that means consumer won the lock first so has to wait for kvs.
             // or we cannot use file lock based synchronization as it does not work with the
             // files managed by c++ fstream.
-            rc = dyad_fetch_metadata (ctx, fname, upath, &mdata);
+            rc = dyad_fetch_metadata (ctx, fname, upath, version, &mdata);
             if (DYAD_IS_ERROR (rc)) {
                 DYAD_LOG_ERROR (ctx, "dyad_fetch_metadata failed fore shared storage!\n");
                 goto consume_done;
             }
         }
-    } else {
-        if (file_size <= 0) {
-            DYAD_LOG_INFO (ctx, "[node %u rank %u pid %d] File (%s with lock_fd %d) is not fetched yet", \
-                           ctx->node_idx, ctx->rank, ctx->pid, fname, lock_fd);
-            // Call dyad_fetch to get (and possibly wait on)
-            // data from the Flux KVS
-            rc = dyad_fetch_metadata (ctx, fname, upath, &mdata);
-            // If an error occured in dyad_fetch_metadata, log an error
-            // and return the corresponding DYAD return code
-            if (DYAD_IS_ERROR (rc)) {
-                DYAD_LOG_ERROR (ctx, "dyad_fetch_metadata failed!\n");
-                dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-                goto consume_done;
-            }
-            // If dyad_fetch_metadata was successful, but mdata is still NULL,
-            // then we need to skip data transfer.
-            // This is either because producer and consumer share storage
-            // or because the file is not on the managed directory.
-            if (mdata == NULL) {
-                DYAD_LOG_INFO (ctx, "File '%s' is local!\n", fname);
-                rc = DYAD_RC_OK;
-                dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-                goto consume_done;
-            }
+        DYAD_C_FUNCTION_UPDATE_INT ("file_size", file_size);
+    } else if (dyad_local_stale (fname, version)) {
+        DYAD_LOG_INFO (ctx, "[node %u rank %u pid %d] File (%s) is not fetched yet", \
+                       ctx->node_idx, ctx->rank, ctx->pid, fname);
+        // Call dyad_fetch to get (and possibly wait on)
+        // data from the Flux KVS
+        rc = dyad_fetch_metadata (ctx, fname, upath, version, &mdata);
+        // If an error occured in dyad_fetch_metadata, log an error
+        // and return the corresponding DYAD return code
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (ctx, "dyad_fetch_metadata failed!\n");
+            goto consume_done;
+        }
+        // If dyad_fetch_metadata was successful, but mdata is still NULL,
+        // then we need to skip data transfer.
+        // This is either because producer and consumer share storage
+        // or because the file is not on the managed directory.
+        if (mdata == NULL) {
+            DYAD_LOG_INFO (ctx, "File '%s' is local!\n", fname);
+            rc = DYAD_RC_OK;
+            goto consume_done;
+        }
 
-            // Call dyad_get_data to dispatch a RPC to the producer's Flux broker
-            // and retrieve the data associated with the file
-            rc = dyad_get_data (ctx, mdata, &file_data, &data_len);
+        // Concurrent consumers of the same file each write their own copy,
+        // and the last one in place wins. It is opened first, so that a DTL
+        // that can write into it does not stage the data in memory.
+        io_fd = dyad_materialize_open (ctx, fname, &tmpname);
+        DYAD_C_FUNCTION_UPDATE_INT ("io_fd", io_fd);
+        if (io_fd == -1) {
+            DYAD_LOG_ERROR (ctx, "Cannot open file (%s) in write mode for dyad_consume!\n", fname);
+            rc = DYAD_RC_BADFIO;
+            goto consume_done;
+        }
+        if (mdata->inline_data != NULL) {
+            // Small files travel inside the metadata record, so there is
+            // nothing to fetch from the producer's broker
+            DYAD_LOG_INFO (ctx, "File '%s' is inlined in its KVS record", fname);
+            store_data = mdata->inline_data;
+            data_len = mdata->inline_len;
+            ctx->last_source = DYAD_SOURCE_INLINE;
+        } else {
+            // Retrieve the data from the producer's Flux broker or, if it
+            // cannot serve it, from wherever else the file is
+            rc = dyad_get_data_failover (ctx, mdata, io_fd, &file_data, &drained_data,
+                                         &data_len, &ctx->last_source);
             if (DYAD_IS_ERROR (rc)) {
                 DYAD_LOG_ERROR (ctx, "dyad_get_data failed!\n");
-                dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-                goto consume_done;
-            }
-            DYAD_C_FUNCTION_UPDATE_INT ("data_len", data_len);
-            io_fd = open (fname, O_WRONLY);
-            DYAD_C_FUNCTION_UPDATE_INT ("io_fd", io_fd);
-            if (io_fd == -1) {
-                DYAD_LOG_ERROR (ctx, "Cannot open file (%s) in write mode for dyad_consume!\n", fname);
-                rc = DYAD_RC_BADFIO;
-                goto consume_close;
-            }
-            // Call dyad_pull to fetch the data from the producer's
-            // Flux broker
-            rc = dyad_cons_store (ctx, mdata, io_fd, data_len, file_data);
-            // Regardless if there was an error in dyad_pull,
-            // free the KVS response object
-            if (mdata != NULL) {
-                dyad_free_metadata (&mdata);
-            }
-            if (close (io_fd) != 0) {
-                rc = DYAD_RC_BADFIO;
-                dyad_release_flock (ctx, lock_fd, &exclusive_lock);
+                dyad_materialize_finish (ctx, io_fd, fname, tmpname, false);
                 goto consume_done;
             }
-            // If an error occured in dyad_pull, log it
-            // and return the corresponding DYAD return code
-            if (DYAD_IS_ERROR (rc)) {
-                DYAD_LOG_ERROR (ctx, "dyad_cons_store failed!\n");
-                dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-                goto consume_done;
-            };
+            store_data = (ctx->last_source == DYAD_SOURCE_DRAIN) ? drained_data : file_data;
         }
-        dyad_release_flock (ctx, lock_fd, &exclusive_lock);
+        DYAD_C_FUNCTION_UPDATE_INT ("data_len", data_len);
+        // Call dyad_pull to fetch the data from the producer's
+        // Flux broker
+        rc = dyad_cons_store (ctx, mdata, io_fd, (store_data != NULL) ? data_len : 0ul, store_data);
+        fetched_version = mdata->version;
+        if (!DYAD_IS_ERROR (rc) && fetched_version > 0ul
+            && fsetxattr (io_fd, DYAD_VERSION_XATTR, &fetched_version,
+                          sizeof (fetched_version), 0) != 0) {
+            // Only costs a refetch on the next versioned consume
+            DYAD_LOG_DEBUG (ctx, "Cannot record version of %s: %s", fname, strerror (errno));
+        }
+        // If an error occured in dyad_pull, log it
+        // and return the corresponding DYAD return code
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (ctx, "dyad_cons_store failed!\n");
+            dyad_materialize_finish (ctx, io_fd, fname, tmpname, false);
+            goto consume_done;
+        }
+        rc = dyad_materialize_finish (ctx, io_fd, fname, tmpname, true);
+        if (!DYAD_IS_ERROR (rc)) {
+            dyad_cache_admit (ctx, data_len);
+        }
+    } else {
+        dyad_cache_touch (ctx, fname);
     }
-    DYAD_C_FUNCTION_UPDATE_INT ("file_size", file_size);
 consume_done:;
-    if (close (lock_fd) != 0) {
+    if (DYAD_IS_ERROR (rc)) {
+        ctx->last_source = DYAD_SOURCE_NONE;
+    } else {
+        // Whichever way the file came, fetched or read from shared storage
+        dyad_gc_ack (ctx, mdata);
+    }
+    DYAD_C_FUNCTION_UPDATE_STR ("source", dyad_source_name[ctx->last_source]);
+    // Regardless if there was an error in dyad_pull,
+    // free the KVS response object
+    if (mdata != NULL) {
+        dyad_free_metadata (&mdata);
+    }
+    if (lock_fd >= 0 && close (lock_fd) != 0) {
         rc = DYAD_RC_BADFIO;
     }
     if (file_data != NULL) {
         ctx->dtl_handle->return_buffer (ctx, (void**)&file_data);
     }
+    free (drained_data);
     // Set reenter to true to allow additional intercepting
 consume_close:;
     ctx->reenter = true;
@@ -814,17 +2005,23 @@ consume_close:;
     return rc;
 }
 
+dyad_rc_t dyad_consume (dyad_ctx_t* restrict ctx, const char* restrict fname)
+{
+    return dyad_consume_version (ctx, fname, 0ul);
+}
+
 dyad_rc_t dyad_consume_w_metadata (dyad_ctx_t* restrict ctx, const char* fname,
                                    const dyad_metadata_t* restrict mdata)
 {
     DYAD_C_FUNCTION_START();
     DYAD_C_FUNCTION_UPDATE_STR ("fname", fname);
     dyad_rc_t rc = DYAD_RC_OK;
-    int lock_fd = -1, io_fd = -1;
-    ssize_t file_size = -1;
+    int io_fd = -1;
     char* file_data = NULL;
+    char* drained_data = NULL;
+    char* store_data = NULL;
+    char* tmpname = NULL;
     size_t data_len = 0ul;
-    struct flock exclusive_lock;
     // If the context is not defined, then it is not valid.
     // So, return DYAD_NOCTX
     if (!ctx || !ctx->h) {
@@ -835,6 +2032,7 @@ dyad_rc_t dyad_consume_w_metadata (dyad_ctx_t* restrict ctx, const char* fname,
     // then we need to skip data transfer.
     if (mdata == NULL) {
         DYAD_LOG_INFO (ctx, "File '%s' is local!\n", fname);
+        ctx->last_source = DYAD_SOURCE_LOCAL;
         rc = DYAD_RC_OK;
         goto consume_close;
     }
@@ -846,67 +2044,71 @@ dyad_rc_t dyad_consume_w_metadata (dyad_ctx_t* restrict ctx, const char* fname,
     }
     // Set reenter to false to avoid recursively performing DYAD operations
     ctx->reenter = false;
-    lock_fd = open (fname, O_RDWR | O_CREAT, 0666);
-    DYAD_C_FUNCTION_UPDATE_INT ("lock_fd", lock_fd);
-    if (lock_fd == -1) {
-        DYAD_LOG_ERROR (ctx, "Cannot create file (%s) for dyad_consume_w_metadata!\n", fname);
-        rc = DYAD_RC_BADFIO;
-        goto consume_close;
-    }
-    rc = dyad_excl_flock (ctx, lock_fd, &exclusive_lock);
-    if (DYAD_IS_ERROR (rc)) {
-        dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-        goto consume_close;
-    }
-    if ((file_size = get_file_size (lock_fd)) <= 0) {
-        DYAD_LOG_INFO (ctx, "[node %u rank %u pid %d] File (%s with fd %d) is not fetched yet", \
-                       ctx->node_idx, ctx->rank, ctx->pid, fname, lock_fd);
+    // The file is local unless fetched below
+    ctx->last_source = DYAD_SOURCE_LOCAL;
+    if (dyad_local_stale (fname, 0ul)) {
+        DYAD_LOG_INFO (ctx, "[node %u rank %u pid %d] File (%s) is not fetched yet", \
+                       ctx->node_idx, ctx->rank, ctx->pid, fname);
 
-        // Call dyad_get_data to dispatch a RPC to the producer's Flux broker
-        // and retrieve the data associated with the file
-        rc = dyad_get_data (ctx, mdata, &file_data, &data_len);
-        if (DYAD_IS_ERROR (rc)) {
-            DYAD_LOG_ERROR (ctx, "dyad_get_data failed!\n");
-            dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-            goto consume_done;
-        }
-        DYAD_C_FUNCTION_UPDATE_INT ("data_len", data_len);
-        io_fd = open (fname, O_WRONLY);
+        // Concurrent consumers of the same file each write their own copy,
+        // and the last one in place wins. It is opened first, so that a DTL
+        // that can write into it does not stage the data in memory.
+        io_fd = dyad_materialize_open (ctx, fname, &tmpname);
         DYAD_C_FUNCTION_UPDATE_INT ("io_fd", io_fd);
         if (io_fd == -1) {
             DYAD_LOG_ERROR (ctx, "Cannot open file (%s) in write mode for dyad_consume!\n", fname);
             rc = DYAD_RC_BADFIO;
-            goto consume_close;
+            goto consume_done;
         }
+        if (mdata->inline_data != NULL) {
+            DYAD_LOG_INFO (ctx, "File '%s' is inlined in its KVS record", fname);
+            store_data = mdata->inline_data;
+            data_len = mdata->inline_len;
+            ctx->last_source = DYAD_SOURCE_INLINE;
+        } else {
+            // Retrieve the data from the producer's Flux broker or, if it
+            // cannot serve it, from wherever else the file is
+            rc = dyad_get_data_failover (ctx, mdata, io_fd, &file_data, &drained_data,
+                                         &data_len, &ctx->last_source);
+            if (DYAD_IS_ERROR (rc)) {
+                DYAD_LOG_ERROR (ctx, "dyad_get_data failed!\n");
+                dyad_materialize_finish (ctx, io_fd, fname, tmpname, false);
+                goto consume_done;
+            }
+            store_data = (ctx->last_source == DYAD_SOURCE_DRAIN) ? drained_data : file_data;
+        }
+        DYAD_C_FUNCTION_UPDATE_INT ("data_len", data_len);
         // Call dyad_pull to fetch the data from the producer's
         // Flux broker
-        rc = dyad_cons_store (ctx, mdata, io_fd, data_len, file_data);
-
-        if (close (io_fd) != 0) {
-            rc = DYAD_RC_BADFIO;
-            dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-            goto consume_done;
-        }
+        rc = dyad_cons_store (ctx, mdata, io_fd, (store_data != NULL) ? data_len : 0ul, store_data);
         // If an error occured in dyad_pull, log it
         // and return the corresponding DYAD return code
         if (DYAD_IS_ERROR (rc)) {
             DYAD_LOG_ERROR (ctx, "dyad_cons_store failed!\n");
-            dyad_release_flock (ctx, io_fd, &exclusive_lock);
+            dyad_materialize_finish (ctx, io_fd, fname, tmpname, false);
             goto consume_done;
         };
-    }
-    dyad_release_flock (ctx, lock_fd, &exclusive_lock);
-    DYAD_C_FUNCTION_UPDATE_INT ("file_size", file_size);
-
-    if (close (lock_fd) != 0) {
-        rc = DYAD_RC_BADFIO;
-        goto consume_done;
+        rc = dyad_materialize_finish (ctx, io_fd, fname, tmpname, true);
+        if (DYAD_IS_ERROR (rc)) {
+            goto consume_done;
+        }
+        dyad_cache_admit (ctx, data_len);
+    } else {
+        dyad_cache_touch (ctx, fname);
     }
     rc = DYAD_RC_OK;
 consume_done:;
+    if (DYAD_IS_ERROR (rc)) {
+        ctx->last_source = DYAD_SOURCE_NONE;
+    } else {
+        // Whichever way the file came, fetched or read from shared storage
+        dyad_gc_ack (ctx, mdata);
+    }
+    DYAD_C_FUNCTION_UPDATE_STR ("source", dyad_source_name[ctx->last_source]);
     if (file_data != NULL) {
         ctx->dtl_handle->return_buffer (ctx, (void**)&file_data);
     }
+    free (drained_data);
 consume_close:;
     // Set reenter to true to allow additional intercepting
     ctx->reenter = true;
@@ -914,6 +2116,312 @@ consume_close:;
     return rc;
 }
 
+/** State of a file being consumed as part of dyad_consume_multi () */
+struct dyad_cons_item {
+    const char* fname;
+    int io_fd;       // copy in progress (see dyad_materialize_open ())
+    char* tmpname;
+    size_t stored;   // bytes of the copy put in place
+    dyad_rc_t rc;    // outcome reported to the caller
+    dyad_metadata_t* mdata;
+};
+
+static int cmp_cons_item_owner (const void* a, const void* b)
+{
+    const struct dyad_cons_item* ia = *(const struct dyad_cons_item* const*)a;
+    const struct dyad_cons_item* ib = *(const struct dyad_cons_item* const*)b;
+    if (ia->mdata->owner_rank < ib->mdata->owner_rank)
+        return -1;
+    return (ia->mdata->owner_rank > ib->mdata->owner_rank) ? 1 : 0;
+}
+
+/**
+ * Split a buffer packed by the DYAD module (see struct dyad_dtl_multi_entry)
+ * and store each file. Files are expected in the order they were requested.
+ * A file that cannot be stored gets its error in items[i]->rc, and the others
+ * are still stored. Only a malformed buffer fails the whole group.
+ */
+DYAD_CORE_FUNC_MODS dyad_rc_t dyad_cons_store_multi (const dyad_ctx_t* restrict ctx,
+                                                     struct dyad_cons_item** items,
+                                                     size_t num_files,
+                                                     char* restrict packed,
+                                                     size_t packed_len)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_rc_t file_rc = DYAD_RC_OK;
+    const char** upaths = NULL;
+    const char** data = NULL;
+    int64_t* data_lens = NULL;
+
+    upaths = (const char**)malloc (num_files * sizeof (*upaths));
+    data = (const char**)malloc (num_files * sizeof (*data));
+    data_lens = (int64_t*)malloc (num_files * sizeof (*data_lens));
+    if (upaths == NULL || data == NULL || data_lens == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto store_multi_done;
+    }
+    if (dyad_dtl_multi_unpack (packed, packed_len, num_files, upaths, data, data_lens) < 0) {
+        DYAD_LOG_ERROR (ctx, "Packed transfer of %zu files is malformed or truncated", num_files);
+        rc = DYAD_RC_BADUNPACK;
+        goto store_multi_done;
+    }
+    for (size_t i = 0ul; i < num_files; i++) {
+        if (strcmp (upaths[i], items[i]->mdata->fpath) != 0) {
+            DYAD_LOG_ERROR (ctx, "Packed file %s does not match requested %s",
+                            upaths[i], items[i]->mdata->fpath);
+            rc = DYAD_RC_BADUNPACK;
+            goto store_multi_done;
+        }
+    }
+    for (size_t i = 0ul; i < num_files; i++) {
+        if (data_lens[i] < 0) {
+            DYAD_LOG_ERROR (ctx, "Producer could not read %s", upaths[i]);
+            items[i]->rc = DYAD_RC_BADFIO;
+            continue;
+        }
+        file_rc = dyad_cons_store (ctx, items[i]->mdata, items[i]->io_fd,
+                                   (size_t)data_lens[i], (char*)data[i]);
+        if (!DYAD_IS_ERROR (file_rc)) {
+            file_rc = dyad_materialize_finish (ctx, items[i]->io_fd, items[i]->fname,
+                                               items[i]->tmpname, true);
+            items[i]->io_fd = -1;
+            items[i]->tmpname = NULL;
+            items[i]->stored = DYAD_IS_ERROR (file_rc) ? 0ul : (size_t)data_lens[i];
+        }
+        items[i]->rc = file_rc;
+    }
+store_multi_done:;
+    free (upaths);
+    free (data);
+    free (data_lens);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+/**
+ * Fetch and store, on its own, a file of dyad_consume_multi () whose packed
+ * transfer failed, so that it goes through dyad_get_data_failover ().
+ */
+static dyad_rc_t dyad_cons_item_failover (dyad_ctx_t* restrict ctx, struct dyad_cons_item* item)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    char* file_data = NULL;
+    char* drained_data = NULL;
+    char* store_data = NULL;
+    size_t data_len = 0ul;
+
+    // The copy was already put in place, or discarded
+    if (item->io_fd < 0) {
+        return item->rc;
+    }
+    // Drop what a failed store of the packed transfer left in the copy
+    if (lseek (item->io_fd, 0, SEEK_SET) != 0 || ftruncate (item->io_fd, 0) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot rewind the copy of %s", item->fname);
+        return DYAD_RC_BADFIO;
+    }
+    rc = dyad_get_data_failover (ctx, item->mdata, item->io_fd, &file_data, &drained_data,
+                                 &data_len, &ctx->last_source);
+    if (!DYAD_IS_ERROR (rc)) {
+        store_data = (ctx->last_source == DYAD_SOURCE_DRAIN) ? drained_data : file_data;
+        rc = dyad_cons_store (ctx, item->mdata, item->io_fd,
+                              (store_data != NULL) ? data_len : 0ul, store_data);
+    }
+    if (!DYAD_IS_ERROR (rc)) {
+        rc = dyad_materialize_finish (ctx, item->io_fd, item->fname, item->tmpname, true);
+        item->io_fd = -1;
+        item->tmpname = NULL;
+        item->stored = DYAD_IS_ERROR (rc) ? 0ul : data_len;
+    }
+    if (file_data != NULL) {
+        ctx->dtl_handle->return_buffer (ctx, (void**)&file_data);
+    }
+    free (drained_data);
+    return rc;
+}
+
+dyad_rc_t dyad_consume_multi (dyad_ctx_t* restrict ctx,
+                              const char* const* fnames,
+                              size_t num_files,
+                              dyad_rc_t* file_rcs)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_INT ("num_files", num_files);
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_rc_t group_rc = DYAD_RC_OK;
+    struct dyad_cons_item* items = NULL;
+    struct dyad_cons_item** pending = NULL;
+    const dyad_metadata_t** group = NULL;
+    size_t num_pending = 0ul;
+    size_t num_untracked = 0ul;
+    size_t start = 0ul, end = 0ul;
+    char* file_data = NULL;
+    size_t data_len = 0ul;
+    size_t stored = 0ul;
+    char upath[PATH_MAX + 1] = {'\0'};
+
+    if (!ctx || !ctx->h) {
+        rc = DYAD_RC_NOCTX;
+        goto consume_multi_fail;
+    }
+    if (ctx->cons_managed_path == NULL) {
+        rc = DYAD_RC_BADMANAGEDPATH;
+        goto consume_multi_fail;
+    }
+    // There is no data to transfer with shared storage. Only synchronize.
+    if (ctx->shared_storage) {
+        for (size_t i = 0ul; i < num_files; i++) {
+            dyad_rc_t file_rc = dyad_consume (ctx, fnames[i]);
+            if (file_rcs != NULL) {
+                file_rcs[i] = file_rc;
+            }
+            if (DYAD_IS_ERROR (file_rc) && !DYAD_IS_ERROR (rc)) {
+                rc = file_rc;
+            }
+        }
+        goto consume_multi_close;
+    }
+    items = (struct dyad_cons_item*)calloc (num_files, sizeof (*items));
+    pending = (struct dyad_cons_item**)calloc (num_files, sizeof (*pending));
+    group = (const dyad_metadata_t**)calloc (num_files, sizeof (*group));
+    if (items == NULL || pending == NULL || group == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto consume_multi_fail;
+    }
+    for (size_t i = 0ul; i < num_files; i++) {
+        items[i].io_fd = -1;
+    }
+    ctx->reenter = false;
+    ctx->last_source = DYAD_SOURCE_LOCAL;
+
+    // Resolve the metadata of every missing file and store what needs no
+    // transfer. A file that fails here does not hold back the others.
+    for (size_t i = 0ul; i < num_files; i++) {
+        struct dyad_cons_item* item = &items[i];
+        item->fname = fnames[i];
+        memset (upath, '\0', sizeof (upath));
+        if (ctx->relative_to_managed_path && (strlen (fnames[i]) > 0ul)
+            && (strncmp (fnames[i], DYAD_PATH_DELIM, ctx->delim_len) != 0)) {
+            memcpy (upath, fnames[i], strlen (fnames[i]));
+        } else if (!cmp_canonical_path_prefix (ctx, false, fnames[i], upath, PATH_MAX)) {
+            DYAD_LOG_INFO (ctx, "%s is not in the Consumer's managed path", fnames[i]);
+            item->rc = DYAD_RC_UNTRACKED;
+            num_untracked++;
+            continue;
+        }
+        if (!dyad_local_stale (fnames[i], 0ul)) {
+            dyad_cache_touch (ctx, fnames[i]);
+            continue;
+        }
+        item->rc = dyad_fetch_metadata (ctx, fnames[i], upath, 0ul, &item->mdata);
+        if (DYAD_IS_ERROR (item->rc)) {
+            DYAD_LOG_ERROR (ctx, "dyad_fetch_metadata failed for %s!\n", fnames[i]);
+            continue;
+        }
+        if (item->mdata == NULL) {
+            continue;
+        }
+        item->io_fd = dyad_materialize_open (ctx, fnames[i], &item->tmpname);
+        if (item->io_fd == -1) {
+            DYAD_LOG_ERROR (ctx, "Cannot create file (%s) for dyad_consume_multi!\n", fnames[i]);
+            item->rc = DYAD_RC_BADFIO;
+            continue;
+        }
+        if (item->mdata->inline_data == NULL) {
+            pending[num_pending++] = item;
+            continue;
+        }
+        ctx->last_source = DYAD_SOURCE_INLINE;
+        item->rc = dyad_cons_store (ctx,
+                                    item->mdata,
+                                    item->io_fd,
+                                    item->mdata->inline_len,
+                                    item->mdata->inline_data);
+        if (!DYAD_IS_ERROR (item->rc)) {
+            item->rc = dyad_materialize_finish (ctx, item->io_fd, item->fname, item->tmpname, true);
+            item->io_fd = -1;
+            item->tmpname = NULL;
+            item->stored = DYAD_IS_ERROR (item->rc) ? 0ul : item->mdata->inline_len;
+        }
+    }
+
+    // Fetch the remaining files with one transfer per producer. Files that the
+    // transfer could not deliver are fetched again one by one.
+    qsort (pending, num_pending, sizeof (*pending), cmp_cons_item_owner);
+    for (start = 0ul; start < num_pending; start = end) {
+        for (end = start; end < num_pending && end - start < DYAD_DTL_MULTI_MAX
+                          && pending[end]->mdata->owner_rank == pending[start]->mdata->owner_rank;
+             end++) {
+            group[end - start] = pending[end]->mdata;
+        }
+        DYAD_LOG_INFO (ctx, "Fetching %zu files from broker %u in one transfer",
+                       end - start, pending[start]->mdata->owner_rank);
+        group_rc = dyad_get_data_multi (ctx, group, end - start, &file_data, &data_len);
+        if (!DYAD_IS_ERROR (group_rc)) {
+            ctx->last_source = DYAD_SOURCE_OWNER;
+            group_rc = dyad_cons_store_multi (ctx, pending + start, end - start,
+                                              file_data, data_len);
+        }
+        if (file_data != NULL) {
+            ctx->dtl_handle->return_buffer (ctx, (void**)&file_data);
+            file_data = NULL;
+        }
+        if (DYAD_IS_ERROR (group_rc)) {
+            DYAD_LOG_ERROR (ctx, "Packed transfer failed! Fetching %zu files one by one\n",
+                            end - start);
+        }
+        for (size_t i = start; i < end; i++) {
+            if (DYAD_IS_ERROR (group_rc) || DYAD_IS_ERROR (pending[i]->rc)) {
+                pending[i]->rc = dyad_cons_item_failover (ctx, pending[i]);
+            }
+        }
+    }
+
+    for (size_t i = 0ul; i < num_files; i++) {
+        if (DYAD_IS_ERROR (items[i].rc) && items[i].rc != DYAD_RC_UNTRACKED) {
+            rc = items[i].rc;
+            break;
+        }
+    }
+    // Files outside of the managed path are only an error if nothing else is
+    if (!DYAD_IS_ERROR (rc) && num_untracked > 0ul) {
+        rc = DYAD_RC_UNTRACKED;
+    }
+
+    if (DYAD_IS_ERROR (rc) && rc != DYAD_RC_UNTRACKED) {
+        ctx->last_source = DYAD_SOURCE_NONE;
+    }
+    DYAD_C_FUNCTION_UPDATE_STR ("source", dyad_source_name[ctx->last_source]);
+    for (size_t i = 0ul; i < num_files; i++) {
+        // Copies not completed are discarded
+        if (items[i].io_fd >= 0) {
+            dyad_materialize_finish (ctx, items[i].io_fd, items[i].fname, items[i].tmpname, false);
+        } else if (!DYAD_IS_ERROR (items[i].rc)) {
+            dyad_gc_ack (ctx, items[i].mdata);
+        }
+        stored += items[i].stored;
+        dyad_free_metadata (&items[i].mdata);
+        if (file_rcs != NULL) {
+            file_rcs[i] = items[i].rc;
+        }
+    }
+    if (stored > 0ul) {
+        dyad_cache_admit (ctx, stored);
+    }
+    ctx->reenter = true;
+    goto consume_multi_close;
+consume_multi_fail:;
+    for (size_t i = 0ul; file_rcs != NULL && i < num_files; i++) {
+        file_rcs[i] = rc;
+    }
+consume_multi_close:;
+    free (group);
+    free (pending);
+    free (items);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
 #if DYAD_SYNC_DIR
 int dyad_sync_directory (dyad_ctx_t* restrict ctx, const char* restrict path)
 {
@@ -9,6 +9,7 @@
 
 #include <dyad/common/dyad_rc.h>
 #include <dyad/common/dyad_structures.h>
+#include <jansson.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -32,9 +33,53 @@ extern "C" {
 #endif
 DYAD_DLL_EXPORTED extern const struct dyad_ctx dyad_ctx_default;
 
+// Largest file that may be inlined into its KVS record. Larger values make
+// the KVS itself the bottleneck, so DYAD_INLINE_THRESHOLD is clamped to it.
+#define DYAD_INLINE_THRESHOLD_MAX (64u * 1024u)
+
+// KVS key layout used when neither the user nor dyad_tune set one
+#define DYAD_KEY_DEPTH_DEFAULT 3u
+#define DYAD_KEY_BINS_DEFAULT 1024u
+
+// Retries of a fetch that neither the producer's broker nor the drain path
+// could serve, and the time before the first, doubled up to the maximum
+#define DYAD_FETCH_RETRIES_DEFAULT 3u
+#define DYAD_FETCH_BACKOFF_DEFAULT 0.1
+#define DYAD_FETCH_BACKOFF_MAX 5.0
+
+// Layout of the KVS record written by producers. Records without a "format"
+// are of format 1, and a bare owner rank is the layout before any format.
+#define DYAD_RECORD_FORMAT 1
+
+// Extended attribute holding the version of a consumed file
+#define DYAD_VERSION_XATTR "user.dyad.version"
+// Extended attribute holding how many consumers will fetch a produced file
+#define DYAD_READERS_XATTR "user.dyad.readers"
+// Extended attribute set on a produced file once it is committed, holding
+// the version it was committed with (0 if unversioned)
+#define DYAD_COMMITTED_XATTR "user.dyad.committed"
+
+// Request to the local module to copy produced files to ctx->drain_path,
+// as {"upaths": [upath, ...]}. It has no response.
+#define DYAD_DRAIN_RPC_NAME "dyad.drain"
+// Appended to the key of a record for the key of its drain mark, a record of
+// its own as {"version": version copied to ctx->drain_path}
+#define DYAD_DRAINED_KEY_SUFFIX "@drained"
+// Sent by a consumer to the module of the owner once it holds a file with
+// expected readers (see DYAD_READERS_XATTR), as {"upath": upath}, whether it
+// fetched the file from the owner, the record, the drain path or shared
+// storage. It has no response.
+#define DYAD_GC_RPC_ACK "dyad.gc.ack"
+
 struct dyad_metadata {
     char* fpath;
     uint32_t owner_rank;
+    size_t file_size;   // size of the file when published (0 if unknown)
+    char* inline_data;  // file contents if inlined into the record, else NULL
+    size_t inline_len;  // number of bytes in inline_data
+    uint64_t version;   // version of the file when published (0 if unversioned)
+    bool placed;        // owner given by the placement rule, without a record
+    uint32_t readers;   // consumers the producer expects (0 if the file is kept)
 };
 typedef struct dyad_metadata dyad_metadata_t;
 
@@ -78,6 +123,76 @@ typedef struct dyad_metadata dyad_metadata_t;
  */
 DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_produce (dyad_ctx_t* ctx, const char* fname);
 
+/**
+ * @brief Produce a new version of a file that is overwritten in place, e.g.,
+ *        a checkpoint rewritten every iteration. The record of the file is
+ *        replaced, so consumers waiting for this version are released.
+ * @param[in] ctx      the DYAD context for the operation
+ * @param[in] fname    the name of the file being "produced"
+ * @param[in] version  the version of the file, increasing from 1
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_produce_version (dyad_ctx_t* ctx,
+                                                                    const char* fname,
+                                                                    uint64_t version);
+
+/**
+ * @brief Produce every regular file under a directory of the producer-managed
+ *        path at once. The records are published in a few large transactions
+ *        instead of one commit per file, e.g., when staging a dataset.
+ * @param[in] ctx  the DYAD context for the operation
+ * @param[in] dir  the directory to walk. Symbolic links are not followed
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_produce_dir (dyad_ctx_t* ctx, const char* dir);
+
+/**
+ * @brief Produce several files at once, publishing their records in a few
+ *        large transactions. Files outside of the producer-managed path are
+ *        skipped.
+ * @param[in] ctx        the DYAD context for the operation
+ * @param[in] fnames     the names of the files being "produced"
+ * @param[in] num_files  the number of entries in fnames
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_produce_multi (dyad_ctx_t* ctx,
+                                                                  const char* const* fnames,
+                                                                  size_t num_files);
+
+/**
+ * @brief Declare how many consumers will read a file, before producing it.
+ *        Each consumer acknowledges the file once it has read it, however it
+ *        got it. Once that many distinct consumers acknowledged it, the
+ *        module removes the file and its record, after the drain copied it
+ *        if it is pending. Files produced without a count get ctx->readers.
+ * @param[in] ctx      the DYAD context for the operation
+ * @param[in] fname    the name of the file in the producer-managed path
+ * @param[in] readers  the number of consumers expected, 0 to keep the file
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_set_readers (dyad_ctx_t* ctx, const char* fname, uint32_t readers);
+
+/**
+ * @brief Publish the drain marks of files copied to ctx->drain_path, so that
+ *        consumers of those versions read that copy when the producer's
+ *        broker cannot serve them. The records of the files are left as they
+ *        are, so a concurrent publish of a newer version is never undone.
+ * @param[in] ctx        the DYAD context for the operation
+ * @param[in] upaths     the paths of the files relative to the managed path
+ * @param[in] versions   the version of each file that was copied
+ * @param[in] num_files  the number of entries in upaths and versions
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_mark_drained (dyad_ctx_t* ctx,
+                                               const char* const* upaths,
+                                               const uint64_t* versions,
+                                               size_t num_files);
+
 /**
  * @brief Obtain DYAD metadata for a file in the consumer-managed directory
  * @param[in]  ctx         the DYAD context for the operation
@@ -104,6 +219,20 @@ DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_free_metadata (dyad_metadata_
  */
 DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_consume (dyad_ctx_t* ctx, const char* fname);
 
+/**
+ * @brief Consume at least the given version of a file. A local copy that is
+ *        already at this version or newer is used as is; otherwise, wait for
+ *        the version to be produced and refetch the file.
+ * @param[in] ctx      the DYAD context for the operation
+ * @param[in] fname    the name of the file being "consumed"
+ * @param[in] version  the lowest acceptable version of the file
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_consume_version (dyad_ctx_t* ctx,
+                                                                    const char* fname,
+                                                                    uint64_t version);
+
 /**
  * @brief Wrapper function that performs all the common tasks needed
  *        of a consumer
@@ -117,13 +246,54 @@ DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_consume (dyad_ctx_t* ctx, con
 DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_consume_w_metadata (dyad_ctx_t* ctx, const char* fname,
                                                                        const dyad_metadata_t* mdata);
 
+/**
+ * @brief Consume several files at once. Files that are not available locally
+ *        are grouped by producer and each group is fetched in a single
+ *        transfer, amortizing the RPC and DTL costs over many small files.
+ *        Files the transfer could not deliver are fetched one by one, and a
+ *        file that fails does not keep the others from being consumed.
+ * @param[in]  ctx        the DYAD context for the operation
+ * @param[in]  fnames     the names of the files being "consumed"
+ * @param[in]  num_files  the number of entries in fnames
+ * @param[out] file_rcs   if not NULL, num_files entries that receive the
+ *                        outcome of each file. DYAD_RC_UNTRACKED marks a
+ *                        file outside of the consumer-managed path
+ *
+ * @return The error of the first file that failed, else DYAD_RC_UNTRACKED if
+ *         some files are outside of the consumer-managed path, else
+ *         DYAD_RC_OK
+ */
+DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_consume_multi (dyad_ctx_t* ctx,
+                                                                  const char* const* fnames,
+                                                                  size_t num_files,
+                                                                  dyad_rc_t* file_rcs);
+
+/**
+ * @brief Remove the records of produced files from the metadata backend,
+ *        batching all of them into as few KVS transactions as possible.
+ *        Consumers can no longer find these files afterwards.
+ * @param[in] ctx        the DYAD context for the operation
+ * @param[in] fnames     the names of the files to unpublish
+ * @param[in] num_files  the number of entries in fnames
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_PFA_ANNOTATE DYAD_DLL_EXPORTED dyad_rc_t dyad_unpublish (dyad_ctx_t* ctx,
+                                                              const char* const* fnames,
+                                                              size_t num_files);
+
 
 /**
  * Private Function definitions
  */
-DYAD_DLL_EXPORTED dyad_rc_t dyad_get_data (const dyad_ctx_t* ctx, const dyad_metadata_t* mdata,
+DYAD_DLL_EXPORTED dyad_rc_t dyad_get_data (dyad_ctx_t* ctx, const dyad_metadata_t* mdata,
                                                          char** file_data,
                                                          size_t* file_len);
+DYAD_DLL_EXPORTED dyad_rc_t dyad_get_data_multi (dyad_ctx_t* ctx,
+                                                 const dyad_metadata_t* const* mdata,
+                                                 size_t num_files,
+                                                 char** file_data,
+                                                 size_t* file_len);
 DYAD_DLL_EXPORTED dyad_rc_t dyad_commit (dyad_ctx_t* ctx, const char* fname);
 
 DYAD_DLL_EXPORTED int gen_path_key (const char* str, char* path_key,
@@ -131,6 +301,20 @@ DYAD_DLL_EXPORTED int gen_path_key (const char* str, char* path_key,
                                                           const uint32_t depth,
                                                           const uint32_t width);
 
+// Build and parse the KVS record of a produced file (see DYAD_RECORD_FORMAT)
+DYAD_DLL_EXPORTED dyad_rc_t dyad_pack_record (const dyad_ctx_t* ctx,
+                                              const char* upath,
+                                              uint64_t version,
+                                              bool with_data,
+                                              json_t** record);
+DYAD_DLL_EXPORTED dyad_rc_t dyad_unpack_record (const dyad_ctx_t* ctx,
+                                                json_t* record,
+                                                dyad_metadata_t* mdata);
+
+// Match `str' against a placement pattern (see ctx->placement_pattern),
+// storing the rank matched by `%r' into `*rank'
+DYAD_DLL_EXPORTED bool dyad_placement_match (const char* pat, const char* str, uint32_t* rank);
+
 DYAD_DLL_EXPORTED dyad_rc_t dyad_kvs_read (const dyad_ctx_t* ctx,
                                              const char* topic,
                                              const char* upath,
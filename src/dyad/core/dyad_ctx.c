@@ -27,6 +27,7 @@
 #endif
 
 #include <errno.h>
+#include <strings.h>
 
 // Note:
 // To ensure we don't have multiple initialization, we need the following:
@@ -59,8 +60,8 @@ const struct dyad_ctx dyad_ctx_default = {
     false,  // shared_storage
     false,  // async_publish
     false,  // fsync_write
-    3u,     // key_depth
-    1024u,  // key_bins
+    DYAD_KEY_DEPTH_DEFAULT,  // key_depth
+    DYAD_KEY_BINS_DEFAULT,   // key_bins
     0u,     // rank
     1u,     // service_mux
     0u,     // node_idx
@@ -68,7 +69,26 @@ const struct dyad_ctx dyad_ctx_default = {
     NULL,   // kvs_namespace
     NULL,   // prod_managed_path
     NULL,   // cons_managed_path
-    false   // relative_to_managed_path
+    false,  // relative_to_managed_path
+    0u,     // inline_threshold
+    DYAD_DTL_AUTO_THRESHOLD_DEFAULT,  // dtl_switch_size
+    DYAD_MD_DEFAULT,  // md_mode
+    NULL,   // placement_pattern
+    NULL,   // placement_cb
+    NULL,   // placement_arg
+    1u,     // kvs_shards
+    0u,     // kvs_ttl
+    false,  // publish_thread
+    0.0,    // fsync_group
+    NULL,   // publisher
+    NULL,   // publisher_fini
+    0u,     // cache_bytes
+    INT64_MIN,  // cache_used
+    0u,     // readers
+    NULL,   // drain_path
+    DYAD_FETCH_RETRIES_DEFAULT,  // fetch_retries
+    DYAD_FETCH_BACKOFF_DEFAULT,  // fetch_backoff
+    DYAD_SOURCE_NONE  // last_source
 };
 
 DYAD_DLL_EXPORTED dyad_ctx_t* dyad_ctx_get ()
@@ -118,6 +138,45 @@ dyad_wrapper_fini_done:;
 dyad_rc_t dyad_clear ();
 
 DYAD_DLL_EXPORTED
+/**
+ * Adopt the key layout that dyad_tune recorded in the namespace, if any, so
+ * that producers and consumers that do not set it explicitly agree on it.
+ */
+static void dyad_load_key_layout (dyad_ctx_t* ctx)
+{
+    flux_future_t* f = NULL;
+    int key_depth = 0;
+    int key_bins = 0;
+
+    if (ctx->h == NULL || ctx->kvs_namespace == NULL) {
+        return;
+    }
+    f = flux_kvs_lookup ((flux_t*)ctx->h, ctx->kvs_namespace, 0, DYAD_KVS_CONFIG_KEY);
+    if (f == NULL
+        || flux_kvs_lookup_get_unpack (f,
+                                       "{s:i, s:i}",
+                                       "key_depth",
+                                       &key_depth,
+                                       "key_bins",
+                                       &key_bins)
+               < 0) {
+        goto load_key_layout_done;
+    }
+    if (key_depth > 0 && key_bins > 0) {
+        ctx->key_depth = (unsigned int)key_depth;
+        ctx->key_bins = (unsigned int)key_bins;
+        if (ctx->rank == 0) {
+            DYAD_LOG_INFO (ctx,
+                           "DYAD_CORE INIT: using the key layout in %s (depth %u, bins %u)",
+                           DYAD_KVS_CONFIG_KEY,
+                           ctx->key_depth,
+                           ctx->key_bins);
+        }
+    }
+load_key_layout_done:;
+    flux_future_destroy (f);
+}
+
 dyad_rc_t dyad_init (bool debug,
                      bool check,
                      bool shared_storage,
@@ -242,8 +301,6 @@ dyad_rc_t dyad_init (bool debug,
                        "DYAD_CORE INIT: async_publish %s",
                        ctx->async_publish ? "true" : "false");
         DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: fsync_write %s", ctx->fsync_write ? "true" : "false");
-        DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: kvs key depth %u", ctx->key_depth);
-        DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: kvs key bins %u", ctx->key_bins);
         DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: broker rank %u", my_rank);
         DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: pid %u", ctx->pid);
     }
@@ -265,6 +322,17 @@ dyad_rc_t dyad_init (bool debug,
     if (my_rank == 0) {
         DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: kvs_namespace %s", ctx->kvs_namespace);
     }
+    // A key depth or bin count of 0 leaves the layout unset: use the one
+    // that dyad_tune recorded in the namespace, if any, or the default one
+    if (ctx->key_depth == 0u || ctx->key_bins == 0u) {
+        ctx->key_depth = DYAD_KEY_DEPTH_DEFAULT;
+        ctx->key_bins = DYAD_KEY_BINS_DEFAULT;
+        dyad_load_key_layout (ctx);
+    }
+    if (my_rank == 0) {
+        DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: kvs key depth %u", ctx->key_depth);
+        DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: kvs key bins %u", ctx->key_bins);
+    }
 
     // Initialize the DTL based on the value of dtl_mode
     // If an error occurs, log it and return an error
@@ -326,6 +394,41 @@ init_region_finish:;
     return rc;
 }
 
+/**
+ * When keys are spread over several KVS namespaces (DYAD_KVS_SHARDS), create
+ * the shards of DYAD_KVS_NAMESPACE that do not exist yet, so that users only
+ * have to create the base namespace and no shard is used before it exists.
+ * Shards are created in order, so if the last one exists, all of them do.
+ */
+static dyad_rc_t dyad_create_kvs_shards (dyad_ctx_t* ctx)
+{
+    char ns[PATH_MAX + 1] = {'\0'};
+    flux_future_t* f = NULL;
+
+    if (ctx->h == NULL || ctx->kvs_shards <= 1u || ctx->kvs_namespace == NULL) {
+        return DYAD_RC_OK;
+    }
+    snprintf (ns, PATH_MAX, DYAD_KVS_SHARD_FMT, ctx->kvs_namespace, ctx->kvs_shards - 1u);
+    f = flux_kvs_getroot ((flux_t*)ctx->h, ns, 0);
+    if (f != NULL && flux_future_get (f, NULL) == 0) {
+        flux_future_destroy (f);
+        return DYAD_RC_OK;
+    }
+    flux_future_destroy (f);
+    for (uint32_t i = 0u; i < ctx->kvs_shards; i++) {
+        snprintf (ns, PATH_MAX, DYAD_KVS_SHARD_FMT, ctx->kvs_namespace, i);
+        f = flux_kvs_namespace_create ((flux_t*)ctx->h, ns, FLUX_USERID_UNKNOWN, 0);
+        if (f == NULL || (flux_future_get (f, NULL) < 0 && errno != EEXIST)) {
+            DYAD_LOG_ERROR (ctx, "Cannot create KVS namespace %s: %s", ns, strerror (errno));
+            flux_future_destroy (f);
+            return DYAD_RC_FLUXFAIL;
+        }
+        flux_future_destroy (f);
+    }
+    DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: created %u KVS namespace shards", ctx->kvs_shards);
+    return DYAD_RC_OK;
+}
+
 DYAD_DLL_EXPORTED dyad_rc_t dyad_init_env (const dyad_dtl_comm_mode_t dtl_comm_mode,
                                            void* flux_handle)
 {
@@ -340,7 +443,21 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_init_env (const dyad_dtl_comm_mode_t dtl_comm_m
     bool relative_to_managed_path = false;
     unsigned int key_depth = 0u;
     unsigned int key_bins = 0u;
+    bool key_layout_set = false;
     unsigned int service_mux = 1u;
+    unsigned long inline_threshold = 0ul;
+    unsigned long long dtl_switch_size = DYAD_DTL_AUTO_THRESHOLD_DEFAULT;
+    dyad_md_mode_t md_mode = DYAD_MD_DEFAULT;
+    const char* placement_pattern = NULL;
+    unsigned int kvs_shards = 1u;
+    unsigned long kvs_ttl = 0ul;
+    bool publish_thread = false;
+    double fsync_group = 0.0;
+    unsigned long long cache_bytes = 0ull;
+    unsigned long readers = 0ul;
+    const char* drain_path = NULL;
+    unsigned long fetch_retries = DYAD_FETCH_RETRIES_DEFAULT;
+    double fetch_backoff = DYAD_FETCH_BACKOFF_DEFAULT;
     const char* kvs_namespace = NULL;
     const char* prod_managed_path = NULL;
     const char* cons_managed_path = NULL;
@@ -390,14 +507,21 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_init_env (const dyad_dtl_comm_mode_t dtl_comm_m
 
     if ((e = getenv (DYAD_KEY_DEPTH_ENV))) {
         key_depth = atoi (e);
+        key_layout_set = true;
     } else {
-        key_depth = 3;
+        key_depth = DYAD_KEY_DEPTH_DEFAULT;
     }
 
     if ((e = getenv (DYAD_KEY_BINS_ENV))) {
         key_bins = atoi (e);
+        key_layout_set = true;
     } else {
-        key_bins = 1024;
+        key_bins = DYAD_KEY_BINS_DEFAULT;
+    }
+    // Leave the layout to dyad_init () unless one of them is set
+    if (!key_layout_set) {
+        key_depth = 0u;
+        key_bins = 0u;
     }
 
     if ((e = getenv (DYAD_SERVICE_MUX_ENV))) {
@@ -430,6 +554,117 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_init_env (const dyad_dtl_comm_mode_t dtl_comm_m
         relative_to_managed_path = false;
     }
 
+    if ((e = getenv (DYAD_INLINE_THRESHOLD_ENV))) {
+        inline_threshold = strtoul (e, NULL, 10);
+        if (inline_threshold > DYAD_INLINE_THRESHOLD_MAX) {
+            DYAD_LOG_STDERR ("%s = %lu is too large. Using %u\n",
+                             DYAD_INLINE_THRESHOLD_ENV,
+                             inline_threshold,
+                             DYAD_INLINE_THRESHOLD_MAX);
+            inline_threshold = DYAD_INLINE_THRESHOLD_MAX;
+        }
+    } else {
+        inline_threshold = 0ul;
+    }
+
+    if ((e = getenv (DYAD_DTL_AUTO_THRESHOLD_ENV))) {
+        dtl_switch_size = strtoull (e, NULL, 10);
+    } else {
+        dtl_switch_size = DYAD_DTL_AUTO_THRESHOLD_DEFAULT;
+    }
+
+    if ((e = getenv (DYAD_METADATA_MODE_ENV))) {
+        if (strcasecmp (e, dyad_md_mode_name[DYAD_MD_DHT]) == 0) {
+            md_mode = DYAD_MD_DHT;
+        } else if (strcasecmp (e, dyad_md_mode_name[DYAD_MD_KVS]) == 0) {
+            md_mode = DYAD_MD_KVS;
+        } else {
+            DYAD_LOG_STDERR ("Unknown %s = %s. Using %s\n",
+                             DYAD_METADATA_MODE_ENV,
+                             e,
+                             dyad_md_mode_name[DYAD_MD_DEFAULT]);
+            md_mode = DYAD_MD_DEFAULT;
+        }
+    } else {
+        md_mode = DYAD_MD_DEFAULT;
+    }
+
+    if ((e = getenv (DYAD_PLACEMENT_PATTERN_ENV)) && (strlen (e) > 0ul)) {
+        placement_pattern = e;
+    } else {
+        placement_pattern = NULL;
+    }
+
+    if ((e = getenv (DYAD_KVS_SHARDS_ENV))) {
+        long shards = strtol (e, NULL, 10);
+        if (shards < 1l || shards > (long)DYAD_KVS_SHARDS_MAX) {
+            shards = (shards < 1l) ? 1l : (long)DYAD_KVS_SHARDS_MAX;
+            DYAD_LOG_STDERR ("%s = %s is out of range. Using %ld\n",
+                             DYAD_KVS_SHARDS_ENV,
+                             e,
+                             shards);
+        }
+        kvs_shards = (unsigned int)shards;
+    } else {
+        kvs_shards = 1u;
+    }
+
+    if ((e = getenv (DYAD_KVS_TTL_ENV))) {
+        kvs_ttl = strtoul (e, NULL, 10);
+    } else {
+        kvs_ttl = 0ul;
+    }
+
+    if ((e = getenv (DYAD_PUBLISH_THREAD_ENV))) {
+        publish_thread = true;
+    } else {
+        publish_thread = false;
+    }
+
+    if ((e = getenv (DYAD_READERS_ENV))) {
+        readers = strtoul (e, NULL, 10);
+    } else {
+        readers = 0ul;
+    }
+
+    if ((e = getenv (DYAD_PATH_DRAIN_ENV)) && (strlen (e) > 0ul)) {
+        drain_path = e;
+    } else {
+        drain_path = NULL;
+    }
+
+    if ((e = getenv (DYAD_FETCH_RETRIES_ENV))) {
+        fetch_retries = strtoul (e, NULL, 10);
+    } else {
+        fetch_retries = DYAD_FETCH_RETRIES_DEFAULT;
+    }
+
+    if ((e = getenv (DYAD_FETCH_BACKOFF_ENV))) {
+        fetch_backoff = strtod (e, NULL);
+        if (fetch_backoff < 0.0) {
+            fetch_backoff = 0.0;
+        } else if (fetch_backoff > DYAD_FETCH_BACKOFF_MAX) {
+            fetch_backoff = DYAD_FETCH_BACKOFF_MAX;
+        }
+    } else {
+        fetch_backoff = DYAD_FETCH_BACKOFF_DEFAULT;
+    }
+
+    if ((e = getenv (DYAD_CACHE_BYTES_ENV))) {
+        cache_bytes = strtoull (e, NULL, 10);
+    } else {
+        cache_bytes = 0ull;
+    }
+
+    if ((e = getenv (DYAD_FSYNC_GROUP_ENV))) {
+        fsync_group = strtod (e, NULL);
+        if (fsync_group < 0.0) {
+            fsync_group = 0.0;
+        }
+    } else {
+        fsync_group = 0.0;
+    }
+
     if ((e = getenv (DYAD_DTL_MODE_ENV))) {
         dtl_mode = e;
     } else {
@@ -457,6 +692,52 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_init_env (const dyad_dtl_comm_mode_t dtl_comm_m
                               dtl_mode,
                               dtl_comm_mode,
                               flux_handle);
+    // The following settings are not part of the dyad_init () signature.
+    // Apply them once the context exists.
+    if (!DYAD_IS_ERROR (rc) && ctx != NULL) {
+        ctx->inline_threshold = (uint32_t)inline_threshold;
+        ctx->dtl_switch_size = (uint64_t)dtl_switch_size;
+        ctx->md_mode = md_mode;
+        ctx->kvs_shards = kvs_shards;
+        ctx->kvs_ttl = (uint32_t)kvs_ttl;
+        ctx->publish_thread = publish_thread;
+        ctx->fsync_group = fsync_group;
+        ctx->cache_bytes = (uint64_t)cache_bytes;
+        ctx->readers = (uint32_t)readers;
+        ctx->fetch_retries = (uint32_t)fetch_retries;
+        ctx->fetch_backoff = fetch_backoff;
+        if (drain_path != NULL && (ctx->drain_path = strdup (drain_path)) == NULL) {
+            DYAD_LOG_ERROR (ctx, "Could not copy the drain path!\n");
+            rc = DYAD_RC_SYSFAIL;
+        }
+        if (!DYAD_IS_ERROR (rc)) {
+            rc = dyad_create_kvs_shards (ctx);
+        }
+        if (!DYAD_IS_ERROR (rc) && placement_pattern != NULL) {
+            rc = dyad_set_placement (placement_pattern, NULL, NULL);
+        }
+        if (ctx->rank == 0) {
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: inline_threshold %u", ctx->inline_threshold);
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: dtl_switch_size %lu", ctx->dtl_switch_size);
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: metadata %s", dyad_md_mode_name[ctx->md_mode]);
+            if (ctx->placement_pattern != NULL) {
+                DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: placement %s", ctx->placement_pattern);
+            }
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: kvs_shards %u", ctx->kvs_shards);
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: kvs_ttl %u", ctx->kvs_ttl);
+            DYAD_LOG_INFO (ctx,
+                           "DYAD_CORE INIT: publish_thread %s",
+                           ctx->publish_thread ? "true" : "false");
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: fsync_group %f", ctx->fsync_group);
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: cache_bytes %lu", ctx->cache_bytes);
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: readers %u", ctx->readers);
+            if (ctx->drain_path != NULL) {
+                DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: drain_path %s", ctx->drain_path);
+            }
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: fetch_retries %u", ctx->fetch_retries);
+            DYAD_LOG_INFO (ctx, "DYAD_CORE INIT: fetch_backoff %f", ctx->fetch_backoff);
+        }
+    }
     DYAD_C_FUNCTION_END ();
     return rc;
 }
@@ -481,6 +762,15 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_set_and_init_dtl_mode (const char* dtl_name,
         dtl_mode = DYAD_DTL_UCX;
     } else if (strncmp (dtl_name, dyad_dtl_mode_name[DYAD_DTL_FLUX_RPC], dtl_name_len) == 0) {
         dtl_mode = DYAD_DTL_FLUX_RPC;
+    } else if (strncmp (dtl_name, dyad_dtl_mode_name[DYAD_DTL_AUTO], dtl_name_len) == 0) {
+        dtl_mode = DYAD_DTL_AUTO;
+    } else if (strncmp (dtl_name, dyad_dtl_mode_name[DYAD_DTL_TCP], dtl_name_len) == 0) {
+        dtl_mode = DYAD_DTL_TCP;
+    } else if (strncmp (dtl_name, dyad_dtl_mode_name[DYAD_DTL_FABRIC], dtl_name_len) == 0) {
+        dtl_mode = DYAD_DTL_FABRIC;
+    } else if (dtl_name_len > strlen (DYAD_DTL_PLUGIN_PREFIX)
+               && strncmp (dtl_name, DYAD_DTL_PLUGIN_PREFIX, strlen (DYAD_DTL_PLUGIN_PREFIX)) == 0) {
+        dtl_mode = DYAD_DTL_PLUGIN;
     } else {
         DYAD_LOG_STDERR ("Invalid env %s = %s.\n", DYAD_DTL_MODE_ENV, dtl_name);
         return DYAD_RC_BADDTLMODE;
@@ -494,9 +784,16 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_set_and_init_dtl_mode (const char* dtl_name,
         goto set_and_init_dtl_mode_region_finish;
     }
 
-    rc = dyad_dtl_init (ctx, dtl_mode, dtl_comm_mode, ctx->debug);
+    if (dtl_mode == DYAD_DTL_PLUGIN) {
+        rc = dyad_dtl_init_plugin (ctx,
+                                   dtl_name + strlen (DYAD_DTL_PLUGIN_PREFIX),
+                                   dtl_comm_mode,
+                                   ctx->debug);
+    } else {
+        rc = dyad_dtl_init (ctx, dtl_mode, dtl_comm_mode, ctx->debug);
+    }
     if (DYAD_IS_ERROR (rc)) {
-        DYAD_LOG_ERROR (ctx, "Cannot initialize the DTL %s\n", dyad_dtl_mode_name[dtl_mode]);
+        DYAD_LOG_ERROR (ctx, "Cannot initialize the DTL %s\n", dtl_name);
     }
 
 set_and_init_dtl_mode_region_finish:;
@@ -756,6 +1053,35 @@ set_cons_path_region_finish:;
     return rc;
 }
 
+DYAD_DLL_EXPORTED dyad_rc_t dyad_set_placement (const char* pattern,
+                                                dyad_placement_cb_t cb,
+                                                void* arg)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+
+    if (!ctx) {
+        return DYAD_RC_NOCTX;
+    }
+    DYAD_C_FUNCTION_START ();
+
+    if (ctx->placement_pattern != NULL) {
+        free (ctx->placement_pattern);
+        ctx->placement_pattern = NULL;
+    }
+    if (pattern != NULL && strlen (pattern) > 0ul) {
+        ctx->placement_pattern = strdup (pattern);
+        if (ctx->placement_pattern == NULL) {
+            DYAD_LOG_ERROR (ctx, "Could not copy the placement pattern!\n");
+            rc = DYAD_RC_SYSFAIL;
+        }
+    }
+    ctx->placement_cb = cb;
+    ctx->placement_arg = arg;
+
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
 DYAD_DLL_EXPORTED dyad_rc_t dyad_clear ()
 {
     DYAD_C_FUNCTION_START ();
@@ -765,6 +1091,10 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_clear ()
         rc = DYAD_RC_OK;
         goto clear_region_finish;
     }
+    // The publisher thread may still need the handle and the managed paths
+    if (ctx->publisher_fini != NULL) {
+        ctx->publisher_fini (ctx);
+    }
     dyad_dtl_finalize (ctx);
     if (ctx->h != NULL) {
         flux_close (ctx->h);
@@ -790,6 +1120,16 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_clear ()
         free (ctx->cons_real_path);
         ctx->cons_real_path = NULL;
     }
+    if (ctx->placement_pattern != NULL) {
+        free (ctx->placement_pattern);
+        ctx->placement_pattern = NULL;
+    }
+    ctx->placement_cb = NULL;
+    ctx->placement_arg = NULL;
+    if (ctx->drain_path != NULL) {
+        free (ctx->drain_path);
+        ctx->drain_path = NULL;
+    }
     rc = DYAD_RC_OK;
 clear_region_finish:;
     DYAD_C_FUNCTION_END ();
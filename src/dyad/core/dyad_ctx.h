@@ -30,7 +30,9 @@ DYAD_DLL_EXPORTED void dyad_ctx_fini ();
  * @param[in]  async_publish  enable asynchronous publish by producer
  * @param[in]  fsync_write    apply fsync after write by producer
  * @param[in]  key_depth      depth of the key hierarchy for the path
- * @param[in]  key_bins       number of bins used in key hashing
+ * @param[in]  key_bins       number of bins used in key hashing. If either
+ *                            is 0, the layout recorded in the namespace by
+ *                            dyad_tune is used, or else the default one
  * @param[in]  service_mux    number of brokers sharing node-local storage
  * @param[in]  kvs_namespace  Flux KVS namespace to be used for this
  *                            instance of DYAD
@@ -97,6 +99,25 @@ DYAD_DLL_EXPORTED dyad_rc_t dyad_set_cons_path (const char* path);
 DYAD_DLL_EXPORTED dyad_rc_t dyad_set_and_init_dtl_mode (const char* dtl_mode_name,
                                                         dyad_dtl_comm_mode_t dtl_comm_mode);
 
+/**
+ * @brief Set the rule that maps a file to its producer without a metadata
+ *        lookup. `cb', if not NULL, is tried first. `pattern' is matched
+ *        against the path relative to the consumer-managed directory:
+ *        `%r' matches the decimal owner rank and `*' any run of characters,
+ *        e.g., "out/%r/sample_*". Passing NULL for both removes the rule.
+ *        The owner's module serves a file found by the rule once the
+ *        producer has committed it. With DYAD_DTL_AUTO, the rule is not
+ *        used, as the DTL is picked by the file size in the metadata.
+ * @param[in] pattern placement pattern, or NULL
+ * @param[in] cb      placement callback, or NULL
+ * @param[in] arg     argument passed to cb
+ *
+ * @return An error code from dyad_rc.h
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_set_placement (const char* pattern,
+                                                dyad_placement_cb_t cb,
+                                                void* arg);
+
 /**
  * Reset the contents of the ctx to the default values and deallocate
  * internal objects linked. However, do not destroy the ctx object itself.
@@ -0,0 +1,663 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_md_api.h>
+#include <dyad/utils/murmur3.h>
+#include <errno.h>
+#include <flux/core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Longest namespace name, including the shard suffix
+#define DYAD_MD_NS_MAX 256
+// Most records packed into one KVS transaction by publish_multi ()
+#define DYAD_MD_TXN_MAX 4096u
+
+static void future_cleanup_cb (flux_future_t *f, void *arg)
+{
+    if (flux_future_get (f, NULL) < 0) {
+        DYAD_LOG_STDERR ("future_cleanup: future error detected with.%s", "");
+    }
+    flux_future_destroy (f);
+}
+
+/*****************************************************************************
+ *                               Flux KVS                                    *
+ *****************************************************************************/
+/**
+ * Namespace holding `key'. With ctx->kvs_shards > 1, keys are spread by hash
+ * over that many namespaces so that commits to different shards are not
+ * serialized behind one another.
+ */
+uint32_t dyad_md_kvs_shard_of (const char* key, uint32_t num_shards)
+{
+    uint32_t hash = 0u;
+    if (num_shards <= 1u) {
+        return 0u;
+    }
+    MurmurHash3_x86_32 (key, (int)strlen (key), 57u, &hash);
+    return hash % num_shards;
+}
+
+static uint32_t dyad_md_kvs_shard (const dyad_ctx_t* restrict ctx, const char* restrict key)
+{
+    return dyad_md_kvs_shard_of (key, ctx->kvs_shards);
+}
+
+static const char* dyad_md_kvs_shard_name (const dyad_ctx_t* restrict ctx,
+                                           uint32_t shard,
+                                           char* restrict buf,
+                                           size_t len)
+{
+    if (ctx->kvs_shards <= 1u || ctx->kvs_namespace == NULL) {
+        return ctx->kvs_namespace;
+    }
+    snprintf (buf, len, DYAD_KVS_SHARD_FMT, ctx->kvs_namespace, shard);
+    return buf;
+}
+
+static const char* dyad_md_kvs_namespace (const dyad_ctx_t* restrict ctx,
+                                          const char* restrict key,
+                                          char* restrict buf,
+                                          size_t len)
+{
+    return dyad_md_kvs_shard_name (ctx, dyad_md_kvs_shard (ctx, key), buf, len);
+}
+
+/* Wait for the commits or RPCs in `futs', or leave them to the reactor with
+ * ctx->async_publish, and destroy them */
+static dyad_rc_t dyad_md_wait_all (const dyad_ctx_t* restrict ctx,
+                                   flux_future_t** restrict futs,
+                                   size_t num_futs)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    for (size_t i = 0ul; i < num_futs; i++) {
+        if (ctx->async_publish && flux_future_then (futs[i], -1, future_cleanup_cb, NULL) == 0) {
+            continue;
+        }
+        if (flux_future_get (futs[i], NULL) < 0) {
+            DYAD_LOG_ERROR (ctx, "A batched publish failed");
+            rc = DYAD_RC_BADCOMMIT;
+        }
+        flux_future_destroy (futs[i]);
+    }
+    return rc;
+}
+
+static dyad_rc_t dyad_kvs_commit (const dyad_ctx_t* restrict ctx,
+                                  const char* restrict ns,
+                                  flux_kvs_txn_t* restrict txn)
+{
+    DYAD_C_FUNCTION_START();
+    flux_future_t* f = NULL;
+    dyad_rc_t rc = DYAD_RC_OK;
+    DYAD_LOG_INFO (ctx, "Committing transaction to KVS namespace %s", ns);
+    // Commit the transaction to the Flux KVS
+    f = flux_kvs_commit ((flux_t*) ctx->h, ns, 0, txn);
+    // If the commit failed, log an error and return DYAD_BADCOMMIT
+    if (f == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not commit transaction to Flux KVS");
+        rc = DYAD_RC_BADCOMMIT;
+        goto kvs_commit_region_finish;
+    }
+    if (ctx->async_publish) {
+        if (flux_future_then (f, -1, future_cleanup_cb, NULL) < 0) {
+            DYAD_LOG_ERROR (ctx, "Error with flux_future_then");
+        }
+    } else {
+        // If the commit is pending, wait for it to complete
+        flux_future_wait_for (f, -1.0);
+        // Once the commit is complete, destroy the future and transaction
+        flux_future_destroy (f);
+        f = NULL;
+    }
+    rc = DYAD_RC_OK;
+kvs_commit_region_finish:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+static dyad_rc_t dyad_md_kvs_publish (const dyad_ctx_t* ctx,
+                                      const char* key,
+                                      const char* upath,
+                                      json_t* record)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    flux_kvs_txn_t* txn = NULL;
+    char ns[DYAD_MD_NS_MAX] = {'\0'};
+    // Crete and pack a Flux KVS transaction.
+    // The transaction will contain a single key-value pair
+    // with the previously generated key as the key and the
+    // file's record (producer's rank, size, inline data) as the value
+    DYAD_LOG_INFO (ctx, "Creating KVS transaction under the key %s", key);
+    txn = flux_kvs_txn_create ();
+    if (txn == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not create Flux KVS transaction");
+        rc = DYAD_RC_FLUXFAIL;
+        goto kvs_publish_done;
+    }
+    if (flux_kvs_txn_pack (txn, 0, key, "O", record) < 0) {
+        DYAD_LOG_ERROR (ctx, "Could not pack Flux KVS transaction");
+        rc = DYAD_RC_FLUXFAIL;
+        goto kvs_publish_done;
+    }
+    // Call dyad_kvs_commit to commit the transaction into the Flux KVS
+    rc = dyad_kvs_commit (ctx, dyad_md_kvs_namespace (ctx, key, ns, sizeof (ns)), txn);
+    // If dyad_kvs_commit failed, log an error and forward the return code
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "dyad_kvs_commit failed!");
+    }
+kvs_publish_done:;
+    if (txn != NULL) {
+        flux_kvs_txn_destroy (txn);
+    }
+    return rc;
+}
+
+/* Seconds on the monotonic clock */
+static double dyad_md_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/* Version of a record, 0 for unversioned ones */
+static uint64_t dyad_md_record_version (json_t* record)
+{
+    json_t* v = json_is_object (record) ? json_object_get (record, "version") : NULL;
+    return json_is_integer (v) ? (uint64_t)json_integer_value (v) : 0ul;
+}
+
+static dyad_rc_t dyad_md_kvs_lookup (const dyad_ctx_t* ctx,
+                                     const char* key,
+                                     const char* upath,
+                                     bool should_wait,
+                                     uint64_t min_version,
+                                     json_t** record)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    flux_future_t* f = NULL;
+    json_t* o = NULL;
+    char ns[DYAD_MD_NS_MAX] = {'\0'};
+    // Waiting for a version watches the key, which yields every value it
+    // takes, instead of returning the first one
+    const bool watch = should_wait && min_version > 0ul;
+    const double deadline = dyad_md_now () + DYAD_MD_VERSION_WAIT_TIMEOUT;
+    double left = 0.0;
+    int flags = should_wait ? FLUX_KVS_WAITCREATE : 0;
+    if (watch) {
+        flags |= FLUX_KVS_WATCH;
+    }
+    // Lookup information about the desired file (represented by key)
+    // from the Flux KVS. If there is no information, wait for it to be
+    // made available
+    DYAD_LOG_INFO (ctx, "Retrieving information from KVS under the key %s", key);
+    f = flux_kvs_lookup ((flux_t*) ctx->h,
+                         dyad_md_kvs_namespace (ctx, key, ns, sizeof (ns)),
+                         flags,
+                         key);
+    // If the KVS lookup failed, log an error and return DYAD_BADLOOKUP
+    if (f == NULL) {
+        DYAD_LOG_ERROR (ctx, "KVS lookup failed!\n");
+        rc = DYAD_RC_NOTFOUND;
+        goto kvs_lookup_done;
+    }
+    while (true) {
+        // Unlike the record itself, a version may never come
+        left = deadline - dyad_md_now ();
+        // A negative timeout would wait forever
+        if (watch && flux_future_wait_for (f, (left > 0.0) ? left : 0.0) < 0) {
+            DYAD_LOG_ERROR (ctx,
+                            "Timed out waiting for version %lu of %s",
+                            (unsigned long)min_version,
+                            upath);
+            rc = DYAD_RC_NOTFOUND;
+            goto kvs_lookup_done;
+        }
+        if (flux_kvs_lookup_get_unpack (f, "o", &o) < 0) {
+            if (errno == ENOENT) {
+                DYAD_LOG_INFO (ctx, "No KVS entry under the key %s", key);
+                rc = DYAD_RC_NOTFOUND;
+            } else {
+                DYAD_LOG_ERROR (ctx, "Could not unpack the record of %s from KVS response", upath);
+                rc = DYAD_RC_BADMETADATA;
+            }
+            goto kvs_lookup_done;
+        }
+        if (!watch || dyad_md_record_version (o) >= min_version) {
+            break;
+        }
+        DYAD_LOG_DEBUG (ctx, "Waiting for version %lu of %s", (unsigned long)min_version, upath);
+        flux_future_reset (f);
+    }
+    // The record belongs to the future, which is destroyed below
+    *record = json_incref (o);
+kvs_lookup_done:;
+    if (f != NULL) {
+        if (watch) {
+            flux_kvs_lookup_cancel (f);
+        }
+        flux_future_destroy (f);
+    }
+    return rc;
+}
+
+/* Start the commit of `*txn' to `shard', and add its future to `futs' */
+static dyad_rc_t dyad_md_kvs_flush (const dyad_ctx_t* ctx,
+                                    uint32_t shard,
+                                    flux_kvs_txn_t** txn,
+                                    flux_future_t** futs,
+                                    size_t* num_futs)
+{
+    char ns[DYAD_MD_NS_MAX] = {'\0'};
+    flux_future_t* f = flux_kvs_commit ((flux_t*) ctx->h,
+                                        dyad_md_kvs_shard_name (ctx, shard, ns, sizeof (ns)),
+                                        0,
+                                        *txn);
+    flux_kvs_txn_destroy (*txn);
+    *txn = NULL;
+    if (f == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not commit transaction to Flux KVS");
+        return DYAD_RC_BADCOMMIT;
+    }
+    futs[(*num_futs)++] = f;
+    return DYAD_RC_OK;
+}
+
+/* Pack the records of each namespace shard into transactions of up to
+ * DYAD_MD_TXN_MAX keys. The transactions are committed concurrently. */
+static dyad_rc_t dyad_md_kvs_publish_multi (const dyad_ctx_t* ctx,
+                                            const char* const* keys,
+                                            const char* const* upaths,
+                                            json_t* const* records,
+                                            size_t n)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    flux_kvs_txn_t* txn = NULL;
+    const uint32_t num_shards = (ctx->kvs_shards <= 1u) ? 1u : ctx->kvs_shards;
+    flux_future_t** futs = NULL;
+    size_t num_futs = 0ul;
+    size_t num_keys = 0ul;
+
+    futs = (flux_future_t**)calloc (n / DYAD_MD_TXN_MAX + num_shards, sizeof (flux_future_t*));
+    if (futs == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory to publish %zu records", n);
+        return DYAD_RC_SYSFAIL;
+    }
+    for (uint32_t shard = 0u; shard < num_shards && !DYAD_IS_ERROR (rc); shard++) {
+        num_keys = 0ul;
+        for (size_t i = 0ul; i < n; i++) {
+            if (dyad_md_kvs_shard (ctx, keys[i]) != shard) {
+                continue;
+            }
+            if (txn == NULL && (txn = flux_kvs_txn_create ()) == NULL) {
+                DYAD_LOG_ERROR (ctx, "Could not create Flux KVS transaction");
+                rc = DYAD_RC_FLUXFAIL;
+                break;
+            }
+            if (flux_kvs_txn_pack (txn, 0, keys[i], "O", records[i]) < 0) {
+                DYAD_LOG_ERROR (ctx, "Could not pack the record of %s", upaths[i]);
+                rc = DYAD_RC_FLUXFAIL;
+                break;
+            }
+            if (++num_keys % DYAD_MD_TXN_MAX == 0ul) {
+                if (DYAD_IS_ERROR (rc = dyad_md_kvs_flush (ctx, shard, &txn, futs, &num_futs))) {
+                    break;
+                }
+            }
+        }
+        if (txn != NULL && !DYAD_IS_ERROR (rc)) {
+            rc = dyad_md_kvs_flush (ctx, shard, &txn, futs, &num_futs);
+        }
+        if (num_keys > 0ul) {
+            DYAD_LOG_INFO (ctx, "Publishing %zu records to shard %u", num_keys, shard);
+        }
+    }
+    if (txn != NULL) {
+        flux_kvs_txn_destroy (txn);
+    }
+    if (DYAD_IS_ERROR (dyad_md_wait_all (ctx, futs, num_futs)) && !DYAD_IS_ERROR (rc)) {
+        rc = DYAD_RC_BADCOMMIT;
+    }
+    free (futs);
+    return rc;
+}
+
+/* Unlink the keys of each namespace shard in a single transaction */
+static dyad_rc_t dyad_md_kvs_unpublish (const dyad_ctx_t* ctx,
+                                        const char* const* keys,
+                                        const char* const* upaths,
+                                        size_t n)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    flux_kvs_txn_t* txn = NULL;
+    char ns[DYAD_MD_NS_MAX] = {'\0'};
+    const uint32_t num_shards = (ctx->kvs_shards <= 1u) ? 1u : ctx->kvs_shards;
+    size_t num_keys = 0ul;
+
+    for (uint32_t shard = 0u; shard < num_shards && !DYAD_IS_ERROR (rc); shard++) {
+        num_keys = 0ul;
+        for (size_t i = 0ul; i < n; i++) {
+            if (dyad_md_kvs_shard (ctx, keys[i]) != shard) {
+                continue;
+            }
+            if (txn == NULL && (txn = flux_kvs_txn_create ()) == NULL) {
+                DYAD_LOG_ERROR (ctx, "Could not create Flux KVS transaction");
+                return DYAD_RC_FLUXFAIL;
+            }
+            if (flux_kvs_txn_unlink (txn, 0, keys[i]) < 0) {
+                DYAD_LOG_ERROR (ctx, "Could not unlink the record of %s", upaths[i]);
+                rc = DYAD_RC_FLUXFAIL;
+                break;
+            }
+            num_keys++;
+        }
+        if (num_keys > 0ul && !DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_INFO (ctx, "Unpublishing %zu records", num_keys);
+            rc = dyad_kvs_commit (ctx, dyad_md_kvs_shard_name (ctx, shard, ns, sizeof (ns)), txn);
+        }
+        if (txn != NULL) {
+            flux_kvs_txn_destroy (txn);
+            txn = NULL;
+        }
+    }
+    return rc;
+}
+
+/*****************************************************************************
+ *                       Distributed hash table                              *
+ *   Every DYAD module holds a shard of the records. A key lives on the      *
+ *   broker that dyad_md_home_rank () picks from the hash of its path.       *
+ *****************************************************************************/
+uint32_t dyad_md_home_rank (const char* upath, uint32_t size)
+{
+    uint32_t hash = 0u;
+    if (size <= 1u) {
+        return 0u;
+    }
+    MurmurHash3_x86_32 (upath, (int)strlen (upath), 57u, &hash);
+    return hash % size;
+}
+
+static dyad_rc_t dyad_md_dht_home (const dyad_ctx_t* ctx, const char* upath, uint32_t* home)
+{
+    uint32_t size = 0u;
+    if (flux_get_size ((flux_t*) ctx->h, &size) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot get the size of the Flux instance");
+        return DYAD_RC_FLUXFAIL;
+    }
+    *home = dyad_md_home_rank (upath, size);
+    return DYAD_RC_OK;
+}
+
+static dyad_rc_t dyad_md_dht_publish (const dyad_ctx_t* ctx,
+                                      const char* key,
+                                      const char* upath,
+                                      json_t* record)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    flux_future_t* f = NULL;
+    uint32_t home = 0u;
+
+    rc = dyad_md_dht_home (ctx, upath, &home);
+    if (DYAD_IS_ERROR (rc)) {
+        return rc;
+    }
+    DYAD_LOG_INFO (ctx, "Publishing the record of %s to the shard on rank %u", upath, home);
+    f = flux_rpc_pack ((flux_t*) ctx->h,
+                       DYAD_MD_RPC_PUBLISH,
+                       home,
+                       0,
+                       "{s:s, s:s, s:O}",
+                       "ns",
+                       (ctx->kvs_namespace == NULL) ? "" : ctx->kvs_namespace,
+                       "key",
+                       key,
+                       "record",
+                       record);
+    if (f == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot send %s RPC to rank %u", DYAD_MD_RPC_PUBLISH, home);
+        return DYAD_RC_BADRPC;
+    }
+    if (ctx->async_publish) {
+        if (flux_future_then (f, -1, future_cleanup_cb, NULL) < 0) {
+            DYAD_LOG_ERROR (ctx, "Error with flux_future_then");
+            flux_future_destroy (f);
+            return DYAD_RC_FLUXFAIL;
+        }
+        return DYAD_RC_OK;
+    }
+    if (flux_future_get (f, NULL) < 0) {
+        DYAD_LOG_ERROR (ctx, "%s RPC to rank %u failed", DYAD_MD_RPC_PUBLISH, home);
+        rc = DYAD_RC_BADCOMMIT;
+    }
+    flux_future_destroy (f);
+    return rc;
+}
+
+static dyad_rc_t dyad_md_dht_lookup (const dyad_ctx_t* ctx,
+                                     const char* key,
+                                     const char* upath,
+                                     bool should_wait,
+                                     uint64_t min_version,
+                                     json_t** record)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    flux_future_t* f = NULL;
+    json_t* o = NULL;
+    uint32_t home = 0u;
+
+    rc = dyad_md_dht_home (ctx, upath, &home);
+    if (DYAD_IS_ERROR (rc)) {
+        return rc;
+    }
+    DYAD_LOG_INFO (ctx, "Looking up the record of %s on rank %u", upath, home);
+    f = flux_rpc_pack ((flux_t*) ctx->h,
+                       DYAD_MD_RPC_LOOKUP,
+                       home,
+                       0,
+                       "{s:s, s:s, s:b, s:I}",
+                       "ns",
+                       (ctx->kvs_namespace == NULL) ? "" : ctx->kvs_namespace,
+                       "key",
+                       key,
+                       "wait",
+                       should_wait,
+                       "version",
+                       (json_int_t)min_version);
+    if (f == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot send %s RPC to rank %u", DYAD_MD_RPC_LOOKUP, home);
+        return DYAD_RC_BADRPC;
+    }
+    if (flux_rpc_get_unpack (f, "{s:o}", "record", &o) < 0) {
+        if (errno == ENOENT) {
+            DYAD_LOG_INFO (ctx, "No record of %s on rank %u", upath, home);
+            rc = DYAD_RC_NOTFOUND;
+        } else {
+            DYAD_LOG_ERROR (ctx, "%s RPC to rank %u failed", DYAD_MD_RPC_LOOKUP, home);
+            rc = DYAD_RC_BADRPC;
+        }
+        goto dht_lookup_done;
+    }
+    *record = json_incref (o);
+dht_lookup_done:;
+    flux_future_destroy (f);
+    return rc;
+}
+
+/* Send one request per home broker with all the records it holds. The
+ * requests are in flight together. */
+static dyad_rc_t dyad_md_dht_publish_multi (const dyad_ctx_t* ctx,
+                                            const char* const* keys,
+                                            const char* const* upaths,
+                                            json_t* const* records,
+                                            size_t n)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    uint32_t size = 0u;
+    uint32_t* homes = NULL;
+    bool* sent = NULL;
+    json_t* batch_keys = NULL;
+    json_t* batch_records = NULL;
+    flux_future_t** futs = NULL;
+    size_t num_futs = 0ul;
+
+    if (n == 0ul) {
+        return DYAD_RC_OK;
+    }
+    if (flux_get_size ((flux_t*) ctx->h, &size) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot get the size of the Flux instance");
+        return DYAD_RC_FLUXFAIL;
+    }
+    homes = (uint32_t*)malloc (n * sizeof (uint32_t));
+    sent = (bool*)calloc (n, sizeof (bool));
+    futs = (flux_future_t**)calloc ((n < size) ? n : size, sizeof (flux_future_t*));
+    if (homes == NULL || sent == NULL || futs == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory to publish %zu records", n);
+        rc = DYAD_RC_SYSFAIL;
+        goto dht_publish_multi_done;
+    }
+    for (size_t i = 0ul; i < n; i++) {
+        homes[i] = dyad_md_home_rank (upaths[i], size);
+    }
+    for (size_t i = 0ul; i < n && !DYAD_IS_ERROR (rc); i++) {
+        if (sent[i]) {
+            continue;
+        }
+        batch_keys = json_array ();
+        batch_records = json_array ();
+        if (batch_keys == NULL || batch_records == NULL) {
+            json_decref (batch_keys);
+            json_decref (batch_records);
+            rc = DYAD_RC_BADPACK;
+            break;
+        }
+        for (size_t j = i; j < n; j++) {
+            if (!sent[j] && homes[j] == homes[i]) {
+                json_array_append_new (batch_keys, json_string (keys[j]));
+                json_array_append (batch_records, records[j]);
+                sent[j] = true;
+            }
+        }
+        futs[num_futs] = flux_rpc_pack ((flux_t*) ctx->h,
+                                        DYAD_MD_RPC_PUBLISH,
+                                        homes[i],
+                                        0,
+                                        "{s:s, s:o, s:o}",
+                                        "ns",
+                                        (ctx->kvs_namespace == NULL) ? "" : ctx->kvs_namespace,
+                                        "keys",
+                                        batch_keys,
+                                        "records",
+                                        batch_records);
+        if (futs[num_futs] == NULL) {
+            DYAD_LOG_ERROR (ctx, "Cannot send %s RPC to rank %u", DYAD_MD_RPC_PUBLISH, homes[i]);
+            rc = DYAD_RC_BADRPC;
+            break;
+        }
+        num_futs++;
+    }
+    if (DYAD_IS_ERROR (dyad_md_wait_all (ctx, futs, num_futs)) && !DYAD_IS_ERROR (rc)) {
+        rc = DYAD_RC_BADCOMMIT;
+    }
+dht_publish_multi_done:;
+    free (homes);
+    free (sent);
+    free (futs);
+    return rc;
+}
+
+/* Send one request per home broker with all the keys it holds */
+static dyad_rc_t dyad_md_dht_unpublish (const dyad_ctx_t* ctx,
+                                        const char* const* keys,
+                                        const char* const* upaths,
+                                        size_t n)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    uint32_t size = 0u;
+    uint32_t* homes = NULL;
+    bool* sent = NULL;
+    json_t* batch = NULL;
+    flux_future_t* f = NULL;
+
+    if (n == 0ul) {
+        return DYAD_RC_OK;
+    }
+    if (flux_get_size ((flux_t*) ctx->h, &size) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot get the size of the Flux instance");
+        return DYAD_RC_FLUXFAIL;
+    }
+    homes = (uint32_t*)malloc (n * sizeof (uint32_t));
+    sent = (bool*)calloc (n, sizeof (bool));
+    if (homes == NULL || sent == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate memory to unpublish %zu records", n);
+        rc = DYAD_RC_SYSFAIL;
+        goto dht_unpublish_done;
+    }
+    for (size_t i = 0ul; i < n; i++) {
+        homes[i] = dyad_md_home_rank (upaths[i], size);
+    }
+    for (size_t i = 0ul; i < n && !DYAD_IS_ERROR (rc); i++) {
+        if (sent[i]) {
+            continue;
+        }
+        if ((batch = json_array ()) == NULL) {
+            rc = DYAD_RC_BADPACK;
+            break;
+        }
+        for (size_t j = i; j < n; j++) {
+            if (!sent[j] && homes[j] == homes[i]) {
+                json_array_append_new (batch, json_string (keys[j]));
+                sent[j] = true;
+            }
+        }
+        f = flux_rpc_pack ((flux_t*) ctx->h,
+                           DYAD_MD_RPC_UNPUBLISH,
+                           homes[i],
+                           0,
+                           "{s:s, s:o}",
+                           "ns",
+                           (ctx->kvs_namespace == NULL) ? "" : ctx->kvs_namespace,
+                           "keys",
+                           batch);
+        if (f == NULL || flux_future_get (f, NULL) < 0) {
+            DYAD_LOG_ERROR (ctx, "%s RPC to rank %u failed", DYAD_MD_RPC_UNPUBLISH, homes[i]);
+            rc = DYAD_RC_BADRPC;
+        }
+        flux_future_destroy (f);
+        f = NULL;
+    }
+dht_unpublish_done:;
+    free (homes);
+    free (sent);
+    return rc;
+}
+
+static const dyad_md_backend_t dyad_md_backends[DYAD_MD_END] = {
+    {DYAD_MD_KVS,
+     dyad_md_kvs_publish,
+     dyad_md_kvs_lookup,
+     dyad_md_kvs_publish_multi,
+     dyad_md_kvs_unpublish},
+    {DYAD_MD_DHT,
+     dyad_md_dht_publish,
+     dyad_md_dht_lookup,
+     dyad_md_dht_publish_multi,
+     dyad_md_dht_unpublish},
+};
+
+const dyad_md_backend_t* dyad_md_backend_get (const dyad_ctx_t* ctx)
+{
+    if (ctx == NULL || ctx->md_mode >= DYAD_MD_END) {
+        return &dyad_md_backends[DYAD_MD_DEFAULT];
+    }
+    return &dyad_md_backends[ctx->md_mode];
+}
@@ -0,0 +1,70 @@
+#ifndef DYAD_CORE_DYAD_MD_API_H
+#define DYAD_CORE_DYAD_MD_API_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_md.h>
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+#include <jansson.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A place where producers publish, and consumers look up, the record of a
+ * file (see dyad_pack_record). `key' is the path key made by gen_path_key ()
+ * and `upath' the path of the file relative to the managed directory.
+ *
+ * publish () does not steal the reference to `record'.
+ * lookup () returns a new reference in `*record' on success, and returns
+ * DYAD_RC_NOTFOUND if the key is absent and `should_wait' is false. With
+ * `should_wait' and a non-zero `min_version', it waits until the record
+ * carries that version or a later one.
+ * publish_multi () stores `n' records at once, in as few round trips as the
+ * backend allows.
+ * unpublish () removes `n' keys at once. Absent keys are not an error.
+ */
+struct dyad_md_backend {
+    dyad_md_mode_t mode;
+    dyad_rc_t (*publish) (const dyad_ctx_t* ctx,
+                          const char* key,
+                          const char* upath,
+                          json_t* record);
+    dyad_rc_t (*lookup) (const dyad_ctx_t* ctx,
+                         const char* key,
+                         const char* upath,
+                         bool should_wait,
+                         uint64_t min_version,
+                         json_t** record);
+    dyad_rc_t (*publish_multi) (const dyad_ctx_t* ctx,
+                                const char* const* keys,
+                                const char* const* upaths,
+                                json_t* const* records,
+                                size_t n);
+    dyad_rc_t (*unpublish) (const dyad_ctx_t* ctx,
+                            const char* const* keys,
+                            const char* const* upaths,
+                            size_t n);
+};
+typedef struct dyad_md_backend dyad_md_backend_t;
+
+// Returns the backend selected by ctx->md_mode
+const dyad_md_backend_t* dyad_md_backend_get (const dyad_ctx_t* ctx);
+
+// Broker rank owning `upath' in DYAD_MD_DHT mode
+uint32_t dyad_md_home_rank (const char* upath, uint32_t size);
+
+// Namespace shard, out of `num_shards', holding the KVS key `key'
+uint32_t dyad_md_kvs_shard_of (const char* key, uint32_t num_shards);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_CORE_DYAD_MD_API_H */
@@ -0,0 +1,399 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  // _GNU_SOURCE
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_core.h>
+#include <dyad/core/dyad_publish.h>
+#include <dyad/utils/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <flux/core.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct publish_item {
+    struct publish_item *_Atomic next;
+    char *path;
+    bool waited;        // the closer waits for the item, and frees it
+    atomic_bool done;
+    dyad_rc_t rc;
+};
+
+/* The queue is the intrusive MPSC queue of D. Vyukov: any thread pushes with
+ * a single exchange on `head', and only the publisher thread pops at `tail'.
+ * `stub' keeps the queue from ever being empty. */
+struct dyad_publisher {
+    dyad_ctx_t ctx;  // copy of the caller's context with the thread's own handle
+    pthread_t thread;
+    sem_t wake;  // posted once per queued file, and to stop
+    struct publish_item *_Atomic head;
+    struct publish_item *tail;
+    struct publish_item stub;
+    atomic_bool stop;
+    atomic_uint_fast64_t enqueued;
+    atomic_uint_fast64_t published;
+    atomic_uint_fast64_t failed;
+    pthread_mutex_t lock;  // only taken by flushes and to wake them
+    pthread_cond_t done;
+};
+
+static void publish_push (dyad_publisher_t *p, struct publish_item *item)
+{
+    struct publish_item *prev = NULL;
+
+    atomic_store_explicit (&item->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit (&p->head, item, memory_order_acq_rel);
+    atomic_store_explicit (&prev->next, item, memory_order_release);
+}
+
+/* Returns NULL when the queue is empty, or when a push is half way through.
+ * The pusher posts `wake' after it completes, so the item is not missed. */
+static struct publish_item *publish_pop (dyad_publisher_t *p)
+{
+    struct publish_item *tail = p->tail;
+    struct publish_item *next = atomic_load_explicit (&tail->next, memory_order_acquire);
+
+    if (tail == &p->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        p->tail = tail = next;
+        next = atomic_load_explicit (&next->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        p->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit (&p->head, memory_order_acquire)) {
+        return NULL;
+    }
+    publish_push (p, &p->stub);
+    next = atomic_load_explicit (&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        p->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+bool dyad_group_sync (const dyad_ctx_t *ctx)
+{
+    return ctx != NULL && ctx->fsync_write && ctx->fsync_group > 0.0;
+}
+
+#if DYAD_SYNC_DIR
+static bool same_dir (const char *a, const char *b)
+{
+    const char *sa = strrchr (a, '/');
+    const char *sb = strrchr (b, '/');
+    const size_t la = (sa == NULL) ? 0ul : (size_t)(sa - a);
+    const size_t lb = (sb == NULL) ? 0ul : (size_t)(sb - b);
+    return la == lb && strncmp (a, b, la) == 0;
+}
+#endif  // DYAD_SYNC_DIR
+
+/* Make a group of closed files durable before any of them is published.
+ * One syncfs () flushes a large group, file data and directory entries
+ * alike. A small one is cheaper to flush file by file. */
+static void publish_sync (dyad_publisher_t *p, char *const *paths, size_t n)
+{
+    int fd = -1;
+
+    if (n >= DYAD_FSYNC_GROUP_SYNCFS) {
+        if ((fd = dyad_open_raw (p->ctx.prod_managed_path, O_RDONLY | O_DIRECTORY, 0)) < 0
+            || syncfs (fd) < 0) {
+            DYAD_LOG_ERROR (&p->ctx, "DYAD_PUBLISH: cannot sync the file system of %s: %s",
+                            p->ctx.prod_managed_path, strerror (errno));
+        }
+        if (fd >= 0) {
+            close (fd);
+        }
+        return;
+    }
+    for (size_t i = 0ul; i < n; i++) {
+        if ((fd = dyad_open_raw (paths[i], O_RDONLY, 0)) < 0 || fdatasync (fd) < 0) {
+            DYAD_LOG_ERROR (&p->ctx, "DYAD_PUBLISH: cannot flush %s: %s",
+                            paths[i], strerror (errno));
+        }
+        if (fd >= 0) {
+            close (fd);
+        }
+#if DYAD_SYNC_DIR
+        // Files of a group tend to share a directory, which needs one flush
+        if (i + 1ul == n || !same_dir (paths[i], paths[i + 1ul])) {
+            dyad_sync_directory (&p->ctx, paths[i]);
+        }
+#endif  // DYAD_SYNC_DIR
+    }
+}
+
+static size_t publish_drain (dyad_publisher_t *p)
+{
+    char *paths[DYAD_PUBLISH_BATCH];
+    struct publish_item *items[DYAD_PUBLISH_BATCH];
+    dyad_rc_t rc = DYAD_RC_OK;
+    size_t total = 0ul;
+    size_t n = 0ul;
+
+    do {
+        for (n = 0ul; n < DYAD_PUBLISH_BATCH && (items[n] = publish_pop (p)) != NULL; n++) {
+            paths[n] = items[n]->path;
+        }
+        if (n == 0ul) {
+            break;
+        }
+        if (dyad_group_sync (&p->ctx)) {
+            publish_sync (p, paths, n);
+        }
+        rc = dyad_produce_multi (&p->ctx, (const char *const *)paths, n);
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (&p->ctx, "DYAD_PUBLISH: cannot publish %zu closed files", n);
+            atomic_fetch_add (&p->failed, n);
+        }
+        for (size_t i = 0ul; i < n; i++) {
+            if (items[i]->waited) {
+                items[i]->rc = rc;
+                atomic_store (&items[i]->done, true);
+            } else {
+                free (items[i]->path);
+                free (items[i]);
+            }
+        }
+        atomic_fetch_add (&p->published, n);
+        pthread_mutex_lock (&p->lock);
+        pthread_cond_broadcast (&p->done);
+        pthread_mutex_unlock (&p->lock);
+        total += n;
+    } while (n == DYAD_PUBLISH_BATCH);
+    return total;
+}
+
+static void publish_ctx_free (dyad_ctx_t *c)
+{
+    free (c->prod_real_path);
+    free (c->cons_real_path);
+    free (c->kvs_namespace);
+    free (c->prod_managed_path);
+    free (c->cons_managed_path);
+    free (c->placement_pattern);
+    free (c->drain_path);
+}
+
+static int publish_strdup (char **dst, const char *src)
+{
+    *dst = NULL;
+    return (src != NULL && (*dst = strdup (src)) == NULL) ? -1 : 0;
+}
+
+/* The thread keeps its own copy of the strings of the context, which the
+ * caller may change or free while the thread runs. It does not use the DTL
+ * nor the publisher of the caller. */
+static int publish_ctx_copy (dyad_ctx_t *dst, const dyad_ctx_t *src)
+{
+    *dst = *src;
+    dst->dtl_handle = NULL;
+    dst->fname = NULL;
+    dst->publisher = NULL;
+    dst->publisher_fini = NULL;
+    // Nothing runs the reactor of the thread's handle, so the thread waits
+    // for its commits itself instead of leaving them to continuations
+    dst->async_publish = false;
+    if (publish_strdup (&dst->prod_real_path, src->prod_real_path) < 0
+        || publish_strdup (&dst->cons_real_path, src->cons_real_path) < 0
+        || publish_strdup (&dst->kvs_namespace, src->kvs_namespace) < 0
+        || publish_strdup (&dst->prod_managed_path, src->prod_managed_path) < 0
+        || publish_strdup (&dst->cons_managed_path, src->cons_managed_path) < 0
+        || publish_strdup (&dst->placement_pattern, src->placement_pattern) < 0
+        || publish_strdup (&dst->drain_path, src->drain_path) < 0) {
+        publish_ctx_free (dst);
+        return -1;
+    }
+    return 0;
+}
+
+static void *publish_main (void *arg)
+{
+    dyad_publisher_t *p = (dyad_publisher_t *)arg;
+    const struct timespec window = {
+        (time_t)p->ctx.fsync_group,
+        (long)((p->ctx.fsync_group - (double)(time_t)p->ctx.fsync_group) * 1e9)};
+
+    for (;;) {
+        while (sem_wait (&p->wake) < 0 && errno == EINTR)
+            ;
+        // Let the closes of the window join the group of the first one
+        if (dyad_group_sync (&p->ctx) && !atomic_load (&p->stop)) {
+            nanosleep (&window, NULL);
+        }
+        // Take whatever else was queued meanwhile, to publish in one batch
+        while (sem_trywait (&p->wake) == 0)
+            ;
+        publish_drain (p);
+        if (atomic_load (&p->stop)
+            && atomic_load (&p->published) == atomic_load (&p->enqueued)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void publish_fini (dyad_ctx_t *ctx)
+{
+    dyad_publish_stop (ctx);
+}
+
+dyad_rc_t dyad_publish_start (dyad_ctx_t *ctx)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_publisher_t *p = NULL;
+
+    if (ctx == NULL || ctx->h == NULL) {
+        rc = DYAD_RC_NOCTX;
+        goto publish_start_done;
+    }
+    if (ctx->publisher != NULL) {
+        goto publish_start_done;
+    }
+    if ((p = (dyad_publisher_t *)calloc (1ul, sizeof (dyad_publisher_t))) == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto publish_start_done;
+    }
+    if (publish_ctx_copy (&p->ctx, ctx) < 0) {
+        DYAD_LOG_ERROR (ctx, "DYAD_PUBLISH: cannot copy the context for the publisher");
+        free (p);
+        rc = DYAD_RC_SYSFAIL;
+        goto publish_start_done;
+    }
+    if ((p->ctx.h = flux_open (NULL, 0)) == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_PUBLISH: cannot open a Flux handle for the publisher");
+        publish_ctx_free (&p->ctx);
+        free (p);
+        rc = DYAD_RC_FLUXFAIL;
+        goto publish_start_done;
+    }
+    p->tail = &p->stub;
+    atomic_init (&p->stub.next, NULL);
+    atomic_init (&p->head, &p->stub);
+    atomic_init (&p->stop, false);
+    atomic_init (&p->enqueued, 0u);
+    atomic_init (&p->published, 0u);
+    atomic_init (&p->failed, 0u);
+    sem_init (&p->wake, 0, 0u);
+    pthread_mutex_init (&p->lock, NULL);
+    pthread_cond_init (&p->done, NULL);
+    if (pthread_create (&p->thread, NULL, publish_main, p) != 0) {
+        DYAD_LOG_ERROR (ctx, "DYAD_PUBLISH: cannot start the publisher thread");
+        pthread_cond_destroy (&p->done);
+        pthread_mutex_destroy (&p->lock);
+        sem_destroy (&p->wake);
+        flux_close (p->ctx.h);
+        publish_ctx_free (&p->ctx);
+        free (p);
+        rc = DYAD_RC_SYSFAIL;
+        goto publish_start_done;
+    }
+    ctx->publisher = p;
+    ctx->publisher_fini = publish_fini;
+    DYAD_LOG_INFO (ctx, "DYAD_PUBLISH: publishing closed files from a background thread");
+
+publish_start_done:;
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
+dyad_rc_t dyad_publish_enqueue (dyad_ctx_t *ctx, const char *fname)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    struct publish_item *item = NULL;
+    dyad_publisher_t *p = (ctx != NULL) ? ctx->publisher : NULL;
+
+    if (p == NULL || atomic_load (&p->stop)) {
+        return dyad_produce (ctx, fname);
+    }
+    if ((item = (struct publish_item *)calloc (1ul, sizeof (struct publish_item))) == NULL
+        || (item->path = strdup (fname)) == NULL) {
+        free (item);
+        return dyad_produce (ctx, fname);
+    }
+    item->waited = !ctx->publish_thread;
+    atomic_init (&item->done, false);
+    atomic_fetch_add (&p->enqueued, 1u);
+    publish_push (p, item);
+    sem_post (&p->wake);
+    if (!item->waited) {
+        return DYAD_RC_OK;
+    }
+    pthread_mutex_lock (&p->lock);
+    while (!atomic_load (&item->done)) {
+        pthread_cond_wait (&p->done, &p->lock);
+    }
+    pthread_mutex_unlock (&p->lock);
+    rc = item->rc;
+    free (item->path);
+    free (item);
+    return rc;
+}
+
+dyad_rc_t dyad_publish_flush (dyad_ctx_t *ctx)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_publisher_t *p = (ctx != NULL) ? ctx->publisher : NULL;
+    uint_fast64_t target = 0u;
+
+    if (p == NULL) {
+        goto publish_flush_done;
+    }
+    target = atomic_load (&p->enqueued);
+    pthread_mutex_lock (&p->lock);
+    while (atomic_load (&p->published) < target) {
+        pthread_cond_wait (&p->done, &p->lock);
+    }
+    pthread_mutex_unlock (&p->lock);
+    if (atomic_exchange (&p->failed, 0u) > 0u) {
+        rc = DYAD_RC_BADCOMMIT;
+    }
+
+publish_flush_done:;
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
+void dyad_publish_stop (dyad_ctx_t *ctx)
+{
+    dyad_publisher_t *p = (ctx != NULL) ? ctx->publisher : NULL;
+
+    if (p == NULL) {
+        return;
+    }
+    atomic_store (&p->stop, true);
+    sem_post (&p->wake);
+    pthread_join (p->thread, NULL);
+    ctx->publisher = NULL;
+    ctx->publisher_fini = NULL;
+    if (atomic_load (&p->failed) > 0u) {
+        DYAD_LOG_ERROR (ctx, "DYAD_PUBLISH: %lu closed files were not published",
+                        (unsigned long)atomic_load (&p->failed));
+    }
+    pthread_cond_destroy (&p->done);
+    pthread_mutex_destroy (&p->lock);
+    sem_destroy (&p->wake);
+    flux_close (p->ctx.h);
+    publish_ctx_free (&p->ctx);
+    free (p);
+}
@@ -0,0 +1,55 @@
+#ifndef DYAD_CORE_DYAD_PUBLISH_H
+#define DYAD_CORE_DYAD_PUBLISH_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most files the publisher thread hands to dyad_produce_multi () at once
+#define DYAD_PUBLISH_BATCH 1024u
+// Smallest group of files flushed with one syncfs () rather than one by one
+#define DYAD_FSYNC_GROUP_SYNCFS 16u
+
+/**
+ * Start the thread that publishes the files queued by dyad_publish_enqueue ().
+ * The thread opens its own Flux handle, as a handle must not be shared
+ * between threads. dyad_finalize () drains the queue and stops the thread.
+ * With ctx->fsync_write and ctx->fsync_group, the thread also flushes the
+ * files closed within ctx->fsync_group seconds of each other at once.
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_publish_start (dyad_ctx_t *ctx);
+
+/**
+ * Queue `fname' for publishing. With ctx->publish_thread, return without
+ * waiting for it. Otherwise, wait until the group it joined is published,
+ * which with ctx->fsync_group is after the group is durable. Without a
+ * publisher thread, this is dyad_produce ().
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_publish_enqueue (dyad_ctx_t *ctx, const char *fname);
+
+/**
+ * Wait until every file queued so far is published. Returns DYAD_RC_BADCOMMIT
+ * if any of them failed to publish since the last flush.
+ */
+DYAD_DLL_EXPORTED dyad_rc_t dyad_publish_flush (dyad_ctx_t *ctx);
+
+// Whether closed files are flushed in groups by the publisher thread
+DYAD_DLL_EXPORTED bool dyad_group_sync (const dyad_ctx_t *ctx);
+
+// Drain the queue and stop the publisher thread
+DYAD_DLL_EXPORTED void dyad_publish_stop (dyad_ctx_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // DYAD_CORE_DYAD_PUBLISH_H
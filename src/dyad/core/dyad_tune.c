@@ -0,0 +1,287 @@
+/************************************************************\
+ * Copyright 2021 Lawrence Livermore National Security, LLC
+ * (c.f. AUTHORS, NOTICE.LLNS, COPYING)
+ *
+ * This file is part of the Flux resource manager framework.
+ * For details, see https://github.com/flux-framework.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+\************************************************************/
+
+/* Calibrate the KVS key layout of DYAD (DYAD_KEY_DEPTH and DYAD_KEY_BINS).
+ *
+ * For each candidate layout, publish a number of synthetic records one
+ * commit each, as producers do, then look each of them up, and time both.
+ * The layout with the lowest mean commit + lookup time is reported and, with
+ * --apply, recorded under DYAD_KVS_CONFIG_KEY in the namespace, where
+ * dyad_init () picks it up unless the user sets a layout.
+ *
+ * This runs from a single client. The fan-out of each KVS directory only
+ * matches a real run if --count is close to the number of files the run
+ * publishes, and --inflight only approximates concurrent producers by
+ * keeping that many commits and lookups outstanding at once. It does not
+ * reproduce their load on the brokers. */
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_envs.h>
+#include <dyad/common/dyad_md.h>
+#include <dyad/core/dyad_core.h>
+#include <flux/core.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Directory of the namespace the synthetic records are written to
+#define DYAD_TUNE_SCRATCH "dyad_tune"
+
+static const unsigned int tune_depths[] = {1u, 2u, 3u, 4u};
+static const unsigned int tune_bins[] = {16u, 64u, 256u, 1024u, 4096u};
+
+static double now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void make_key (unsigned int i,
+                      unsigned int depth,
+                      unsigned int bins,
+                      char* key,
+                      size_t len)
+{
+    char upath[64] = {'\0'};
+    char topic[PATH_MAX + 1] = {'\0'};
+    snprintf (upath, sizeof (upath), "tune/file_%u", i);
+    gen_path_key (upath, topic, PATH_MAX, depth, bins);
+    snprintf (key, len, "%s.%ux%u.%s", DYAD_TUNE_SCRATCH, depth, bins, topic);
+}
+
+static int remove_scratch (flux_t* h, const char* ns)
+{
+    flux_kvs_txn_t* txn = flux_kvs_txn_create ();
+    flux_future_t* f = NULL;
+    int ret = -1;
+    if (txn == NULL || flux_kvs_txn_unlink (txn, 0, DYAD_TUNE_SCRATCH) < 0) {
+        goto remove_done;
+    }
+    if ((f = flux_kvs_commit (h, ns, 0, txn)) == NULL || flux_future_get (f, NULL) < 0) {
+        goto remove_done;
+    }
+    ret = 0;
+remove_done:;
+    flux_future_destroy (f);
+    flux_kvs_txn_destroy (txn);
+    return ret;
+}
+
+/* Wait for the commit or lookup `f' and destroy it. Returns -1 on error. */
+static int trial_wait (flux_future_t* f, bool lookup)
+{
+    int rank = 0;
+    int ret = lookup ? flux_kvs_lookup_get_unpack (f, "{s:i}", "rank", &rank)
+                     : flux_future_get (f, NULL);
+    flux_future_destroy (f);
+    return ret;
+}
+
+/* Mean time, in seconds, of one commit and one lookup with the given layout,
+ * keeping up to `inflight' of each outstanding as that many producers and
+ * consumers would, or a negative value on error. */
+static double trial (flux_t* h,
+                     const char* ns,
+                     unsigned int depth,
+                     unsigned int bins,
+                     unsigned int n,
+                     unsigned int inflight)
+{
+    char key[PATH_MAX + 64] = {'\0'};
+    flux_kvs_txn_t* txn = NULL;
+    flux_future_t** futs = (flux_future_t**)calloc (inflight, sizeof (flux_future_t*));
+    double t_commit = 0.0;
+    double t_lookup = 0.0;
+    double t0 = 0.0;
+    double ret = -1.0;
+
+    if (futs == NULL) {
+        return -1.0;
+    }
+    t0 = now ();
+    for (unsigned int i = 0u; i < n; i++) {
+        make_key (i, depth, bins, key, sizeof (key));
+        if (futs[i % inflight] != NULL && trial_wait (futs[i % inflight], false) < 0) {
+            futs[i % inflight] = NULL;
+            fprintf (stderr, "dyad_tune: a commit failed\n");
+            goto trial_done;
+        }
+        futs[i % inflight] = NULL;
+        if ((txn = flux_kvs_txn_create ()) == NULL
+            || flux_kvs_txn_pack (txn, 0, key, "{s:i}", "rank", 0) < 0
+            || (futs[i % inflight] = flux_kvs_commit (h, ns, 0, txn)) == NULL) {
+            fprintf (stderr, "dyad_tune: cannot commit %s\n", key);
+            flux_kvs_txn_destroy (txn);
+            goto trial_done;
+        }
+        flux_kvs_txn_destroy (txn);
+    }
+    for (unsigned int i = 0u; i < inflight; i++) {
+        if (futs[i] != NULL && trial_wait (futs[i], false) < 0) {
+            futs[i] = NULL;
+            fprintf (stderr, "dyad_tune: a commit failed\n");
+            goto trial_done;
+        }
+        futs[i] = NULL;
+    }
+    t_commit = now () - t0;
+    t0 = now ();
+    for (unsigned int i = 0u; i < n; i++) {
+        make_key (i, depth, bins, key, sizeof (key));
+        if (futs[i % inflight] != NULL && trial_wait (futs[i % inflight], true) < 0) {
+            futs[i % inflight] = NULL;
+            fprintf (stderr, "dyad_tune: a lookup failed\n");
+            goto trial_done;
+        }
+        if ((futs[i % inflight] = flux_kvs_lookup (h, ns, 0, key)) == NULL) {
+            fprintf (stderr, "dyad_tune: cannot look up %s\n", key);
+            goto trial_done;
+        }
+    }
+    for (unsigned int i = 0u; i < inflight; i++) {
+        if (futs[i] != NULL && trial_wait (futs[i], true) < 0) {
+            futs[i] = NULL;
+            fprintf (stderr, "dyad_tune: a lookup failed\n");
+            goto trial_done;
+        }
+        futs[i] = NULL;
+    }
+    t_lookup = now () - t0;
+    ret = (t_commit + t_lookup) / (double)n;
+
+trial_done:;
+    for (unsigned int i = 0u; i < inflight; i++) {
+        flux_future_destroy (futs[i]);
+    }
+    free (futs);
+    return ret;
+}
+
+static void show_help (void)
+{
+    printf ("Usage: dyad_tune [-n NAMESPACE] [-c COUNT] [-p INFLIGHT] [-a]\n");
+    printf ("    -n, --namespace: KVS namespace (default: $%s)\n", DYAD_KVS_NAMESPACE_ENV);
+    printf ("    -c, --count:     records published per layout, ideally as many as\n");
+    printf ("                     the files of a run (default: 256)\n");
+    printf ("    -p, --inflight:  commits and lookups outstanding at once, as with\n");
+    printf ("                     that many producers (default: 1)\n");
+    printf ("    -a, --apply:     record the best layout in the namespace\n");
+}
+
+int main (int argc, char** argv)
+{
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"namespace", required_argument, 0, 'n'},
+                                           {"count", required_argument, 0, 'c'},
+                                           {"inflight", required_argument, 0, 'p'},
+                                           {"apply", no_argument, 0, 'a'},
+                                           {0, 0, 0, 0}};
+    const char* ns = getenv (DYAD_KVS_NAMESPACE_ENV);
+    unsigned int count = 256u;
+    unsigned int inflight = 1u;
+    int apply = 0;
+    int c = -1;
+    flux_t* h = NULL;
+    flux_kvs_txn_t* txn = NULL;
+    flux_future_t* f = NULL;
+    unsigned int best_depth = 0u;
+    unsigned int best_bins = 0u;
+    double best = -1.0;
+    double t = 0.0;
+    int ret = EXIT_FAILURE;
+
+    while ((c = getopt_long (argc, argv, "hn:c:p:a", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                ns = optarg;
+                break;
+            case 'c':
+                count = (unsigned int)strtoul (optarg, NULL, 10);
+                break;
+            case 'p':
+                inflight = (unsigned int)strtoul (optarg, NULL, 10);
+                break;
+            case 'a':
+                apply = 1;
+                break;
+            case 'h':
+                show_help ();
+                return EXIT_SUCCESS;
+            default:
+                show_help ();
+                return EXIT_FAILURE;
+        }
+    }
+    if (ns == NULL || count == 0u || inflight == 0u) {
+        show_help ();
+        return EXIT_FAILURE;
+    }
+    if ((h = flux_open (NULL, 0)) == NULL) {
+        fprintf (stderr, "dyad_tune: cannot open flux\n");
+        return EXIT_FAILURE;
+    }
+
+    printf ("%6s %6s %14s\n", "depth", "bins", "time (us)");
+    for (size_t d = 0ul; d < sizeof (tune_depths) / sizeof (tune_depths[0]); d++) {
+        for (size_t b = 0ul; b < sizeof (tune_bins) / sizeof (tune_bins[0]); b++) {
+            t = trial (h, ns, tune_depths[d], tune_bins[b], count, inflight);
+            remove_scratch (h, ns);
+            if (t < 0.0) {
+                goto tune_done;
+            }
+            printf ("%6u %6u %14.1f\n", tune_depths[d], tune_bins[b], t * 1000000.0);
+            if (best < 0.0 || t < best) {
+                best = t;
+                best_depth = tune_depths[d];
+                best_bins = tune_bins[b];
+            }
+        }
+    }
+    printf ("Recommended: %s=%u %s=%u\n",
+            DYAD_KEY_DEPTH_ENV,
+            best_depth,
+            DYAD_KEY_BINS_ENV,
+            best_bins);
+
+    if (apply) {
+        if ((txn = flux_kvs_txn_create ()) == NULL
+            || flux_kvs_txn_pack (txn,
+                                  0,
+                                  DYAD_KVS_CONFIG_KEY,
+                                  "{s:i, s:i}",
+                                  "key_depth",
+                                  (int)best_depth,
+                                  "key_bins",
+                                  (int)best_bins)
+                   < 0
+            || (f = flux_kvs_commit (h, ns, 0, txn)) == NULL || flux_future_get (f, NULL) < 0) {
+            fprintf (stderr, "dyad_tune: cannot record the layout in %s\n", ns);
+            goto tune_done;
+        }
+        printf ("Recorded under %s in namespace %s\n", DYAD_KVS_CONFIG_KEY, ns);
+    }
+    ret = EXIT_SUCCESS;
+
+tune_done:;
+    flux_future_destroy (f);
+    flux_kvs_txn_destroy (txn);
+    flux_close (h);
+    return ret;
+}
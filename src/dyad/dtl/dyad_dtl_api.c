@@ -6,12 +6,54 @@
 
 #include <dyad/dtl/dyad_dtl_api.h>
 #include <dyad/dtl/flux_dtl.h>
+#include <dyad/dtl/tcp_dtl.h>
+#include <dyad/dtl/plugin_dtl.h>
 #include <dyad/common/dyad_logging.h>
 #include <dyad/common/dyad_profiler.h>
+#include <string.h>
 
 #if DYAD_ENABLE_UCX_DTL || DYAD_ENABLE_UCX_RMA
 #include "ucx_dtl.h"
 #endif // DYAD_ENABLE_UCX_DTL || DYAD_ENABLE_UCX_RMA
+#ifdef DYAD_ENABLE_FABRIC_DTL
+#include "fabric_dtl.h"
+#endif // DYAD_ENABLE_FABRIC_DTL
+
+static inline bool dtl_is_auto (const dyad_dtl_t* dtl_handle)
+{
+    return dtl_handle->auto_dtl[DYAD_DTL_UCX] != NULL
+           || dtl_handle->auto_dtl[DYAD_DTL_FLUX_RPC] != NULL;
+}
+
+#if DYAD_ENABLE_UCX_DTL || DYAD_ENABLE_UCX_RMA
+// Initialize every DTL that DYAD_DTL_AUTO switches between. Each one gets its
+// own handle, created by dyad_dtl_init () while it is installed in the context.
+static dyad_rc_t dtl_auto_init (dyad_ctx_t* ctx,
+                                dyad_dtl_comm_mode_t comm_mode,
+                                bool debug)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_t* auto_handle = ctx->dtl_handle;
+    const dyad_dtl_mode_t modes[] = {DYAD_DTL_FLUX_RPC, DYAD_DTL_UCX};
+    for (size_t i = 0ul; i < sizeof (modes) / sizeof (modes[0]); i++) {
+        ctx->dtl_handle = NULL;
+        rc = dyad_dtl_init (ctx, modes[i], comm_mode, debug);
+        auto_handle->auto_dtl[modes[i]] = ctx->dtl_handle;
+        ctx->dtl_handle = auto_handle;
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (ctx, "Cannot initialize the %s DTL for AUTO mode",
+                            dyad_dtl_mode_name[modes[i]]);
+            goto dtl_auto_init_done;
+        }
+    }
+    // Until the first selection, behave like the UCX DTL
+    rc = dyad_dtl_select (ctx, DYAD_DTL_UCX);
+dtl_auto_init_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+#endif // DYAD_ENABLE_UCX_DTL || DYAD_ENABLE_UCX_RMA
 
 dyad_rc_t dyad_dtl_init (dyad_ctx_t* ctx,
                          dyad_dtl_mode_t mode,
@@ -28,8 +70,18 @@ dyad_rc_t dyad_dtl_init (dyad_ctx_t* ctx,
         goto dtl_init_done;
     }
     ctx->dtl_handle->mode = mode;
+    ctx->dtl_handle->caps = 0ul;
+    ctx->dtl_handle->recv_file = NULL;
+    ctx->dtl_handle->disconnect = NULL;
+    memset (ctx->dtl_handle->auto_dtl, 0, sizeof (ctx->dtl_handle->auto_dtl));
 #if DYAD_ENABLE_UCX_DTL || DYAD_ENABLE_UCX_RMA
-    if (mode == DYAD_DTL_UCX) {
+    if (mode == DYAD_DTL_AUTO) {
+        rc = dtl_auto_init (ctx, comm_mode, debug);
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (ctx, "AUTO DTL initialization failed rc %d", rc);
+            goto dtl_init_done;
+        }
+    } else if (mode == DYAD_DTL_UCX) {
         rc = dyad_dtl_ucx_init (ctx, mode, comm_mode, debug);
         if (DYAD_IS_ERROR (rc)) {
             DYAD_LOG_ERROR (ctx, "dyad_dtl_ucx_init initialization failed rc %d", rc);
@@ -44,6 +96,20 @@ dyad_rc_t dyad_dtl_init (dyad_ctx_t* ctx,
             DYAD_LOG_ERROR (ctx, "dyad_dtl_flux_init initialization failed rc %d", rc);
             goto dtl_init_done;
         }
+    } else if (mode == DYAD_DTL_TCP) {
+        rc = dyad_dtl_tcp_init (ctx, mode, comm_mode, debug);
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (ctx, "dyad_dtl_tcp_init initialization failed rc %d", rc);
+            goto dtl_init_done;
+        }
+#ifdef DYAD_ENABLE_FABRIC_DTL
+    } else if (mode == DYAD_DTL_FABRIC) {
+        rc = dyad_dtl_fabric_init (ctx, mode, comm_mode, debug);
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (ctx, "dyad_dtl_fabric_init initialization failed rc %d", rc);
+            goto dtl_init_done;
+        }
+#endif // DYAD_ENABLE_FABRIC_DTL
     } else {
         rc = DYAD_RC_BADDTLMODE;
         DYAD_LOG_ERROR (ctx, "dyad_dtl_flux_init initialization failed with incorrect mode %d", mode);
@@ -56,6 +122,97 @@ dtl_init_done:;
     return rc;
 }
 
+dyad_rc_t dyad_dtl_init_plugin (dyad_ctx_t* ctx,
+                                const char* name,
+                                dyad_dtl_comm_mode_t comm_mode,
+                                bool debug)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_LOG_DEBUG (ctx, "Initializing DTL plugin %s ...", name);
+    dyad_rc_t rc = DYAD_RC_OK;
+    ctx->dtl_handle = malloc (sizeof (struct dyad_dtl));
+    if (ctx->dtl_handle == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        DYAD_LOG_ERROR (ctx, "Cannot allocate Memory");
+        goto dtl_init_plugin_done;
+    }
+    memset (ctx->dtl_handle, 0, sizeof (struct dyad_dtl));
+    ctx->dtl_handle->mode = DYAD_DTL_PLUGIN;
+    rc = dyad_dtl_plugin_init (ctx, name, comm_mode, debug);
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "dyad_dtl_plugin_init initialization failed rc %d", rc);
+        goto dtl_init_plugin_done;
+    }
+    rc = DYAD_RC_OK;
+    DYAD_LOG_DEBUG (ctx, "Finished dyad_dtl_init_plugin successfully");
+dtl_init_plugin_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_select (dyad_ctx_t* ctx, dyad_dtl_mode_t mode)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_t* dtl_handle = ctx->dtl_handle;
+    dyad_dtl_t* auto_dtl[DYAD_DTL_AUTO];
+    if (dtl_handle == NULL || !dtl_is_auto (dtl_handle)) {
+        rc = DYAD_RC_OK;
+        goto dtl_select_done;
+    }
+    if ((int)mode < 0 || mode >= DYAD_DTL_AUTO || dtl_handle->auto_dtl[mode] == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot select DTL mode %d", (int)mode);
+        rc = DYAD_RC_BADDTLMODE;
+        goto dtl_select_done;
+    }
+    if (dtl_handle->mode != mode) {
+        DYAD_LOG_DEBUG (ctx, "Switching to the %s DTL", dyad_dtl_mode_name[mode]);
+        memcpy (auto_dtl, dtl_handle->auto_dtl, sizeof (auto_dtl));
+        *dtl_handle = *(auto_dtl[mode]);
+        memcpy (dtl_handle->auto_dtl, auto_dtl, sizeof (auto_dtl));
+    }
+    rc = DYAD_RC_OK;
+dtl_select_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+bool dyad_dtl_is_auto (const dyad_ctx_t* ctx)
+{
+    return ctx->dtl_handle != NULL && dtl_is_auto (ctx->dtl_handle);
+}
+
+dyad_rc_t dyad_dtl_disconnect (dyad_ctx_t* ctx, const flux_msg_t* msg)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_t* dtl_handle = ctx->dtl_handle;
+    if (dtl_handle == NULL) {
+        goto dtl_disconnect_done;
+    }
+    if (dtl_is_auto (dtl_handle)) {
+        // The selected DTL is a copy, so go to the handles themselves
+        for (int m = 0; m < DYAD_DTL_AUTO; m++) {
+            if (dtl_handle->auto_dtl[m] == NULL || dtl_handle->auto_dtl[m]->disconnect == NULL) {
+                continue;
+            }
+            ctx->dtl_handle = dtl_handle->auto_dtl[m];
+            dyad_rc_t sub_rc = ctx->dtl_handle->disconnect (ctx, msg);
+            if (DYAD_IS_ERROR (sub_rc)) {
+                rc = sub_rc;
+            }
+        }
+        ctx->dtl_handle = dtl_handle;
+        goto dtl_disconnect_done;
+    }
+    if (dtl_handle->disconnect != NULL) {
+        rc = dtl_handle->disconnect (ctx, msg);
+    }
+dtl_disconnect_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
 dyad_rc_t dyad_dtl_finalize (dyad_ctx_t* ctx)
 {
     DYAD_C_FUNCTION_START();
@@ -68,6 +225,24 @@ dyad_rc_t dyad_dtl_finalize (dyad_ctx_t* ctx)
         rc = DYAD_RC_OK;
         goto dtl_finalize_done;
     }
+    if (dtl_is_auto (ctx->dtl_handle)) {
+        // The private handles are owned by the underlying DTLs,
+        // so finalize each of them in turn
+        dyad_dtl_t* auto_handle = ctx->dtl_handle;
+        for (int m = 0; m < DYAD_DTL_AUTO; m++) {
+            if (auto_handle->auto_dtl[m] == NULL) {
+                continue;
+            }
+            ctx->dtl_handle = auto_handle->auto_dtl[m];
+            dyad_rc_t sub_rc = dyad_dtl_finalize (ctx);
+            auto_handle->auto_dtl[m] = NULL;
+            if (DYAD_IS_ERROR (sub_rc)) {
+                rc = sub_rc;
+            }
+        }
+        ctx->dtl_handle = auto_handle;
+        goto dtl_finalize_done;
+    }
 #if DYAD_ENABLE_UCX_DTL || DYAD_ENABLE_UCX_RMA
     if ((ctx->dtl_handle)->mode == DYAD_DTL_UCX) {
         if ((ctx->dtl_handle)->private_dtl.ucx_dtl_handle != NULL) {
@@ -86,7 +261,30 @@ dyad_rc_t dyad_dtl_finalize (dyad_ctx_t* ctx)
                 goto dtl_finalize_done;
             }
         }
-    } else {
+    } else if ((ctx->dtl_handle)->mode == DYAD_DTL_TCP) {
+        if ((ctx->dtl_handle)->private_dtl.tcp_dtl_handle != NULL) {
+            rc = dyad_dtl_tcp_finalize (ctx);
+            if (DYAD_IS_ERROR (rc)) {
+                goto dtl_finalize_done;
+            }
+        }
+#ifdef DYAD_ENABLE_FABRIC_DTL
+    } else if ((ctx->dtl_handle)->mode == DYAD_DTL_FABRIC) {
+        if ((ctx->dtl_handle)->private_dtl.fabric_dtl_handle != NULL) {
+            rc = dyad_dtl_fabric_finalize (ctx);
+            if (DYAD_IS_ERROR (rc)) {
+                goto dtl_finalize_done;
+            }
+        }
+#endif // DYAD_ENABLE_FABRIC_DTL
+    } else if ((ctx->dtl_handle)->mode == DYAD_DTL_PLUGIN) {
+        if ((ctx->dtl_handle)->private_dtl.plugin_dtl_handle != NULL) {
+            rc = dyad_dtl_plugin_finalize (ctx);
+            if (DYAD_IS_ERROR (rc)) {
+                goto dtl_finalize_done;
+            }
+        }
+    } else if ((ctx->dtl_handle)->mode != DYAD_DTL_AUTO) {
         rc = DYAD_RC_BADDTLMODE;
         goto dtl_finalize_done;
     }
@@ -24,17 +24,24 @@ extern "C" {
 // Forward declarations of DTL contexts for the underlying implementations
 struct dyad_dtl_ucx;
 struct dyad_dtl_flux;
+struct dyad_dtl_tcp;
+struct dyad_dtl_fabric;
+struct dyad_dtl_plugin_handle;
 
 // Union type to store the underlying DTL contexts
 union dyad_dtl_private {
     struct dyad_dtl_ucx* ucx_dtl_handle;
     struct dyad_dtl_flux* flux_dtl_handle;
+    struct dyad_dtl_tcp* tcp_dtl_handle;
+    struct dyad_dtl_fabric* fabric_dtl_handle;
+    struct dyad_dtl_plugin_handle* plugin_dtl_handle;
 } __attribute__((aligned(16)));
 typedef union dyad_dtl_private dyad_dtl_private_t;
 
 struct dyad_dtl {
     dyad_dtl_private_t private_dtl;
     dyad_dtl_mode_t mode;
+    uint64_t caps;  // DYAD_DTL_CAP_* flags
     dyad_rc_t (*rpc_pack) (const dyad_ctx_t* ctx,
                            const char*  upath,
                            uint32_t producer_rank,
@@ -47,17 +54,81 @@ struct dyad_dtl {
     dyad_rc_t (*establish_connection) (const dyad_ctx_t* ctx);
     dyad_rc_t (*send) (const dyad_ctx_t* ctx, void* buf, size_t buflen);
     dyad_rc_t (*recv) (const dyad_ctx_t* ctx, void** buf, size_t* buflen);
+    // Optional: like recv, but write the data straight into the open file `fd'
+    // at its current offset. NULL if the DTL does not support it.
+    dyad_rc_t (*recv_file) (const dyad_ctx_t* ctx, int fd, size_t* file_len);
     dyad_rc_t (*close_connection) (const dyad_ctx_t* ctx);
+    // Optional: send `file_size' bytes of the open file `fd' without staging
+    // them in a buffer from get_buffer. NULL if the DTL does not support it.
+    dyad_rc_t (*send_file) (const dyad_ctx_t* ctx, int fd, size_t file_size);
+    // Optional: release whatever the DTL still holds for the client that sent
+    // the disconnect request `msg'. NULL if the DTL holds nothing across requests.
+    dyad_rc_t (*disconnect) (const dyad_ctx_t* ctx, const flux_msg_t* msg);
+    // Only used by DYAD_DTL_AUTO: the handles of the underlying DTLs, indexed
+    // by mode. dyad_dtl_select () copies one of them into this handle, so the
+    // fields above always describe the DTL used for the current transfer.
+    struct dyad_dtl* auto_dtl[DYAD_DTL_AUTO];
 } __attribute__((aligned(256)));
 typedef struct dyad_dtl dyad_dtl_t;
 
+// Transfers put by the UCX RMA DTL are prefixed by their length as a ssize_t
+#if defined(DYAD_ENABLE_UCX_RMA) && !defined(DYAD_ENABLE_UCX_RMA_GET)
+#define DYAD_DTL_LEN_PREFIX(dtl) ((dtl)->mode == DYAD_DTL_UCX ? sizeof (ssize_t) : 0ul)
+#else
+#define DYAD_DTL_LEN_PREFIX(dtl) (0ul)
+#endif
+
 dyad_rc_t dyad_dtl_init (dyad_ctx_t* ctx,
                          dyad_dtl_mode_t mode,
                          dyad_dtl_comm_mode_t comm_mode,
                          bool debug);
 
+/**
+ * @brief Initialize the DTL plugin called `name' (see dyad_dtl_plugin.h)
+ * @param[in] ctx        the DYAD context for the operation
+ * @param[in] name       name of the plugin, or path to its shared object
+ * @param[in] comm_mode  whether the DTL sends or receives data
+ * @param[in] debug      whether to print debugging messages
+ *
+ * @return An error code from dyad_rc.h
+ */
+dyad_rc_t dyad_dtl_init_plugin (dyad_ctx_t* ctx,
+                                const char* name,
+                                dyad_dtl_comm_mode_t comm_mode,
+                                bool debug);
+
 dyad_rc_t dyad_dtl_finalize (dyad_ctx_t* ctx);
 
+/**
+ * @brief If the DTL was initialized in DYAD_DTL_AUTO mode, make the DTL of
+ *        the given mode the one used by the next transfer. Otherwise, this
+ *        is a no-op.
+ * @param[in] ctx   the DYAD context for the operation
+ * @param[in] mode  DYAD_DTL_UCX or DYAD_DTL_FLUX_RPC
+ *
+ * @return An error code from dyad_rc.h
+ */
+dyad_rc_t dyad_dtl_select (dyad_ctx_t* ctx, dyad_dtl_mode_t mode);
+
+/**
+ * @brief Whether the DTL was initialized in DYAD_DTL_AUTO mode
+ * @param[in] ctx  the DYAD context for the operation
+ *
+ * @return true if dyad_dtl_select () switches between DTLs
+ */
+bool dyad_dtl_is_auto (const dyad_ctx_t* ctx);
+
+/**
+ * @brief Let the DTL release what it still holds for a client that has
+ *        disconnected (e.g., memory exposed to it for RMA GET). With
+ *        DYAD_DTL_AUTO, every underlying DTL is told.
+ * @param[in] ctx  the DYAD context for the operation
+ * @param[in] msg  the disconnect request sent on behalf of the client
+ *
+ * @return An error code from dyad_rc.h
+ */
+dyad_rc_t dyad_dtl_disconnect (dyad_ctx_t* ctx, const flux_msg_t* msg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,82 @@
+#ifndef DYAD_DTL_DYAD_DTL_PLUGIN_H
+#define DYAD_DTL_DYAD_DTL_PLUGIN_H
+
+#include <jansson.h>
+#include <dyad/common/dyad_dtl.h>
+#include <dyad/common/dyad_rc.h>
+#include <flux/core.h>
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+/**
+ * ABI of DTL plugins.
+ *
+ * A plugin is a shared object named libdyad_dtl_<name>.so that exports a
+ * `const struct dyad_dtl_plugin' named DYAD_DTL_PLUGIN_SYMBOL. Setting
+ * DYAD_DTL_MODE (or the module's --mode) to plugin:<name> loads it, from
+ * DYAD_DTL_PLUGIN_DIR if set and through the dynamic loader's search path
+ * otherwise. A <name> containing a '/' is used as the path of the plugin.
+ * This header is installed along with dyad/common/dyad_dtl.h and
+ * dyad/common/dyad_rc.h, and needs none of DYAD's build configuration.
+ *
+ * The operations have the same meaning as those of struct dyad_dtl. Plugins
+ * get the state returned by their init through dyad_dtl_plugin_state ().
+ * Changes that break plugins built against an older version of this header
+ * must increase DYAD_DTL_PLUGIN_ABI_VERSION.
+ */
+#define DYAD_DTL_PLUGIN_ABI_VERSION 1u
+#define DYAD_DTL_PLUGIN_SYMBOL "dyad_dtl_plugin"
+
+struct dyad_ctx;
+
+struct dyad_dtl_plugin {
+    uint32_t abi_version;  // always DYAD_DTL_PLUGIN_ABI_VERSION
+    const char* name;
+    uint64_t caps;         // DYAD_DTL_CAP_* flags
+    dyad_rc_t (*init) (const struct dyad_ctx* ctx,
+                       dyad_dtl_comm_mode_t comm_mode,
+                       bool debug,
+                       void** state);
+    dyad_rc_t (*finalize) (const struct dyad_ctx* ctx, void* state);
+    dyad_rc_t (*rpc_pack) (const struct dyad_ctx* ctx,
+                           const char* upath,
+                           uint32_t producer_rank,
+                           json_t** packed_obj);
+    dyad_rc_t (*rpc_unpack) (const struct dyad_ctx* ctx, const flux_msg_t* msg, char** upath);
+    dyad_rc_t (*rpc_respond) (const struct dyad_ctx* ctx, const flux_msg_t* orig_msg);
+    dyad_rc_t (*rpc_recv_response) (const struct dyad_ctx* ctx, flux_future_t* f);
+    dyad_rc_t (*get_buffer) (const struct dyad_ctx* ctx, size_t data_size, void** data_buf);
+    dyad_rc_t (*return_buffer) (const struct dyad_ctx* ctx, void** data_buf);
+    dyad_rc_t (*establish_connection) (const struct dyad_ctx* ctx);
+    dyad_rc_t (*send) (const struct dyad_ctx* ctx, void* buf, size_t buflen);
+    dyad_rc_t (*recv) (const struct dyad_ctx* ctx, void** buf, size_t* buflen);
+    dyad_rc_t (*close_connection) (const struct dyad_ctx* ctx);
+    // Optional, may be NULL
+    dyad_rc_t (*send_file) (const struct dyad_ctx* ctx, int fd, size_t file_size);
+};
+
+/**
+ * @brief Get the state that the init function of the loaded plugin returned
+ * @param[in] ctx  the DYAD context for the operation
+ *
+ * @return The state, or NULL if the DTL is not a plugin
+ */
+void* dyad_dtl_plugin_state (const struct dyad_ctx* ctx);
+
+/**
+ * @brief Get the Flux handle that the plugin should use
+ * @param[in] ctx  the DYAD context for the operation
+ */
+flux_t* dyad_dtl_plugin_flux (const struct dyad_ctx* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_DTL_DYAD_DTL_PLUGIN_H */
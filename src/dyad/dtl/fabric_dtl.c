@@ -0,0 +1,865 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/dtl/fabric_dtl.h>
+#include <dyad/common/dyad_envs.h>
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/utils/base64/base64.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <rdma/fi_cm.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_tagged.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern const base64_maps_t base64_maps_rfc4648;
+
+#define FABRIC_MAX_TRANSFER_SIZE (1024ul * 1024ul * 1024ul)
+// Large RMA transfers are split into writes of at most this size
+#define DYAD_FABRIC_CHUNK_SIZE_DEFAULT (4ul * 1024ul * 1024ul)
+// Oldest libfabric API whose semantics we rely on
+#define DYAD_FABRIC_API_VERSION FI_VERSION (1, 9)
+// Requested keys of our registrations, for providers without FI_MR_PROV_KEY
+#define DYAD_FABRIC_KEY_NET_BUF 1ul
+#define DYAD_FABRIC_KEY_SEND_BUF 2ul
+// Number of empty CQ polls between checks of the RPC of the ongoing fetch
+#define DYAD_FABRIC_POLL_CHECK 4096u
+
+// Register `len' bytes at `buf' with the domain (and endpoint, if needed)
+static dyad_rc_t fabric_register (const dyad_ctx_t* ctx,
+                                  dyad_dtl_fabric_t* dtl_handle,
+                                  void* buf,
+                                  size_t len,
+                                  uint64_t access,
+                                  uint64_t key,
+                                  struct fid_mr** mr)
+{
+    int ret = fi_mr_reg (dtl_handle->domain, buf, len, access, 0ul, key, 0ul, mr, NULL);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_mr_reg of %zu bytes failed: %s", len, fi_strerror (-ret));
+        *mr = NULL;
+        return DYAD_RC_FABRICINIT_FAIL;
+    }
+    if (dtl_handle->info->domain_attr->mr_mode & FI_MR_ENDPOINT) {
+        ret = fi_mr_bind (*mr, &(dtl_handle->ep->fid), 0ul);
+        if (ret == 0) {
+            ret = fi_mr_enable (*mr);
+        }
+        if (ret != 0) {
+            DYAD_LOG_ERROR (ctx, "Cannot bind memory region to endpoint: %s", fi_strerror (-ret));
+            fi_close (&((*mr)->fid));
+            *mr = NULL;
+            return DYAD_RC_FABRICINIT_FAIL;
+        }
+    }
+    return DYAD_RC_OK;
+}
+
+// Descriptor of `buf' if it lies within our registered buffer, else NULL
+static void* fabric_desc (const dyad_dtl_fabric_t* dtl_handle, const void* buf, size_t len)
+{
+    const char* base = (const char*)dtl_handle->net_buf;
+    const char* end = (const char*)(dtl_handle->hdr + 1);
+    if (dtl_handle->mr == NULL || (const char*)buf < base || (const char*)buf + len > end) {
+        return NULL;
+    }
+    return fi_mr_desc (dtl_handle->mr);
+}
+
+// Reap completions until `count' operations have completed. The last
+// completion is stored in `entry' if not NULL. While waiting, a consumer
+// watches the RPC of the ongoing fetch, so that a producer-side failure
+// is reported instead of waiting forever.
+static dyad_rc_t fabric_wait (const dyad_ctx_t* ctx,
+                              dyad_dtl_fabric_t* dtl_handle,
+                              size_t count,
+                              struct fi_cq_tagged_entry* entry)
+{
+    struct fi_cq_tagged_entry comp;
+    struct fi_cq_err_entry err;
+    unsigned idle = 0u;
+    ssize_t ret = 0;
+    while (count > 0ul) {
+        ret = fi_cq_read (dtl_handle->cq, &comp, 1);
+        if (ret == 1) {
+            if (entry != NULL) {
+                *entry = comp;
+            }
+            count--;
+            idle = 0u;
+            continue;
+        }
+        if (ret == -FI_EAVAIL) {
+            memset (&err, 0, sizeof (err));
+            fi_cq_readerr (dtl_handle->cq, &err, 0ul);
+            DYAD_LOG_ERROR (ctx, "libfabric operation failed: %s", \
+                            fi_cq_strerror (dtl_handle->cq, err.prov_errno, err.err_data, NULL, 0ul));
+            return DYAD_RC_FABRICCOMM_FAIL;
+        }
+        if (ret != -FI_EAGAIN) {
+            DYAD_LOG_ERROR (ctx, "fi_cq_read failed: %s", fi_strerror ((int)-ret));
+            return DYAD_RC_FABRICCOMM_FAIL;
+        }
+        // The module only ends the stream early if it failed. ENODATA means
+        // it has sent everything, and the data is still on its way.
+        if (++idle % DYAD_FABRIC_POLL_CHECK == 0u && dtl_handle->f != NULL
+            && flux_future_is_ready (dtl_handle->f) && flux_rpc_get (dtl_handle->f, NULL) < 0
+            && errno != ENODATA) {
+            DYAD_LOG_ERROR (ctx, "Producer failed to serve the request (errno = %d)", errno);
+            return DYAD_RC_BADRPC;
+        }
+    }
+    return DYAD_RC_OK;
+}
+
+// Withdraw the receive posted for the ongoing transfer, if it is still
+// pending, so that a late answer never lands in the buffer of the next one
+static void fabric_cancel_recv (const dyad_ctx_t* ctx, dyad_dtl_fabric_t* dtl_handle)
+{
+    struct fi_cq_tagged_entry comp;
+    struct fi_cq_err_entry err;
+    ssize_t ret = 0;
+    if (!dtl_handle->posted) {
+        return;
+    }
+    fi_cancel (&(dtl_handle->ep->fid), &(dtl_handle->recv_ctx));
+    // The receive completes either way: canceled, or because data arrived
+    for (;;) {
+        ret = fi_cq_read (dtl_handle->cq, &comp, 1);
+        if (ret == 1 && comp.op_context == &(dtl_handle->recv_ctx)) {
+            break;
+        }
+        if (ret == -FI_EAVAIL) {
+            memset (&err, 0, sizeof (err));
+            fi_cq_readerr (dtl_handle->cq, &err, 0ul);
+            if (err.op_context == &(dtl_handle->recv_ctx)) {
+                break;
+            }
+        } else if (ret != 1 && ret != -FI_EAGAIN) {
+            DYAD_LOG_ERROR (ctx, "fi_cq_read failed: %s", fi_strerror ((int)-ret));
+            break;
+        }
+    }
+    dtl_handle->posted = false;
+}
+
+// Post the receive that the answer to the request tagged `tag' completes.
+// With RMA, only the header is received, after the data has been written.
+static dyad_rc_t fabric_post_recv (const dyad_ctx_t* ctx, dyad_dtl_fabric_t* dtl_handle)
+{
+    void* buf = dtl_handle->rma ? (void*)dtl_handle->hdr : dtl_handle->net_buf;
+    size_t len = dtl_handle->rma ? sizeof (struct dyad_fabric_hdr) : dtl_handle->max_transfer_size;
+    ssize_t ret = 0;
+    do {
+        ret = fi_trecv (dtl_handle->ep,
+                        buf,
+                        len,
+                        fabric_desc (dtl_handle, buf, len),
+                        FI_ADDR_UNSPEC,
+                        dtl_handle->tag,
+                        0ul,
+                        &(dtl_handle->recv_ctx));
+        if (ret == -FI_EAGAIN) {
+            fi_cq_read (dtl_handle->cq, NULL, 0);
+        }
+    } while (ret == -FI_EAGAIN);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_trecv failed: %s", fi_strerror ((int)-ret));
+        return DYAD_RC_FABRICCOMM_FAIL;
+    }
+    dtl_handle->posted = true;
+    return DYAD_RC_OK;
+}
+
+// Send `len' bytes to the consumer with the tag of the ongoing transfer
+static dyad_rc_t fabric_tsend (const dyad_ctx_t* ctx,
+                               dyad_dtl_fabric_t* dtl_handle,
+                               void* buf,
+                               size_t len,
+                               void* desc)
+{
+    ssize_t ret = 0;
+    do {
+        ret = fi_tsend (dtl_handle->ep,
+                        buf,
+                        len,
+                        desc,
+                        dtl_handle->remote,
+                        dtl_handle->tag,
+                        &(dtl_handle->send_ctx));
+        if (ret == -FI_EAGAIN) {
+            fi_cq_read (dtl_handle->cq, NULL, 0);
+        }
+    } while (ret == -FI_EAGAIN);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_tsend of %zu bytes failed: %s", len, fi_strerror ((int)-ret));
+        return DYAD_RC_FABRICCOMM_FAIL;
+    }
+    return fabric_wait (ctx, dtl_handle, 1ul, NULL);
+}
+
+// Write `len' bytes into the consumer's buffer, keeping up to
+// DYAD_FABRIC_MAX_INFLIGHT chunks in flight, and wait for all of them
+static dyad_rc_t fabric_write (const dyad_ctx_t* ctx,
+                               dyad_dtl_fabric_t* dtl_handle,
+                               void* buf,
+                               size_t len,
+                               void* desc)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    struct iovec iov;
+    struct fi_rma_iov rma_iov;
+    struct fi_msg_rma msg;
+    uint64_t flags = FI_COMPLETION;
+    size_t off = 0ul;
+    size_t n = 0ul;
+    size_t inflight = 0ul;
+    size_t slot = 0ul;
+    ssize_t ret = 0;
+    // Without send-after-write ordering, the header could overtake the data
+    if (!(dtl_handle->info->tx_attr->msg_order & FI_ORDER_SAW)) {
+        flags |= FI_DELIVERY_COMPLETE;
+    }
+    while (off < len) {
+        n = (len - off < dtl_handle->chunk_size) ? len - off : dtl_handle->chunk_size;
+        iov.iov_base = (char*)buf + off;
+        iov.iov_len = n;
+        rma_iov.addr = dtl_handle->remote_buf + off;
+        rma_iov.len = n;
+        rma_iov.key = dtl_handle->remote_key;
+        memset (&msg, 0, sizeof (msg));
+        msg.msg_iov = &iov;
+        msg.desc = &desc;
+        msg.iov_count = 1ul;
+        msg.addr = dtl_handle->remote;
+        msg.rma_iov = &rma_iov;
+        msg.rma_iov_count = 1ul;
+        msg.context = &(dtl_handle->write_ctx[slot]);
+        if (inflight == DYAD_FABRIC_MAX_INFLIGHT) {
+            rc = fabric_wait (ctx, dtl_handle, 1ul, NULL);
+            if (DYAD_IS_ERROR (rc)) {
+                return rc;
+            }
+            inflight--;
+        }
+        ret = fi_writemsg (dtl_handle->ep, &msg, flags);
+        if (ret == -FI_EAGAIN) {
+            if (inflight > 0ul) {
+                rc = fabric_wait (ctx, dtl_handle, 1ul, NULL);
+                if (DYAD_IS_ERROR (rc)) {
+                    return rc;
+                }
+                inflight--;
+            } else {
+                fi_cq_read (dtl_handle->cq, NULL, 0);
+            }
+            continue;
+        }
+        if (ret != 0) {
+            DYAD_LOG_ERROR (ctx, "fi_writemsg of %zu bytes failed: %s", n, fi_strerror ((int)-ret));
+            // Let the writes already issued finish before the buffer is reused
+            fabric_wait (ctx, dtl_handle, inflight, NULL);
+            return DYAD_RC_FABRICCOMM_FAIL;
+        }
+        inflight++;
+        slot = (slot + 1ul) % DYAD_FABRIC_MAX_INFLIGHT;
+        off += n;
+    }
+    return fabric_wait (ctx, dtl_handle, inflight, NULL);
+}
+
+// Open the fabric, domain, completion queue, address vector and endpoint
+static dyad_rc_t fabric_open (const dyad_ctx_t* ctx, dyad_dtl_fabric_t* dtl_handle)
+{
+    struct fi_info* hints = NULL;
+    struct fi_cq_attr cq_attr;
+    struct fi_av_attr av_attr;
+    const char* prov = getenv (DYAD_FABRIC_PROVIDER_ENV);
+    const char* rma_env = getenv (DYAD_FABRIC_RMA_ENV);
+    bool want_rma = (rma_env == NULL || strcmp (rma_env, "0") != 0);
+    dyad_rc_t rc = DYAD_RC_FABRICINIT_FAIL;
+    int ret = 0;
+
+    hints = fi_allocinfo ();
+    if (hints == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate libfabric hints");
+        return DYAD_RC_SYSFAIL;
+    }
+    hints->ep_attr->type = FI_EP_RDM;
+    hints->caps = FI_TAGGED | (want_rma ? FI_RMA : 0ul);
+    hints->mode = FI_CONTEXT;
+    hints->domain_attr->mr_mode = FI_MR_LOCAL | FI_MR_VIRT_ADDR | FI_MR_ALLOCATED
+                                  | FI_MR_PROV_KEY | FI_MR_ENDPOINT;
+    hints->domain_attr->threading = FI_THREAD_DOMAIN;
+    if (prov != NULL && prov[0] != '\0') {
+        // Released by fi_freeinfo
+        hints->fabric_attr->prov_name = strdup (prov);
+    }
+    ret = fi_getinfo (DYAD_FABRIC_API_VERSION, NULL, NULL, 0ul, hints, &(dtl_handle->info));
+    if (ret == -FI_ENODATA && want_rma) {
+        DYAD_LOG_INFO (ctx, "No libfabric provider with RMA, falling back to tagged messages");
+        hints->caps = FI_TAGGED;
+        ret = fi_getinfo (DYAD_FABRIC_API_VERSION, NULL, NULL, 0ul, hints, &(dtl_handle->info));
+    }
+    fi_freeinfo (hints);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_getinfo failed: %s", fi_strerror (-ret));
+        dtl_handle->info = NULL;
+        goto fabric_open_done;
+    }
+    dtl_handle->rma = ((dtl_handle->info->caps & FI_RMA) == FI_RMA);
+    DYAD_LOG_INFO (ctx, "Using libfabric provider %s on fabric %s (RMA %s)", \
+                   dtl_handle->info->fabric_attr->prov_name, \
+                   dtl_handle->info->fabric_attr->name, \
+                   dtl_handle->rma ? "on" : "off");
+    if (dtl_handle->info->ep_attr->max_msg_size < dtl_handle->chunk_size) {
+        dtl_handle->chunk_size = dtl_handle->info->ep_attr->max_msg_size;
+    }
+
+    ret = fi_fabric (dtl_handle->info->fabric_attr, &(dtl_handle->fabric), NULL);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_fabric failed: %s", fi_strerror (-ret));
+        goto fabric_open_done;
+    }
+    ret = fi_domain (dtl_handle->fabric, dtl_handle->info, &(dtl_handle->domain), NULL);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_domain failed: %s", fi_strerror (-ret));
+        goto fabric_open_done;
+    }
+    memset (&cq_attr, 0, sizeof (cq_attr));
+    cq_attr.format = FI_CQ_FORMAT_TAGGED;
+    cq_attr.wait_obj = FI_WAIT_NONE;
+    ret = fi_cq_open (dtl_handle->domain, &cq_attr, &(dtl_handle->cq), NULL);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_cq_open failed: %s", fi_strerror (-ret));
+        goto fabric_open_done;
+    }
+    memset (&av_attr, 0, sizeof (av_attr));
+    av_attr.type = FI_AV_UNSPEC;
+    ret = fi_av_open (dtl_handle->domain, &av_attr, &(dtl_handle->av), NULL);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_av_open failed: %s", fi_strerror (-ret));
+        goto fabric_open_done;
+    }
+    ret = fi_endpoint (dtl_handle->domain, dtl_handle->info, &(dtl_handle->ep), NULL);
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_endpoint failed: %s", fi_strerror (-ret));
+        goto fabric_open_done;
+    }
+    ret = fi_ep_bind (dtl_handle->ep, &(dtl_handle->cq->fid), FI_TRANSMIT | FI_RECV);
+    if (ret == 0) {
+        ret = fi_ep_bind (dtl_handle->ep, &(dtl_handle->av->fid), 0ul);
+    }
+    if (ret == 0) {
+        ret = fi_enable (dtl_handle->ep);
+    }
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot enable libfabric endpoint: %s", fi_strerror (-ret));
+        goto fabric_open_done;
+    }
+    dtl_handle->local_addr_len = sizeof (dtl_handle->local_addr);
+    ret = fi_getname (&(dtl_handle->ep->fid), dtl_handle->local_addr, &(dtl_handle->local_addr_len));
+    if (ret != 0) {
+        DYAD_LOG_ERROR (ctx, "fi_getname failed: %s", fi_strerror (-ret));
+        goto fabric_open_done;
+    }
+    rc = DYAD_RC_OK;
+
+fabric_open_done:;
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_init (const dyad_ctx_t* ctx,
+                                dyad_dtl_mode_t mode,
+                                dyad_dtl_comm_mode_t comm_mode,
+                                bool debug)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = NULL;
+    size_t buf_size = 0ul;
+    ctx->dtl_handle->private_dtl.fabric_dtl_handle = malloc (sizeof (struct dyad_dtl_fabric));
+    if (ctx->dtl_handle->private_dtl.fabric_dtl_handle == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate the libfabric DTL handle");
+        rc = DYAD_RC_SYSFAIL;
+        goto dtl_fabric_init_region_finish;
+    }
+    dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    memset (dtl_handle, 0, sizeof (struct dyad_dtl_fabric));
+    // Allocation/Freeing of the Flux handle should be
+    // handled by the DYAD context
+    dtl_handle->h = (flux_t*)ctx->h;
+    dtl_handle->comm_mode = comm_mode;
+    dtl_handle->debug = debug;
+    dtl_handle->max_transfer_size = FABRIC_MAX_TRANSFER_SIZE;
+    dtl_handle->chunk_size = DYAD_FABRIC_CHUNK_SIZE_DEFAULT;
+    dtl_handle->remote = FI_ADDR_UNSPEC;
+
+    rc = fabric_open (ctx, dtl_handle);
+    if (DYAD_IS_ERROR (rc)) {
+        goto dtl_fabric_init_region_finish;
+    }
+    // The header of RMA transfers lives right after the data, so that a
+    // single registration covers both
+    buf_size = dtl_handle->max_transfer_size + sizeof (struct dyad_fabric_hdr);
+    if (posix_memalign (&(dtl_handle->net_buf), sysconf (_SC_PAGESIZE), buf_size) != 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate the libfabric DTL buffer");
+        dtl_handle->net_buf = NULL;
+        rc = DYAD_RC_SYSFAIL;
+        goto dtl_fabric_init_region_finish;
+    }
+    dtl_handle->hdr = (struct dyad_fabric_hdr*)((char*)dtl_handle->net_buf
+                                                + dtl_handle->max_transfer_size);
+    rc = fabric_register (ctx,
+                          dtl_handle,
+                          dtl_handle->net_buf,
+                          buf_size,
+                          (comm_mode == DYAD_COMM_RECV) ? (FI_RECV | FI_REMOTE_WRITE)
+                                                        : (FI_SEND | FI_WRITE),
+                          DYAD_FABRIC_KEY_NET_BUF,
+                          &(dtl_handle->mr));
+    if (DYAD_IS_ERROR (rc)) {
+        goto dtl_fabric_init_region_finish;
+    }
+
+    ctx->dtl_handle->rpc_pack = dyad_dtl_fabric_rpc_pack;
+    ctx->dtl_handle->rpc_unpack = dyad_dtl_fabric_rpc_unpack;
+    ctx->dtl_handle->rpc_respond = dyad_dtl_fabric_rpc_respond;
+    ctx->dtl_handle->rpc_recv_response = dyad_dtl_fabric_rpc_recv_response;
+    ctx->dtl_handle->get_buffer = dyad_dtl_fabric_get_buffer;
+    ctx->dtl_handle->return_buffer = dyad_dtl_fabric_return_buffer;
+    ctx->dtl_handle->establish_connection = dyad_dtl_fabric_establish_connection;
+    ctx->dtl_handle->send = dyad_dtl_fabric_send;
+    ctx->dtl_handle->recv = dyad_dtl_fabric_recv;
+    ctx->dtl_handle->recv_file = NULL;
+    ctx->dtl_handle->close_connection = dyad_dtl_fabric_close_connection;
+    ctx->dtl_handle->send_file = NULL;
+    ctx->dtl_handle->disconnect = NULL;
+    ctx->dtl_handle->caps = dtl_handle->rma ? (DYAD_DTL_CAP_RMA | DYAD_DTL_CAP_CHUNKING) : 0ul;
+    rc = DYAD_RC_OK;
+
+dtl_fabric_init_region_finish:;
+    if (DYAD_IS_ERROR (rc) && dtl_handle != NULL) {
+        dyad_dtl_fabric_finalize (ctx);
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_rpc_pack (const dyad_ctx_t* ctx,
+                                    const char* restrict upath,
+                                    uint32_t producer_rank,
+                                    json_t** restrict packed_obj)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
+    DYAD_C_FUNCTION_UPDATE_INT ("producer_rank", producer_rank);
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    size_t enc_len = 0ul;
+    char* enc_buf = NULL;
+    ssize_t enc_size = 0;
+    uint64_t buf_addr = 0ul;
+
+    // A request that failed before its answer came must not get this one's
+    fabric_cancel_recv (ctx, dtl_handle);
+    dtl_handle->tag = ((uint64_t)ctx->pid << 32) | (uint64_t)(++dtl_handle->seq);
+    rc = fabric_post_recv (ctx, dtl_handle);
+    if (DYAD_IS_ERROR (rc)) {
+        goto dtl_fabric_rpc_pack_region_finish;
+    }
+
+    enc_len = base64_encoded_length (dtl_handle->local_addr_len);
+    // Add 1 to encoded length because the encoded buffer will be
+    // packed as if it is a string
+    enc_buf = malloc (enc_len + 1);
+    if (enc_buf == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not allocate buffer for packed address");
+        rc = DYAD_RC_SYSFAIL;
+        goto dtl_fabric_rpc_pack_region_finish;
+    }
+    enc_size = base64_encode_using_maps (&base64_maps_rfc4648,
+                                         enc_buf,
+                                         enc_len + 1,
+                                         dtl_handle->local_addr,
+                                         dtl_handle->local_addr_len);
+    if (enc_size < 0) {
+        DYAD_LOG_ERROR (ctx, "Unable to encode libfabric address");
+        rc = DYAD_RC_BADPACK;
+        goto dtl_fabric_rpc_pack_region_finish;
+    }
+    // Without FI_MR_VIRT_ADDR, RMA addresses are offsets into the region
+    if (dtl_handle->info->domain_attr->mr_mode & FI_MR_VIRT_ADDR) {
+        buf_addr = (uint64_t)(uintptr_t)dtl_handle->net_buf;
+    }
+    *packed_obj = json_pack ("{s:s, s:s%, s:I, s:b, s:I, s:I, s:I}",
+                             "upath",
+                             upath,
+                             "fi_addr",
+                             enc_buf,
+                             enc_len,
+                             "fi_tag",
+                             (json_int_t)dtl_handle->tag,
+                             "fi_rma",
+                             dtl_handle->rma,
+                             "fi_buf",
+                             (json_int_t)buf_addr,
+                             "fi_key",
+                             (json_int_t)fi_mr_key (dtl_handle->mr),
+                             "fi_cap",
+                             (json_int_t)dtl_handle->max_transfer_size);
+    if (*packed_obj == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not pack upath and libfabric address for RPC");
+        rc = DYAD_RC_BADPACK;
+        goto dtl_fabric_rpc_pack_region_finish;
+    }
+    rc = DYAD_RC_OK;
+
+dtl_fabric_rpc_pack_region_finish:;
+    free (enc_buf);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_rpc_unpack (const dyad_ctx_t* ctx, const flux_msg_t* msg, char** upath)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    json_int_t tag = 0;
+    json_int_t buf_addr = 0;
+    json_int_t key = 0;
+    json_int_t cap = 0;
+    int rma = 0;
+    if (flux_request_unpack (msg,
+                             NULL,
+                             "{s:s, s:s%, s:I, s:b, s:I, s:I, s:I}",
+                             "upath",
+                             upath,
+                             "fi_addr",
+                             &(dtl_handle->remote_addr),
+                             &(dtl_handle->remote_addr_len),
+                             "fi_tag",
+                             &tag,
+                             "fi_rma",
+                             &rma,
+                             "fi_buf",
+                             &buf_addr,
+                             "fi_key",
+                             &key,
+                             "fi_cap",
+                             &cap)
+        < 0) {
+        DYAD_LOG_ERROR (ctx, "Could not unpack Flux message from consumer");
+        rc = DYAD_RC_BADUNPACK;
+        goto dtl_fabric_rpc_unpack_region_finish;
+    }
+    dtl_handle->tag = (uint64_t)tag;
+    dtl_handle->remote_rma = (rma != 0);
+    dtl_handle->remote_buf = (uint64_t)buf_addr;
+    dtl_handle->remote_key = (uint64_t)key;
+    dtl_handle->remote_cap = (uint64_t)cap;
+    if (dtl_handle->remote_rma && !dtl_handle->rma) {
+        DYAD_LOG_ERROR (ctx, "Consumer asked for RMA, which our libfabric provider lacks");
+        rc = DYAD_RC_FABRICCOMM_FAIL;
+        goto dtl_fabric_rpc_unpack_region_finish;
+    }
+    DYAD_C_FUNCTION_UPDATE_STR ("upath", *upath);
+    DYAD_LOG_INFO (ctx, "Consumer of %s waits on tag %" PRIu64 " (RMA %s)", \
+                   *upath, dtl_handle->tag, dtl_handle->remote_rma ? "on" : "off");
+    rc = DYAD_RC_OK;
+dtl_fabric_rpc_unpack_region_finish:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_rpc_respond (const dyad_ctx_t* ctx, const flux_msg_t* orig_msg)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_fabric_rpc_recv_response (const dyad_ctx_t* ctx, flux_future_t* f)
+{
+    DYAD_C_FUNCTION_START();
+    ctx->dtl_handle->private_dtl.fabric_dtl_handle->f = f;
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_fabric_get_buffer (const dyad_ctx_t* ctx, size_t data_size, void** data_buf)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    if (data_buf == NULL) {
+        rc = DYAD_RC_BADBUF;
+        goto fabric_get_buffer_done;
+    }
+    if (data_size > dtl_handle->max_transfer_size) {
+        DYAD_LOG_ERROR (ctx, "Requested a data size that's larger than the libfabric buffer");
+        rc = DYAD_RC_BADBUF;
+        goto fabric_get_buffer_done;
+    }
+    // Already registered, so sends and RMA writes need no extra registration
+    *data_buf = dtl_handle->net_buf;
+    rc = DYAD_RC_OK;
+
+fabric_get_buffer_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_return_buffer (const dyad_ctx_t* ctx, void** data_buf)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    if (data_buf == NULL || *data_buf == NULL) {
+        rc = DYAD_RC_BADBUF;
+        goto fabric_return_buffer_done;
+    }
+    *data_buf = NULL;
+
+fabric_return_buffer_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_establish_connection (const dyad_ctx_t* ctx)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    struct dyad_fabric_peer* peer = NULL;
+    char addr[DYAD_FABRIC_ADDR_MAX];
+    ssize_t addr_len = 0;
+    int ret = 0;
+    if (dtl_handle->comm_mode != DYAD_COMM_SEND) {
+        // Producers address consumers, so there is nothing to set up here
+        rc = DYAD_RC_OK;
+        goto dtl_fabric_establish_connection_region_finish;
+    }
+    if (dtl_handle->remote_addr == NULL
+        || base64_decoded_length (dtl_handle->remote_addr_len) > sizeof (addr)) {
+        DYAD_LOG_ERROR (ctx, "No valid libfabric address for the consumer");
+        rc = DYAD_RC_BAD_B64DECODE;
+        goto dtl_fabric_establish_connection_region_finish;
+    }
+    addr_len = base64_decode_using_maps (&base64_maps_rfc4648,
+                                         addr,
+                                         sizeof (addr),
+                                         dtl_handle->remote_addr,
+                                         dtl_handle->remote_addr_len);
+    if (addr_len < 0) {
+        DYAD_LOG_ERROR (ctx, "Failed to decode the consumer's libfabric address");
+        rc = DYAD_RC_BAD_B64DECODE;
+        goto dtl_fabric_establish_connection_region_finish;
+    }
+    for (peer = dtl_handle->peers; peer != NULL; peer = peer->next) {
+        if (peer->addr_len == (size_t)addr_len && memcmp (peer->addr, addr, peer->addr_len) == 0) {
+            break;
+        }
+    }
+    if (peer == NULL) {
+        peer = malloc (sizeof (struct dyad_fabric_peer));
+        if (peer == NULL) {
+            rc = DYAD_RC_SYSFAIL;
+            goto dtl_fabric_establish_connection_region_finish;
+        }
+        memcpy (peer->addr, addr, (size_t)addr_len);
+        peer->addr_len = (size_t)addr_len;
+        ret = fi_av_insert (dtl_handle->av, peer->addr, 1ul, &(peer->fi_addr), 0ul, NULL);
+        if (ret != 1) {
+            DYAD_LOG_ERROR (ctx, "Cannot insert the consumer into the libfabric AV");
+            free (peer);
+            rc = DYAD_RC_FABRICCOMM_FAIL;
+            goto dtl_fabric_establish_connection_region_finish;
+        }
+        peer->next = dtl_handle->peers;
+        dtl_handle->peers = peer;
+    }
+    dtl_handle->remote = peer->fi_addr;
+    rc = DYAD_RC_OK;
+
+dtl_fabric_establish_connection_region_finish:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_send (const dyad_ctx_t* ctx, void* buf, size_t buflen)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    struct fid_mr* mr = NULL;
+    void* desc = NULL;
+    if (dtl_handle->remote == FI_ADDR_UNSPEC) {
+        DYAD_LOG_ERROR (ctx, "libfabric send invoked before the consumer was addressed");
+        rc = DYAD_RC_FABRICCOMM_FAIL;
+        goto dtl_fabric_send_region_finish;
+    }
+    if (buflen > dtl_handle->remote_cap) {
+        DYAD_LOG_ERROR (ctx, "Cannot send %zu bytes into a consumer buffer of %" PRIu64, \
+                        buflen, dtl_handle->remote_cap);
+        rc = DYAD_RC_BADBUF;
+        goto dtl_fabric_send_region_finish;
+    }
+    desc = fabric_desc (dtl_handle, buf, buflen);
+    if (desc == NULL && (dtl_handle->info->domain_attr->mr_mode & FI_MR_LOCAL)) {
+        // Not from get_buffer, so it has to be registered for this send
+        rc = fabric_register (ctx, dtl_handle, buf, buflen, FI_SEND | FI_WRITE,
+                              DYAD_FABRIC_KEY_SEND_BUF, &mr);
+        if (DYAD_IS_ERROR (rc)) {
+            goto dtl_fabric_send_region_finish;
+        }
+        desc = fi_mr_desc (mr);
+    }
+    if (dtl_handle->remote_rma) {
+        rc = fabric_write (ctx, dtl_handle, buf, buflen, desc);
+        if (DYAD_IS_ERROR (rc)) {
+            goto dtl_fabric_send_region_finish;
+        }
+        // The data is in place, tell the consumer how much of it there is
+        dtl_handle->hdr->len = (uint64_t)buflen;
+        rc = fabric_tsend (ctx,
+                           dtl_handle,
+                           dtl_handle->hdr,
+                           sizeof (struct dyad_fabric_hdr),
+                           fabric_desc (dtl_handle, dtl_handle->hdr, sizeof (struct dyad_fabric_hdr)));
+    } else {
+        if (buflen > dtl_handle->info->ep_attr->max_msg_size) {
+            DYAD_LOG_ERROR (ctx, "%zu bytes exceed the largest libfabric message without RMA", \
+                            buflen);
+            rc = DYAD_RC_BADBUF;
+            goto dtl_fabric_send_region_finish;
+        }
+        rc = fabric_tsend (ctx, dtl_handle, buf, buflen, desc);
+    }
+    if (DYAD_IS_ERROR (rc)) {
+        goto dtl_fabric_send_region_finish;
+    }
+    DYAD_LOG_INFO (ctx, "Sent %zu bytes to consumer with libfabric", buflen);
+    rc = DYAD_RC_OK;
+
+dtl_fabric_send_region_finish:;
+    if (mr != NULL) {
+        fi_close (&(mr->fid));
+    }
+    DYAD_C_FUNCTION_UPDATE_INT ("buflen", buflen);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_recv (const dyad_ctx_t* ctx, void** buf, size_t* buflen)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    struct fi_cq_tagged_entry comp;
+    *buf = NULL;
+    *buflen = 0ul;
+    if (!dtl_handle->posted) {
+        DYAD_LOG_ERROR (ctx, "libfabric recv invoked without a posted receive");
+        rc = DYAD_RC_FABRICCOMM_FAIL;
+        goto dtl_fabric_recv_region_finish;
+    }
+    memset (&comp, 0, sizeof (comp));
+    rc = fabric_wait (ctx, dtl_handle, 1ul, &comp);
+    if (rc != DYAD_RC_BADRPC) {
+        // Otherwise the receive is still pending and close_connection withdraws it
+        dtl_handle->posted = false;
+    }
+    if (DYAD_IS_ERROR (rc)) {
+        goto dtl_fabric_recv_region_finish;
+    }
+    *buflen = dtl_handle->rma ? (size_t)dtl_handle->hdr->len : comp.len;
+    if (*buflen > dtl_handle->max_transfer_size) {
+        DYAD_LOG_ERROR (ctx, "Producer announced %zu bytes, more than the libfabric buffer", \
+                        *buflen);
+        *buflen = 0ul;
+        rc = DYAD_RC_FABRICCOMM_FAIL;
+        goto dtl_fabric_recv_region_finish;
+    }
+    *buf = dtl_handle->net_buf;
+    DYAD_LOG_INFO (ctx, "Received %zu bytes from producer with libfabric", *buflen);
+    rc = DYAD_RC_OK;
+
+dtl_fabric_recv_region_finish:;
+    DYAD_C_FUNCTION_UPDATE_INT ("buflen", *buflen);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_fabric_close_connection (const dyad_ctx_t* ctx)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_dtl_fabric_t* dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    fabric_cancel_recv (ctx, dtl_handle);
+    // Consumers stay in the AV for the next request
+    dtl_handle->remote = FI_ADDR_UNSPEC;
+    dtl_handle->remote_addr = NULL;
+    dtl_handle->remote_addr_len = 0ul;
+    dtl_handle->f = NULL;
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_fabric_finalize (const dyad_ctx_t* ctx)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_fabric_t* dtl_handle = NULL;
+    struct dyad_fabric_peer* next = NULL;
+    if (ctx->dtl_handle == NULL || ctx->dtl_handle->private_dtl.fabric_dtl_handle == NULL) {
+        goto dtl_fabric_finalize_done;
+    }
+    dtl_handle = ctx->dtl_handle->private_dtl.fabric_dtl_handle;
+    if (dtl_handle->ep != NULL) {
+        fabric_cancel_recv (ctx, dtl_handle);
+    }
+    while (dtl_handle->peers != NULL) {
+        next = dtl_handle->peers->next;
+        free (dtl_handle->peers);
+        dtl_handle->peers = next;
+    }
+    // Close in the reverse order of opening
+    if (dtl_handle->mr != NULL) {
+        fi_close (&(dtl_handle->mr->fid));
+    }
+    if (dtl_handle->ep != NULL) {
+        fi_close (&(dtl_handle->ep->fid));
+    }
+    if (dtl_handle->av != NULL) {
+        fi_close (&(dtl_handle->av->fid));
+    }
+    if (dtl_handle->cq != NULL) {
+        fi_close (&(dtl_handle->cq->fid));
+    }
+    if (dtl_handle->domain != NULL) {
+        fi_close (&(dtl_handle->domain->fid));
+    }
+    if (dtl_handle->fabric != NULL) {
+        fi_close (&(dtl_handle->fabric->fid));
+    }
+    if (dtl_handle->info != NULL) {
+        fi_freeinfo (dtl_handle->info);
+    }
+    free (dtl_handle->net_buf);
+    // Flux handle should be released by the
+    // DYAD context, so it is not released here
+    free (dtl_handle);
+    ctx->dtl_handle->private_dtl.fabric_dtl_handle = NULL;
+dtl_fabric_finalize_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
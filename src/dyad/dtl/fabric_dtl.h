@@ -0,0 +1,101 @@
+#ifndef DYAD_DTL_FABRIC_H
+#define DYAD_DTL_FABRIC_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <rdma/fabric.h>
+#include <stdlib.h>
+
+#include <dyad/dtl/dyad_dtl_api.h>
+
+// Largest endpoint name we handle (e.g., a cxi, tcp or shm address)
+#define DYAD_FABRIC_ADDR_MAX 256
+// Maximum number of RMA writes in flight at any time
+#define DYAD_FABRIC_MAX_INFLIGHT 16
+
+// A consumer the producer has talked to before, and its handle in the AV
+struct dyad_fabric_peer {
+    char addr[DYAD_FABRIC_ADDR_MAX];
+    size_t addr_len;
+    fi_addr_t fi_addr;
+    struct dyad_fabric_peer* next;
+};
+
+// Sent by the producer once it has written the data of a transfer with RMA
+struct dyad_fabric_hdr {
+    uint64_t len;
+};
+
+struct dyad_dtl_fabric {
+    flux_t* h;
+    dyad_dtl_comm_mode_t comm_mode;
+    bool debug;
+    bool rma;                       // consumer asks producers to write with RMA
+    struct fi_info* info;
+    struct fid_fabric* fabric;
+    struct fid_domain* domain;
+    struct fid_av* av;
+    struct fid_cq* cq;
+    struct fid_ep* ep;
+    struct fid_mr* mr;              // registration of net_buf and hdr
+    void* net_buf;
+    size_t max_transfer_size;
+    size_t chunk_size;
+    struct dyad_fabric_hdr* hdr;    // just past net_buf, in the same registration
+    char local_addr[DYAD_FABRIC_ADDR_MAX];
+    size_t local_addr_len;
+    struct dyad_fabric_peer* peers;
+    // State of the ongoing transfer
+    uint64_t tag;
+    uint32_t seq;
+    bool posted;                    // consumer: a receive is posted for `tag'
+    struct fi_context recv_ctx;
+    struct fi_context send_ctx;
+    struct fi_context write_ctx[DYAD_FABRIC_MAX_INFLIGHT];
+    flux_future_t* f;               // consumer: future of the ongoing fetch
+    const char* remote_addr;        // producer: base64 name of the consumer
+    size_t remote_addr_len;
+    fi_addr_t remote;               // producer: the consumer in the AV
+    uint64_t remote_buf;            // producer: consumer buffer to write to, if RMA
+    uint64_t remote_key;
+    uint64_t remote_cap;
+    bool remote_rma;
+};
+
+typedef struct dyad_dtl_fabric dyad_dtl_fabric_t;
+
+dyad_rc_t dyad_dtl_fabric_init (const dyad_ctx_t* ctx,
+                                dyad_dtl_mode_t mode,
+                                dyad_dtl_comm_mode_t comm_mode,
+                                bool debug);
+
+dyad_rc_t dyad_dtl_fabric_rpc_pack (const dyad_ctx_t* ctx,
+                                    const char* restrict upath,
+                                    uint32_t producer_rank,
+                                    json_t** restrict packed_obj);
+
+dyad_rc_t dyad_dtl_fabric_rpc_unpack (const dyad_ctx_t* ctx, const flux_msg_t* msg, char** upath);
+
+dyad_rc_t dyad_dtl_fabric_rpc_respond (const dyad_ctx_t* ctx, const flux_msg_t* orig_msg);
+
+dyad_rc_t dyad_dtl_fabric_rpc_recv_response (const dyad_ctx_t* ctx, flux_future_t* f);
+
+dyad_rc_t dyad_dtl_fabric_get_buffer (const dyad_ctx_t* ctx, size_t data_size, void** data_buf);
+
+dyad_rc_t dyad_dtl_fabric_return_buffer (const dyad_ctx_t* ctx, void** data_buf);
+
+dyad_rc_t dyad_dtl_fabric_establish_connection (const dyad_ctx_t* ctx);
+
+dyad_rc_t dyad_dtl_fabric_send (const dyad_ctx_t* ctx, void* buf, size_t buflen);
+
+dyad_rc_t dyad_dtl_fabric_recv (const dyad_ctx_t* ctx, void** buf, size_t* buflen);
+
+dyad_rc_t dyad_dtl_fabric_close_connection (const dyad_ctx_t* ctx);
+
+dyad_rc_t dyad_dtl_fabric_finalize (const dyad_ctx_t* ctx);
+
+#endif /* DYAD_DTL_FABRIC_H */
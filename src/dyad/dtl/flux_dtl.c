@@ -7,6 +7,7 @@
 #include <dyad/dtl/flux_dtl.h>
 #include <dyad/common/dyad_logging.h>
 #include <dyad/common/dyad_profiler.h>
+#include <string.h> // memcpy
 #include <unistd.h> // sysconf
 
 dyad_rc_t dyad_dtl_flux_init (const dyad_ctx_t* ctx,
@@ -37,7 +38,11 @@ dyad_rc_t dyad_dtl_flux_init (const dyad_ctx_t* ctx,
     ctx->dtl_handle->establish_connection = dyad_dtl_flux_establish_connection;
     ctx->dtl_handle->send = dyad_dtl_flux_send;
     ctx->dtl_handle->recv = dyad_dtl_flux_recv;
+    ctx->dtl_handle->recv_file = NULL;
     ctx->dtl_handle->close_connection = dyad_dtl_flux_close_connection;
+    ctx->dtl_handle->send_file = NULL;
+    ctx->dtl_handle->disconnect = NULL;
+    ctx->dtl_handle->caps = 0ul;
 
 dtl_flux_init_region_finish:
     DYAD_C_FUNCTION_END();
@@ -0,0 +1,168 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/dtl/plugin_dtl.h>
+#include <dyad/common/dyad_envs.h>
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+// Build the file name of the plugin called `name' into `path'
+static void plugin_path (const char* name, char* path, size_t len)
+{
+    char lname[NAME_MAX + 1] = {'\0'};
+    const char* dir = getenv (DYAD_DTL_PLUGIN_DIR_ENV);
+    size_t i = 0ul;
+    if (strchr (name, '/') != NULL) {
+        snprintf (path, len, "%s", name);
+        return;
+    }
+    for (i = 0ul; name[i] != '\0' && i < NAME_MAX; i++) {
+        lname[i] = (char)tolower ((unsigned char)name[i]);
+    }
+    if (dir != NULL && dir[0] != '\0') {
+        snprintf (path, len, "%s/libdyad_dtl_%s.so", dir, lname);
+    } else {
+        snprintf (path, len, "libdyad_dtl_%s.so", lname);
+    }
+}
+
+// Check that the plugin is usable before calling into it
+static dyad_rc_t plugin_validate (const dyad_ctx_t* ctx, const struct dyad_dtl_plugin* ops)
+{
+    if (ops->abi_version != DYAD_DTL_PLUGIN_ABI_VERSION) {
+        DYAD_LOG_ERROR (ctx, "DTL plugin has ABI version %u instead of %u", \
+                        ops->abi_version, DYAD_DTL_PLUGIN_ABI_VERSION);
+        return DYAD_RC_BADDTLMODE;
+    }
+    if (ops->init == NULL || ops->finalize == NULL || ops->rpc_pack == NULL
+        || ops->rpc_unpack == NULL || ops->rpc_respond == NULL || ops->rpc_recv_response == NULL
+        || ops->get_buffer == NULL || ops->return_buffer == NULL
+        || ops->establish_connection == NULL || ops->send == NULL || ops->recv == NULL
+        || ops->close_connection == NULL) {
+        DYAD_LOG_ERROR (ctx, "DTL plugin %s does not define every required operation", \
+                        (ops->name != NULL) ? ops->name : "(unnamed)");
+        return DYAD_RC_BADDTLMODE;
+    }
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_plugin_init (const dyad_ctx_t* ctx,
+                                const char* name,
+                                dyad_dtl_comm_mode_t comm_mode,
+                                bool debug)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_STR ("name", name);
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_plugin_handle_t* dtl_handle = NULL;
+    const struct dyad_dtl_plugin* ops = NULL;
+    char path[PATH_MAX + 1] = {'\0'};
+
+    dtl_handle = malloc (sizeof (struct dyad_dtl_plugin_handle));
+    if (dtl_handle == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate the DTL plugin handle");
+        rc = DYAD_RC_SYSFAIL;
+        goto dtl_plugin_init_region_finish;
+    }
+    dtl_handle->dl = NULL;
+    dtl_handle->ops = NULL;
+    dtl_handle->state = NULL;
+    ctx->dtl_handle->private_dtl.plugin_dtl_handle = dtl_handle;
+
+    plugin_path (name, path, sizeof (path));
+    DYAD_LOG_INFO (ctx, "Loading DTL plugin %s", path);
+    dtl_handle->dl = dlopen (path, RTLD_NOW | RTLD_LOCAL);
+    if (dtl_handle->dl == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot load DTL plugin %s: %s", path, dlerror ());
+        rc = DYAD_RC_BADDTLMODE;
+        goto dtl_plugin_init_region_finish;
+    }
+    ops = (const struct dyad_dtl_plugin*)dlsym (dtl_handle->dl, DYAD_DTL_PLUGIN_SYMBOL);
+    if (ops == NULL) {
+        DYAD_LOG_ERROR (ctx, "%s does not export %s", path, DYAD_DTL_PLUGIN_SYMBOL);
+        rc = DYAD_RC_BADDTLMODE;
+        goto dtl_plugin_init_region_finish;
+    }
+    rc = plugin_validate (ctx, ops);
+    if (DYAD_IS_ERROR (rc)) {
+        goto dtl_plugin_init_region_finish;
+    }
+    dtl_handle->ops = ops;
+
+    ctx->dtl_handle->caps = ops->caps;
+    ctx->dtl_handle->rpc_pack = ops->rpc_pack;
+    ctx->dtl_handle->rpc_unpack = ops->rpc_unpack;
+    ctx->dtl_handle->rpc_respond = ops->rpc_respond;
+    ctx->dtl_handle->rpc_recv_response = ops->rpc_recv_response;
+    ctx->dtl_handle->get_buffer = ops->get_buffer;
+    ctx->dtl_handle->return_buffer = ops->return_buffer;
+    ctx->dtl_handle->establish_connection = ops->establish_connection;
+    ctx->dtl_handle->send = ops->send;
+    ctx->dtl_handle->recv = ops->recv;
+    ctx->dtl_handle->recv_file = NULL;
+    ctx->dtl_handle->close_connection = ops->close_connection;
+    ctx->dtl_handle->send_file = ops->send_file;
+    ctx->dtl_handle->disconnect = NULL;
+
+    rc = ops->init (ctx, comm_mode, debug, &(dtl_handle->state));
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "DTL plugin %s failed to initialize rc %d", ops->name, rc);
+        dtl_handle->ops = NULL;
+        goto dtl_plugin_init_region_finish;
+    }
+    DYAD_LOG_INFO (ctx, "Loaded DTL plugin %s (capabilities 0x%lx)", \
+                   ops->name, (unsigned long)ops->caps);
+    rc = DYAD_RC_OK;
+
+dtl_plugin_init_region_finish:;
+    if (DYAD_IS_ERROR (rc) && dtl_handle != NULL) {
+        dyad_dtl_plugin_finalize (ctx);
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_plugin_finalize (const dyad_ctx_t* ctx)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_plugin_handle_t* dtl_handle = NULL;
+    if (ctx->dtl_handle == NULL || ctx->dtl_handle->private_dtl.plugin_dtl_handle == NULL) {
+        goto dtl_plugin_finalize_done;
+    }
+    dtl_handle = ctx->dtl_handle->private_dtl.plugin_dtl_handle;
+    if (dtl_handle->ops != NULL) {
+        rc = dtl_handle->ops->finalize (ctx, dtl_handle->state);
+    }
+    // The DTL's functions live in the plugin, so they must not outlive it
+    if (dtl_handle->dl != NULL) {
+        dlclose (dtl_handle->dl);
+    }
+    free (dtl_handle);
+    ctx->dtl_handle->private_dtl.plugin_dtl_handle = NULL;
+dtl_plugin_finalize_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+void* dyad_dtl_plugin_state (const dyad_ctx_t* ctx)
+{
+    if (ctx == NULL || ctx->dtl_handle == NULL || ctx->dtl_handle->mode != DYAD_DTL_PLUGIN
+        || ctx->dtl_handle->private_dtl.plugin_dtl_handle == NULL) {
+        return NULL;
+    }
+    return ctx->dtl_handle->private_dtl.plugin_dtl_handle->state;
+}
+
+flux_t* dyad_dtl_plugin_flux (const dyad_ctx_t* ctx)
+{
+    return (ctx != NULL) ? (flux_t*)ctx->h : NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef DYAD_DTL_PLUGIN_H
+#define DYAD_DTL_PLUGIN_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <stdlib.h>
+
+#include <dyad/dtl/dyad_dtl_api.h>
+#include <dyad/dtl/dyad_dtl_plugin.h>
+
+struct dyad_dtl_plugin_handle {
+    void* dl;                             // from dlopen
+    const struct dyad_dtl_plugin* ops;    // exported by the plugin
+    void* state;                          // returned by ops->init
+};
+
+typedef struct dyad_dtl_plugin_handle dyad_dtl_plugin_handle_t;
+
+dyad_rc_t dyad_dtl_plugin_init (const dyad_ctx_t* ctx,
+                                const char* name,
+                                dyad_dtl_comm_mode_t comm_mode,
+                                bool debug);
+
+dyad_rc_t dyad_dtl_plugin_finalize (const dyad_ctx_t* ctx);
+
+#endif /* DYAD_DTL_PLUGIN_H */
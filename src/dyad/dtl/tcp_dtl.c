@@ -0,0 +1,983 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  // _GNU_SOURCE
+
+#include <dyad/dtl/tcp_dtl.h>
+#include <dyad/common/dyad_envs.h>
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Give up on a peer that makes no progress for this long
+#define DYAD_TCP_TIMEOUT_SEC 30
+// Granularity at which a waiting consumer checks its RPC for errors
+#define DYAD_TCP_POLL_MS 100
+
+// Sent by the producer in front of every transfer
+struct dyad_tcp_hdr {
+    uint64_t id;   // the "tcp_id" of the request being served (big endian)
+    uint64_t len;  // number of bytes that follow (big endian)
+};
+
+static int tcp_write_all (int fd, const void* buf, size_t len, int flags)
+{
+    const char* pos = (const char*)buf;
+    ssize_t n = 0l;
+    while (len > 0ul) {
+        n = send (fd, pos, len, flags | MSG_NOSIGNAL);
+        if (n < 0l) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        pos += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int tcp_read_all (int fd, void* buf, size_t len)
+{
+    char* pos = (char*)buf;
+    ssize_t n = 0l;
+    while (len > 0ul) {
+        n = recv (fd, pos, len, MSG_WAITALL);
+        if (n < 0l) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0l) {
+            // The peer closed the connection
+            errno = ECONNRESET;
+            return -1;
+        }
+        pos += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void tcp_set_options (int fd)
+{
+    int one = 1;
+    struct timeval tv = {DYAD_TCP_TIMEOUT_SEC, 0};
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+}
+
+static struct dyad_tcp_conn* tcp_pool_add (dyad_dtl_tcp_t* dtl_handle,
+                                           int fd,
+                                           const char* addr,
+                                           uint32_t rank)
+{
+    struct dyad_tcp_conn* conn = malloc (sizeof (struct dyad_tcp_conn));
+    if (conn == NULL) {
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->addr[0] = '\0';
+    if (addr != NULL) {
+        strncpy (conn->addr, addr, DYAD_TCP_ADDR_MAX - 1);
+        conn->addr[DYAD_TCP_ADDR_MAX - 1] = '\0';
+    }
+    conn->rank = rank;
+    // Newest first, so that a reconnecting peer replaces its old connection
+    conn->next = dtl_handle->pool;
+    dtl_handle->pool = conn;
+    return conn;
+}
+
+static struct dyad_tcp_conn* tcp_pool_find_addr (dyad_dtl_tcp_t* dtl_handle, const char* addr)
+{
+    struct dyad_tcp_conn* conn = dtl_handle->pool;
+    while (conn != NULL && strcmp (conn->addr, addr) != 0) {
+        conn = conn->next;
+    }
+    return conn;
+}
+
+static struct dyad_tcp_conn* tcp_pool_find_rank (dyad_dtl_tcp_t* dtl_handle, uint32_t rank)
+{
+    struct dyad_tcp_conn* conn = dtl_handle->pool;
+    while (conn != NULL && conn->rank != rank) {
+        conn = conn->next;
+    }
+    return conn;
+}
+
+// Close a connection and forget it, e.g., after an I/O error on it
+static void tcp_pool_drop (dyad_dtl_tcp_t* dtl_handle, struct dyad_tcp_conn* conn)
+{
+    struct dyad_tcp_conn** pos = &(dtl_handle->pool);
+    while (*pos != NULL && *pos != conn) {
+        pos = &((*pos)->next);
+    }
+    if (*pos != NULL) {
+        *pos = conn->next;
+    }
+    if (dtl_handle->conn == conn) {
+        dtl_handle->conn = NULL;
+    }
+    close (conn->fd);
+    free (conn);
+}
+
+// Open the socket producers connect to, and build the address advertised in
+// requests. DYAD_TCP_HOST and DYAD_TCP_PORT override the host name and the
+// ephemeral port, e.g., to pick a network interface.
+static dyad_rc_t tcp_listen (const dyad_ctx_t* ctx, dyad_dtl_tcp_t* dtl_handle)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof (sa);
+    char host[DYAD_TCP_ADDR_MAX - 8] = {'\0'};
+    char* e = NULL;
+    int one = 1;
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl (INADDR_ANY);
+    sa.sin_port = 0;
+    if ((e = getenv (DYAD_TCP_PORT_ENV))) {
+        sa.sin_port = htons ((uint16_t)strtoul (e, NULL, 10));
+    }
+    dtl_handle->listen_fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (dtl_handle->listen_fd < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot create a TCP socket: %s", strerror (errno));
+        rc = DYAD_RC_TCPCONN_FAIL;
+        goto tcp_listen_done;
+    }
+    setsockopt (dtl_handle->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    if (bind (dtl_handle->listen_fd, (struct sockaddr*)&sa, sizeof (sa)) < 0
+        || listen (dtl_handle->listen_fd, SOMAXCONN) < 0
+        || getsockname (dtl_handle->listen_fd, (struct sockaddr*)&sa, &sa_len) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot listen for TCP connections: %s", strerror (errno));
+        rc = DYAD_RC_TCPCONN_FAIL;
+        goto tcp_listen_done;
+    }
+    if ((e = getenv (DYAD_TCP_HOST_ENV))) {
+        strncpy (host, e, sizeof (host) - 1);
+    } else if (gethostname (host, sizeof (host) - 1) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot get the host name: %s", strerror (errno));
+        rc = DYAD_RC_TCPCONN_FAIL;
+        goto tcp_listen_done;
+    }
+    snprintf (dtl_handle->local_addr,
+              DYAD_TCP_ADDR_MAX,
+              "%s:%u",
+              host,
+              (unsigned)ntohs (sa.sin_port));
+    DYAD_LOG_INFO (ctx, "TCP DTL listens on %s", dtl_handle->local_addr);
+    rc = DYAD_RC_OK;
+
+tcp_listen_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+// Connect to the consumer at `addr' ("host:port") and introduce ourselves
+static struct dyad_tcp_conn* tcp_connect (const dyad_ctx_t* ctx,
+                                          dyad_dtl_tcp_t* dtl_handle,
+                                          const char* addr)
+{
+    DYAD_C_FUNCTION_START();
+    struct dyad_tcp_conn* conn = NULL;
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    struct addrinfo* ai = NULL;
+    char host[DYAD_TCP_ADDR_MAX] = {'\0'};
+    char* port = NULL;
+    uint32_t hello = htonl (dtl_handle->rank);
+    int fd = -1;
+
+    strncpy (host, addr, DYAD_TCP_ADDR_MAX - 1);
+    port = strrchr (host, ':');
+    if (port == NULL) {
+        DYAD_LOG_ERROR (ctx, "Invalid TCP address '%s'", addr);
+        goto tcp_connect_done;
+    }
+    *(port++) = '\0';
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo (host, port, &hints, &res) != 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot resolve TCP address '%s'", addr);
+        goto tcp_connect_done;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket (ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        tcp_set_options (fd);
+        if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close (fd);
+        fd = -1;
+    }
+    freeaddrinfo (res);
+    if (fd < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot connect to consumer at '%s': %s", addr, strerror (errno));
+        goto tcp_connect_done;
+    }
+    if (tcp_write_all (fd, &hello, sizeof (hello), 0) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot introduce producer to '%s': %s", addr, strerror (errno));
+        close (fd);
+        goto tcp_connect_done;
+    }
+    conn = tcp_pool_add (dtl_handle, fd, addr, 0u);
+    if (conn == NULL) {
+        close (fd);
+    }
+    DYAD_LOG_INFO (ctx, "Opened TCP connection to consumer at %s", addr);
+
+tcp_connect_done:;
+    DYAD_C_FUNCTION_END();
+    return conn;
+}
+
+// Wait until `fd' is readable. While waiting, watch the RPC of the ongoing
+// fetch, so that a producer-side failure is reported without waiting for
+// the timeout.
+static dyad_rc_t tcp_wait_readable (const dyad_ctx_t* ctx, dyad_dtl_tcp_t* dtl_handle, int fd)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int waited_ms = 0;
+    int n = 0;
+    while (waited_ms < DYAD_TCP_TIMEOUT_SEC * 1000) {
+        n = poll (&pfd, 1, DYAD_TCP_POLL_MS);
+        if (n > 0) {
+            return DYAD_RC_OK;
+        }
+        if (n < 0 && errno != EINTR) {
+            return DYAD_RC_TCPCOMM_FAIL;
+        }
+        waited_ms += DYAD_TCP_POLL_MS;
+        // The module only ends the stream early if it failed. ENODATA means
+        // it has sent everything, and the data is still on its way.
+        if (dtl_handle->f != NULL && flux_future_is_ready (dtl_handle->f)
+            && flux_rpc_get (dtl_handle->f, NULL) < 0 && errno != ENODATA) {
+            DYAD_LOG_ERROR (ctx, "Producer failed to serve the request (errno = %d)", errno);
+            return DYAD_RC_BADRPC;
+        }
+    }
+    DYAD_LOG_ERROR (ctx, "Timed out waiting for the producer");
+    return DYAD_RC_TCPCOMM_FAIL;
+}
+
+// Accept connections until the producer on `rank' has connected
+static dyad_rc_t tcp_accept_from (const dyad_ctx_t* ctx, dyad_dtl_tcp_t* dtl_handle, uint32_t rank)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    uint32_t hello = 0u;
+    int fd = -1;
+    dtl_handle->conn = NULL;
+    while (dtl_handle->conn == NULL) {
+        rc = tcp_wait_readable (ctx, dtl_handle, dtl_handle->listen_fd);
+        if (DYAD_IS_ERROR (rc)) {
+            goto tcp_accept_done;
+        }
+        fd = accept4 (dtl_handle->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            DYAD_LOG_ERROR (ctx, "Cannot accept TCP connection: %s", strerror (errno));
+            rc = DYAD_RC_TCPCONN_FAIL;
+            goto tcp_accept_done;
+        }
+        tcp_set_options (fd);
+        if (tcp_read_all (fd, &hello, sizeof (hello)) < 0) {
+            close (fd);
+            continue;
+        }
+        hello = ntohl (hello);
+        DYAD_LOG_INFO (ctx, "Accepted TCP connection from producer on rank %u", hello);
+        if (tcp_pool_add (dtl_handle, fd, NULL, hello) == NULL) {
+            close (fd);
+            rc = DYAD_RC_SYSFAIL;
+            goto tcp_accept_done;
+        }
+        if (hello == rank) {
+            dtl_handle->conn = dtl_handle->pool;
+        }
+    }
+    rc = DYAD_RC_OK;
+
+tcp_accept_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+static int tcp_send_hdr (int fd, uint64_t id, size_t len)
+{
+    struct dyad_tcp_hdr hdr;
+    hdr.id = htobe64 (id);
+    hdr.len = htobe64 ((uint64_t)len);
+    // The payload follows right away, so let it share the first segment
+    return tcp_write_all (fd, &hdr, sizeof (hdr), MSG_MORE);
+}
+
+static void tcp_job_free (struct dyad_tcp_job* job)
+{
+    if (job->fd >= 0) {
+        // Also drops the lock that kept writers away from the file
+        close (job->fd);
+    }
+    free (job->buf);
+    free (job);
+}
+
+// Send the header and the data of `job' over `conn'. Returns 0 on success,
+// and -1 with errno set otherwise.
+static int tcp_job_send (struct dyad_tcp_conn* conn, struct dyad_tcp_job* job)
+{
+    off_t offset = 0;
+    ssize_t n = 0l;
+    if (tcp_send_hdr (conn->fd, job->xfer_id, job->len) < 0) {
+        return -1;
+    }
+    if (job->fd < 0) {
+        return tcp_write_all (conn->fd, job->buf, job->len, 0);
+    }
+    while ((size_t)offset < job->len) {
+        n = sendfile (conn->fd, job->fd, &offset, job->len - (size_t)offset);
+        if (n < 0l && errno == EINTR)
+            continue;
+        if (n < 0l)
+            return -1;
+        if (n == 0l) {
+            // The file got shorter than its size
+            errno = EIO;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void tcp_job_run (dyad_dtl_tcp_t* dtl_handle, struct dyad_tcp_job* job)
+{
+    const dyad_ctx_t* ctx = &(dtl_handle->sender_ctx);
+    struct dyad_tcp_conn* conn = tcp_pool_find_addr (dtl_handle, job->addr);
+    bool pooled = (conn != NULL);
+    sigset_t pipe_set;
+    struct timespec no_wait = {0, 0};
+    for (;;) {
+        if (conn == NULL && (conn = tcp_connect (ctx, dtl_handle, job->addr)) == NULL) {
+            return;
+        }
+        if (tcp_job_send (conn, job) == 0) {
+            DYAD_LOG_INFO (ctx, "Sent %zu bytes to consumer at %s", job->len, job->addr);
+            return;
+        }
+        DYAD_LOG_ERROR (ctx, "Cannot send data to %s over TCP: %s", job->addr, strerror (errno));
+        if (errno == EPIPE) {
+            // sendfile has no MSG_NOSIGNAL, so clear the blocked SIGPIPE
+            sigemptyset (&pipe_set);
+            sigaddset (&pipe_set, SIGPIPE);
+            sigtimedwait (&pipe_set, NULL, &no_wait);
+        }
+        tcp_pool_drop (dtl_handle, conn);
+        conn = NULL;
+        // A pooled connection may have been closed by a restarted consumer,
+        // which then waits for a new one. Retry on that once.
+        if (!pooled) {
+            return;
+        }
+        pooled = false;
+    }
+}
+
+static void* tcp_sender_main (void* arg)
+{
+    dyad_dtl_tcp_t* dtl_handle = (dyad_dtl_tcp_t*)arg;
+    struct dyad_tcp_job* job = NULL;
+    sigset_t pipe_set;
+    // Keep a consumer that went away from killing the broker with SIGPIPE
+    sigemptyset (&pipe_set);
+    sigaddset (&pipe_set, SIGPIPE);
+    pthread_sigmask (SIG_BLOCK, &pipe_set, NULL);
+    for (;;) {
+        pthread_mutex_lock (&dtl_handle->lock);
+        while (dtl_handle->jobs == NULL && !dtl_handle->stop) {
+            pthread_cond_wait (&dtl_handle->wake, &dtl_handle->lock);
+        }
+        // Queued transfers are made before stopping
+        if ((job = dtl_handle->jobs) == NULL) {
+            pthread_mutex_unlock (&dtl_handle->lock);
+            break;
+        }
+        if ((dtl_handle->jobs = job->next) == NULL) {
+            dtl_handle->jobs_tail = NULL;
+        }
+        pthread_mutex_unlock (&dtl_handle->lock);
+        tcp_job_run (dtl_handle, job);
+        tcp_job_free (job);
+    }
+    return NULL;
+}
+
+// Queue a transfer to the consumer of the request being served. On success,
+// `fd' or `buf' belongs to the sender thread.
+static dyad_rc_t tcp_enqueue (const dyad_ctx_t* ctx,
+                              dyad_dtl_tcp_t* dtl_handle,
+                              int fd,
+                              void* buf,
+                              size_t len)
+{
+    struct dyad_tcp_job* job = NULL;
+    if (dtl_handle->remote_addr == NULL) {
+        DYAD_LOG_ERROR (ctx, "No consumer address to send to");
+        return DYAD_RC_TCPCONN_FAIL;
+    }
+    job = malloc (sizeof (struct dyad_tcp_job));
+    if (job == NULL) {
+        return DYAD_RC_SYSFAIL;
+    }
+    strncpy (job->addr, dtl_handle->remote_addr, DYAD_TCP_ADDR_MAX - 1);
+    job->addr[DYAD_TCP_ADDR_MAX - 1] = '\0';
+    job->xfer_id = dtl_handle->xfer_id;
+    job->fd = fd;
+    job->buf = buf;
+    job->len = len;
+    job->next = NULL;
+    pthread_mutex_lock (&dtl_handle->lock);
+    if (dtl_handle->jobs_tail != NULL) {
+        dtl_handle->jobs_tail->next = job;
+    } else {
+        dtl_handle->jobs = job;
+    }
+    dtl_handle->jobs_tail = job;
+    pthread_cond_signal (&dtl_handle->wake);
+    pthread_mutex_unlock (&dtl_handle->lock);
+    return DYAD_RC_OK;
+}
+
+static dyad_rc_t tcp_sender_start (const dyad_ctx_t* ctx, dyad_dtl_tcp_t* dtl_handle)
+{
+    dtl_handle->sender_ctx = *ctx;
+    dtl_handle->sender_ctx.h = flux_open (NULL, 0);
+    if (dtl_handle->sender_ctx.h == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot open a Flux handle for the TCP sender thread");
+        return DYAD_RC_FLUXFAIL;
+    }
+    if (pthread_create (&dtl_handle->sender, NULL, tcp_sender_main, dtl_handle) != 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot start the TCP sender thread");
+        return DYAD_RC_SYSFAIL;
+    }
+    dtl_handle->sender_started = true;
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_tcp_init (const dyad_ctx_t* ctx,
+                             dyad_dtl_mode_t mode,
+                             dyad_dtl_comm_mode_t comm_mode,
+                             bool debug)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = NULL;
+    ctx->dtl_handle->private_dtl.tcp_dtl_handle = malloc (sizeof (struct dyad_dtl_tcp));
+    if (ctx->dtl_handle->private_dtl.tcp_dtl_handle == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate the TCP DTL handle");
+        rc = DYAD_RC_SYSFAIL;
+        goto dtl_tcp_init_region_finish;
+    }
+    dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    dtl_handle->h = (flux_t*)ctx->h;
+    dtl_handle->comm_mode = comm_mode;
+    dtl_handle->debug = debug;
+    dtl_handle->rank = 0u;
+    dtl_handle->listen_fd = -1;
+    dtl_handle->local_addr[0] = '\0';
+    dtl_handle->pool = NULL;
+    dtl_handle->conn = NULL;
+    dtl_handle->remote_addr = NULL;
+    dtl_handle->producer_rank = 0u;
+    dtl_handle->f = NULL;
+    dtl_handle->xfer_id = 0ul;
+    dtl_handle->next_xfer_id = ((uint64_t)ctx->pid << 32);
+    dtl_handle->pipe_fds[0] = -1;
+    dtl_handle->pipe_fds[1] = -1;
+    dtl_handle->sender_started = false;
+    pthread_mutex_init (&dtl_handle->lock, NULL);
+    pthread_cond_init (&dtl_handle->wake, NULL);
+    dtl_handle->stop = false;
+    dtl_handle->jobs = NULL;
+    dtl_handle->jobs_tail = NULL;
+    dtl_handle->handed_off = NULL;
+    dtl_handle->sender_ctx.h = NULL;
+
+    if (flux_get_rank (dtl_handle->h, &(dtl_handle->rank)) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot get the broker rank for the TCP DTL");
+        rc = DYAD_RC_FLUXFAIL;
+        goto dtl_tcp_init_region_finish;
+    }
+    if (comm_mode == DYAD_COMM_RECV) {
+        rc = tcp_listen (ctx, dtl_handle);
+        if (DYAD_IS_ERROR (rc)) {
+            goto dtl_tcp_init_region_finish;
+        }
+    } else if (comm_mode == DYAD_COMM_SEND) {
+        rc = tcp_sender_start (ctx, dtl_handle);
+        if (DYAD_IS_ERROR (rc)) {
+            goto dtl_tcp_init_region_finish;
+        }
+    }
+
+    ctx->dtl_handle->rpc_pack = dyad_dtl_tcp_rpc_pack;
+    ctx->dtl_handle->rpc_unpack = dyad_dtl_tcp_rpc_unpack;
+    ctx->dtl_handle->rpc_respond = dyad_dtl_tcp_rpc_respond;
+    ctx->dtl_handle->rpc_recv_response = dyad_dtl_tcp_rpc_recv_response;
+    ctx->dtl_handle->get_buffer = dyad_dtl_tcp_get_buffer;
+    ctx->dtl_handle->return_buffer = dyad_dtl_tcp_return_buffer;
+    ctx->dtl_handle->establish_connection = dyad_dtl_tcp_establish_connection;
+    ctx->dtl_handle->send = dyad_dtl_tcp_send;
+    ctx->dtl_handle->recv = dyad_dtl_tcp_recv;
+    ctx->dtl_handle->recv_file = dyad_dtl_tcp_recv_file;
+    ctx->dtl_handle->close_connection = dyad_dtl_tcp_close_connection;
+    ctx->dtl_handle->send_file = dyad_dtl_tcp_send_file;
+    ctx->dtl_handle->disconnect = NULL;
+    ctx->dtl_handle->caps = DYAD_DTL_CAP_ZERO_COPY;
+    rc = DYAD_RC_OK;
+
+dtl_tcp_init_region_finish:;
+    if (DYAD_IS_ERROR (rc) && dtl_handle != NULL) {
+        dyad_dtl_tcp_finalize (ctx);
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_rpc_pack (const dyad_ctx_t* ctx,
+                                 const char* restrict upath,
+                                 uint32_t producer_rank,
+                                 json_t** restrict packed_obj)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
+    DYAD_C_FUNCTION_UPDATE_INT ("producer_rank", producer_rank);
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    if (dtl_handle->listen_fd < 0) {
+        DYAD_LOG_ERROR (ctx, "Tried to pack an RPC payload without a TCP address");
+        rc = DYAD_RC_BADPACK;
+        goto dtl_tcp_rpc_pack_region_finish;
+    }
+    // Each request gets its own id, so that data left over from an earlier,
+    // failed request is never taken for the answer to this one
+    dtl_handle->producer_rank = producer_rank;
+    dtl_handle->xfer_id = ++(dtl_handle->next_xfer_id);
+    *packed_obj = json_pack ("{s:s, s:s, s:I}",
+                             "upath",
+                             upath,
+                             "tcp_addr",
+                             dtl_handle->local_addr,
+                             "tcp_id",
+                             (json_int_t)dtl_handle->xfer_id);
+    if (*packed_obj == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not pack upath and TCP address for RPC");
+        rc = DYAD_RC_BADPACK;
+        goto dtl_tcp_rpc_pack_region_finish;
+    }
+    rc = DYAD_RC_OK;
+dtl_tcp_rpc_pack_region_finish:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_rpc_unpack (const dyad_ctx_t* ctx, const flux_msg_t* msg, char** upath)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    json_int_t id = 0;
+    if (flux_request_unpack (msg,
+                             NULL,
+                             "{s:s, s:s, s:I}",
+                             "upath",
+                             upath,
+                             "tcp_addr",
+                             &(dtl_handle->remote_addr),
+                             "tcp_id",
+                             &id)
+        < 0) {
+        DYAD_LOG_ERROR (ctx, "Could not unpack Flux message from consumer");
+        rc = DYAD_RC_BADUNPACK;
+        goto dtl_tcp_rpc_unpack_region_finish;
+    }
+    dtl_handle->xfer_id = (uint64_t)id;
+    DYAD_C_FUNCTION_UPDATE_STR ("upath", *upath);
+    DYAD_LOG_INFO (ctx, "Consumer of %s waits at %s", *upath, dtl_handle->remote_addr);
+    rc = DYAD_RC_OK;
+dtl_tcp_rpc_unpack_region_finish:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_rpc_respond (const dyad_ctx_t* ctx, const flux_msg_t* orig_msg)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_tcp_rpc_recv_response (const dyad_ctx_t* ctx, flux_future_t* f)
+{
+    DYAD_C_FUNCTION_START();
+    ctx->dtl_handle->private_dtl.tcp_dtl_handle->f = f;
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_tcp_get_buffer (const dyad_ctx_t* ctx, size_t data_size, void** data_buf)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    if (data_buf == NULL || *data_buf != NULL) {
+        rc = DYAD_RC_BADBUF;
+        goto tcp_get_buf_done;
+    }
+    if (posix_memalign (data_buf, sysconf (_SC_PAGESIZE), data_size) != 0
+        || *data_buf == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto tcp_get_buf_done;
+    }
+    rc = DYAD_RC_OK;
+
+tcp_get_buf_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_return_buffer (const dyad_ctx_t* ctx, void** data_buf)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    if (data_buf == NULL || *data_buf == NULL) {
+        rc = DYAD_RC_BADBUF;
+        goto tcp_ret_buf_done;
+    }
+    if (*data_buf == dtl_handle->handed_off) {
+        // The sender thread frees it once it is sent
+        dtl_handle->handed_off = NULL;
+        *data_buf = NULL;
+        goto tcp_ret_buf_done;
+    }
+    free (*data_buf);
+    *data_buf = NULL;
+    rc = DYAD_RC_OK;
+
+tcp_ret_buf_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_establish_connection (const dyad_ctx_t* ctx)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    if (dtl_handle->comm_mode != DYAD_COMM_SEND) {
+        // Producers connect to consumers, so recv picks the connection up
+        rc = DYAD_RC_OK;
+        goto tcp_establish_done;
+    }
+    // The sender thread connects, so that the reactor never blocks on it
+    if (dtl_handle->remote_addr == NULL) {
+        DYAD_LOG_ERROR (ctx, "No consumer address to connect to");
+        rc = DYAD_RC_TCPCONN_FAIL;
+        goto tcp_establish_done;
+    }
+    rc = DYAD_RC_OK;
+
+tcp_establish_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_send (const dyad_ctx_t* ctx, void* buf, size_t buflen)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_INT ("buflen", buflen);
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    DYAD_LOG_INFO (ctx, "Queue %zu bytes for the consumer at %s", buflen, dtl_handle->remote_addr);
+    rc = tcp_enqueue (ctx, dtl_handle, -1, buf, buflen);
+    if (!DYAD_IS_ERROR (rc)) {
+        dtl_handle->handed_off = buf;
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_send_file (const dyad_ctx_t* ctx, int fd, size_t file_size)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_INT ("file_size", file_size);
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    struct flock lock;
+    // The caller closes `fd' once we return, but the sender thread reads the
+    // file later. Hold a lock of our own until it is done. It must be an open
+    // file description lock: closing any descriptor of the file drops the
+    // process' traditional locks.
+    int send_fd = dup (fd);
+    if (send_fd < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot duplicate file descriptor: %s", strerror (errno));
+        rc = DYAD_RC_SYSFAIL;
+        goto tcp_send_file_done;
+    }
+    memset (&lock, 0, sizeof (lock));
+    lock.l_type = F_RDLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl (send_fd, F_OFD_SETLKW, &lock) == -1) {
+        DYAD_LOG_ERROR (ctx, "Cannot lock file for sending: %s", strerror (errno));
+        rc = DYAD_RC_BADFIO;
+        goto tcp_send_file_done;
+    }
+    DYAD_LOG_INFO (ctx, "Queue %zu bytes of file for the consumer at %s", file_size,
+                   dtl_handle->remote_addr);
+    rc = tcp_enqueue (ctx, dtl_handle, send_fd, NULL, file_size);
+    if (!DYAD_IS_ERROR (rc)) {
+        send_fd = -1;
+    }
+
+tcp_send_file_done:;
+    if (send_fd >= 0) {
+        close (send_fd);
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+// Wait for the producer of the request to start its transfer, and read the
+// header. On success, `dtl_handle->conn' is the connection the data follows on.
+static dyad_rc_t tcp_recv_hdr (const dyad_ctx_t* ctx, dyad_dtl_tcp_t* dtl_handle, size_t* len)
+{
+    struct dyad_tcp_hdr hdr;
+    bool pooled = false;
+    dyad_rc_t rc = DYAD_RC_OK;
+
+    dtl_handle->conn = tcp_pool_find_rank (dtl_handle, dtl_handle->producer_rank);
+    pooled = (dtl_handle->conn != NULL);
+    for (;;) {
+        if (dtl_handle->conn == NULL) {
+            rc = tcp_accept_from (ctx, dtl_handle, dtl_handle->producer_rank);
+            if (DYAD_IS_ERROR (rc)) {
+                return rc;
+            }
+        }
+        rc = tcp_wait_readable (ctx, dtl_handle, dtl_handle->conn->fd);
+        if (DYAD_IS_ERROR (rc)) {
+            return rc;
+        }
+        if (tcp_read_all (dtl_handle->conn->fd, &hdr, sizeof (hdr)) == 0) {
+            break;
+        }
+        // A pooled connection may have been closed by a restarted producer,
+        // which then opens a new one. Fall back to that once.
+        tcp_pool_drop (dtl_handle, dtl_handle->conn);
+        dtl_handle->conn = NULL;
+        if (!pooled) {
+            DYAD_LOG_ERROR (ctx, "Cannot read from producer: %s", strerror (errno));
+            return DYAD_RC_TCPCOMM_FAIL;
+        }
+        pooled = false;
+    }
+    if (be64toh (hdr.id) != dtl_handle->xfer_id) {
+        DYAD_LOG_ERROR (ctx, "Got TCP transfer %" PRIu64 " instead of %" PRIu64, \
+                        be64toh (hdr.id), dtl_handle->xfer_id);
+        tcp_pool_drop (dtl_handle, dtl_handle->conn);
+        dtl_handle->conn = NULL;
+        return DYAD_RC_TCPCOMM_FAIL;
+    }
+    *len = (size_t)be64toh (hdr.len);
+    return DYAD_RC_OK;
+}
+
+// Move `len' bytes from the connection into `fd' through a pipe, without
+// copying them to user space. Returns 0 on success, and -1 with errno set.
+static int tcp_splice_to (const dyad_ctx_t* ctx, dyad_dtl_tcp_t* dtl_handle, int fd, size_t len)
+{
+    size_t left = len;
+    size_t in_pipe = 0ul;
+    ssize_t n = 0l;
+    if (dtl_handle->pipe_fds[0] < 0 && pipe2 (dtl_handle->pipe_fds, O_CLOEXEC) < 0) {
+        dtl_handle->pipe_fds[0] = dtl_handle->pipe_fds[1] = -1;
+        return -1;
+    }
+    while (left > 0ul) {
+        if (tcp_wait_readable (ctx, dtl_handle, dtl_handle->conn->fd) != DYAD_RC_OK) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        n = splice (dtl_handle->conn->fd, NULL, dtl_handle->pipe_fds[1], NULL, left, \
+                    SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+        if (n < 0l && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n < 0l)
+            return -1;
+        if (n == 0l) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        left -= (size_t)n;
+        in_pipe = (size_t)n;
+        while (in_pipe > 0ul) {
+            n = splice (dtl_handle->pipe_fds[0], NULL, fd, NULL, in_pipe, \
+                        SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0l && errno == EINTR)
+                continue;
+            if (n <= 0l)
+                return -1;
+            in_pipe -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+dyad_rc_t dyad_dtl_tcp_recv (const dyad_ctx_t* ctx, void** buf, size_t* buflen)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    *buf = NULL;
+    *buflen = 0ul;
+
+    rc = tcp_recv_hdr (ctx, dtl_handle, buflen);
+    if (DYAD_IS_ERROR (rc)) {
+        goto tcp_recv_done;
+    }
+    rc = ctx->dtl_handle->get_buffer (ctx, *buflen, buf);
+    if (DYAD_IS_ERROR (rc)) {
+        tcp_pool_drop (dtl_handle, dtl_handle->conn);
+        *buf = NULL;
+        *buflen = 0ul;
+        goto tcp_recv_done;
+    }
+    // Straight from the socket into the buffer the file is stored from
+    if (tcp_read_all (dtl_handle->conn->fd, *buf, *buflen) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot read %zu bytes from producer: %s", *buflen, strerror (errno));
+        tcp_pool_drop (dtl_handle, dtl_handle->conn);
+        ctx->dtl_handle->return_buffer (ctx, buf);
+        *buflen = 0ul;
+        rc = DYAD_RC_TCPCOMM_FAIL;
+        goto tcp_recv_done;
+    }
+    DYAD_LOG_INFO (ctx, "Received %zu bytes from producer over TCP", *buflen);
+    rc = DYAD_RC_OK;
+
+tcp_recv_done:;
+    DYAD_C_FUNCTION_UPDATE_INT ("buflen", *buflen);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_recv_file (const dyad_ctx_t* ctx, int fd, size_t* file_len)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    *file_len = 0ul;
+
+    rc = tcp_recv_hdr (ctx, dtl_handle, file_len);
+    if (DYAD_IS_ERROR (rc)) {
+        goto tcp_recv_file_done;
+    }
+    if (tcp_splice_to (ctx, dtl_handle, fd, *file_len) < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot splice %zu bytes from producer into file: %s", \
+                        *file_len, strerror (errno));
+        // Whatever is left in the pipe or on the connection belongs to this
+        // transfer, so neither can be reused
+        close (dtl_handle->pipe_fds[0]);
+        close (dtl_handle->pipe_fds[1]);
+        dtl_handle->pipe_fds[0] = dtl_handle->pipe_fds[1] = -1;
+        tcp_pool_drop (dtl_handle, dtl_handle->conn);
+        dtl_handle->conn = NULL;
+        *file_len = 0ul;
+        rc = DYAD_RC_TCPCOMM_FAIL;
+        goto tcp_recv_file_done;
+    }
+    DYAD_LOG_INFO (ctx, "Spliced %zu bytes from producer into file", *file_len);
+    rc = DYAD_RC_OK;
+
+tcp_recv_file_done:;
+    DYAD_C_FUNCTION_UPDATE_INT ("file_len", *file_len);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_tcp_close_connection (const dyad_ctx_t* ctx)
+{
+    DYAD_C_FUNCTION_START();
+    // The connection stays open in the pool for the next request
+    dyad_dtl_tcp_t* dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    dtl_handle->conn = NULL;
+    dtl_handle->remote_addr = NULL;
+    dtl_handle->f = NULL;
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_dtl_tcp_finalize (const dyad_ctx_t* ctx)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_dtl_tcp_t* dtl_handle = NULL;
+    if (ctx->dtl_handle == NULL || ctx->dtl_handle->private_dtl.tcp_dtl_handle == NULL) {
+        goto dtl_tcp_finalize_done;
+    }
+    dtl_handle = ctx->dtl_handle->private_dtl.tcp_dtl_handle;
+    if (dtl_handle->sender_started) {
+        pthread_mutex_lock (&dtl_handle->lock);
+        dtl_handle->stop = true;
+        pthread_cond_broadcast (&dtl_handle->wake);
+        pthread_mutex_unlock (&dtl_handle->lock);
+        pthread_join (dtl_handle->sender, NULL);
+    }
+    if (dtl_handle->sender_ctx.h != NULL) {
+        flux_close (dtl_handle->sender_ctx.h);
+    }
+    pthread_cond_destroy (&dtl_handle->wake);
+    pthread_mutex_destroy (&dtl_handle->lock);
+    if (dtl_handle->pipe_fds[0] >= 0) {
+        close (dtl_handle->pipe_fds[0]);
+        close (dtl_handle->pipe_fds[1]);
+    }
+    while (dtl_handle->pool != NULL) {
+        tcp_pool_drop (dtl_handle, dtl_handle->pool);
+    }
+    if (dtl_handle->listen_fd >= 0) {
+        close (dtl_handle->listen_fd);
+    }
+    free (dtl_handle);
+    ctx->dtl_handle->private_dtl.tcp_dtl_handle = NULL;
+dtl_tcp_finalize_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
@@ -0,0 +1,104 @@
+#ifndef DYAD_DTL_TCP_H
+#define DYAD_DTL_TCP_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <dyad/dtl/dyad_dtl_api.h>
+
+// Maximum length of a "host:port" address, including the terminating NUL
+#define DYAD_TCP_ADDR_MAX 300
+
+// An open connection, kept across requests. On the producer, connections are
+// keyed by the address of the consumer. On the consumer, they are keyed by
+// the rank of the producer that opened them.
+struct dyad_tcp_conn {
+    int fd;
+    char addr[DYAD_TCP_ADDR_MAX];
+    uint32_t rank;
+    struct dyad_tcp_conn* next;
+};
+
+// A transfer queued for the sender thread of the producer
+struct dyad_tcp_job {
+    char addr[DYAD_TCP_ADDR_MAX];  // address of the consumer
+    uint64_t xfer_id;
+    int fd;                        // file to send with sendfile, or -1
+    size_t len;
+    void* buf;                     // if fd is -1, the data to send
+    struct dyad_tcp_job* next;
+};
+
+struct dyad_dtl_tcp {
+    flux_t* h;
+    dyad_dtl_comm_mode_t comm_mode;
+    bool debug;
+    uint32_t rank;
+    // Consumer: socket producers connect to, and its advertised address
+    int listen_fd;
+    char local_addr[DYAD_TCP_ADDR_MAX];
+    struct dyad_tcp_conn* pool;
+    // State of the ongoing transfer
+    struct dyad_tcp_conn* conn;
+    const char* remote_addr;  // producer: address of the consumer
+    uint32_t producer_rank;   // consumer: rank of the producer
+    flux_future_t* f;         // consumer: future of the ongoing fetch
+    uint64_t xfer_id;
+    uint64_t next_xfer_id;
+    int pipe_fds[2];          // consumer: splices data from the socket to files
+    // Producer: connecting and sending block, so a thread of its own does
+    // it instead of the reactor. It owns the connection pool.
+    pthread_t sender;
+    bool sender_started;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stop;
+    struct dyad_tcp_job* jobs;
+    struct dyad_tcp_job* jobs_tail;
+    void* handed_off;         // the buffer of the last send, owned by the sender
+    dyad_ctx_t sender_ctx;    // with a Flux handle of the sender thread's own
+};
+
+typedef struct dyad_dtl_tcp dyad_dtl_tcp_t;
+
+dyad_rc_t dyad_dtl_tcp_init (const dyad_ctx_t* ctx,
+                             dyad_dtl_mode_t mode,
+                             dyad_dtl_comm_mode_t comm_mode,
+                             bool debug);
+
+dyad_rc_t dyad_dtl_tcp_rpc_pack (const dyad_ctx_t* ctx,
+                                 const char* restrict upath,
+                                 uint32_t producer_rank,
+                                 json_t** restrict packed_obj);
+
+dyad_rc_t dyad_dtl_tcp_rpc_unpack (const dyad_ctx_t* ctx, const flux_msg_t* msg, char** upath);
+
+dyad_rc_t dyad_dtl_tcp_rpc_respond (const dyad_ctx_t* ctx, const flux_msg_t* orig_msg);
+
+dyad_rc_t dyad_dtl_tcp_rpc_recv_response (const dyad_ctx_t* ctx, flux_future_t* f);
+
+dyad_rc_t dyad_dtl_tcp_get_buffer (const dyad_ctx_t* ctx, size_t data_size, void** data_buf);
+
+dyad_rc_t dyad_dtl_tcp_return_buffer (const dyad_ctx_t* ctx, void** data_buf);
+
+dyad_rc_t dyad_dtl_tcp_establish_connection (const dyad_ctx_t* ctx);
+
+dyad_rc_t dyad_dtl_tcp_send (const dyad_ctx_t* ctx, void* buf, size_t buflen);
+
+dyad_rc_t dyad_dtl_tcp_send_file (const dyad_ctx_t* ctx, int fd, size_t file_size);
+
+dyad_rc_t dyad_dtl_tcp_recv (const dyad_ctx_t* ctx, void** buf, size_t* buflen);
+
+dyad_rc_t dyad_dtl_tcp_recv_file (const dyad_ctx_t* ctx, int fd, size_t* file_len);
+
+dyad_rc_t dyad_dtl_tcp_close_connection (const dyad_ctx_t* ctx);
+
+dyad_rc_t dyad_dtl_tcp_finalize (const dyad_ctx_t* ctx);
+
+#endif /* DYAD_DTL_TCP_H */
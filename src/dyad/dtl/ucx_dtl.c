@@ -4,7 +4,12 @@
 #error "no config"
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  // _GNU_SOURCE
+
 #include <assert.h>
+#include <dyad/common/dyad_envs.h>
 #include <dyad/common/dyad_logging.h>
 #include <dyad/common/dyad_profiler.h>
 #include <dyad/dtl/ucx_dtl.h>
@@ -16,14 +21,46 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <time.h>
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif // DYAD_ENABLE_UCX_RMA_GET
 
 extern const base64_maps_t base64_maps_rfc4648;
 
 #define UCX_MAX_TRANSFER_SIZE (1024 * 1024 * 1024)
 
+// Large RMA transfers are split into stripes of this size (overridden by
+// DYAD_UCX_STRIPE_SIZE) so that UCX can spread them over several lanes
+#define DYAD_UCX_STRIPE_SIZE_DEFAULT (4ul * 1024ul * 1024ul)
+// Maximum number of stripes in flight at any time
+#define DYAD_UCX_MAX_INFLIGHT 16
+// UCX does not use more rails than this (UCP_MAX_RAILS)
+#define DYAD_UCX_MAX_RAILS 4u
+
+// Memory exposed for RMA GET is released after this many seconds even if the
+// consumer never says that it is done with it, e.g., because it crashed
+#define DYAD_UCX_GET_EXPOSE_TIMEOUT 60.0
+
 // Tag mask for UCX Tag send/recv
 #define DYAD_UCX_TAG_MASK UINT64_MAX
 
+#ifdef DYAD_ENABLE_UCX_AM
+#if UCP_API_VERSION < UCP_VERSION(1, 10)
+#error "The UCX active message DTL requires UCX 1.10 or newer"
+#endif // UCP_API_VERSION
+#ifdef DYAD_ENABLE_UCX_RMA
+#error "DYAD_ENABLE_UCX_AM and DYAD_ENABLE_UCX_RMA are mutually exclusive"
+#endif // DYAD_ENABLE_UCX_RMA
+// Active message id of DYAD file transfers
+#define DYAD_UCX_AM_ID 0x1D
+// At most this many active messages are kept until they are expected
+#define DYAD_UCX_AM_MAX_UNEXPECTED 16ul
+// Payloads of at least this many bytes always use the rendezvous protocol,
+// so that they land directly in the consumer's buffer
+#define DYAD_UCX_AM_RNDV_THRESHOLD (64ul * 1024ul)
+#endif // DYAD_ENABLE_UCX_AM
+
 // Define a request struct to be used in handling
 // async UCX operations
 struct ucx_request {
@@ -31,6 +68,21 @@ struct ucx_request {
 };
 typedef struct ucx_request dyad_ucx_request_t;
 
+// Memory that the producer exposed to a consumer for RMA GET. It stays
+// registered until the consumer sends DYAD_DTL_RPC_DONE_NAME with its id,
+// disconnects, or DYAD_UCX_GET_EXPOSE_TIMEOUT passes.
+struct ucx_get_exposed {
+    uint64_t id;
+    void* base;
+    size_t len;
+    bool mapped;   // if true, base is a mapping of the file, else a buffer
+    int lock_fd;   // if mapped, holds a shared lock on the file, else -1
+    char* sender;  // route of the consumer the memory is exposed to
+    time_t expires;
+    ucp_mem_h mem_handle;
+    struct ucx_get_exposed* next;
+};
+
 // Define a function that UCX will use to allocate and
 // initialize our request struct
 static void dyad_ucx_request_init (void* request)
@@ -41,7 +93,7 @@ static void dyad_ucx_request_init (void* request)
     real_request->completed = 0;
     DYAD_C_FUNCTION_END();
 }
-#ifndef DYAD_ENABLE_UCX_RMA
+#if !defined(DYAD_ENABLE_UCX_RMA) && !defined(DYAD_ENABLE_UCX_AM)
 // Define a function that ucp_tag_msg_recv_nbx will use
 // as a callback to signal the completion of the async receive
 // TODO(Ian): See if we can get msg size from recv_info
@@ -60,7 +112,7 @@ static void dyad_recv_callback (void* request, ucs_status_t status, ucp_tag_recv
     real_request->completed = 1;
     DYAD_C_FUNCTION_END();
 }
-#endif // DYAD_ENABLE_UCX_RMA
+#endif // !DYAD_ENABLE_UCX_RMA && !DYAD_ENABLE_UCX_AM
 
 #if UCP_API_VERSION >= UCP_VERSION(1, 10)
 static void dyad_send_callback (void* req, ucs_status_t status, void* ctx)
@@ -75,6 +127,216 @@ static void dyad_send_callback (void* req, ucs_status_t status)
     DYAD_C_FUNCTION_END();
 }
 
+#ifdef DYAD_ENABLE_UCX_AM
+static void dyad_am_recv_data_callback (void* request,
+                                        ucs_status_t status,
+                                        size_t length,
+                                        void* user_data)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_ucx_request_t* real_request = (dyad_ucx_request_t*)request;
+    real_request->completed = 1;
+    DYAD_C_FUNCTION_END();
+}
+
+// An active message that the consumer expects, or that arrived before it
+// was expected. The queue is keyed by the id of the request it answers,
+// so that several requests may be outstanding at once.
+struct ucx_am_entry {
+    uint64_t id;
+    bool expected;         // if false, the payload is held in `data'
+    bool done;             // the payload is in `buf', or `status' says why not
+    void* buf;             // where the expected payload goes
+    size_t cap;
+    size_t len;
+    ucs_status_t status;
+    ucs_status_ptr_t req;  // rendezvous receive, if any
+    void* data;            // payload (or rendezvous descriptor) not yet placed
+    bool held;             // if true, `data' belongs to UCX, else it was copied
+    bool rndv;
+    struct ucx_am_entry* next;
+};
+
+static struct ucx_am_entry* ucx_am_find (const dyad_dtl_ucx_t* dtl_handle, uint64_t id)
+{
+    for (struct ucx_am_entry* e = dtl_handle->am_queue; e != NULL; e = e->next) {
+        if (e->id == id) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void ucx_am_release_data (dyad_dtl_ucx_t* dtl_handle, struct ucx_am_entry* e)
+{
+    if (e->data == NULL) {
+        return;
+    }
+    if (e->held) {
+        ucp_am_data_release (dtl_handle->ucx_worker, e->data);
+    } else {
+        free (e->data);
+    }
+    e->data = NULL;
+}
+
+static void ucx_am_remove (dyad_dtl_ucx_t* dtl_handle, struct ucx_am_entry* entry)
+{
+    struct ucx_am_entry** prev = &(dtl_handle->am_queue);
+    while (*prev != NULL && *prev != entry) {
+        prev = &((*prev)->next);
+    }
+    if (*prev == NULL) {
+        return;
+    }
+    *prev = entry->next;
+    if (!entry->expected) {
+        dtl_handle->am_num_unexpected--;
+    }
+    if (entry->req != NULL && UCS_PTR_IS_PTR (entry->req)) {
+        // The request was abandoned while its data was still coming
+        ucp_request_cancel (dtl_handle->ucx_worker, entry->req);
+        ucp_request_free (entry->req);
+    }
+    ucx_am_release_data (dtl_handle, entry);
+    free (entry);
+}
+
+// Place `length' bytes of payload into the buffer of an expected message.
+// With rendezvous, `data' is a descriptor and the data is still on its way.
+static void ucx_am_deliver (dyad_dtl_ucx_t* dtl_handle,
+                            struct ucx_am_entry* e,
+                            void* data,
+                            size_t length,
+                            bool rndv)
+{
+    ucp_request_param_t recv_params;
+    e->len = length;
+    if (length > e->cap) {
+        e->status = UCS_ERR_BUFFER_TOO_SMALL;
+    } else if (rndv) {
+        recv_params.op_attr_mask = UCP_OP_ATTR_FIELD_CALLBACK | UCP_OP_ATTR_FIELD_MEMORY_TYPE;
+        recv_params.cb.recv_am = dyad_am_recv_data_callback;
+        recv_params.memory_type = UCS_MEMORY_TYPE_HOST;
+        e->req = ucp_am_recv_data_nbx (dtl_handle->ucx_worker, data, e->buf, length, &recv_params);
+        if (UCS_PTR_IS_ERR (e->req)) {
+            e->status = UCS_PTR_STATUS (e->req);
+            e->req = NULL;
+        }
+    } else {
+        memcpy (e->buf, data, length);
+    }
+    e->done = true;
+}
+
+// Get ready to receive the active message with the given id into `buf'. If
+// it already arrived, it is placed right away. Otherwise, the handler places
+// it from whichever progress of the worker sees it.
+static inline dyad_rc_t ucx_am_expect (dyad_dtl_ucx_t* dtl_handle,
+                                       uint64_t id,
+                                       void* buf,
+                                       size_t cap)
+{
+    struct ucx_am_entry* e = dtl_handle->am_queue;
+    struct ucx_am_entry* next = NULL;
+    // Ids grow with each request of this process, so unexpected answers to
+    // earlier requests are late ones that nobody will ask for anymore
+    for (; e != NULL; e = next) {
+        next = e->next;
+        if (!e->expected && (e->id >> 32) == (id >> 32) && e->id < id) {
+            ucx_am_remove (dtl_handle, e);
+        }
+    }
+    e = ucx_am_find (dtl_handle, id);
+    if (e == NULL) {
+        e = calloc (1ul, sizeof (*e));
+        if (e == NULL) {
+            return DYAD_RC_SYSFAIL;
+        }
+        e->id = id;
+        e->next = dtl_handle->am_queue;
+        dtl_handle->am_queue = e;
+    } else if (!e->expected) {
+        dtl_handle->am_num_unexpected--;
+    }
+    e->expected = true;
+    e->buf = buf;
+    e->cap = cap;
+    e->status = UCS_OK;
+    if (e->data != NULL) {
+        ucx_am_deliver (dtl_handle, e, e->data, e->len, e->rndv);
+        if (e->rndv && e->status == UCS_OK) {
+            // ucp_am_recv_data_nbx took over the descriptor
+            e->data = NULL;
+        }
+        ucx_am_release_data (dtl_handle, e);
+    }
+    dtl_handle->am_id = id;
+    return DYAD_RC_OK;
+}
+
+// Called by the UCP worker when a DYAD active message arrives. Small
+// payloads come with the message and are copied out. Large ones use
+// rendezvous and are received directly into the expected buffer. Messages
+// that are not expected yet are kept, up to DYAD_UCX_AM_MAX_UNEXPECTED.
+static ucs_status_t dyad_ucx_am_recv_cb (void* arg,
+                                         const void* header,
+                                         size_t header_length,
+                                         void* data,
+                                         size_t length,
+                                         const ucp_am_recv_param_t* param)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_dtl_ucx_t* dtl_handle = (dyad_dtl_ucx_t*)arg;
+    ucs_status_t status = UCS_OK;
+    struct ucx_am_entry* e = NULL;
+    const bool rndv = (param->recv_attr & UCP_AM_RECV_ATTR_FLAG_RNDV) != 0;
+    uint64_t id = 0ul;
+    if (header_length != sizeof (id)) {
+        DYAD_LOG_ERROR (dtl_handle, "Dropping active message with a bad header");
+        goto am_recv_cb_done;
+    }
+    memcpy (&id, header, sizeof (id));
+    e = ucx_am_find (dtl_handle, id);
+    if (e != NULL && e->expected && !e->done) {
+        ucx_am_deliver (dtl_handle, e, data, length, rndv);
+        goto am_recv_cb_done;
+    }
+    if (e != NULL || dtl_handle->am_num_unexpected >= DYAD_UCX_AM_MAX_UNEXPECTED) {
+        // E.g., the late answers to requests that have already failed
+        DYAD_LOG_ERROR (dtl_handle, "Dropping unexpected active message %lu", id);
+        goto am_recv_cb_done;
+    }
+    e = calloc (1ul, sizeof (*e));
+    if (e == NULL) {
+        goto am_recv_cb_done;
+    }
+    e->id = id;
+    e->len = length;
+    e->rndv = rndv;
+    if (rndv || (param->recv_attr & UCP_AM_RECV_ATTR_FLAG_DATA)) {
+        // UCX keeps the data, or the rendezvous descriptor, for us
+        e->data = data;
+        e->held = true;
+        status = UCS_INPROGRESS;
+    } else {
+        e->data = malloc (length);
+        if (e->data == NULL && length > 0ul) {
+            free (e);
+            goto am_recv_cb_done;
+        }
+        memcpy (e->data, data, length);
+    }
+    e->next = dtl_handle->am_queue;
+    dtl_handle->am_queue = e;
+    dtl_handle->am_num_unexpected++;
+    DYAD_LOG_DEBUG (dtl_handle, "Keeping active message %lu until it is expected", id);
+am_recv_cb_done:;
+    DYAD_C_FUNCTION_END();
+    return status;
+}
+#endif // DYAD_ENABLE_UCX_AM
+
 // Simple function used to wait on the async receive
 static ucs_status_t dyad_ucx_request_wait (const dyad_ctx_t* ctx,
                                            dyad_ucx_request_t* request)
@@ -122,6 +384,36 @@ dtl_ucx_request_wait_region_finish:;
     return final_request_status;
 }
 
+// Read the striping and multi-rail settings from the environment. When more
+// than one rail is requested, UCX is allowed to use that many lanes for
+// both RMA and rendezvous, so that the stripes of a transfer can go over
+// different NICs at once.
+static void ucx_configure_rails (const dyad_ctx_t* ctx,
+                                 dyad_dtl_ucx_t* dtl_handle,
+                                 ucp_config_t* config)
+{
+    DYAD_C_FUNCTION_START();
+    char* e = NULL;
+    char rails_str[16];
+    unsigned long val = 0ul;
+    if ((e = getenv (DYAD_UCX_STRIPE_SIZE_ENV)) && (val = strtoul (e, NULL, 10)) > 0ul) {
+        dtl_handle->stripe_size = (size_t)val;
+    }
+    if ((e = getenv (DYAD_UCX_RAILS_ENV)) && (val = strtoul (e, NULL, 10)) > 0ul) {
+        dtl_handle->rails = (val > DYAD_UCX_MAX_RAILS) ? DYAD_UCX_MAX_RAILS : (unsigned)val;
+    }
+    if (dtl_handle->rails > 1u) {
+        snprintf (rails_str, sizeof (rails_str), "%u", dtl_handle->rails);
+        if (UCX_STATUS_FAIL (ucp_config_modify (config, "MAX_RMA_RAILS", rails_str))
+            || UCX_STATUS_FAIL (ucp_config_modify (config, "MAX_RNDV_RAILS", rails_str))) {
+            DYAD_LOG_ERROR (ctx, "Cannot set UCX to use %u rails", dtl_handle->rails);
+        }
+    }
+    DYAD_LOG_INFO (ctx, "UCX DTL uses %u rail(s) and stripes of %zu bytes", \
+                   dtl_handle->rails, dtl_handle->stripe_size);
+    DYAD_C_FUNCTION_END();
+}
+
 static dyad_rc_t ucx_allocate_buffer (const dyad_ctx_t *ctx,
                                       dyad_dtl_ucx_t* dtl_handle,
                                       dyad_dtl_comm_mode_t comm_mode)
@@ -152,6 +444,10 @@ static dyad_rc_t ucx_allocate_buffer (const dyad_ctx_t *ctx,
         mmap_params.prot = UCP_MEM_MAP_PROT_LOCAL_READ;
     } else {
         mmap_params.prot = UCP_MEM_MAP_PROT_REMOTE_WRITE;
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+        // The consumer is the target of its own GET operations
+        mmap_params.prot |= UCP_MEM_MAP_PROT_LOCAL_WRITE;
+#endif // DYAD_ENABLE_UCX_RMA_GET
     }
     status = ucp_mem_map (dtl_handle->ucx_ctx, &mmap_params, &(dtl_handle->mem_handle));
     if (UCX_STATUS_FAIL (status)) {
@@ -219,6 +515,68 @@ ucx_free_buf_done:;
     return rc;
 }
 
+#ifdef DYAD_ENABLE_UCX_RMA
+// Put (or get) `length' bytes between `buf' and the remote address `raddr'
+// as a pipeline of stripes. Returns once every stripe has completed locally.
+static ucs_status_t ucx_rma_striped (const dyad_ctx_t* ctx,
+                                     bool is_put,
+                                     void* buf,
+                                     size_t length,
+                                     uint64_t raddr,
+                                     ucp_rkey_h rkey)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_dtl_ucx_t* dtl_handle = ctx->dtl_handle->private_dtl.ucx_dtl_handle;
+    ucs_status_ptr_t inflight[DYAD_UCX_MAX_INFLIGHT];
+    ucs_status_ptr_t stat_ptr = NULL;
+    ucs_status_t status = UCS_OK;
+    ucs_status_t wait_status = UCS_OK;
+    ucp_request_param_t params;
+    size_t stripe = dtl_handle->stripe_size;
+    size_t head = 0ul, count = 0ul, off = 0ul, len = 0ul;
+    params.op_attr_mask = UCP_OP_ATTR_FIELD_CALLBACK;
+    params.cb.send = dyad_send_callback;
+    DYAD_LOG_DEBUG (ctx, "RMA %s of %zu bytes in stripes of %zu bytes", \
+                    is_put ? "PUT" : "GET", length, stripe);
+    for (off = 0ul; off < length; off += len) {
+        len = (length - off < stripe) ? (length - off) : stripe;
+        if (count == DYAD_UCX_MAX_INFLIGHT) {
+            wait_status = dyad_ucx_request_wait (ctx, inflight[head]);
+            head = (head + 1) % DYAD_UCX_MAX_INFLIGHT;
+            count--;
+            if (UCX_STATUS_FAIL (wait_status)) {
+                status = wait_status;
+                break;
+            }
+        }
+        if (is_put) {
+            stat_ptr = ucp_put_nbx (dtl_handle->ep, (char*)buf + off, len, raddr + off, rkey, &params);
+        } else {
+            stat_ptr = ucp_get_nbx (dtl_handle->ep, (char*)buf + off, len, raddr + off, rkey, &params);
+        }
+        if (UCS_PTR_IS_ERR (stat_ptr)) {
+            status = UCS_PTR_STATUS (stat_ptr);
+            break;
+        }
+        inflight[(head + count) % DYAD_UCX_MAX_INFLIGHT] = stat_ptr;
+        count++;
+    }
+    // Drain the pipeline even on failure, so no request is leaked
+    for (; count > 0ul; count--) {
+        wait_status = dyad_ucx_request_wait (ctx, inflight[head]);
+        head = (head + 1) % DYAD_UCX_MAX_INFLIGHT;
+        if (UCX_STATUS_FAIL (wait_status) && status == UCS_OK) {
+            status = wait_status;
+        }
+    }
+    if (UCX_STATUS_FAIL (status)) {
+        DYAD_LOG_ERROR (ctx, "Striped RMA failed %s (%d)", ucs_status_string (status), status);
+    }
+    DYAD_C_FUNCTION_END();
+    return status;
+}
+#endif // DYAD_ENABLE_UCX_RMA
+
 static inline ucs_status_ptr_t ucx_send_no_wait (const dyad_ctx_t* ctx, bool is_warmup, void* buf, size_t buflen)
 {
     /**
@@ -233,7 +591,21 @@ static inline ucs_status_ptr_t ucx_send_no_wait (const dyad_ctx_t* ctx, bool is_
         stat_ptr = (void*)UCS_ERR_NOT_CONNECTED;
         goto ucx_send_no_wait_done;
     }
-#ifndef DYAD_ENABLE_UCX_RMA
+#if defined(DYAD_ENABLE_UCX_AM)
+    // The header carries the id of the request this payload answers
+    ucp_request_param_t params;
+    params.op_attr_mask = UCP_OP_ATTR_FIELD_CALLBACK | UCP_OP_ATTR_FIELD_FLAGS;
+    params.cb.send = dyad_send_callback;
+    params.flags = (buflen >= DYAD_UCX_AM_RNDV_THRESHOLD) ? UCP_AM_SEND_FLAG_RNDV : 0;
+    DYAD_LOG_INFO (ctx, "Sending %lu bytes to consumer with ucp_am_send_nbx", buflen);
+    stat_ptr = ucp_am_send_nbx (dtl_handle->ep,
+                                DYAD_UCX_AM_ID,
+                                &(dtl_handle->am_id),
+                                sizeof (dtl_handle->am_id),
+                                buf,
+                                buflen,
+                                &params);
+#elif !defined(DYAD_ENABLE_UCX_RMA)
     // ucp_tag_send_sync_nbx is the prefered version of this send since UCX 1.9
     // However, some systems (e.g., Lassen) may have an older verison
     // This conditional compilation will use ucp_tag_send_sync_nbx if using
@@ -265,7 +637,26 @@ static inline ucs_status_ptr_t ucx_send_no_wait (const dyad_ctx_t* ctx, bool is_
     ucp_request_param_t params;
     params.op_attr_mask = UCP_OP_ATTR_FIELD_CALLBACK;
     params.cb.send = dyad_send_callback;
-    stat_ptr = ucp_put_nbx(dtl_handle->ep, buf, buflen, dtl_handle->cons_buf_ptr, dtl_handle->rkey, &params);
+    size_t head_len = buflen;
+    if (!is_warmup && buflen > dtl_handle->stripe_size) {
+        // The first stripe holds the length the consumer polls on,
+        // so it must only become visible after the rest of the data
+        head_len = dtl_handle->stripe_size;
+        status = ucx_rma_striped (ctx,
+                                  true,
+                                  (char*)buf + head_len,
+                                  buflen - head_len,
+                                  dtl_handle->cons_buf_ptr + head_len,
+                                  dtl_handle->rkey);
+        if (!UCX_STATUS_FAIL (status)) {
+            status = dyad_ucx_request_wait (ctx, ucp_ep_flush_nbx (dtl_handle->ep, &params));
+        }
+        if (UCX_STATUS_FAIL (status)) {
+            stat_ptr = (void*)UCS_ERR_NOT_CONNECTED;
+            goto ucx_send_no_wait_done;
+        }
+    }
+    stat_ptr = ucp_put_nbx(dtl_handle->ep, buf, head_len, dtl_handle->cons_buf_ptr, dtl_handle->rkey, &params);
     if (UCS_PTR_IS_ERR(stat_ptr)) {
         DYAD_LOG_ERROR (ctx, "ucp_put_nbx() failed %s (%d)\n", \
                         ucs_status_string(UCS_PTR_STATUS(stat_ptr)), \
@@ -287,7 +678,37 @@ static inline ucs_status_ptr_t ucx_recv_no_wait (const dyad_ctx_t* ctx,
 {
     DYAD_C_FUNCTION_START();
     ucs_status_ptr_t stat_ptr = NULL;
-#ifndef DYAD_ENABLE_UCX_RMA
+#if defined(DYAD_ENABLE_UCX_AM)
+    dyad_dtl_ucx_t* dtl_handle = ctx->dtl_handle->private_dtl.ucx_dtl_handle;
+    struct ucx_am_entry* e = ucx_am_find (dtl_handle, dtl_handle->am_id);
+    DYAD_LOG_INFO (ctx, "Progress UCP until the active message %lu arrives", \
+                   dtl_handle->am_id);
+    if (e == NULL || !e->expected) {
+        DYAD_LOG_ERROR (ctx, "Active message %lu was never expected", dtl_handle->am_id);
+        *buflen = 0;
+        stat_ptr = UCS_STATUS_PTR (UCS_ERR_NO_MESSAGE);
+        goto ucx_recv_no_wait_done;
+    }
+    // The buffer was set by ucx_am_expect, so there is nothing to probe:
+    // the handler places the data as soon as the worker sees it
+    while (!e->done) {
+        ucp_worker_progress (dtl_handle->ucx_worker);
+    }
+    if (e->status != UCS_OK) {
+        DYAD_LOG_ERROR (ctx, "Active message of %lu bytes could not be received in %lu bytes", \
+                        e->len, e->cap);
+        *buflen = 0;
+        stat_ptr = UCS_STATUS_PTR (e->status);
+        ucx_am_remove (dtl_handle, e);
+        goto ucx_recv_no_wait_done;
+    }
+    *buf = e->buf;
+    *buflen = e->len;
+    // The caller waits for the rendezvous receive, if any
+    stat_ptr = e->req;
+    e->req = NULL;
+    ucx_am_remove (dtl_handle, e);
+#elif !defined(DYAD_ENABLE_UCX_RMA)
     dyad_rc_t rc = DYAD_RC_OK;
     ucp_tag_message_h msg = NULL;
     ucp_tag_recv_info_t msg_info;
@@ -411,7 +832,7 @@ static inline ucs_status_ptr_t ucx_recv_no_wait (const dyad_ctx_t* ctx,
 #endif // DYAD_ENABLE_UCX_RMA
     DYAD_LOG_DEBUG (ctx, "Consumer finsihed all work");
 
-#ifndef DYAD_ENABLE_UCX_RMA
+#if defined(DYAD_ENABLE_UCX_AM) || !defined(DYAD_ENABLE_UCX_RMA)
 ucx_recv_no_wait_done:;
 #endif // DYAD_ENABLE_UCX_RMA
     DYAD_C_FUNCTION_END();
@@ -456,6 +877,18 @@ static dyad_rc_t ucx_warmup (const dyad_ctx_t* ctx)
         DYAD_LOG_ERROR (ctx, "Failed to establish connection with self");
         goto warmup_region_done;
     }
+#ifdef DYAD_ENABLE_UCX_AM
+    // Over shared memory or self, the message can be handled during the send
+    rc = ucx_am_expect (ctx->dtl_handle->private_dtl.ucx_dtl_handle,
+                        ctx->dtl_handle->private_dtl.ucx_dtl_handle->am_id,
+                        recv_buf,
+                        1ul);
+    if (DYAD_IS_ERROR (rc)) {
+        free (recv_buf);
+        dyad_dtl_ucx_return_buffer (ctx, &send_buf);
+        goto warmup_region_done;
+    }
+#endif // DYAD_ENABLE_UCX_AM
     DYAD_LOG_INFO (ctx, "Starting non-blocking send for warmup");
     send_stat_ptr = ucx_send_no_wait (ctx, true, send_buf, 1);
     if ((uintptr_t)send_stat_ptr == (uintptr_t)UCS_ERR_NOT_CONNECTED) {
@@ -497,6 +930,406 @@ warmup_region_done:;
     return rc;
 }
 
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+static dyad_rc_t ucx_b64_encode (const dyad_ctx_t* ctx,
+                                 const void* src,
+                                 size_t src_len,
+                                 char** enc,
+                                 size_t* enc_len)
+{
+    ssize_t enc_size = 0;
+    *enc_len = base64_encoded_length (src_len);
+    // Add 1 to encoded length because the encoded buffer will be
+    // packed as if it is a string
+    *enc = malloc (*enc_len + 1);
+    if (*enc == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not allocate buffer for base64 encoding");
+        return DYAD_RC_SYSFAIL;
+    }
+    enc_size = base64_encode_using_maps (&base64_maps_rfc4648,
+                                         *enc,
+                                         *enc_len + 1,
+                                         (const char*)src,
+                                         src_len);
+    if (enc_size < 0) {
+        DYAD_LOG_ERROR (ctx, "Unable to base64 encode %zu bytes", src_len);
+        free (*enc);
+        *enc = NULL;
+        return DYAD_RC_BADPACK;
+    }
+    return DYAD_RC_OK;
+}
+
+static dyad_rc_t ucx_b64_decode (const dyad_ctx_t* ctx,
+                                 const char* enc,
+                                 size_t enc_len,
+                                 void** dst,
+                                 size_t* dst_len)
+{
+    ssize_t decoded_len = 0;
+    *dst_len = base64_decoded_length (enc_len);
+    *dst = malloc (*dst_len);
+    if (*dst == NULL) {
+        DYAD_LOG_ERROR (ctx, "Could not allocate buffer for base64 decoding");
+        return DYAD_RC_SYSFAIL;
+    }
+    decoded_len = base64_decode_using_maps (&base64_maps_rfc4648,
+                                            (char*)*dst,
+                                            *dst_len,
+                                            enc,
+                                            enc_len);
+    if (decoded_len < 0) {
+        DYAD_LOG_ERROR (ctx, "Failed to base64 decode %zu bytes", enc_len);
+        free (*dst);
+        *dst = NULL;
+        *dst_len = 0ul;
+        return DYAD_RC_BAD_B64DECODE;
+    }
+    return DYAD_RC_OK;
+}
+
+static void ucx_get_release (dyad_dtl_ucx_t* dtl_handle, struct ucx_get_exposed* exposed)
+{
+    ucp_mem_unmap (dtl_handle->ucx_ctx, exposed->mem_handle);
+    if (exposed->mapped) {
+        munmap (exposed->base, exposed->len);
+    } else {
+        free (exposed->base);
+    }
+    if (exposed->lock_fd >= 0) {
+        // Writers may modify the file again once the mapping is gone
+        close (exposed->lock_fd);
+    }
+    free (exposed->sender);
+    free (exposed);
+}
+
+/* Release the memory exposed to the consumer with the given route, or, if
+ * `sender' is NULL, the memory whose consumer has not been heard from in
+ * time. Returns the number of exposed regions released. */
+static size_t ucx_get_reap (dyad_dtl_ucx_t* dtl_handle, const char* sender)
+{
+    struct ucx_get_exposed** prev = &(dtl_handle->exposed);
+    struct ucx_get_exposed* curr = NULL;
+    time_t now = time (NULL);
+    size_t num_released = 0ul;
+    while ((curr = *prev) != NULL) {
+        bool release = (sender != NULL)
+                           ? (curr->sender != NULL && strcmp (curr->sender, sender) == 0)
+                           : (curr->expires <= now);
+        if (!release) {
+            prev = &(curr->next);
+            continue;
+        }
+        *prev = curr->next;
+        ucx_get_release (dtl_handle, curr);
+        num_released++;
+    }
+    return num_released;
+}
+
+static void ucx_get_timer_cb (flux_reactor_t* r, flux_watcher_t* w, int revents, void* arg)
+{
+    dyad_dtl_ucx_t* dtl_handle = (dyad_dtl_ucx_t*)arg;
+    size_t num_released = ucx_get_reap (dtl_handle, NULL);
+    if (num_released > 0ul) {
+        DYAD_LOG_ERROR (dtl_handle,
+                        "Released %zu regions exposed for RMA GET that were never read",
+                        num_released);
+    }
+}
+
+static bool ucx_get_is_exposed (const dyad_dtl_ucx_t* dtl_handle, const void* base)
+{
+    for (const struct ucx_get_exposed* e = dtl_handle->exposed; e != NULL; e = e->next) {
+        if (e->base == base) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Handle DYAD_DTL_RPC_DONE_NAME: the consumer finished reading the memory
+ * exposed under the given id, so it can be released. */
+static void ucx_get_done_cb (flux_t* h,
+                             flux_msg_handler_t* w,
+                             const flux_msg_t* msg,
+                             void* arg)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_dtl_ucx_t* dtl_handle = (dyad_dtl_ucx_t*)arg;
+    struct ucx_get_exposed** prev = &(dtl_handle->exposed);
+    struct ucx_get_exposed* curr = NULL;
+    uint64_t id = 0ul;
+    if (flux_request_unpack (msg, NULL, "{s:I}", "id", &id) < 0) {
+        DYAD_LOG_ERROR (dtl_handle, "Could not unpack %s request", DYAD_DTL_RPC_DONE_NAME);
+        goto get_done_cb_done;
+    }
+    for (curr = *prev; curr != NULL; prev = &(curr->next), curr = curr->next) {
+        if (curr->id == id) {
+            *prev = curr->next;
+            DYAD_LOG_DEBUG (dtl_handle, "Releasing %zu bytes exposed for RMA GET", curr->len);
+            ucx_get_release (dtl_handle, curr);
+            goto get_done_cb_done;
+        }
+    }
+    DYAD_LOG_ERROR (dtl_handle, "No memory exposed for RMA GET with id %lu", id);
+get_done_cb_done:;
+    DYAD_C_FUNCTION_END();
+}
+
+static const struct flux_msg_handler_spec ucx_get_htab[] =
+    {{FLUX_MSGTYPE_REQUEST, DYAD_DTL_RPC_DONE_NAME, ucx_get_done_cb, 0},
+     FLUX_MSGHANDLER_TABLE_END};
+
+/* Register `len' bytes at `base' for remote reads and tell the consumer
+ * where to find them with a response to the request being served. On
+ * success, the memory and `lock_fd' are owned by the DTL until the consumer
+ * is done. */
+static dyad_rc_t ucx_get_expose (const dyad_ctx_t* ctx,
+                                  void* base,
+                                  size_t len,
+                                  bool mapped,
+                                  int lock_fd)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    ucs_status_t status = UCS_OK;
+    ucp_mem_map_params_t mmap_params;
+    dyad_dtl_ucx_t* dtl_handle = ctx->dtl_handle->private_dtl.ucx_dtl_handle;
+    struct ucx_get_exposed* exposed = NULL;
+    void* rkey_buf = NULL;
+    size_t rkey_size = 0ul;
+    char* enc_addr = NULL;
+    size_t enc_addr_len = 0ul;
+    char* enc_rkey = NULL;
+    size_t enc_rkey_len = 0ul;
+
+    if (dtl_handle->msg == NULL) {
+        DYAD_LOG_ERROR (ctx, "No request to respond to with the RMA GET information");
+        rc = DYAD_RC_BADRPC;
+        goto ucx_get_expose_done;
+    }
+    exposed = malloc (sizeof (*exposed));
+    if (exposed == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto ucx_get_expose_done;
+    }
+    exposed->base = base;
+    exposed->len = len;
+    exposed->mapped = mapped;
+    exposed->lock_fd = -1;
+    exposed->sender = NULL;
+    exposed->expires = time (NULL) + (time_t)DYAD_UCX_GET_EXPOSE_TIMEOUT;
+    exposed->mem_handle = NULL;
+    if (flux_msg_route_first (dtl_handle->msg) != NULL) {
+        exposed->sender = strdup (flux_msg_route_first (dtl_handle->msg));
+    }
+    mmap_params.field_mask = UCP_MEM_MAP_PARAM_FIELD_ADDRESS | UCP_MEM_MAP_PARAM_FIELD_LENGTH
+                             | UCP_MEM_MAP_PARAM_FIELD_PROT;
+    mmap_params.address = base;
+    mmap_params.length = len;
+    mmap_params.prot = UCP_MEM_MAP_PROT_LOCAL_READ | UCP_MEM_MAP_PROT_REMOTE_READ;
+    status = ucp_mem_map (dtl_handle->ucx_ctx, &mmap_params, &(exposed->mem_handle));
+    if (UCX_STATUS_FAIL (status)) {
+        DYAD_LOG_ERROR (ctx, "ucp_mem_map failed for RMA GET (status = %d)", (int)status);
+        rc = DYAD_RC_UCXMMAP_FAIL;
+        goto ucx_get_expose_done;
+    }
+    status = ucp_rkey_pack (dtl_handle->ucx_ctx, exposed->mem_handle, &rkey_buf, &rkey_size);
+    if (UCX_STATUS_FAIL (status)) {
+        DYAD_LOG_ERROR (ctx, "ucp_rkey_pack failed for RMA GET (status = %d)", (int)status);
+        rc = DYAD_RC_UCXRKEY_PACK_FAILED;
+        goto ucx_get_expose_done;
+    }
+    rc = ucx_b64_encode (ctx, rkey_buf, rkey_size, &enc_rkey, &enc_rkey_len);
+    if (DYAD_IS_ERROR (rc)) {
+        goto ucx_get_expose_done;
+    }
+    rc = ucx_b64_encode (ctx,
+                         dtl_handle->local_address,
+                         dtl_handle->local_addr_len,
+                         &enc_addr,
+                         &enc_addr_len);
+    if (DYAD_IS_ERROR (rc)) {
+        goto ucx_get_expose_done;
+    }
+    exposed->id = dtl_handle->next_exposed_id++;
+    if (flux_respond_pack (dtl_handle->h,
+                           dtl_handle->msg,
+                           "{s:s%, s:s%, s:I, s:I, s:I}",
+                           "addr",
+                           enc_addr,
+                           enc_addr_len,
+                           "rkey",
+                           enc_rkey,
+                           enc_rkey_len,
+                           "raddr",
+                           (json_int_t)(uintptr_t)base,
+                           "size",
+                           (json_int_t)len,
+                           "id",
+                           (json_int_t)exposed->id)
+        < 0) {
+        DYAD_LOG_ERROR (ctx, "Could not send the RMA GET information to the consumer");
+        rc = DYAD_RC_FLUXFAIL;
+        goto ucx_get_expose_done;
+    }
+    DYAD_LOG_INFO (ctx, "Exposed %zu bytes for RMA GET with id %lu", len, exposed->id);
+    exposed->lock_fd = lock_fd;
+    exposed->next = dtl_handle->exposed;
+    dtl_handle->exposed = exposed;
+    exposed = NULL;
+    rc = DYAD_RC_OK;
+
+ucx_get_expose_done:;
+    if (rkey_buf != NULL) {
+        ucp_rkey_buffer_release (rkey_buf);
+    }
+    if (exposed != NULL) {
+        if (exposed->mem_handle != NULL) {
+            ucp_mem_unmap (dtl_handle->ucx_ctx, exposed->mem_handle);
+        }
+        free (exposed->sender);
+        free (exposed);
+    }
+    free (enc_addr);
+    free (enc_rkey);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+/* Consumer side of RMA GET: read where the producer exposed the data from
+ * the response to our request, pull it into our registered buffer, and
+ * let the producer know that it can release its memory. */
+static dyad_rc_t ucx_get_pull (const dyad_ctx_t* ctx, void** buf, size_t* buflen)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    ucs_status_t status = UCS_OK;
+    ucp_rkey_h rkey = NULL;
+    dyad_dtl_ucx_t* dtl_handle = ctx->dtl_handle->private_dtl.ucx_dtl_handle;
+    const uint32_t producer_rank = dtl_handle->producer_rank;
+    flux_future_t* done_f = NULL;
+    const char* enc_addr = NULL;
+    size_t enc_addr_len = 0ul;
+    const char* enc_rkey = NULL;
+    size_t enc_rkey_len = 0ul;
+    void* rkey_buf = NULL;
+    size_t rkey_size = 0ul;
+    json_int_t raddr = 0;
+    json_int_t size = 0;
+    json_int_t id = -1;
+
+    if (dtl_handle->f == NULL) {
+        DYAD_LOG_ERROR (ctx, "Cannot get data using RMA GET without a Flux future");
+        rc = DYAD_RC_FLUXFAIL;
+        goto ucx_get_pull_done;
+    }
+    if (flux_rpc_get_unpack (dtl_handle->f,
+                             "{s:s%, s:s%, s:I, s:I, s:I}",
+                             "addr",
+                             &enc_addr,
+                             &enc_addr_len,
+                             "rkey",
+                             &enc_rkey,
+                             &enc_rkey_len,
+                             "raddr",
+                             &raddr,
+                             "size",
+                             &size,
+                             "id",
+                             &id)
+        < 0) {
+        DYAD_LOG_ERROR (ctx, "Could not get the RMA GET information from the module");
+        rc = (errno == ENODATA) ? DYAD_RC_RPC_FINISHED : DYAD_RC_BADRPC;
+        goto ucx_get_pull_done;
+    }
+    if (size < 0 || (size_t)size > dtl_handle->max_transfer_size) {
+        DYAD_LOG_ERROR (ctx, "Cannot pull %ld bytes with RMA GET", (long)size);
+        rc = DYAD_RC_BADBUF;
+        goto ucx_get_pull_done;
+    }
+    rc = ucx_b64_decode (ctx,
+                         enc_addr,
+                         enc_addr_len,
+                         (void**)&(dtl_handle->remote_address),
+                         &(dtl_handle->remote_addr_len));
+    if (DYAD_IS_ERROR (rc)) {
+        goto ucx_get_pull_done;
+    }
+    // On the consumer side, endpoints are cached by producer rank
+    dtl_handle->ep = NULL;
+    rc = dyad_ucx_ep_cache_find (ctx,
+                                 dtl_handle->ep_cache,
+                                 dtl_handle->remote_address,
+                                 dtl_handle->remote_addr_len,
+                                 &(dtl_handle->ep));
+    if (DYAD_IS_ERROR (rc)) {
+        rc = dyad_ucx_ep_cache_insert (ctx,
+                                       dtl_handle->ep_cache,
+                                       dtl_handle->remote_address,
+                                       dtl_handle->remote_addr_len,
+                                       dtl_handle->ucx_worker);
+    }
+    free (dtl_handle->remote_address);
+    dtl_handle->remote_address = NULL;
+    dtl_handle->remote_addr_len = 0ul;
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "Failed to create UCP endpoint to producer %u", producer_rank);
+        goto ucx_get_pull_done;
+    }
+    rc = ucx_b64_decode (ctx, enc_rkey, enc_rkey_len, &rkey_buf, &rkey_size);
+    if (DYAD_IS_ERROR (rc)) {
+        goto ucx_get_pull_done;
+    }
+    status = ucp_ep_rkey_unpack (dtl_handle->ep, rkey_buf, &rkey);
+    if (UCX_STATUS_FAIL (status)) {
+        DYAD_LOG_ERROR (ctx, "ucp_ep_rkey_unpack failed");
+        rc = DYAD_RC_UCXCOMM_FAIL;
+        goto ucx_get_pull_done;
+    }
+    rc = ctx->dtl_handle->get_buffer (ctx, (size_t)size, buf);
+    if (DYAD_IS_ERROR (rc)) {
+        goto ucx_get_pull_done;
+    }
+    status = ucx_rma_striped (ctx, false, *buf, (size_t)size, (uint64_t)raddr, rkey);
+    if (UCX_STATUS_FAIL (status)) {
+        DYAD_LOG_ERROR (ctx, "ucp_get_nbx failed %s (%d)", ucs_status_string (status), status);
+        rc = DYAD_RC_UCXCOMM_FAIL;
+        goto ucx_get_pull_done;
+    }
+    *buflen = (size_t)size;
+    DYAD_LOG_INFO (ctx, "Pulled %zu bytes with RMA GET", *buflen);
+    rc = DYAD_RC_OK;
+
+ucx_get_pull_done:;
+    if (id >= 0) {
+        // Release the producer's memory whether or not the GET succeeded
+        done_f = flux_rpc_pack (dtl_handle->h,
+                                DYAD_DTL_RPC_DONE_NAME,
+                                producer_rank,
+                                FLUX_RPC_NORESPONSE,
+                                "{s:I}",
+                                "id",
+                                id);
+        if (done_f == NULL) {
+            DYAD_LOG_ERROR (ctx, "Could not send %s to producer", DYAD_DTL_RPC_DONE_NAME);
+        }
+        flux_future_destroy (done_f);
+    }
+    if (rkey != NULL) {
+        ucp_rkey_destroy (rkey);
+    }
+    free (rkey_buf);
+    if (dtl_handle->f != NULL) {
+        flux_future_reset (dtl_handle->f);
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+#endif // DYAD_ENABLE_UCX_RMA_GET
+
 dyad_rc_t dyad_dtl_ucx_init (const dyad_ctx_t* ctx,
                              dyad_dtl_mode_t mode,
                              dyad_dtl_comm_mode_t comm_mode,
@@ -527,6 +1360,8 @@ dyad_rc_t dyad_dtl_ucx_init (const dyad_ctx_t* ctx,
     dtl_handle->mem_handle = NULL;
     dtl_handle->net_buf = NULL;
     dtl_handle->max_transfer_size = UCX_MAX_TRANSFER_SIZE;
+    dtl_handle->stripe_size = DYAD_UCX_STRIPE_SIZE_DEFAULT;
+    dtl_handle->rails = 1u;
     dtl_handle->ep = NULL;
     dtl_handle->ep_cache = NULL;
     dtl_handle->local_address = NULL;
@@ -534,6 +1369,18 @@ dyad_rc_t dyad_dtl_ucx_init (const dyad_ctx_t* ctx,
     dtl_handle->remote_address = NULL;
     dtl_handle->remote_addr_len = 0;
     dtl_handle->comm_tag = 0;
+    dtl_handle->rkey_buf = NULL;
+    dtl_handle->msg = NULL;
+    dtl_handle->f = NULL;
+    dtl_handle->handlers = NULL;
+    dtl_handle->exposed = NULL;
+    dtl_handle->next_exposed_id = 0ul;
+    dtl_handle->producer_rank = 0u;
+    dtl_handle->expose_timer = NULL;
+    dtl_handle->am_id = 0ul;
+    dtl_handle->am_queue = NULL;
+    dtl_handle->am_num_unexpected = 0ul;
+    dtl_handle->am_seq = 0u;
 
     // Read the UCX configuration
     DYAD_LOG_INFO (ctx, "Reading UCP config\n");
@@ -542,6 +1389,7 @@ dyad_rc_t dyad_dtl_ucx_init (const dyad_ctx_t* ctx,
         DYAD_LOG_ERROR (ctx, "Could not read the UCX config\n");
         goto error;
     }
+    ucx_configure_rails (ctx, dtl_handle, config);
 
     // Define the settings, parameters, features, etc.
     // for the UCX context. UCX will use this info internally
@@ -555,6 +1403,9 @@ dyad_rc_t dyad_dtl_ucx_init (const dyad_ctx_t* ctx,
     ucx_params.field_mask =
         UCP_PARAM_FIELD_FEATURES | UCP_PARAM_FIELD_REQUEST_SIZE;
     ucx_params.features = UCP_FEATURE_RMA | UCP_FEATURE_AMO32 | UCP_FEATURE_TAG;
+#ifdef DYAD_ENABLE_UCX_AM
+    ucx_params.features |= UCP_FEATURE_AM;
+#endif // DYAD_ENABLE_UCX_AM
     ucx_params.request_size = sizeof (struct ucx_request);
     ucx_params.request_init = dyad_ucx_request_init;
 
@@ -583,6 +1434,23 @@ dyad_rc_t dyad_dtl_ucx_init (const dyad_ctx_t* ctx,
         DYAD_LOG_ERROR (ctx, "ucp_worker_create failed (status = %d)!\n", status);
         goto error;
     }
+#ifdef DYAD_ENABLE_UCX_AM
+    // Data is delivered to this handler instead of being probed for by tag.
+    // Both sides register it, since warmup sends to self.
+    ucp_am_handler_param_t am_params;
+    am_params.field_mask = UCP_AM_HANDLER_PARAM_FIELD_ID | UCP_AM_HANDLER_PARAM_FIELD_CB
+                           | UCP_AM_HANDLER_PARAM_FIELD_ARG | UCP_AM_HANDLER_PARAM_FIELD_FLAGS;
+    am_params.id = DYAD_UCX_AM_ID;
+    am_params.flags = UCP_AM_FLAG_WHOLE_MSG;
+    am_params.cb = dyad_ucx_am_recv_cb;
+    am_params.arg = dtl_handle;
+    status = ucp_worker_set_am_recv_handler (dtl_handle->ucx_worker, &am_params);
+    if (UCX_STATUS_FAIL (status)) {
+        DYAD_LOG_ERROR (ctx, "Cannot register the UCX active message handler (status = %d)", \
+                        status);
+        goto error;
+    }
+#endif // DYAD_ENABLE_UCX_AM
     // Query the worker for its address
     DYAD_LOG_INFO (ctx, "Get address of UCP worker\n");
     status = ucp_worker_get_address(dtl_handle->ucx_worker,
@@ -609,6 +1477,38 @@ dyad_rc_t dyad_dtl_ucx_init (const dyad_ctx_t* ctx,
     ctx->dtl_handle->send = dyad_dtl_ucx_send;
     ctx->dtl_handle->recv = dyad_dtl_ucx_recv;
     ctx->dtl_handle->close_connection = dyad_dtl_ucx_close_connection;
+#ifdef DYAD_ENABLE_UCX_RMA
+    ctx->dtl_handle->caps = DYAD_DTL_CAP_RMA | DYAD_DTL_CAP_CHUNKING;
+#else  // DYAD_ENABLE_UCX_RMA
+    ctx->dtl_handle->caps = 0ul;
+#endif // DYAD_ENABLE_UCX_RMA
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    ctx->dtl_handle->caps |= DYAD_DTL_CAP_ZERO_COPY;
+    ctx->dtl_handle->send_file = dyad_dtl_ucx_send_file;
+    ctx->dtl_handle->disconnect = dyad_dtl_ucx_disconnect;
+    if (comm_mode == DYAD_COMM_SEND) {
+        if (flux_msg_handler_addvec (dtl_handle->h,
+                                     ucx_get_htab,
+                                     dtl_handle,
+                                     &(dtl_handle->handlers))
+            < 0) {
+            DYAD_LOG_ERROR (ctx, "Cannot register the %s handler", DYAD_DTL_RPC_DONE_NAME);
+            goto error;
+        }
+        dtl_handle->expose_timer = flux_timer_watcher_create (flux_get_reactor (dtl_handle->h),
+                                                              DYAD_UCX_GET_EXPOSE_TIMEOUT,
+                                                              DYAD_UCX_GET_EXPOSE_TIMEOUT,
+                                                              ucx_get_timer_cb,
+                                                              dtl_handle);
+        if (dtl_handle->expose_timer == NULL) {
+            DYAD_LOG_ERROR (ctx, "Cannot create the timer for memory exposed for RMA GET");
+            goto error;
+        }
+        flux_watcher_start (dtl_handle->expose_timer);
+    }
+#else  // DYAD_ENABLE_UCX_RMA_GET
+    ctx->dtl_handle->send_file = NULL;
+#endif // DYAD_ENABLE_UCX_RMA_GET
 
     rc = ucx_warmup (ctx);
     if (DYAD_IS_ERROR (rc)) {
@@ -733,6 +1633,10 @@ dyad_rc_t dyad_dtl_ucx_rpc_pack (const dyad_ctx_t* ctx,
 #else  // DYAD_ENABLE_UCX_RMA
     char* tag_name = "cons_buf";
     uint64_t tag_val = dtl_handle->cons_buf_ptr;
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    // The completion of the GET is reported to the producer's broker
+    dtl_handle->producer_rank = producer_rank;
+#endif // DYAD_ENABLE_UCX_RMA_GET
 #endif // DYAD_ENABLE_UCX_RMA
     char tag_val_buf[128];
     memset(tag_val_buf, 0x00, 128);
@@ -761,6 +1665,24 @@ dyad_rc_t dyad_dtl_ucx_rpc_pack (const dyad_ctx_t* ctx,
         rc = DYAD_RC_BADPACK;
         goto dtl_ucx_rpc_pack_region_finish;
     }
+#ifdef DYAD_ENABLE_UCX_AM
+    // Tag the reply with an id unique to this request, so that a late
+    // answer to an earlier request is never taken for this one
+    uint64_t am_id = ((uint64_t)ctx->pid << 32) | (uint64_t)(++dtl_handle->am_seq);
+    if (json_object_set_new (*packed_obj, "am_id", json_integer ((json_int_t)am_id)) < 0) {
+        DYAD_LOG_ERROR (ctx, "Could not pack the active message id for RPC\n");
+        json_decref (*packed_obj);
+        *packed_obj = NULL;
+        rc = DYAD_RC_BADPACK;
+        goto dtl_ucx_rpc_pack_region_finish;
+    }
+    rc = ucx_am_expect (dtl_handle, am_id, dtl_handle->net_buf, dtl_handle->max_transfer_size);
+    if (DYAD_IS_ERROR (rc)) {
+        json_decref (*packed_obj);
+        *packed_obj = NULL;
+        goto dtl_ucx_rpc_pack_region_finish;
+    }
+#endif // DYAD_ENABLE_UCX_AM
     rc = DYAD_RC_OK;
 dtl_ucx_rpc_pack_region_finish:;
     DYAD_C_FUNCTION_END();
@@ -823,6 +1745,18 @@ dyad_rc_t dyad_dtl_ucx_rpc_unpack (const dyad_ctx_t* ctx, const flux_msg_t* msg,
     dtl_handle->comm_tag = tag_prod << 32 | tag_cons;
     dtl_handle->consumer_conn_key = pid << 32 | tag_cons;
     DYAD_C_FUNCTION_UPDATE_INT ("cons_key", dtl_handle->consumer_conn_key);
+#ifdef DYAD_ENABLE_UCX_AM
+    json_int_t am_id = 0;
+    if (flux_request_unpack (msg, NULL, "{s:I}", "am_id", &am_id) < 0) {
+        DYAD_LOG_ERROR (ctx, "Could not unpack the active message id from consumer!\n");
+        rc = DYAD_RC_BADUNPACK;
+        goto dtl_ucx_rpc_unpack_region_finish;
+    }
+    dtl_handle->am_id = (uint64_t)am_id;
+#endif // DYAD_ENABLE_UCX_AM
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    dtl_handle->msg = msg;
+#endif // DYAD_ENABLE_UCX_RMA_GET
     DYAD_LOG_INFO (ctx, "Obtained upath from RPC payload: %s\n", *upath);
     DYAD_LOG_INFO (ctx, "Obtained UCP tag from RPC payload: %lu\n", dtl_handle->comm_tag);
     DYAD_LOG_INFO (ctx, "Decoding consumer UCP address using base64\n");
@@ -884,6 +1818,10 @@ dyad_rc_t dyad_dtl_ucx_rpc_respond (const dyad_ctx_t* ctx, const flux_msg_t* ori
 dyad_rc_t dyad_dtl_ucx_rpc_recv_response (const dyad_ctx_t* ctx, flux_future_t* f)
 {
     DYAD_C_FUNCTION_START();
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    // The module answers with where to GET the data from
+    ctx->dtl_handle->private_dtl.ucx_dtl_handle->f = f;
+#endif // DYAD_ENABLE_UCX_RMA_GET
     DYAD_C_FUNCTION_END();
     return DYAD_RC_OK;
 }
@@ -912,6 +1850,19 @@ dyad_rc_t dyad_dtl_ucx_get_buffer (const dyad_ctx_t* ctx, size_t data_size, void
         rc = DYAD_RC_BADBUF;
         goto ucx_get_buffer_done;
     }
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    if (dtl_handle->comm_mode == DYAD_COMM_SEND) {
+        // Consumers read the buffer after the request has been served, so
+        // each transfer needs its own. It is registered by send.
+        if (posix_memalign (data_buf, sysconf (_SC_PAGESIZE), data_size) != 0) {
+            *data_buf = NULL;
+            rc = DYAD_RC_SYSFAIL;
+            goto ucx_get_buffer_done;
+        }
+        rc = DYAD_RC_OK;
+        goto ucx_get_buffer_done;
+    }
+#endif // DYAD_ENABLE_UCX_RMA_GET
     DYAD_LOG_INFO (dtl_handle, "Setting the data buffer pointer to the UCX-allocated buffer");
     *data_buf = dtl_handle->net_buf;
     rc = DYAD_RC_OK;
@@ -929,6 +1880,14 @@ dyad_rc_t dyad_dtl_ucx_return_buffer (const dyad_ctx_t* ctx, void** data_buf)
         rc = DYAD_RC_BADBUF;
         goto dtl_ucx_return_buffer_done;
     }
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    dyad_dtl_ucx_t* dtl_handle = ctx->dtl_handle->private_dtl.ucx_dtl_handle;
+    // Buffers that were exposed by send are released once the consumer is done
+    if (dtl_handle->comm_mode == DYAD_COMM_SEND
+        && !ucx_get_is_exposed (dtl_handle, *data_buf)) {
+        free (*data_buf);
+    }
+#endif // DYAD_ENABLE_UCX_RMA_GET
     *data_buf = NULL;
 dtl_ucx_return_buffer_done:;
     DYAD_C_FUNCTION_END();
@@ -982,6 +1941,13 @@ dyad_rc_t dyad_dtl_ucx_send (const dyad_ctx_t* ctx, void* buf, size_t buflen)
     dyad_rc_t rc = DYAD_RC_OK;
     ucs_status_ptr_t stat_ptr;
     ucs_status_t status = UCS_OK;
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    // The consumer pulls the data itself
+    (void)stat_ptr;
+    (void)status;
+    rc = ucx_get_expose (ctx, buf, buflen, false, -1);
+    goto dtl_ucx_send_region_finish;
+#endif // DYAD_ENABLE_UCX_RMA_GET
     stat_ptr = ucx_send_no_wait (ctx, false, buf, buflen);
     DYAD_LOG_INFO (ctx, "Processing UCP send request\n");
     status = dyad_ucx_request_wait (ctx, stat_ptr);
@@ -1005,6 +1971,12 @@ dyad_rc_t dyad_dtl_ucx_recv (const dyad_ctx_t* ctx, void** buf, size_t* buflen)
 
 
     ucs_status_ptr_t stat_ptr = NULL;
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    (void)stat_ptr;
+    rc = ucx_get_pull (ctx, buf, buflen);
+    DYAD_C_FUNCTION_END();
+    return rc;
+#endif // DYAD_ENABLE_UCX_RMA_GET
     // Wait on the recv operation to complete
     stat_ptr = ucx_recv_no_wait (ctx, false, buf, buflen);
 #ifndef DYAD_ENABLE_UCX_RMA
@@ -1048,9 +2020,9 @@ dyad_rc_t dyad_dtl_ucx_close_connection (const dyad_ctx_t* ctx)
             //                   "Could not successfully close Endpoint! However, endpoint was "
             //                   "released.");
             // }
-#ifdef DYAD_ENABLE_UCX_RMA
+#if defined(DYAD_ENABLE_UCX_RMA) && !defined(DYAD_ENABLE_UCX_RMA_GET)
             ucp_rkey_destroy(dtl_handle->rkey);
-#endif // DYAD_ENABLE_UCX_RMA
+#endif // DYAD_ENABLE_UCX_RMA && !DYAD_ENABLE_UCX_RMA_GET
             dtl_handle->ep = NULL;
             // Sender doesn't have a consumer address at this time
             // So, free the consumer address when closing the connection
@@ -1062,6 +2034,7 @@ dyad_rc_t dyad_dtl_ucx_close_connection (const dyad_ctx_t* ctx)
             dtl_handle->remote_addr_len = 0;
             // }
             dtl_handle->comm_tag = 0;
+            dtl_handle->msg = NULL;
         }
         DYAD_LOG_INFO (ctx, "UCP endpoint close successful\n");
         rc = DYAD_RC_OK;
@@ -1072,6 +2045,14 @@ dyad_rc_t dyad_dtl_ucx_close_connection (const dyad_ctx_t* ctx)
         // be valid for DYAD because DYAD won't send a file from
         // one node to the same node).
         dtl_handle->comm_tag = 0;
+        dtl_handle->f = NULL;
+#ifdef DYAD_ENABLE_UCX_AM
+        // If the transfer failed before recv, stop expecting its answer
+        struct ucx_am_entry* e = ucx_am_find (dtl_handle, dtl_handle->am_id);
+        if (e != NULL && e->expected) {
+            ucx_am_remove (dtl_handle, e);
+        }
+#endif // DYAD_ENABLE_UCX_AM
         rc = DYAD_RC_OK;
     } else {
         DYAD_LOG_ERROR (ctx, "Somehow, an invalid comm mode reached 'close_connection'\n");
@@ -1082,6 +2063,73 @@ dyad_rc_t dyad_dtl_ucx_close_connection (const dyad_ctx_t* ctx)
     return rc;
 }
 
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+dyad_rc_t dyad_dtl_ucx_send_file (const dyad_ctx_t* ctx, int fd, size_t file_size)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    void* base = MAP_FAILED;
+    struct flock lock;
+    // The caller drops its lock once we return, but the consumer reads the
+    // mapping later. Hold a lock of our own until the mapping is released.
+    // It must be an open file description lock: closing any descriptor of
+    // the file drops the process' traditional locks.
+    int lock_fd = dup (fd);
+    if (lock_fd < 0) {
+        DYAD_LOG_ERROR (ctx, "Cannot duplicate file descriptor for RMA GET");
+        rc = DYAD_RC_SYSFAIL;
+        goto dtl_ucx_send_file_done;
+    }
+    memset (&lock, 0, sizeof (lock));
+    lock.l_type = F_RDLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl (lock_fd, F_OFD_SETLKW, &lock) == -1) {
+        DYAD_LOG_ERROR (ctx, "Cannot lock file for RMA GET");
+        rc = DYAD_RC_BADFIO;
+        goto dtl_ucx_send_file_done;
+    }
+    // Expose the file's pages directly so that the module neither
+    // copies nor transmits the data itself
+    base = mmap (NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        DYAD_LOG_ERROR (ctx, "Cannot map %zu bytes of file for RMA GET", file_size);
+        rc = DYAD_RC_SYSFAIL;
+        goto dtl_ucx_send_file_done;
+    }
+    rc = ucx_get_expose (ctx, base, file_size, true, lock_fd);
+    if (DYAD_IS_ERROR (rc)) {
+        munmap (base, file_size);
+        goto dtl_ucx_send_file_done;
+    }
+    lock_fd = -1;
+dtl_ucx_send_file_done:;
+    if (lock_fd >= 0) {
+        close (lock_fd);
+    }
+    DYAD_C_FUNCTION_UPDATE_INT ("file_size", file_size);
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_dtl_ucx_disconnect (const dyad_ctx_t* ctx, const flux_msg_t* msg)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_dtl_ucx_t* dtl_handle = ctx->dtl_handle->private_dtl.ucx_dtl_handle;
+    const char* sender = flux_msg_route_first (msg);
+    size_t num_released = 0ul;
+    if (dtl_handle != NULL && sender != NULL) {
+        num_released = ucx_get_reap (dtl_handle, sender);
+    }
+    if (num_released > 0ul) {
+        DYAD_LOG_INFO (ctx,
+                       "Released %zu regions exposed for RMA GET to a disconnected consumer",
+                       num_released);
+    }
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+#endif // DYAD_ENABLE_UCX_RMA_GET
+
 dyad_rc_t dyad_dtl_ucx_finalize (const dyad_ctx_t* ctx)
 {
     DYAD_C_FUNCTION_START();
@@ -1097,6 +2145,19 @@ dyad_rc_t dyad_dtl_ucx_finalize (const dyad_ctx_t* ctx)
         dyad_dtl_ucx_close_connection (ctx);
         dtl_handle->ep = NULL;
     }
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+    if (dtl_handle->handlers != NULL) {
+        flux_msg_handler_delvec (dtl_handle->handlers);
+        dtl_handle->handlers = NULL;
+    }
+    flux_watcher_destroy (dtl_handle->expose_timer);
+    dtl_handle->expose_timer = NULL;
+    while (dtl_handle->exposed != NULL) {
+        struct ucx_get_exposed* next = dtl_handle->exposed->next;
+        ucx_get_release (dtl_handle, dtl_handle->exposed);
+        dtl_handle->exposed = next;
+    }
+#endif // DYAD_ENABLE_UCX_RMA_GET
     if (dtl_handle->ep_cache != NULL) {
         dyad_ucx_ep_cache_finalize (ctx, &(dtl_handle->ep_cache), dtl_handle->ucx_worker);
         dtl_handle->ep_cache = NULL;
@@ -1113,6 +2174,11 @@ dyad_rc_t dyad_dtl_ucx_finalize (const dyad_ctx_t* ctx)
                          dtl_handle->mem_handle,
                          &(dtl_handle->net_buf));
     }
+#ifdef DYAD_ENABLE_UCX_AM
+    while (dtl_handle->am_queue != NULL) {
+        ucx_am_remove (dtl_handle, dtl_handle->am_queue);
+    }
+#endif // DYAD_ENABLE_UCX_AM
     // Release worker if not already released
     if (dtl_handle->ucx_worker != NULL) {
         ucp_worker_destroy (dtl_handle->ucx_worker);
@@ -21,6 +21,8 @@ struct dyad_dtl_ucx {
     ucp_mem_h mem_handle;
     void* net_buf;
     size_t max_transfer_size;
+    size_t stripe_size;
+    unsigned rails;
     ucp_address_t* local_address;
     size_t local_addr_len;
     ucp_address_t* remote_address;
@@ -35,6 +37,19 @@ struct dyad_dtl_ucx {
     uint64_t cons_buf_ptr;
     // Internal for Sender
     ucp_rkey_h 	rkey;
+    // Required for RMA GET
+    const flux_msg_t* msg;             // producer: request being served
+    flux_future_t* f;                  // consumer: future of the ongoing fetch
+    uint32_t producer_rank;            // consumer: rank serving the ongoing fetch
+    flux_msg_handler_t** handlers;     // producer: DYAD_DTL_RPC_DONE_NAME handler
+    struct ucx_get_exposed* exposed;   // producer: memory consumers may still read
+    uint64_t next_exposed_id;
+    flux_watcher_t* expose_timer;      // producer: releases what was never read
+    // Required for active messages
+    uint64_t am_id;                    // id of the request being served or received
+    struct ucx_am_entry* am_queue;     // consumer: expected and early messages
+    size_t am_num_unexpected;
+    uint32_t am_seq;
 };
 
 typedef struct dyad_dtl_ucx dyad_dtl_ucx_t;
@@ -67,6 +82,12 @@ dyad_rc_t dyad_dtl_ucx_recv (const dyad_ctx_t* ctx, void** buf, size_t* buflen);
 
 dyad_rc_t dyad_dtl_ucx_close_connection (const dyad_ctx_t* ctx);
 
+#ifdef DYAD_ENABLE_UCX_RMA_GET
+dyad_rc_t dyad_dtl_ucx_send_file (const dyad_ctx_t* ctx, int fd, size_t file_size);
+
+dyad_rc_t dyad_dtl_ucx_disconnect (const dyad_ctx_t* ctx, const flux_msg_t* msg);
+#endif // DYAD_ENABLE_UCX_RMA_GET
+
 dyad_rc_t dyad_dtl_ucx_finalize (const dyad_ctx_t* ctx);
 
 #endif /* DYAD_DTL_UCX_H */
@@ -18,11 +18,20 @@
 #include <dyad/common/dyad_dtl.h>
 #include <dyad/common/dyad_envs.h>
 #include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_md.h>
 #include <dyad/common/dyad_profiler.h>
 #include <dyad/common/dyad_rc.h>
 #include <dyad/common/dyad_structures.h>
+#include <dyad/core/dyad_core.h>
 #include <dyad/core/dyad_ctx.h>
 #include <dyad/dtl/dyad_dtl_api.h>
+#include <dyad/modules/dyad_collect.h>
+#include <dyad/modules/dyad_drain.h>
+#include <dyad/modules/dyad_fetch_wait.h>
+#include <dyad/modules/dyad_gc.h>
+#include <dyad/modules/dyad_md_store.h>
+#include <dyad/modules/dyad_sweep.h>
+#include <dyad/modules/dyad_watch.h>
 #include <dyad/utils/read_all.h>
 #include <dyad/utils/utils.h>
 
@@ -56,9 +65,18 @@
 struct dyad_mod_ctx {
     flux_msg_handler_t **handlers;
     dyad_ctx_t *ctx;
+    dyad_md_store_h md_store;  // shard of the metadata hash table
+    flux_watcher_t *sweeper;   // removes expired records periodically
+    dyad_sweep_t *kvs_sweep;   // pass over the KVS on rank 0, run by sweeper
+    dyad_watch_t *watch;       // publishes files closed in the managed path
+    dyad_fetch_wait_t *fetch_wait;  // fetches of files not written yet
+    dyad_gc_h gc;              // consumers of each file with expected readers
+    dyad_drain_t *drain;       // copies published files to the drain path
+    dyad_collect_t *collect;   // removes files after their last expected reader
 };
 
-const struct dyad_mod_ctx dyad_mod_ctx_default = {NULL, NULL};
+const struct dyad_mod_ctx dyad_mod_ctx_default =
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
 
 typedef struct dyad_mod_ctx dyad_mod_ctx_t;
 
@@ -79,7 +97,16 @@ static void freectx (void *arg)
 {
     dyad_mod_ctx_t *mod_ctx = (dyad_mod_ctx_t *)arg;
     flux_msg_handler_delvec (mod_ctx->handlers);
+    flux_watcher_destroy (mod_ctx->sweeper);
+    dyad_sweep_destroy (mod_ctx->kvs_sweep);
+    dyad_watch_destroy (mod_ctx->watch);
+    dyad_fetch_wait_destroy (mod_ctx->fetch_wait);
+    dyad_gc_finalize (&mod_ctx->gc);
+    // Waits for the queued copies, which use the paths of the context
+    dyad_drain_destroy (mod_ctx->drain);
+    dyad_collect_destroy (mod_ctx->collect);
     if (mod_ctx->ctx) {
+        dyad_md_store_finalize (mod_ctx->ctx, &mod_ctx->md_store);
         dyad_ctx_fini ();
         mod_ctx->ctx = NULL;
     }
@@ -98,6 +125,14 @@ static dyad_mod_ctx_t *get_mod_ctx (flux_t *h)
         }
         mod_ctx->handlers = NULL;
         mod_ctx->ctx = NULL;
+        mod_ctx->md_store = NULL;
+        mod_ctx->sweeper = NULL;
+        mod_ctx->kvs_sweep = NULL;
+        mod_ctx->watch = NULL;
+        mod_ctx->fetch_wait = NULL;
+        mod_ctx->gc = NULL;
+        mod_ctx->drain = NULL;
+        mod_ctx->collect = NULL;
 
         if (flux_aux_set (h, "dyad", mod_ctx, freectx) < 0) {
             DYAD_LOG_STDERR ("DYAD_MOD: flux_aux_set() failed!");
@@ -114,6 +149,174 @@ getctx_done:
     return mod_ctx;
 }
 
+/* Have a file, and its record, removed once as many consumers as its
+ * producer expects acknowledged it (see dyad_gc.h). The removal runs on the
+ * collect thread, as unpublishing waits on an RPC this module may serve. A
+ * file still being drained is removed by the drain once its copy is
+ * complete. */
+static void dyad_module_collect (dyad_mod_ctx_t *mod_ctx,
+                                 const char *upath,
+                                 const char *fullpath,
+                                 const char *reader)
+{
+    if (!dyad_gc_count (mod_ctx->ctx, mod_ctx->gc, upath, fullpath, reader)) {
+        return;
+    }
+    if (dyad_drain_defer_collect (mod_ctx->drain, upath)) {
+        DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: removing %s once it is drained", upath);
+        return;
+    }
+    dyad_collect_enqueue (mod_ctx->collect, upath);
+}
+
+/* Read every file listed in `upaths' into one buffer laid out as described
+ * by struct dyad_dtl_multi_entry, and ship it to the consumer with a single
+ * DTL send. Files that cannot be opened are reported with data_len = -1. */
+static dyad_rc_t dyad_send_packed_files (dyad_mod_ctx_t *mod_ctx, json_t *upaths)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_ctx_t *ctx = mod_ctx->ctx;
+    dyad_rc_t rc = DYAD_RC_OK;
+    const size_t num_files = json_array_size (upaths);
+    struct dyad_dtl_multi_entry *entries = NULL;
+    const char **paths = NULL;
+    int *fds = NULL;
+    struct flock shared_lock;
+    char fullpath[PATH_MAX + 1] = {'\0'};
+    char *inbuf = NULL;
+    char *pos = NULL;
+    size_t packed_len = sizeof (uint64_t);
+    size_t idx = 0ul;
+    ssize_t inlen = 0l;
+    uint64_t count = (uint64_t)num_files;
+    json_t *val = NULL;
+
+    if (num_files == 0ul || num_files > DYAD_DTL_MULTI_MAX) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: invalid number of files (%zu) in request", num_files);
+        errno = EPROTO;
+        rc = DYAD_RC_BADUNPACK;
+        goto send_packed_done;
+    }
+    entries = (struct dyad_dtl_multi_entry *)calloc (num_files, sizeof (*entries));
+    paths = (const char **)calloc (num_files, sizeof (*paths));
+    fds = (int *)malloc (num_files * sizeof (*fds));
+    if (entries == NULL || paths == NULL || fds == NULL) {
+        errno = ENOMEM;
+        rc = DYAD_RC_SYSFAIL;
+        goto send_packed_done;
+    }
+    for (idx = 0ul; idx < num_files; idx++) {
+        fds[idx] = -1;
+    }
+    json_array_foreach (upaths, idx, val)
+    {
+        paths[idx] = json_string_value (val);
+        if (paths[idx] == NULL) {
+            DYAD_LOG_ERROR (ctx, "DYAD_MOD: entry %zu of the upath list is not a string", idx);
+            errno = EPROTO;
+            rc = DYAD_RC_BADUNPACK;
+            goto send_packed_done;
+        }
+        strncpy (fullpath, ctx->prod_managed_path, PATH_MAX - 1);
+        fullpath[PATH_MAX - 1] = '\0';
+        concat_str (fullpath, paths[idx], "/", PATH_MAX);
+        entries[idx].upath_len = strlen (paths[idx]) + 1ul;
+        entries[idx].data_len = -1l;
+        fds[idx] = open (fullpath, O_RDONLY);
+        if (fds[idx] < 0) {
+            DYAD_LOG_ERROR (ctx, "DYAD_MOD: Failed to open file \"%s\".", fullpath);
+        } else if (DYAD_IS_ERROR (dyad_shared_flock (ctx, fds[idx], &shared_lock))) {
+            close (fds[idx]);
+            fds[idx] = -1;
+        } else {
+            entries[idx].data_len = get_file_size (fds[idx]);
+        }
+        packed_len += sizeof (*entries) + entries[idx].upath_len;
+        if (entries[idx].data_len > 0l) {
+            packed_len += (size_t)entries[idx].data_len;
+        }
+    }
+    DYAD_LOG_DEBUG (ctx, "DYAD_MOD: packing %zu files into %zu bytes", num_files, packed_len);
+    rc = ctx->dtl_handle->get_buffer (ctx,
+                                      packed_len + DYAD_DTL_LEN_PREFIX (ctx->dtl_handle),
+                                      (void **)&inbuf);
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: cannot get a %zu-byte DTL buffer", packed_len);
+        errno = ENOMEM;
+        goto send_packed_done;
+    }
+    pos = inbuf;
+    if (DYAD_DTL_LEN_PREFIX (ctx->dtl_handle) > 0ul) {
+        // Same convention as single-file transfers: length first
+        inlen = (ssize_t)packed_len;
+        memcpy (pos, &inlen, sizeof (inlen));
+        pos += sizeof (inlen);
+    }
+    memcpy (pos, &count, sizeof (count));
+    pos += sizeof (count);
+    memcpy (pos, entries, num_files * sizeof (*entries));
+    pos += num_files * sizeof (*entries);
+    for (idx = 0ul; idx < num_files; idx++) {
+        memcpy (pos, paths[idx], entries[idx].upath_len);
+        pos += entries[idx].upath_len;
+        if (entries[idx].data_len <= 0l) {
+            continue;
+        }
+        inlen = read (fds[idx], pos, (size_t)entries[idx].data_len);
+        if (inlen != entries[idx].data_len) {
+            DYAD_LOG_ERROR (ctx,
+                            "DYAD_MOD: Failed to load file \"%s\" only read %zd of %zd.",
+                            paths[idx],
+                            inlen,
+                            (ssize_t)entries[idx].data_len);
+            errno = EIO;
+            rc = DYAD_RC_BADFIO;
+            goto send_packed_done;
+        }
+        pos += inlen;
+    }
+    for (idx = 0ul; idx < num_files; idx++) {
+        if (fds[idx] >= 0) {
+            dyad_release_flock (ctx, fds[idx], &shared_lock);
+            close (fds[idx]);
+            fds[idx] = -1;
+        }
+    }
+    DYAD_LOG_DEBUG (ctx, "Establish DTL connection with consumer");
+    rc = ctx->dtl_handle->establish_connection (ctx);
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "Could not establish DTL connection with client");
+        errno = ECONNREFUSED;
+        goto send_packed_done;
+    }
+    DYAD_LOG_DEBUG (ctx, "Send %zu packed files to consumer with DTL", num_files);
+    rc = ctx->dtl_handle->send (ctx, inbuf, (size_t)(pos - inbuf));
+    ctx->dtl_handle->close_connection (ctx);
+    if (DYAD_IS_ERROR (rc)) {
+        DYAD_LOG_ERROR (ctx, "Could not send packed files to client via DTL\n");
+        errno = ECOMM;
+        goto send_packed_done;
+    }
+
+send_packed_done:;
+    if (fds != NULL) {
+        for (idx = 0ul; idx < num_files; idx++) {
+            if (fds[idx] >= 0) {
+                dyad_release_flock (ctx, fds[idx], &shared_lock);
+                close (fds[idx]);
+            }
+        }
+    }
+    if (inbuf != NULL) {
+        ctx->dtl_handle->return_buffer (ctx, (void **)&inbuf);
+    }
+    free (fds);
+    free (paths);
+    free (entries);
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
 /* request callback called when dyad.fetch request is invoked */
 #if DYAD_PERFFLOW
 __attribute__ ((annotate ("@critical_path()")))
@@ -131,9 +334,15 @@ dyad_fetch_request_cb (flux_t *h, flux_msg_handler_t *w, const flux_msg_t *msg,
     char *upath = NULL;
     char fullpath[PATH_MAX + 1] = {'\0'};
     int saved_errno = errno;
+    int open_errno = 0;
     ssize_t file_size = 0l;
+    size_t len_prefix = 0ul;
     dyad_rc_t rc = 0;
     struct flock shared_lock;
+    json_t *upaths = NULL;
+    int placed = 0;
+    json_int_t version = 0;
+    int req_mode = (int)DYAD_DTL_END;
     if (!flux_msg_is_streaming (msg)) {
         errno = EPROTO;
         goto fetch_error_wo_flock;
@@ -142,6 +351,20 @@ dyad_fetch_request_cb (flux_t *h, flux_msg_handler_t *w, const flux_msg_t *msg,
     if (flux_msg_get_userid (msg, &userid) < 0)
         goto fetch_error_wo_flock;
 
+    // With the AUTO DTL, serve the request over the DTL the consumer picked
+    if (mod_ctx->ctx->dtl_handle->auto_dtl[DYAD_DTL_UCX] != NULL) {
+        if (flux_request_unpack (msg, NULL, "{s:i}", DYAD_DTL_RPC_MODE, &req_mode) < 0) {
+            DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: the request does not name its DTL");
+            errno = EPROTO;
+            goto fetch_error_wo_flock;
+        }
+        rc = dyad_dtl_select (mod_ctx->ctx, (dyad_dtl_mode_t)req_mode);
+        if (DYAD_IS_ERROR (rc)) {
+            errno = EPROTO;
+            goto fetch_error_wo_flock;
+        }
+    }
+
     DYAD_LOG_INFO (mod_ctx->ctx, "DYAD_MOD: unpacking RPC message");
 
     rc = mod_ctx->ctx->dtl_handle->rpc_unpack (mod_ctx->ctx, msg, &upath);
@@ -153,30 +376,64 @@ dyad_fetch_request_cb (flux_t *h, flux_msg_handler_t *w, const flux_msg_t *msg,
     }
     DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
     DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: requested user_path: %s", upath);
-    DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: sending initial response to consumer");
 
+    if (flux_request_unpack (msg,
+                             NULL,
+                             "{s?o, s?b, s?I}",
+                             DYAD_DTL_RPC_UPATHS,
+                             &upaths,
+                             DYAD_DTL_RPC_PLACED,
+                             &placed,
+                             DYAD_DTL_RPC_VERSION,
+                             &version)
+        < 0) {
+        upaths = NULL;
+        placed = 0;
+        version = 0;
+    }
+    if (upaths == NULL) {
+        strncpy (fullpath, mod_ctx->ctx->prod_managed_path, PATH_MAX - 1);
+        concat_str (fullpath, upath, "/", PATH_MAX);
+        DYAD_C_FUNCTION_UPDATE_STR ("fullpath", fullpath);
+        // A consumer that found the owner by the placement rule, or that
+        // asks for a given version, may come before the file is complete.
+        // Hold the request, without answering it, until it is. This callback
+        // is invoked again with the same message then. Any other request
+        // follows a published record, so a missing file fails at once.
+        if ((placed != 0 || version > 0)
+            && !DYAD_IS_ERROR (dyad_fetch_wait_park (mod_ctx->fetch_wait,
+                                                     fullpath,
+                                                     placed != 0,
+                                                     (uint64_t)version,
+                                                     msg))) {
+            goto end_fetch_cb;
+        }
+    }
+
+    DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: sending initial response to consumer");
     rc = mod_ctx->ctx->dtl_handle->rpc_respond (mod_ctx->ctx, msg);
     if (DYAD_IS_ERROR (rc)) {
         DYAD_LOG_ERROR (mod_ctx->ctx, "Could not send primary RPC response to client");
         goto fetch_error_wo_flock;
     }
 
-    strncpy (fullpath, mod_ctx->ctx->prod_managed_path, PATH_MAX - 1);
-    concat_str (fullpath, upath, "/", PATH_MAX);
-    DYAD_C_FUNCTION_UPDATE_STR ("fullpath", fullpath);
-
-#if DYAD_SPIN_WAIT
-    if (!get_stat (fullpath, 1000U, 1000L)) {
-        DYAD_LOG_ERR (mod_ctx->ctx, "DYAD_MOD: Failed to access info on \"%s\".", fullpath);
-        // goto error;
+    if (upaths != NULL) {
+        DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: request carries a list of upaths");
+        rc = dyad_send_packed_files (mod_ctx, upaths);
+        if (DYAD_IS_ERROR (rc)) {
+            goto fetch_error_wo_flock;
+        }
+        goto fetch_end_of_stream;
     }
-#endif  // DYAD_SPIN_WAIT
 
     DYAD_LOG_INFO (mod_ctx->ctx, "DYAD_MOD: Reading file %s for transfer", fullpath);
     fd = open (fullpath, O_RDONLY);
 
     if (fd < 0) {
+        // The consumer does not retry a file that is gone (ENOENT)
+        open_errno = errno;
         DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: Failed to open file \"%s\".", fullpath);
+        errno = open_errno;
         goto fetch_error_wo_flock;
     }
     rc = dyad_shared_flock (mod_ctx->ctx, fd, &shared_lock);
@@ -185,24 +442,40 @@ dyad_fetch_request_cb (flux_t *h, flux_msg_handler_t *w, const flux_msg_t *msg,
     }
     file_size = get_file_size (fd);
     DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: file %s has size %zd", fullpath, file_size);
+    if (file_size > 0l && mod_ctx->ctx->dtl_handle->send_file != NULL) {
+        // The DTL can ship the file without staging it in a buffer
+        rc = mod_ctx->ctx->dtl_handle->establish_connection (mod_ctx->ctx);
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (mod_ctx->ctx, "Could not establish DTL connection with client");
+            errno = ECONNREFUSED;
+            goto fetch_error;
+        }
+        DYAD_C_FUNCTION_UPDATE_INT ("file_size", file_size);
+        DYAD_LOG_DEBUG (mod_ctx->ctx, "Send file to consumer with DTL");
+        rc = mod_ctx->ctx->dtl_handle->send_file (mod_ctx->ctx, fd, (size_t)file_size);
+        mod_ctx->ctx->dtl_handle->close_connection (mod_ctx->ctx);
+        dyad_release_flock (mod_ctx->ctx, fd, &shared_lock);
+        close (fd);
+        if (DYAD_IS_ERROR (rc)) {
+            DYAD_LOG_ERROR (mod_ctx->ctx, "Could not send data to client via DTL\n");
+            errno = ECOMM;
+            goto fetch_error_wo_flock;
+        }
+        goto fetch_end_of_stream;
+    }
+    len_prefix = DYAD_DTL_LEN_PREFIX (mod_ctx->ctx->dtl_handle);
     rc = mod_ctx->ctx->dtl_handle->get_buffer (mod_ctx->ctx, file_size, (void **)&inbuf);
-#ifdef DYAD_ENABLE_UCX_RMA
-    // To reduce the number of RMA calls, we are encoding file size at the start of the buffer
-    memcpy (inbuf, &file_size, sizeof (file_size));
-#endif
+    if (len_prefix > 0ul) {
+        // To reduce the number of RMA calls, we are encoding file size at the start of the buffer
+        memcpy (inbuf, &file_size, sizeof (file_size));
+    }
     if (file_size > 0l) {
-#ifdef DYAD_ENABLE_UCX_RMA
-        inlen = read (fd, inbuf + sizeof (file_size), file_size);
-#else
-        inlen = read (fd, inbuf, file_size);
-#endif
+        inlen = read (fd, inbuf + len_prefix, file_size);
         if (inlen != file_size) {
             DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: Failed to load file \"%s\" only read %zd of %zd.", fullpath, inlen, file_size);
             goto fetch_error;
         }
-#ifdef DYAD_ENABLE_UCX_RMA
-        inlen = file_size + sizeof (file_size);
-#endif
+        inlen = file_size + len_prefix;
         DYAD_C_FUNCTION_UPDATE_INT ("file_size", file_size);
         DYAD_LOG_DEBUG (mod_ctx->ctx, "Closing file pointer");
         dyad_release_flock (mod_ctx->ctx, fd, &shared_lock);
@@ -228,6 +501,7 @@ dyad_fetch_request_cb (flux_t *h, flux_msg_handler_t *w, const flux_msg_t *msg,
     } else {
         goto fetch_error;
     }
+fetch_end_of_stream:;
     DYAD_LOG_DEBUG (mod_ctx->ctx, "Close RPC message stream with an ENODATA (%d) message", ENODATA);
     if (flux_respond_error (h, msg, ENODATA, NULL) < 0) {
         DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: %s: flux_respond_error with ENODATA failed\n", __func__);
@@ -254,8 +528,337 @@ end_fetch_cb:;
     return;
 }
 
+/* Store the record a producer publishes to this shard of the metadata
+ * hash table (DYAD_MD_DHT), and answer the lookups waiting for it. A request
+ * carries either one "key" and "record" or the arrays "keys" and "records". */
+static void dyad_md_publish_cb (flux_t *h,
+                                flux_msg_handler_t *w,
+                                const flux_msg_t *msg,
+                                void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_mod_ctx_t *mod_ctx = get_mod_ctx (h);
+    const char *ns = NULL;
+    const char *key = NULL;
+    json_t *record = NULL;
+    json_t *keys = NULL;
+    json_t *records = NULL;
+    size_t i = 0ul;
+
+    if (flux_request_unpack (msg,
+                             NULL,
+                             "{s:s, s?s, s?o, s?o, s?o}",
+                             "ns",
+                             &ns,
+                             "key",
+                             &key,
+                             "record",
+                             &record,
+                             "keys",
+                             &keys,
+                             "records",
+                             &records)
+            < 0
+        || ((key == NULL || record == NULL)
+            && (!json_is_array (keys) || !json_is_array (records)
+                || json_array_size (keys) != json_array_size (records)))) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: Cannot unpack %s request", DYAD_MD_RPC_PUBLISH);
+        errno = EPROTO;
+        goto md_publish_error;
+    }
+    if (key != NULL && record != NULL) {
+        DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: storing the record under %s", key);
+        if (DYAD_IS_ERROR (dyad_md_store_put (mod_ctx->ctx, mod_ctx->md_store, ns, key, record))) {
+            errno = ENOMEM;
+            goto md_publish_error;
+        }
+    } else {
+        DYAD_LOG_DEBUG (mod_ctx->ctx,
+                        "DYAD_MOD: storing %zu records",
+                        json_array_size (records));
+        for (i = 0ul; i < json_array_size (keys); i++) {
+            key = json_string_value (json_array_get (keys, i));
+            if (key == NULL) {
+                errno = EPROTO;
+                goto md_publish_error;
+            }
+            if (DYAD_IS_ERROR (dyad_md_store_put (mod_ctx->ctx,
+                                                  mod_ctx->md_store,
+                                                  ns,
+                                                  key,
+                                                  json_array_get (records, i)))) {
+                errno = ENOMEM;
+                goto md_publish_error;
+            }
+        }
+    }
+    if (flux_respond (h, msg, NULL) < 0) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: %s: flux_respond failed", __func__);
+    }
+    DYAD_C_FUNCTION_END ();
+    return;
+
+md_publish_error:;
+    if (flux_respond_error (h, msg, errno, NULL) < 0) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: %s: flux_respond_error", __func__);
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+/* Answer a lookup from this shard of the metadata hash table. A lookup that
+ * asks to wait for a key not yet published is parked until it is. */
+static void dyad_md_lookup_cb (flux_t *h,
+                               flux_msg_handler_t *w,
+                               const flux_msg_t *msg,
+                               void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_mod_ctx_t *mod_ctx = get_mod_ctx (h);
+    const char *ns = NULL;
+    const char *key = NULL;
+    int wait = 0;
+    json_int_t version = 0;
+    json_t *record = NULL;
+
+    if (flux_request_unpack (msg,
+                             NULL,
+                             "{s:s, s:s, s:b, s?I}",
+                             "ns",
+                             &ns,
+                             "key",
+                             &key,
+                             "wait",
+                             &wait,
+                             "version",
+                             &version)
+        < 0) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: Cannot unpack %s request", DYAD_MD_RPC_LOOKUP);
+        goto md_lookup_error;
+    }
+    // A waiting lookup is only answered by the requested version or a later one
+    if (!DYAD_IS_ERROR (dyad_md_store_get (mod_ctx->ctx, mod_ctx->md_store, ns, key, &record))
+        && (!wait || dyad_md_store_version (record) >= (uint64_t)version)) {
+        if (flux_respond_pack (h, msg, "{s:O}", "record", record) < 0) {
+            DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: %s: flux_respond_pack failed", __func__);
+        }
+        DYAD_C_FUNCTION_END ();
+        return;
+    }
+    if (wait) {
+        dyad_md_store_park (mod_ctx->ctx, mod_ctx->md_store, ns, key, (uint64_t)version, msg);
+        DYAD_C_FUNCTION_END ();
+        return;
+    }
+    errno = ENOENT;
+
+md_lookup_error:;
+    if (flux_respond_error (h, msg, errno, NULL) < 0) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: %s: flux_respond_error", __func__);
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+/* Drop records from this shard of the metadata hash table */
+static void dyad_md_unpublish_cb (flux_t *h,
+                                  flux_msg_handler_t *w,
+                                  const flux_msg_t *msg,
+                                  void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_mod_ctx_t *mod_ctx = get_mod_ctx (h);
+    const char *ns = NULL;
+    json_t *keys = NULL;
+    json_t *key = NULL;
+    size_t i = 0ul;
+
+    if (flux_request_unpack (msg, NULL, "{s:s, s:o}", "ns", &ns, "keys", &keys) < 0
+        || !json_is_array (keys)) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: Cannot unpack %s request", DYAD_MD_RPC_UNPUBLISH);
+        if (flux_respond_error (h, msg, EPROTO, NULL) < 0) {
+            DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: %s: flux_respond_error", __func__);
+        }
+        DYAD_C_FUNCTION_END ();
+        return;
+    }
+    json_array_foreach (keys, i, key)
+    {
+        if (json_is_string (key)) {
+            dyad_md_store_remove (mod_ctx->ctx, mod_ctx->md_store, ns, json_string_value (key));
+        }
+    }
+    DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: unpublished %zu records", json_array_size (keys));
+    if (flux_respond (h, msg, NULL) < 0) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: %s: flux_respond failed", __func__);
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+/* Queue the files a local producer just published for copying to the drain
+ * path. The request has no response. */
+static void dyad_drain_request_cb (flux_t *h,
+                                   flux_msg_handler_t *w,
+                                   const flux_msg_t *msg,
+                                   void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_mod_ctx_t *mod_ctx = get_mod_ctx (h);
+    json_t *upaths = NULL;
+    json_t *upath = NULL;
+    size_t i = 0ul;
+
+    if (flux_request_unpack (msg, NULL, "{s:o}", "upaths", &upaths) < 0
+        || !json_is_array (upaths)) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: Cannot unpack %s request", DYAD_DRAIN_RPC_NAME);
+        DYAD_C_FUNCTION_END ();
+        return;
+    }
+    if (mod_ctx->drain == NULL) {
+        DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: no drain path, ignoring %s", DYAD_DRAIN_RPC_NAME);
+        DYAD_C_FUNCTION_END ();
+        return;
+    }
+    json_array_foreach (upaths, i, upath)
+    {
+        if (json_is_string (upath)) {
+            dyad_drain_enqueue (mod_ctx->drain, json_string_value (upath));
+        }
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+/* A consumer is done with a file this node produced, whether it was sent
+ * here, read from shared storage or from the drain path. Count it towards the
+ * file's expected readers. The request has no response. */
+static void dyad_gc_ack_cb (flux_t *h,
+                            flux_msg_handler_t *w,
+                            const flux_msg_t *msg,
+                            void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_mod_ctx_t *mod_ctx = get_mod_ctx (h);
+    const char *upath = NULL;
+    char fullpath[PATH_MAX + 1] = {'\0'};
+
+    if (flux_request_unpack (msg, NULL, "{s:s}", "upath", &upath) < 0) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: Cannot unpack %s request", DYAD_GC_RPC_ACK);
+        DYAD_C_FUNCTION_END ();
+        return;
+    }
+    if (mod_ctx->ctx->prod_managed_path == NULL) {
+        DYAD_C_FUNCTION_END ();
+        return;
+    }
+    strncpy (fullpath, mod_ctx->ctx->prod_managed_path, PATH_MAX - 1);
+    concat_str (fullpath, upath, "/", PATH_MAX);
+    dyad_module_collect (mod_ctx, upath, fullpath, flux_msg_route_first (msg));
+    DYAD_C_FUNCTION_END ();
+}
+
+/* A client that sent us requests has disconnected. Release what the DTL
+ * and the metadata lookups still hold for it. The request has no response. */
+static void dyad_disconnect_cb (flux_t *h,
+                                flux_msg_handler_t *w,
+                                const flux_msg_t *msg,
+                                void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_mod_ctx_t *mod_ctx = get_mod_ctx (h);
+    size_t released = 0ul;
+    if (DYAD_IS_ERROR (dyad_dtl_disconnect (mod_ctx->ctx, msg))) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: the DTL failed to handle a disconnect");
+    }
+    released = dyad_md_store_disconnect (mod_ctx->ctx, mod_ctx->md_store, msg);
+    if (released > 0ul) {
+        DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: released %zu lookups of a disconnected client", \
+                        released);
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+/* Remove the records whose time to live has passed, from the shard of the
+ * metadata hash table on every rank and from the KVS on rank 0. */
+static void dyad_sweep_cb (flux_reactor_t *r, flux_watcher_t *w, int revents, void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_mod_ctx_t *mod_ctx = (dyad_mod_ctx_t *)arg;
+    const int64_t now = (int64_t)time (NULL);
+    size_t removed = dyad_md_store_sweep (mod_ctx->ctx, mod_ctx->md_store, now);
+
+    // The KVS pass runs asynchronously and logs what it removed when done
+    if (mod_ctx->kvs_sweep != NULL) {
+        if (dyad_sweep_busy (mod_ctx->kvs_sweep)) {
+            DYAD_LOG_DEBUG (mod_ctx->ctx, "DYAD_MOD: previous KVS sweep still running");
+        } else if (DYAD_IS_ERROR (dyad_sweep_kvs_start (mod_ctx->kvs_sweep, now))) {
+            DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: cannot start the KVS sweep");
+        }
+    }
+    if (removed > 0ul) {
+        DYAD_LOG_INFO (mod_ctx->ctx, "DYAD_MOD: swept %zu expired records", removed);
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+static dyad_rc_t dyad_module_start_sweeper (dyad_mod_ctx_t *mod_ctx)
+{
+    const char *e = getenv (DYAD_KVS_SWEEP_PERIOD_ENV);
+    double period = (e != NULL) ? strtod (e, NULL) : 0.0;
+
+    if (period <= 0.0) {
+        return DYAD_RC_OK;
+    }
+    if (mod_ctx->ctx->rank == 0u && mod_ctx->ctx->md_mode == DYAD_MD_KVS
+        && DYAD_IS_ERROR (dyad_sweep_create (mod_ctx->ctx, &mod_ctx->kvs_sweep))) {
+        return DYAD_RC_SYSFAIL;
+    }
+    mod_ctx->sweeper = flux_timer_watcher_create (flux_get_reactor (mod_ctx->ctx->h),
+                                                  period,
+                                                  period,
+                                                  dyad_sweep_cb,
+                                                  mod_ctx);
+    if (mod_ctx->sweeper == NULL) {
+        DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: cannot create the sweeper timer");
+        return DYAD_RC_FLUXFAIL;
+    }
+    flux_watcher_start (mod_ctx->sweeper);
+    DYAD_LOG_INFO (mod_ctx->ctx, "DYAD_MOD: sweeping expired records every %.1f s", period);
+    return DYAD_RC_OK;
+}
+
+static dyad_rc_t dyad_module_start_watch (dyad_mod_ctx_t *mod_ctx, bool watch)
+{
+    const char *e = getenv (DYAD_WATCH_PERIOD_ENV);
+
+    if (!watch) {
+        return DYAD_RC_OK;
+    }
+    return dyad_watch_create (mod_ctx->ctx,
+                              (e != NULL) ? strtod (e, NULL) : DYAD_WATCH_PERIOD_DEFAULT,
+                              &mod_ctx->watch);
+}
+
+static dyad_rc_t dyad_module_start_drain (dyad_mod_ctx_t *mod_ctx)
+{
+    const char *streams = getenv (DYAD_DRAIN_STREAMS_ENV);
+    const char *bandwidth = getenv (DYAD_DRAIN_BANDWIDTH_ENV);
+
+    if (mod_ctx->ctx->drain_path == NULL) {
+        return DYAD_RC_OK;
+    }
+    return dyad_drain_create (mod_ctx->ctx,
+                              (streams != NULL) ? (unsigned)strtoul (streams, NULL, 10)
+                                                : DYAD_DRAIN_STREAMS_DEFAULT,
+                              (bandwidth != NULL) ? strtoull (bandwidth, NULL, 10) : 0ull,
+                              &mod_ctx->drain);
+}
+
 static const struct flux_msg_handler_spec htab[] =
     {{FLUX_MSGTYPE_REQUEST, DYAD_DTL_RPC_NAME, dyad_fetch_request_cb, 0},
+     {FLUX_MSGTYPE_REQUEST, DYAD_MD_RPC_PUBLISH, dyad_md_publish_cb, 0},
+     {FLUX_MSGTYPE_REQUEST, DYAD_MD_RPC_LOOKUP, dyad_md_lookup_cb, 0},
+     {FLUX_MSGTYPE_REQUEST, DYAD_MD_RPC_UNPUBLISH, dyad_md_unpublish_cb, 0},
+     {FLUX_MSGTYPE_REQUEST, DYAD_DRAIN_RPC_NAME, dyad_drain_request_cb, 0},
+     {FLUX_MSGTYPE_REQUEST, DYAD_GC_RPC_ACK, dyad_gc_ack_cb, 0},
+     {FLUX_MSGTYPE_REQUEST, DYAD_DTL_RPC_DISCONNECT_NAME, dyad_disconnect_cb, 0},
      FLUX_MSGHANDLER_TABLE_END};
 
 static void show_help (void)
@@ -265,7 +868,14 @@ static void show_help (void)
     DYAD_LOG_STDOUT ("    -d, --debug: Enable debugging log message.\n");
     DYAD_LOG_STDOUT (
         "    -m, --mode:  DTL mode. Need an argument.\n"
-        "                 Either 'FLUX_RPC' (default) or 'UCX'.\n");
+        "                 Either 'FLUX_RPC' (default), 'UCX', 'AUTO',\n"
+        "                 or 'TCP'. 'AUTO' serves each request over the\n"
+        "                 DTL the consumer chose for it. 'TCP' connects\n"
+        "                 to consumers directly over TCP sockets.\n"
+        "                 'FABRIC' uses libfabric, if DYAD was built\n"
+        "                 with it.\n"
+        "                 Any other name loads the DTL plugin\n"
+        "                 libdyad_dtl_<name>.so.\n");
     DYAD_LOG_STDOUT (
         "    -i, --info_log: Specify the file into which to redirect\n"
         "                    info logging. Does nothing if DYAD was not\n"
@@ -276,12 +886,19 @@ static void show_help (void)
         "                     error logging. Does nothing if DYAD was\n"
         "                     not configured with '-DDYAD_LOGGER=PRINTF'\n"
         "                     Need a filename as an argument.\n");
+    DYAD_LOG_STDOUT (
+        "    -w, --watch: Publish the files written into the producer-managed\n"
+        "                 directory as they are closed, so that producers\n"
+        "                 do not need the LD_PRELOAD wrapper. Files closed\n"
+        "                 within $DYAD_WATCH_PERIOD seconds (default 0.01)\n"
+        "                 are published together.\n");
 }
 
 struct opt_parse_out {
     const char *prod_managed_path;
     const char *dtl_mode;
     bool debug;
+    bool watch;
 };
 
 typedef struct opt_parse_out opt_parse_out_t;
@@ -324,12 +941,13 @@ static int opt_parse (opt_parse_out_t *restrict opt,
                                                {"mode", required_argument, 0, 'm'},
                                                {"info_log", required_argument, 0, 'i'},
                                                {"error_log", required_argument, 0, 'e'},
+                                               {"watch", no_argument, 0, 'w'},
                                                {0, 0, 0, 0}};
         /* getopt_long stores the option index here. */
         int option_index = 0;
         int c = -1;
 
-        c = getopt_long (argc, argv, "hdm:i:e:", long_options, &option_index);
+        c = getopt_long (argc, argv, "hdm:i:e:w", long_options, &option_index);
 
         /* Detect the end of the options. */
         if (c == -1) {
@@ -353,6 +971,17 @@ static int opt_parse (opt_parse_out_t *restrict opt,
                 opt->dtl_mode = optarg;
                 if (strcmp("UCX", optarg) == 0) *dtl_mode = DYAD_DTL_UCX;
                 else if (strcmp("FLUX_RPC", optarg) == 0) *dtl_mode = DYAD_DTL_FLUX_RPC;
+                else if (strcmp("AUTO", optarg) == 0) *dtl_mode = DYAD_DTL_AUTO;
+                else if (strcmp("TCP", optarg) == 0) *dtl_mode = DYAD_DTL_TCP;
+                else if (strcmp("FABRIC", optarg) == 0) *dtl_mode = DYAD_DTL_FABRIC;
+                else if (strncmp (DYAD_DTL_PLUGIN_PREFIX, optarg,
+                                  strlen (DYAD_DTL_PLUGIN_PREFIX)) == 0
+                         && optarg[strlen (DYAD_DTL_PLUGIN_PREFIX)] != '\0')
+                    *dtl_mode = DYAD_DTL_PLUGIN;
+                else {
+                    DYAD_LOG_STDERR ("DYAD_MOD: Unknown DTL mode `%s'\n", optarg);
+                    return DYAD_RC_BADDTLMODE;
+                }
                 break;
             case 'i':
 #ifndef DYAD_LOGGER_NO_LOG
@@ -366,6 +995,10 @@ static int opt_parse (opt_parse_out_t *restrict opt,
                 sprintf (err_file_name, "%s_%d.err", optarg, broker_rank);
 #endif  // DYAD_LOGGER_NO_LOG
                 break;
+            case 'w':
+                DYAD_LOG_STDERR ("DYAD_MOD: 'watch' option -w \n");
+                opt->watch = true;
+                break;
             case '?':
                 /* getopt_long already printed an error message. */
                 break;
@@ -470,7 +1103,7 @@ DYAD_DLL_EXPORTED int mod_main (flux_t *h, int argc, char **argv)
 #endif
     DYAD_C_FUNCTION_START ();
 
-    opt_parse_out_t opt = {NULL, NULL, false};
+    opt_parse_out_t opt = {NULL, NULL, false, false};
     DYAD_LOG_STDERR ("DYAD_MOD: Parsing command line options");
 
     if (DYAD_IS_ERROR (opt_parse (&opt, broker_rank, &dtl_mode, argc, argv))) {
@@ -482,6 +1115,38 @@ DYAD_DLL_EXPORTED int mod_main (flux_t *h, int argc, char **argv)
         goto mod_error;
     }
 
+    if (DYAD_IS_ERROR (dyad_md_store_init (mod_ctx->ctx, &mod_ctx->md_store))) {
+        goto mod_error;
+    }
+
+    if (DYAD_IS_ERROR (dyad_gc_init (mod_ctx->ctx, &mod_ctx->gc))) {
+        goto mod_error;
+    }
+
+    if (mod_ctx->ctx->prod_managed_path != NULL
+        && DYAD_IS_ERROR (dyad_collect_create (mod_ctx->ctx, &mod_ctx->collect))) {
+        goto mod_error;
+    }
+
+    if (DYAD_IS_ERROR (dyad_module_start_sweeper (mod_ctx))) {
+        goto mod_error;
+    }
+
+    if (DYAD_IS_ERROR (dyad_module_start_drain (mod_ctx))) {
+        goto mod_error;
+    }
+
+    if (DYAD_IS_ERROR (dyad_module_start_watch (mod_ctx, opt.watch))) {
+        goto mod_error;
+    }
+
+    if (DYAD_IS_ERROR (dyad_fetch_wait_create (mod_ctx->ctx,
+                                               dyad_fetch_request_cb,
+                                               (void *)h,
+                                               &mod_ctx->fetch_wait))) {
+        goto mod_error;
+    }
+
     if (flux_msg_handler_addvec (mod_ctx->ctx->h, htab, (void *)h, &mod_ctx->handlers) < 0) {
         DYAD_LOG_ERROR (mod_ctx->ctx, "DYAD_MOD: flux_msg_handler_addvec: %s\n", strerror (errno));
         goto mod_error;
@@ -0,0 +1,193 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_core.h>
+#include <dyad/modules/dyad_collect.h>
+#include <dyad/utils/utils.h>
+#include <errno.h>
+#include <flux/core.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct collect_item {
+    struct collect_item *next;
+    char *upath;
+};
+
+struct dyad_collect {
+    const dyad_ctx_t *ctx;
+    dyad_ctx_t wctx;  // copy of the module's context with the thread's own handle
+    pthread_t thread;
+    bool started;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct collect_item *head;
+    struct collect_item *tail;
+    struct collect_item *current;  // item being removed, guarded by lock
+    bool stop;
+};
+
+static void collect_remove (dyad_collect_t *c, const char *upath)
+{
+    char fullpath[PATH_MAX + 1] = {'\0'};
+    const char *fnames[1] = {fullpath};
+
+    strncpy (fullpath, c->wctx.prod_managed_path, PATH_MAX - 1);
+    concat_str (fullpath, upath, "/", PATH_MAX);
+    // The record goes first, so that no consumer is sent to a missing file
+    if (DYAD_IS_ERROR (dyad_unpublish (&c->wctx, fnames, 1ul))) {
+        DYAD_LOG_ERROR (&c->wctx, "DYAD_COLLECT: cannot unpublish %s", upath);
+        return;
+    }
+    if (unlink (fullpath) != 0) {
+        DYAD_LOG_ERROR (&c->wctx, "DYAD_COLLECT: cannot remove %s: %s", fullpath, strerror (errno));
+        return;
+    }
+    DYAD_LOG_INFO (&c->wctx, "DYAD_COLLECT: removed %s after its last expected reader", upath);
+}
+
+static void *collect_main (void *arg)
+{
+    dyad_collect_t *c = (dyad_collect_t *)arg;
+    struct collect_item *item = NULL;
+
+    for (;;) {
+        pthread_mutex_lock (&c->lock);
+        while (c->head == NULL && !c->stop) {
+            pthread_cond_wait (&c->wake, &c->lock);
+        }
+        if (c->stop) {
+            pthread_mutex_unlock (&c->lock);
+            break;
+        }
+        item = c->head;
+        if ((c->head = item->next) == NULL) {
+            c->tail = NULL;
+        }
+        c->current = item;
+        pthread_mutex_unlock (&c->lock);
+
+        collect_remove (c, item->upath);
+
+        pthread_mutex_lock (&c->lock);
+        c->current = NULL;
+        pthread_mutex_unlock (&c->lock);
+        free (item->upath);
+        free (item);
+    }
+    return NULL;
+}
+
+dyad_rc_t dyad_collect_create (const dyad_ctx_t *ctx, dyad_collect_t **collect)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_collect_t *c = NULL;
+
+    *collect = NULL;
+    if (ctx->prod_managed_path == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_COLLECT: removing files needs a producer-managed path");
+        rc = DYAD_RC_BADMANAGEDPATH;
+        goto collect_create_done;
+    }
+    if ((c = (dyad_collect_t *)calloc (1ul, sizeof (dyad_collect_t))) == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto collect_create_done;
+    }
+    c->ctx = ctx;
+    pthread_mutex_init (&c->lock, NULL);
+    pthread_cond_init (&c->wake, NULL);
+    c->wctx = *ctx;
+    // Nothing runs the reactor of the thread's handle
+    c->wctx.async_publish = false;
+    if ((c->wctx.h = flux_open (NULL, 0)) == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_COLLECT: cannot open a Flux handle for the removal thread");
+        rc = DYAD_RC_FLUXFAIL;
+        goto collect_create_done;
+    }
+    if (pthread_create (&c->thread, NULL, collect_main, c) != 0) {
+        DYAD_LOG_ERROR (ctx, "DYAD_COLLECT: cannot start the removal thread");
+        rc = DYAD_RC_SYSFAIL;
+        goto collect_create_done;
+    }
+    c->started = true;
+
+collect_create_done:;
+    if (DYAD_IS_ERROR (rc)) {
+        dyad_collect_destroy (c);
+    } else {
+        *collect = c;
+    }
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
+void dyad_collect_enqueue (dyad_collect_t *collect, const char *upath)
+{
+    struct collect_item *item = NULL;
+    bool queued = false;
+
+    if (collect == NULL) {
+        return;
+    }
+    pthread_mutex_lock (&collect->lock);
+    queued = (collect->current != NULL && strcmp (collect->current->upath, upath) == 0);
+    for (item = collect->head; item != NULL && !queued; item = item->next) {
+        queued = (strcmp (item->upath, upath) == 0);
+    }
+    pthread_mutex_unlock (&collect->lock);
+    if (queued) {
+        return;
+    }
+    if ((item = (struct collect_item *)calloc (1ul, sizeof (struct collect_item))) == NULL
+        || (item->upath = strdup (upath)) == NULL) {
+        DYAD_LOG_ERROR (collect->ctx, "DYAD_COLLECT: cannot queue %s for removal", upath);
+        free (item);
+        return;
+    }
+    pthread_mutex_lock (&collect->lock);
+    if (collect->tail != NULL) {
+        collect->tail->next = item;
+    } else {
+        collect->head = item;
+    }
+    collect->tail = item;
+    pthread_cond_signal (&collect->wake);
+    pthread_mutex_unlock (&collect->lock);
+}
+
+void dyad_collect_destroy (dyad_collect_t *collect)
+{
+    struct collect_item *item = NULL;
+
+    if (collect == NULL) {
+        return;
+    }
+    pthread_mutex_lock (&collect->lock);
+    collect->stop = true;
+    pthread_cond_broadcast (&collect->wake);
+    pthread_mutex_unlock (&collect->lock);
+    if (collect->started) {
+        pthread_join (collect->thread, NULL);
+    }
+    if (collect->wctx.h != NULL) {
+        flux_close ((flux_t *)collect->wctx.h);
+    }
+    while ((item = collect->head) != NULL) {
+        collect->head = item->next;
+        DYAD_LOG_DEBUG (collect->ctx, "DYAD_COLLECT: keeping %s", item->upath);
+        free (item->upath);
+        free (item);
+    }
+    pthread_cond_destroy (&collect->wake);
+    pthread_mutex_destroy (&collect->lock);
+    free (collect);
+}
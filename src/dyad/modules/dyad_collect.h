@@ -0,0 +1,40 @@
+#ifndef DYAD_MODULES_DYAD_COLLECT_H
+#define DYAD_MODULES_DYAD_COLLECT_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Removes the files that all their expected readers acknowledged (see
+ * dyad_gc.h), and their records, from a thread with its own Flux handle.
+ * Unpublishing waits on an RPC that may be served by this very module,
+ * so it cannot run on the module's reactor.
+ */
+typedef struct dyad_collect dyad_collect_t;
+
+dyad_rc_t dyad_collect_create (const dyad_ctx_t *ctx, dyad_collect_t **collect);
+
+/* Queue `upath', relative to the producer-managed path, for removal, unless
+ * it is queued or being removed already */
+void dyad_collect_enqueue (dyad_collect_t *collect, const char *upath);
+
+/* Stop the thread once it is done with the file it is removing. The files
+ * still queued are kept, with their records, as the reactor that serves
+ * their unpublish may no longer run. */
+void dyad_collect_destroy (dyad_collect_t *collect);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_MODULES_DYAD_COLLECT_H */
@@ -0,0 +1,378 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_core.h>
+#include <dyad/modules/dyad_drain.h>
+#include <dyad/utils/read_all.h>
+#include <dyad/utils/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <flux/core.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+struct drain_item {
+    struct drain_item *next;
+    char *upath;
+    bool collect;  // remove the file and its record once it is drained
+};
+
+struct drain_worker {
+    dyad_drain_t *d;
+    dyad_ctx_t ctx;  // copy of the module's context with the worker's own handle
+    pthread_t thread;
+    unsigned idx;
+    bool started;
+    struct drain_item *current;  // item being copied, guarded by d->lock
+};
+
+struct dyad_drain {
+    const dyad_ctx_t *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct drain_item *head;
+    struct drain_item *tail;
+    bool stop;
+    uint64_t bandwidth;       // bytes per second, 0 for no limit
+    pthread_mutex_t bucket;   // guards tokens and refilled
+    double tokens;            // bytes that may be copied without waiting (< 0: owed)
+    struct timespec refilled;
+    unsigned num_workers;
+    struct drain_worker *workers;
+};
+
+/* Charge `n' bytes to a token bucket that holds up to one second of the
+ * bandwidth, and sleep off what is owed, so that the copies of all the
+ * workers together stay under the limit. */
+static void drain_throttle (dyad_drain_t *d, size_t n)
+{
+    struct timespec now;
+    struct timespec pause;
+    double owed = 0.0;
+
+    if (d->bandwidth == 0u) {
+        return;
+    }
+    pthread_mutex_lock (&d->bucket);
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    d->tokens += (double)d->bandwidth
+                 * ((double)(now.tv_sec - d->refilled.tv_sec)
+                    + (double)(now.tv_nsec - d->refilled.tv_nsec) / 1e9);
+    if (d->tokens > (double)d->bandwidth) {
+        d->tokens = (double)d->bandwidth;
+    }
+    d->refilled = now;
+    d->tokens -= (double)n;
+    if (d->tokens < 0.0) {
+        owed = -d->tokens / (double)d->bandwidth;
+    }
+    pthread_mutex_unlock (&d->bucket);
+    if (owed > 0.0) {
+        pause.tv_sec = (time_t)owed;
+        pause.tv_nsec = (long)((owed - (double)pause.tv_sec) * 1e9);
+        nanosleep (&pause, NULL);
+    }
+}
+
+static dyad_rc_t drain_copy (struct drain_worker *w, const char *upath, char *buf, uint64_t *version)
+{
+    dyad_rc_t rc = DYAD_RC_OK;
+    char src[PATH_MAX + 1] = {'\0'};
+    char dst[PATH_MAX + 1] = {'\0'};
+    char tmp[PATH_MAX + 1] = {'\0'};
+    char dir[PATH_MAX + 1] = {'\0'};
+    const mode_t m = (S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH | S_ISGID);
+    struct stat st;
+    ssize_t len = 0l;
+    int in_fd = -1;
+    int out_fd = -1;
+    bool created = false;
+
+    strncpy (src, w->ctx.prod_managed_path, PATH_MAX - 1);
+    concat_str (src, upath, "/", PATH_MAX);
+    strncpy (dst, w->ctx.drain_path, PATH_MAX - 1);
+    concat_str (dst, upath, "/", PATH_MAX);
+    // Consumers only ever see a complete copy under the final name
+    snprintf (tmp, PATH_MAX, "%s.dyad.drain.%u", dst, w->idx);
+    memcpy (dir, dst, PATH_MAX);  // dirname modifies the arg
+
+    if ((in_fd = open (src, O_RDONLY)) < 0 || fstat (in_fd, &st) < 0) {
+        // Such as a file removed once all its readers fetched it
+        DYAD_LOG_DEBUG (&w->ctx, "DYAD_DRAIN: cannot open %s: %s", src, strerror (errno));
+        rc = DYAD_RC_BADFIO;
+        goto copy_done;
+    }
+    // Read before the data, so that the copy holds this version or a later one
+    if (fgetxattr (in_fd, DYAD_COMMITTED_XATTR, version, sizeof (*version))
+        != (ssize_t)sizeof (*version)) {
+        *version = 0ul;
+    }
+    if (mkdir_as_needed (dirname (dir), m) < 0
+        || (out_fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777)) < 0) {
+        DYAD_LOG_ERROR (&w->ctx, "DYAD_DRAIN: cannot create %s: %s", tmp, strerror (errno));
+        rc = DYAD_RC_BADFIO;
+        goto copy_done;
+    }
+    created = true;
+    while ((len = read (in_fd, buf, DYAD_DRAIN_CHUNK)) > 0l) {
+        drain_throttle (w->d, (size_t)len);
+        if (write_all (out_fd, buf, (size_t)len) != len) {
+            break;
+        }
+    }
+    if (len != 0l || fdatasync (out_fd) < 0 || close (out_fd) < 0) {
+        DYAD_LOG_ERROR (&w->ctx, "DYAD_DRAIN: cannot copy %s to %s", src, tmp);
+        rc = DYAD_RC_BADFIO;
+        goto copy_done;
+    }
+    out_fd = -1;
+    if (rename (tmp, dst) < 0) {
+        DYAD_LOG_ERROR (&w->ctx, "DYAD_DRAIN: cannot rename %s: %s", tmp, strerror (errno));
+        rc = DYAD_RC_BADFIO;
+    }
+
+copy_done:;
+    if (out_fd >= 0) {
+        close (out_fd);
+    }
+    if (DYAD_IS_ERROR (rc) && created) {
+        unlink (tmp);
+    }
+    if (in_fd >= 0) {
+        close (in_fd);
+    }
+    return rc;
+}
+
+// Remove a file whose readers all acknowledged it while it was being drained
+static void drain_collect (struct drain_worker *w, const char *upath)
+{
+    char src[PATH_MAX + 1] = {'\0'};
+    const char *fnames[1] = {src};
+
+    strncpy (src, w->ctx.prod_managed_path, PATH_MAX - 1);
+    concat_str (src, upath, "/", PATH_MAX);
+    if (DYAD_IS_ERROR (dyad_unpublish (&w->ctx, fnames, 1ul))) {
+        DYAD_LOG_ERROR (&w->ctx, "DYAD_DRAIN: cannot unpublish %s", upath);
+        return;
+    }
+    if (unlink (src) != 0) {
+        DYAD_LOG_ERROR (&w->ctx, "DYAD_DRAIN: cannot remove %s: %s", src, strerror (errno));
+        return;
+    }
+    DYAD_LOG_INFO (&w->ctx, "DYAD_DRAIN: removed %s after draining it", upath);
+}
+
+static void *drain_main (void *arg)
+{
+    struct drain_worker *w = (struct drain_worker *)arg;
+    dyad_drain_t *d = w->d;
+    struct drain_item *item = NULL;
+    char *buf = (char *)malloc (DYAD_DRAIN_CHUNK);
+    bool drained = false;
+    bool collect = false;
+    uint64_t version = 0ul;
+
+    if (buf == NULL) {
+        DYAD_LOG_ERROR (&w->ctx, "DYAD_DRAIN: cannot allocate the copy buffer");
+        return NULL;
+    }
+    for (;;) {
+        pthread_mutex_lock (&d->lock);
+        while (d->head == NULL && !d->stop) {
+            pthread_cond_wait (&d->wake, &d->lock);
+        }
+        // The queue is emptied before stopping, so that no file is lost
+        if ((item = d->head) == NULL) {
+            pthread_mutex_unlock (&d->lock);
+            break;
+        }
+        if ((d->head = item->next) == NULL) {
+            d->tail = NULL;
+        }
+        w->current = item;
+        pthread_mutex_unlock (&d->lock);
+
+        drained = !DYAD_IS_ERROR (drain_copy (w, item->upath, buf, &version));
+        if (drained) {
+            DYAD_LOG_DEBUG (&w->ctx, "DYAD_DRAIN: drained version %lu of %s",
+                            (unsigned long)version, item->upath);
+            dyad_mark_drained (&w->ctx, (const char *const *)&item->upath, &version, 1ul);
+        }
+        pthread_mutex_lock (&d->lock);
+        w->current = NULL;
+        collect = item->collect;
+        pthread_mutex_unlock (&d->lock);
+        if (collect && drained) {
+            drain_collect (w, item->upath);
+        } else if (collect) {
+            // Keep the only copy rather than lose the file
+            DYAD_LOG_ERROR (&w->ctx, "DYAD_DRAIN: keeping %s, which could not be drained", item->upath);
+        }
+        free (item->upath);
+        free (item);
+    }
+    free (buf);
+    return NULL;
+}
+
+dyad_rc_t dyad_drain_create (const dyad_ctx_t *ctx,
+                             unsigned streams,
+                             uint64_t bandwidth,
+                             dyad_drain_t **drain)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_rc_t rc = DYAD_RC_OK;
+    dyad_drain_t *d = NULL;
+    struct drain_worker *w = NULL;
+
+    *drain = NULL;
+    if (ctx->prod_managed_path == NULL || ctx->drain_path == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_DRAIN: draining needs a producer-managed and a drain path");
+        rc = DYAD_RC_BADMANAGEDPATH;
+        goto drain_create_done;
+    }
+    if ((d = (dyad_drain_t *)calloc (1ul, sizeof (dyad_drain_t))) == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto drain_create_done;
+    }
+    d->ctx = ctx;
+    d->bandwidth = bandwidth;
+    d->tokens = (double)bandwidth;
+    clock_gettime (CLOCK_MONOTONIC, &d->refilled);
+    pthread_mutex_init (&d->lock, NULL);
+    pthread_cond_init (&d->wake, NULL);
+    pthread_mutex_init (&d->bucket, NULL);
+    d->num_workers = (streams > 0u) ? streams : DYAD_DRAIN_STREAMS_DEFAULT;
+    d->workers = (struct drain_worker *)calloc (d->num_workers, sizeof (struct drain_worker));
+    if (d->workers == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto drain_create_done;
+    }
+    for (unsigned i = 0u; i < d->num_workers; i++) {
+        w = &d->workers[i];
+        w->d = d;
+        w->idx = i;
+        w->ctx = *ctx;
+        // Nothing runs the reactor of the thread's handle
+        w->ctx.async_publish = false;
+        if ((w->ctx.h = flux_open (NULL, 0)) == NULL) {
+            DYAD_LOG_ERROR (ctx, "DYAD_DRAIN: cannot open a Flux handle for a drain thread");
+            rc = DYAD_RC_FLUXFAIL;
+            goto drain_create_done;
+        }
+        if (pthread_create (&w->thread, NULL, drain_main, w) != 0) {
+            DYAD_LOG_ERROR (ctx, "DYAD_DRAIN: cannot start a drain thread");
+            rc = DYAD_RC_SYSFAIL;
+            goto drain_create_done;
+        }
+        w->started = true;
+    }
+    DYAD_LOG_INFO (ctx,
+                   "DYAD_DRAIN: draining to %s with %u streams, %lu bytes/s (0: unlimited)",
+                   ctx->drain_path,
+                   d->num_workers,
+                   (unsigned long)bandwidth);
+
+drain_create_done:;
+    if (DYAD_IS_ERROR (rc)) {
+        dyad_drain_destroy (d);
+    } else {
+        *drain = d;
+    }
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
+void dyad_drain_enqueue (dyad_drain_t *drain, const char *upath)
+{
+    struct drain_item *item = NULL;
+
+    if (drain == NULL) {
+        return;
+    }
+    if ((item = (struct drain_item *)calloc (1ul, sizeof (struct drain_item))) == NULL
+        || (item->upath = strdup (upath)) == NULL) {
+        DYAD_LOG_ERROR (drain->ctx, "DYAD_DRAIN: cannot queue %s for draining", upath);
+        free (item);
+        return;
+    }
+    pthread_mutex_lock (&drain->lock);
+    if (drain->tail != NULL) {
+        drain->tail->next = item;
+    } else {
+        drain->head = item;
+    }
+    drain->tail = item;
+    pthread_cond_signal (&drain->wake);
+    pthread_mutex_unlock (&drain->lock);
+}
+
+bool dyad_drain_defer_collect (dyad_drain_t *drain, const char *upath)
+{
+    struct drain_item *item = NULL;
+    bool deferred = false;
+
+    if (drain == NULL) {
+        return false;
+    }
+    pthread_mutex_lock (&drain->lock);
+    for (item = drain->head; item != NULL && !deferred; item = item->next) {
+        if (strcmp (item->upath, upath) == 0) {
+            item->collect = deferred = true;
+        }
+    }
+    for (unsigned i = 0u; i < drain->num_workers && !deferred; i++) {
+        item = drain->workers[i].current;
+        if (item != NULL && strcmp (item->upath, upath) == 0) {
+            item->collect = deferred = true;
+        }
+    }
+    pthread_mutex_unlock (&drain->lock);
+    return deferred;
+}
+
+void dyad_drain_destroy (dyad_drain_t *drain)
+{
+    struct drain_item *item = NULL;
+
+    if (drain == NULL) {
+        return;
+    }
+    pthread_mutex_lock (&drain->lock);
+    drain->stop = true;
+    pthread_cond_broadcast (&drain->wake);
+    pthread_mutex_unlock (&drain->lock);
+    for (unsigned i = 0u; drain->workers != NULL && i < drain->num_workers; i++) {
+        if (drain->workers[i].started) {
+            pthread_join (drain->workers[i].thread, NULL);
+        }
+        if (drain->workers[i].ctx.h != NULL) {
+            flux_close ((flux_t *)drain->workers[i].ctx.h);
+        }
+    }
+    // Left over only if no thread could start
+    while ((item = drain->head) != NULL) {
+        drain->head = item->next;
+        free (item->upath);
+        free (item);
+    }
+    pthread_mutex_destroy (&drain->bucket);
+    pthread_cond_destroy (&drain->wake);
+    pthread_mutex_destroy (&drain->lock);
+    free (drain->workers);
+    free (drain);
+}
@@ -0,0 +1,60 @@
+#ifndef DYAD_MODULES_DYAD_DRAIN_H
+#define DYAD_MODULES_DYAD_DRAIN_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+// Default number of files copied to the drain path at once
+#define DYAD_DRAIN_STREAMS_DEFAULT 2u
+// Bytes read and written at a time, and charged to the bandwidth limit
+#define DYAD_DRAIN_CHUNK (1u << 20)
+
+/**
+ * Copies published files from the producer-managed path, which is usually
+ * node-local storage, to ctx->drain_path on the parallel file system, so
+ * that they outlive the producer's node. Each copy is written under a
+ * temporary name, flushed, and renamed into place, after which the version
+ * copied is published with dyad_mark_drained ().
+ */
+typedef struct dyad_drain dyad_drain_t;
+
+/**
+ * Start `streams' threads copying files, at most `bandwidth' bytes per
+ * second between them (0 for no limit). Each thread opens its own Flux
+ * handle to update the records.
+ */
+dyad_rc_t dyad_drain_create (const dyad_ctx_t *ctx,
+                             unsigned streams,
+                             uint64_t bandwidth,
+                             dyad_drain_t **drain);
+
+// Queue `upath', relative to the producer-managed path, for copying
+void dyad_drain_enqueue (dyad_drain_t *drain, const char *upath);
+
+/* If `upath' is queued or being copied, have it removed, with its record,
+ * once it is drained, and return true. Returns false otherwise. */
+bool dyad_drain_defer_collect (dyad_drain_t *drain, const char *upath);
+
+// Finish copying the queued files and stop the threads
+void dyad_drain_destroy (dyad_drain_t *drain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_MODULES_DYAD_DRAIN_H */
@@ -0,0 +1,295 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_core.h>
+#include <dyad/modules/dyad_fetch_wait.h>
+#include <errno.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+// Events after which a file may be complete. Committing a file sets an
+// extended attribute, which shows as IN_ATTRIB.
+#define DYAD_FETCH_WAIT_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)
+// Seconds between the checks for timed out requests
+#define DYAD_FETCH_WAIT_CHECK 1.0
+
+struct parked_fetch {
+    char *fullpath;
+    int wd;  // watch on the directory of fullpath
+    bool committed;  // wait for the commit too, not just for the file
+    uint64_t min_version;  // wait for this committed version or a later one
+    const flux_msg_t *msg;
+    double deadline;
+    struct parked_fetch *next;
+};
+
+struct dyad_fetch_wait {
+    const dyad_ctx_t *ctx;
+    flux_msg_handler_f cb;
+    void *arg;
+    int fd;  // inotify instance
+    flux_watcher_t *fd_w;
+    flux_watcher_t *timer;  // expires the requests past their deadline
+    struct parked_fetch *parked;
+};
+
+static bool wd_in_use (const dyad_fetch_wait_t *fw, int wd)
+{
+    for (const struct parked_fetch *p = fw->parked; p != NULL; p = p->next) {
+        if (p->wd == wd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void parked_free (struct parked_fetch *p)
+{
+    flux_msg_decref (p->msg);
+    free (p->fullpath);
+    free (p);
+}
+
+/* Unlink the requests that `match' selects into a separate list, so that
+ * handing them back to the callback cannot disturb the traversal */
+static struct parked_fetch *take_parked (dyad_fetch_wait_t *fw,
+                                         bool (*match) (const struct parked_fetch *, const void *),
+                                         const void *key)
+{
+    struct parked_fetch *taken = NULL;
+    struct parked_fetch **pp = &fw->parked;
+    struct parked_fetch *p = NULL;
+
+    while ((p = *pp) != NULL) {
+        if (match (p, key)) {
+            *pp = p->next;
+            p->next = taken;
+            taken = p;
+        } else {
+            pp = &p->next;
+        }
+    }
+    for (p = taken; p != NULL; p = p->next) {
+        if (!wd_in_use (fw, p->wd)) {
+            inotify_rm_watch (fw->fd, p->wd);
+        }
+    }
+    if (fw->parked == NULL) {
+        flux_watcher_stop (fw->timer);
+    }
+    return taken;
+}
+
+static bool fetch_ready (const char *fullpath, bool committed, uint64_t min_version)
+{
+    struct stat sb;
+    uint64_t version = 0ul;
+    ssize_t len = 0l;
+
+    if (stat (fullpath, &sb) != 0) {
+        return false;
+    }
+    if (!committed && min_version == 0ul) {
+        return true;
+    }
+    // Without extended attributes, the file is served as soon as it exists
+    len = getxattr (fullpath, DYAD_COMMITTED_XATTR, &version, sizeof (version));
+    if (len < 0l) {
+        return errno == ENOTSUP;
+    }
+    return len == (ssize_t)sizeof (version) && version >= min_version;
+}
+
+static bool match_ready (const struct parked_fetch *p, const void *key)
+{
+    return strcmp (p->fullpath, (const char *)key) == 0
+           && fetch_ready (p->fullpath, p->committed, p->min_version);
+}
+
+static bool match_expired (const struct parked_fetch *p, const void *key)
+{
+    return p->deadline <= *(const double *)key;
+}
+
+static void fetch_wait_event_cb (flux_reactor_t *r, flux_watcher_t *w, int revents, void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_fetch_wait_t *fw = (dyad_fetch_wait_t *)arg;
+    char buf[16 * 1024] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    char path[PATH_MAX + 1] = {'\0'};
+    const struct inotify_event *ev = NULL;
+    struct parked_fetch *ready = NULL;
+    struct parked_fetch *next = NULL;
+    const char *dir = NULL;
+    ssize_t len = 0l;
+
+    while ((len = read (fw->fd, buf, sizeof (buf))) > 0) {
+        for (char *p = buf; p < buf + len; p += sizeof (struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if (ev->len == 0u || !(ev->mask & DYAD_FETCH_WAIT_MASK)) {
+                continue;
+            }
+            // Any request on this watch knows the path of the directory
+            dir = NULL;
+            for (const struct parked_fetch *q = fw->parked; q != NULL; q = q->next) {
+                if (q->wd == ev->wd) {
+                    dir = q->fullpath;
+                    break;
+                }
+            }
+            if (dir == NULL) {
+                continue;
+            }
+            snprintf (path, sizeof (path), "%.*s/%s",
+                      (int)(strrchr (dir, '/') - dir), dir, ev->name);
+            for (ready = take_parked (fw, match_ready, path); ready != NULL; ready = next) {
+                next = ready->next;
+                DYAD_LOG_DEBUG (fw->ctx, "DYAD_MOD: %s is ready, resuming its fetch", path);
+                fw->cb ((flux_t *)fw->ctx->h, NULL, ready->msg, fw->arg);
+                parked_free (ready);
+            }
+        }
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+static void fetch_wait_timer_cb (flux_reactor_t *r, flux_watcher_t *w, int revents, void *arg)
+{
+    dyad_fetch_wait_t *fw = (dyad_fetch_wait_t *)arg;
+    const double now = flux_reactor_now (r);
+    struct parked_fetch *expired = take_parked (fw, match_expired, &now);
+    struct parked_fetch *next = NULL;
+
+    for (; expired != NULL; expired = next) {
+        next = expired->next;
+        DYAD_LOG_ERROR (fw->ctx, "DYAD_MOD: timed out waiting for %s", expired->fullpath);
+        if (flux_respond_error ((flux_t *)fw->ctx->h, expired->msg, ETIMEDOUT, NULL) < 0) {
+            DYAD_LOG_ERROR (fw->ctx, "DYAD_MOD: %s: flux_respond_error", __func__);
+        }
+        parked_free (expired);
+    }
+}
+
+dyad_rc_t dyad_fetch_wait_create (const dyad_ctx_t *ctx,
+                                  flux_msg_handler_f cb,
+                                  void *arg,
+                                  dyad_fetch_wait_t **fw)
+{
+    flux_reactor_t *r = flux_get_reactor ((flux_t *)ctx->h);
+    dyad_fetch_wait_t *w = (dyad_fetch_wait_t *)calloc (1ul, sizeof (dyad_fetch_wait_t));
+
+    *fw = NULL;
+    if (w == NULL) {
+        return DYAD_RC_SYSFAIL;
+    }
+    w->ctx = ctx;
+    w->cb = cb;
+    w->arg = arg;
+    if ((w->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: inotify_init1 failed: %s", strerror (errno));
+        free (w);
+        return DYAD_RC_SYSFAIL;
+    }
+    w->fd_w = flux_fd_watcher_create (r, w->fd, FLUX_POLLIN, fetch_wait_event_cb, w);
+    w->timer = flux_timer_watcher_create (r,
+                                          DYAD_FETCH_WAIT_CHECK,
+                                          DYAD_FETCH_WAIT_CHECK,
+                                          fetch_wait_timer_cb,
+                                          w);
+    if (w->fd_w == NULL || w->timer == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: cannot create the watchers for parked fetches");
+        dyad_fetch_wait_destroy (w);
+        return DYAD_RC_FLUXFAIL;
+    }
+    flux_watcher_start (w->fd_w);
+    *fw = w;
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_fetch_wait_park (dyad_fetch_wait_t *fw,
+                                const char *fullpath,
+                                bool committed,
+                                uint64_t min_version,
+                                const flux_msg_t *msg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_rc_t rc = DYAD_RC_NOTFOUND;
+    char dir[PATH_MAX + 1] = {'\0'};
+    struct parked_fetch *p = NULL;
+    int wd = -1;
+
+    if (fw == NULL || fetch_ready (fullpath, committed, min_version)) {
+        goto park_done;
+    }
+    strncpy (dir, fullpath, PATH_MAX);
+    // The watch goes first, so that a file completed right after the check
+    // above is not missed. The check below tells whether it already was.
+    wd = inotify_add_watch (fw->fd, dirname (dir), DYAD_FETCH_WAIT_MASK);
+    if (wd < 0) {
+        DYAD_LOG_DEBUG (fw->ctx, "DYAD_MOD: cannot watch the directory of %s", fullpath);
+        goto park_done;
+    }
+    if (fetch_ready (fullpath, committed, min_version)) {
+        if (!wd_in_use (fw, wd)) {
+            inotify_rm_watch (fw->fd, wd);
+        }
+        goto park_done;
+    }
+    if ((p = (struct parked_fetch *)calloc (1ul, sizeof (struct parked_fetch))) == NULL
+        || (p->fullpath = strdup (fullpath)) == NULL) {
+        free (p);
+        if (!wd_in_use (fw, wd)) {
+            inotify_rm_watch (fw->fd, wd);
+        }
+        goto park_done;
+    }
+    p->wd = wd;
+    p->committed = committed;
+    p->min_version = min_version;
+    p->msg = flux_msg_incref (msg);
+    p->deadline = flux_reactor_now (flux_get_reactor ((flux_t *)fw->ctx->h))
+                  + DYAD_FETCH_WAIT_TIMEOUT;
+    p->next = fw->parked;
+    if (fw->parked == NULL) {
+        flux_watcher_start (fw->timer);
+    }
+    fw->parked = p;
+    DYAD_LOG_DEBUG (fw->ctx, "DYAD_MOD: parking the fetch of %s until it is written", fullpath);
+    rc = DYAD_RC_OK;
+
+park_done:;
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
+void dyad_fetch_wait_destroy (dyad_fetch_wait_t *fw)
+{
+    struct parked_fetch *next = NULL;
+
+    if (fw == NULL) {
+        return;
+    }
+    for (struct parked_fetch *p = fw->parked; p != NULL; p = next) {
+        next = p->next;
+        flux_respond_error ((flux_t *)fw->ctx->h, p->msg, ENOSYS, "DYAD module is unloading");
+        parked_free (p);
+    }
+    flux_watcher_destroy (fw->fd_w);
+    flux_watcher_destroy (fw->timer);
+    if (fw->fd >= 0) {
+        close (fw->fd);
+    }
+    free (fw);
+}
@@ -0,0 +1,56 @@
+#ifndef DYAD_MODULES_DYAD_FETCH_WAIT_H
+#define DYAD_MODULES_DYAD_FETCH_WAIT_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <flux/core.h>
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Seconds a fetch request waits for its file before failing with ETIMEDOUT
+#define DYAD_FETCH_WAIT_TIMEOUT 30.0
+
+/**
+ * Fetch requests for files that the producer has not finished writing yet.
+ * Instead of polling the file from the reactor, a request is parked and
+ * handed back to `cb' once the file is closed after writing or moved into
+ * place, or once it is committed (DYAD_COMMITTED_XATTR), as reported by
+ * inotify.
+ */
+typedef struct dyad_fetch_wait dyad_fetch_wait_t;
+
+dyad_rc_t dyad_fetch_wait_create (const dyad_ctx_t *ctx,
+                                  flux_msg_handler_f cb,
+                                  void *arg,
+                                  dyad_fetch_wait_t **fw);
+
+/**
+ * Park `msg' until `fullpath' is ready: until it exists, if `committed' is
+ * set, until the producer has committed it, and, if `min_version' is not 0,
+ * until it is committed at that version or a later one. Returns DYAD_RC_OK
+ * if the request is parked, and DYAD_RC_NOTFOUND if the file turned out to
+ * be ready or cannot be waited for, in which case the caller serves it right
+ * away.
+ */
+dyad_rc_t dyad_fetch_wait_park (dyad_fetch_wait_t *fw,
+                                const char *fullpath,
+                                bool committed,
+                                uint64_t min_version,
+                                const flux_msg_t *msg);
+
+// Fail the parked requests with ENOSYS
+void dyad_fetch_wait_destroy (dyad_fetch_wait_t *fw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_MODULES_DYAD_FETCH_WAIT_H */
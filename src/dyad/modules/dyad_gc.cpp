@@ -0,0 +1,76 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/modules/dyad_gc.h>
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_core.h>
+
+#include <sys/xattr.h>
+
+#include <cstdint>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Consumers that acknowledged each upath so far, by their route, so that a
+// consumer that acknowledges a file more than once counts once
+using count_map_type = std::unordered_map<std::string, std::unordered_set<std::string>>;
+
+dyad_rc_t dyad_gc_init (const dyad_ctx_t *ctx, dyad_gc_h *gc)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    *gc = reinterpret_cast<dyad_gc_h> (new (std::nothrow) count_map_type ());
+    if (*gc == nullptr) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate the acknowledgement counts");
+        rc = DYAD_RC_SYSFAIL;
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+bool dyad_gc_count (const dyad_ctx_t *ctx,
+                    dyad_gc_h gc,
+                    const char *upath,
+                    const char *fullpath,
+                    const char *reader)
+{
+    DYAD_C_FUNCTION_START();
+    DYAD_C_FUNCTION_UPDATE_STR ("upath", upath);
+    count_map_type* counts = reinterpret_cast<count_map_type*> (gc);
+    uint32_t readers = 0u;
+    bool last = false;
+
+    // Files without a reader count are kept, and not counted, and so are
+    // acknowledgements from an unknown sender
+    if (counts == nullptr || reader == nullptr
+        || getxattr (fullpath, DYAD_READERS_XATTR, &readers, sizeof (readers))
+               != static_cast<ssize_t> (sizeof (readers))
+        || readers == 0u) {
+        DYAD_C_FUNCTION_END();
+        return false;
+    }
+    count_map_type::iterator it = counts->emplace (upath, std::unordered_set<std::string> ()).first;
+    it->second.emplace (reader);
+    last = (it->second.size () >= readers);
+    DYAD_LOG_DEBUG (ctx, "%s was consumed by %zu of %u readers", upath, it->second.size (), readers);
+    if (last) {
+        counts->erase (it);
+    }
+    DYAD_C_FUNCTION_END();
+    return last;
+}
+
+void dyad_gc_finalize (dyad_gc_h *gc)
+{
+    if (gc == nullptr || *gc == nullptr) {
+        return;
+    }
+    delete reinterpret_cast<count_map_type*> (*gc);
+    *gc = nullptr;
+}
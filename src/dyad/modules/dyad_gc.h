@@ -0,0 +1,40 @@
+#ifndef DYAD_MODULES_DYAD_GC_H
+#define DYAD_MODULES_DYAD_GC_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Counts the consumer acknowledgements (DYAD_GC_RPC_ACK) of each produced
+ * file that carries an expected reader count (DYAD_READERS_XATTR, see
+ * dyad_set_readers ()), so that the module can remove the file once every
+ * reader consumed it, whichever way it was read. */
+typedef void* dyad_gc_h;
+
+dyad_rc_t dyad_gc_init (const dyad_ctx_t *ctx, dyad_gc_h *gc);
+
+/* Count the acknowledgement of `upath', stored at `fullpath', by the consumer
+ * `reader' (its route), unless it was counted before. Returns true when the
+ * last expected reader acknowledged it, after which `upath' is forgotten. */
+bool dyad_gc_count (const dyad_ctx_t *ctx,
+                    dyad_gc_h gc,
+                    const char *upath,
+                    const char *fullpath,
+                    const char *reader);
+
+void dyad_gc_finalize (dyad_gc_h *gc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_MODULES_DYAD_GC_H */
@@ -0,0 +1,286 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/modules/dyad_md_store.h>
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using key_type = std::string;
+using record_map_type = std::unordered_map<key_type, json_t*>;
+// Seconds between the checks for timed out lookups
+#define DYAD_MD_STORE_WAIT_CHECK 1.0
+
+// A parked lookup, the lowest version that answers it and when it times out
+struct waiter_type {
+    const flux_msg_t* msg;
+    uint64_t min_version;
+    double deadline;
+};
+using waiter_map_type = std::unordered_map<key_type, std::vector<waiter_type>>;
+
+struct md_store {
+    const dyad_ctx_t* ctx;
+    flux_watcher_t* timer;  // expires the lookups past their deadline
+    record_map_type records;
+    waiter_map_type waiters;
+};
+
+// Keys of different namespaces must not collide
+static inline key_type make_key (const char* ns, const char* key)
+{
+    key_type k (ns);
+    k.push_back ('\0');
+    k.append (key);
+    return k;
+}
+
+/* Drop the parked lookups that `match' selects, failing them with `errnum'
+ * unless it is 0, and stop the timer once no lookup is left. */
+template <typename Match>
+static size_t drop_waiters (md_store* s, Match match, int errnum, const char* errmsg)
+{
+    size_t dropped = 0ul;
+    for (waiter_map_type::iterator it = s->waiters.begin (); it != s->waiters.end ();) {
+        std::vector<waiter_type>& w = it->second;
+        size_t kept = 0ul;
+        for (size_t i = 0ul; i < w.size (); i++) {
+            if (!match (w[i])) {
+                w[kept++] = w[i];
+                continue;
+            }
+            if (errnum != 0 && flux_respond_error ((flux_t*)s->ctx->h, w[i].msg, errnum, errmsg) < 0) {
+                DYAD_LOG_ERROR (s->ctx, "Cannot fail a parked lookup");
+            }
+            flux_msg_decref (w[i].msg);
+            dropped++;
+        }
+        w.resize (kept);
+        it = w.empty () ? s->waiters.erase (it) : std::next (it);
+    }
+    if (s->waiters.empty () && s->timer != nullptr) {
+        flux_watcher_stop (s->timer);
+    }
+    return dropped;
+}
+
+static void md_store_timer_cb (flux_reactor_t* r, flux_watcher_t* w, int revents, void* arg)
+{
+    md_store* s = reinterpret_cast<md_store*> (arg);
+    const double now = flux_reactor_now (r);
+    size_t expired = drop_waiters (
+        s,
+        [now] (const waiter_type& p) { return p.deadline <= now; },
+        ETIMEDOUT,
+        nullptr);
+    if (expired > 0ul) {
+        DYAD_LOG_ERROR (s->ctx, "Timed out %zu lookups waiting for metadata", expired);
+    }
+}
+
+dyad_rc_t dyad_md_store_init (const dyad_ctx_t *ctx, dyad_md_store_h *store)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    md_store* s = new (std::nothrow) md_store ();
+    *store = nullptr;
+    if (s == nullptr) {
+        DYAD_LOG_ERROR (ctx, "Cannot allocate the metadata store");
+        rc = DYAD_RC_SYSFAIL;
+        goto md_store_init_done;
+    }
+    s->ctx = ctx;
+    s->timer = flux_timer_watcher_create (flux_get_reactor ((flux_t*)ctx->h),
+                                          DYAD_MD_STORE_WAIT_CHECK,
+                                          DYAD_MD_STORE_WAIT_CHECK,
+                                          md_store_timer_cb,
+                                          s);
+    if (s->timer == nullptr) {
+        DYAD_LOG_ERROR (ctx, "Cannot create the timer for parked lookups");
+        delete s;
+        rc = DYAD_RC_FLUXFAIL;
+        goto md_store_init_done;
+    }
+    *store = reinterpret_cast<dyad_md_store_h> (s);
+
+md_store_init_done:;
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_md_store_put (const dyad_ctx_t *ctx,
+                             dyad_md_store_h store,
+                             const char *ns,
+                             const char *key,
+                             json_t *record)
+{
+    DYAD_C_FUNCTION_START();
+    md_store* s = reinterpret_cast<md_store*> (store);
+    const key_type k = make_key (ns, key);
+    json_t*& slot = s->records[k];
+    if (slot != nullptr) {
+        json_decref (slot);
+    }
+    slot = json_incref (record);
+    waiter_map_type::iterator it = s->waiters.find (k);
+    if (it != s->waiters.end ()) {
+        const uint64_t version = dyad_md_store_version (record);
+        std::vector<waiter_type>& w = it->second;
+        size_t kept = 0ul;
+        for (size_t i = 0ul; i < w.size (); i++) {
+            if (w[i].min_version > version) {
+                w[kept++] = w[i];
+                continue;
+            }
+            if (flux_respond_pack ((flux_t*)ctx->h, w[i].msg, "{s:O}", "record", record) < 0) {
+                DYAD_LOG_ERROR (ctx, "Cannot answer a parked lookup of %s", key);
+            }
+            flux_msg_decref (w[i].msg);
+        }
+        w.resize (kept);
+        if (w.empty ()) {
+            s->waiters.erase (it);
+        }
+        if (s->waiters.empty ()) {
+            flux_watcher_stop (s->timer);
+        }
+    }
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+dyad_rc_t dyad_md_store_get (const dyad_ctx_t *ctx,
+                             const dyad_md_store_h store,
+                             const char *ns,
+                             const char *key,
+                             json_t **record)
+{
+    DYAD_C_FUNCTION_START();
+    dyad_rc_t rc = DYAD_RC_OK;
+    const md_store* s = reinterpret_cast<const md_store*> (store);
+    record_map_type::const_iterator it = s->records.find (make_key (ns, key));
+    if (it == s->records.cend ()) {
+        *record = nullptr;
+        rc = DYAD_RC_NOTFOUND;
+    } else {
+        *record = it->second;
+    }
+    DYAD_C_FUNCTION_END();
+    return rc;
+}
+
+dyad_rc_t dyad_md_store_park (const dyad_ctx_t *ctx,
+                              dyad_md_store_h store,
+                              const char *ns,
+                              const char *key,
+                              uint64_t min_version,
+                              const flux_msg_t *msg)
+{
+    DYAD_C_FUNCTION_START();
+    md_store* s = reinterpret_cast<md_store*> (store);
+    const double deadline = flux_reactor_now (flux_get_reactor ((flux_t*)ctx->h))
+                            + DYAD_MD_STORE_WAIT_TIMEOUT;
+    DYAD_LOG_DEBUG (ctx, "Parking the lookup of %s until it is published", key);
+    if (s->waiters.empty ()) {
+        flux_watcher_start (s->timer);
+    }
+    s->waiters[make_key (ns, key)].push_back ({flux_msg_incref (msg), min_version, deadline});
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+size_t dyad_md_store_disconnect (const dyad_ctx_t *ctx,
+                                 dyad_md_store_h store,
+                                 const flux_msg_t *msg)
+{
+    DYAD_C_FUNCTION_START();
+    md_store* s = reinterpret_cast<md_store*> (store);
+    const char* sender = flux_msg_route_first (msg);
+    size_t dropped = 0ul;
+    if (s != nullptr && sender != nullptr) {
+        // Nobody is left to answer, so the lookups are just released
+        dropped = drop_waiters (
+            s,
+            [sender] (const waiter_type& p) {
+                const char* route = flux_msg_route_first (p.msg);
+                return route != nullptr && strcmp (route, sender) == 0;
+            },
+            0,
+            nullptr);
+    }
+    DYAD_C_FUNCTION_END();
+    return dropped;
+}
+
+uint64_t dyad_md_store_version (json_t *record)
+{
+    json_t* v = json_is_object (record) ? json_object_get (record, "version") : nullptr;
+    return json_is_integer (v) ? static_cast<uint64_t> (json_integer_value (v)) : 0ul;
+}
+
+dyad_rc_t dyad_md_store_remove (const dyad_ctx_t *ctx,
+                                dyad_md_store_h store,
+                                const char *ns,
+                                const char *key)
+{
+    DYAD_C_FUNCTION_START();
+    md_store* s = reinterpret_cast<md_store*> (store);
+    record_map_type::iterator it = s->records.find (make_key (ns, key));
+    if (it != s->records.end ()) {
+        json_decref (it->second);
+        s->records.erase (it);
+    }
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
+
+size_t dyad_md_store_sweep (const dyad_ctx_t *ctx, dyad_md_store_h store, int64_t now)
+{
+    DYAD_C_FUNCTION_START();
+    md_store* s = reinterpret_cast<md_store*> (store);
+    json_int_t expires = 0;
+    size_t removed = 0ul;
+    for (record_map_type::iterator it = s->records.begin (); it != s->records.end ();) {
+        if (json_unpack (it->second, "{s:I}", "expires", &expires) == 0 && expires < now) {
+            json_decref (it->second);
+            it = s->records.erase (it);
+            removed++;
+        } else {
+            ++it;
+        }
+    }
+    DYAD_C_FUNCTION_END();
+    return removed;
+}
+
+dyad_rc_t dyad_md_store_finalize (const dyad_ctx_t *ctx, dyad_md_store_h *store)
+{
+    DYAD_C_FUNCTION_START();
+    if (store == nullptr || *store == nullptr) {
+        return DYAD_RC_OK;
+    }
+    md_store* s = reinterpret_cast<md_store*> (*store);
+    drop_waiters (
+        s,
+        [] (const waiter_type&) { return true; },
+        ENOSYS,
+        "DYAD module is unloading");
+    flux_watcher_destroy (s->timer);
+    for (record_map_type::value_type& r : s->records) {
+        json_decref (r.second);
+    }
+    delete s;
+    *store = nullptr;
+    DYAD_C_FUNCTION_END();
+    return DYAD_RC_OK;
+}
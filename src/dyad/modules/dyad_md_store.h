@@ -0,0 +1,77 @@
+#ifndef DYAD_MODULES_DYAD_MD_STORE_H
+#define DYAD_MODULES_DYAD_MD_STORE_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <flux/core.h>
+#include <jansson.h>
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Seconds a parked lookup waits for its key before failing with ETIMEDOUT
+#define DYAD_MD_STORE_WAIT_TIMEOUT 30.0
+
+// The shard of the metadata hash table (DYAD_MD_DHT) held by this module
+typedef void* dyad_md_store_h;
+
+dyad_rc_t dyad_md_store_init (const dyad_ctx_t *ctx, dyad_md_store_h *store);
+
+// Store a new reference to `record' under `key' of namespace `ns', and
+// answer the lookups parked on that key that the version of `record' satisfies
+dyad_rc_t dyad_md_store_put (const dyad_ctx_t *ctx,
+                             dyad_md_store_h store,
+                             const char *ns,
+                             const char *key,
+                             json_t *record);
+
+// Borrowed reference to the record under `key', or DYAD_RC_NOTFOUND
+dyad_rc_t dyad_md_store_get (const dyad_ctx_t *ctx,
+                             const dyad_md_store_h store,
+                             const char *ns,
+                             const char *key,
+                             json_t **record);
+
+// Hold on to the lookup request `msg' until `key' is published with a
+// "version" of at least `min_version', or fail it with ETIMEDOUT after
+// DYAD_MD_STORE_WAIT_TIMEOUT seconds
+dyad_rc_t dyad_md_store_park (const dyad_ctx_t *ctx,
+                              dyad_md_store_h store,
+                              const char *ns,
+                              const char *key,
+                              uint64_t min_version,
+                              const flux_msg_t *msg);
+
+// Release the lookups parked by the client that sent the disconnect `msg'.
+// Returns how many.
+size_t dyad_md_store_disconnect (const dyad_ctx_t *ctx,
+                                 dyad_md_store_h store,
+                                 const flux_msg_t *msg);
+
+// Version of a record, 0 for unversioned ones
+uint64_t dyad_md_store_version (json_t *record);
+
+// Drop the record under `key', if any
+dyad_rc_t dyad_md_store_remove (const dyad_ctx_t *ctx,
+                                dyad_md_store_h store,
+                                const char *ns,
+                                const char *key);
+
+// Drop the records whose "expires" time is before `now'. Returns how many.
+size_t dyad_md_store_sweep (const dyad_ctx_t *ctx, dyad_md_store_h store, int64_t now);
+
+// Fail the parked lookups with ENOSYS and drop all the records
+dyad_rc_t dyad_md_store_finalize (const dyad_ctx_t *ctx, dyad_md_store_h *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_MODULES_DYAD_MD_STORE_H */
@@ -0,0 +1,329 @@
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_md.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/modules/dyad_sweep.h>
+#include <flux/core.h>
+#include <jansson.h>
+#include <linux/limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keys (or directories) still to be looked up, used as a stack
+struct sweep_list {
+    char **items;
+    size_t n;
+    size_t cap;
+};
+
+struct dyad_sweep {
+    const dyad_ctx_t *ctx;
+    uint32_t num_shards;
+    uint32_t shard;
+    char shard_ns[PATH_MAX + 1];
+    const char *ns;  // namespace of the shard being swept
+    int64_t now;
+    bool active;
+    bool failed;
+    struct sweep_list dirs;
+    struct sweep_list keys;
+    flux_future_t *inflight[DYAD_SWEEP_INFLIGHT];
+    size_t num_inflight;
+    flux_kvs_txn_t *txn;
+    size_t pending;  // keys unlinked in txn but not committed yet
+    size_t removed;
+};
+
+static void sweep_step (dyad_sweep_t *sw);
+
+static int list_push (struct sweep_list *l, const char *s)
+{
+    char **items = NULL;
+    char *item = NULL;
+
+    if (l->n == l->cap) {
+        const size_t cap = (l->cap == 0ul) ? 64ul : 2ul * l->cap;
+        if ((items = (char **)realloc (l->items, cap * sizeof (char *))) == NULL) {
+            return -1;
+        }
+        l->items = items;
+        l->cap = cap;
+    }
+    if ((item = strdup (s)) == NULL) {
+        return -1;
+    }
+    l->items[l->n++] = item;
+    return 0;
+}
+
+static char *list_pop (struct sweep_list *l)
+{
+    return (l->n == 0ul) ? NULL : l->items[--l->n];
+}
+
+static void list_clear (struct sweep_list *l)
+{
+    while (l->n > 0ul) {
+        free (l->items[--l->n]);
+    }
+}
+
+static void sweep_track (dyad_sweep_t *sw, flux_future_t *f)
+{
+    for (size_t i = 0ul; i < DYAD_SWEEP_INFLIGHT; i++) {
+        if (sw->inflight[i] == NULL) {
+            sw->inflight[i] = f;
+            sw->num_inflight++;
+            return;
+        }
+    }
+}
+
+static void sweep_untrack (dyad_sweep_t *sw, flux_future_t *f)
+{
+    for (size_t i = 0ul; i < DYAD_SWEEP_INFLIGHT; i++) {
+        if (sw->inflight[i] == f) {
+            sw->inflight[i] = NULL;
+            sw->num_inflight--;
+            break;
+        }
+    }
+    flux_future_destroy (f);
+}
+
+static void sweep_set_shard (dyad_sweep_t *sw)
+{
+    sw->ns = sw->ctx->kvs_namespace;
+    if (sw->num_shards > 1u && sw->ctx->kvs_namespace != NULL) {
+        snprintf (sw->shard_ns, PATH_MAX, DYAD_KVS_SHARD_FMT, sw->ctx->kvs_namespace, sw->shard);
+        sw->ns = sw->shard_ns;
+    }
+}
+
+static void sweep_commit_cb (flux_future_t *f, void *arg)
+{
+    dyad_sweep_t *sw = (dyad_sweep_t *)arg;
+
+    if (flux_future_get (f, NULL) < 0) {
+        DYAD_LOG_ERROR (sw->ctx, "DYAD_MOD: sweeper cannot commit to %s", sw->ns);
+        sw->failed = true;
+    } else {
+        sw->removed += (size_t)(uintptr_t)flux_future_aux_get (f, "dyad::removed");
+    }
+    sweep_untrack (sw, f);
+    sweep_step (sw);
+}
+
+// Commit the unlinks gathered so far. A slot must be free for the request.
+static void sweep_commit (dyad_sweep_t *sw)
+{
+    flux_future_t *f = flux_kvs_commit ((flux_t *)sw->ctx->h, sw->ns, 0, sw->txn);
+
+    if (f == NULL
+        || flux_future_aux_set (f, "dyad::removed", (void *)(uintptr_t)sw->pending, NULL) < 0
+        || flux_future_then (f, -1.0, sweep_commit_cb, sw) < 0) {
+        DYAD_LOG_ERROR (sw->ctx, "DYAD_MOD: sweeper cannot commit to %s", sw->ns);
+        flux_future_destroy (f);
+        sw->failed = true;
+    } else {
+        sweep_track (sw, f);
+    }
+    // The request carries its own copy of the transaction
+    flux_kvs_txn_destroy (sw->txn);
+    sw->txn = NULL;
+    sw->pending = 0ul;
+}
+
+static void sweep_record_cb (flux_future_t *f, void *arg)
+{
+    dyad_sweep_t *sw = (dyad_sweep_t *)arg;
+    json_int_t expires = -1;
+    const char *key = flux_kvs_lookup_get_key (f);
+
+    if (flux_kvs_lookup_get_unpack (f, "{s:I}", "expires", &expires) == 0
+        && expires < sw->now && !sw->failed) {
+        if (sw->txn == NULL && (sw->txn = flux_kvs_txn_create ()) == NULL) {
+            sw->failed = true;
+        } else if (flux_kvs_txn_unlink (sw->txn, 0, key) < 0) {
+            sw->failed = true;
+        } else {
+            sw->pending++;
+        }
+    }
+    sweep_untrack (sw, f);
+    if (sw->pending >= DYAD_SWEEP_BATCH) {
+        sweep_commit (sw);
+    }
+    sweep_step (sw);
+}
+
+static void sweep_dir_cb (flux_future_t *f, void *arg)
+{
+    dyad_sweep_t *sw = (dyad_sweep_t *)arg;
+    const flux_kvsdir_t *kvsdir = NULL;
+    flux_kvsitr_t *itr = NULL;
+    const char *name = NULL;
+    char *key = NULL;
+
+    // An empty namespace has no root directory to read yet
+    if (flux_kvs_lookup_get_dir (f, &kvsdir) < 0) {
+        goto sweep_dir_done;
+    }
+    if ((itr = flux_kvsitr_create (kvsdir)) == NULL) {
+        sw->failed = true;
+        goto sweep_dir_done;
+    }
+    while ((name = flux_kvsitr_next (itr)) != NULL) {
+        if ((key = flux_kvsdir_key_at (kvsdir, name)) == NULL
+            || list_push (flux_kvsdir_isdir (kvsdir, name) ? &sw->dirs : &sw->keys, key) < 0) {
+            sw->failed = true;
+            free (key);
+            break;
+        }
+        free (key);
+    }
+sweep_dir_done:;
+    flux_kvsitr_destroy (itr);
+    sweep_untrack (sw, f);
+    sweep_step (sw);
+}
+
+static void sweep_finish (dyad_sweep_t *sw)
+{
+    list_clear (&sw->dirs);
+    list_clear (&sw->keys);
+    flux_kvs_txn_destroy (sw->txn);
+    sw->txn = NULL;
+    sw->pending = 0ul;
+    sw->active = false;
+    if (sw->failed) {
+        DYAD_LOG_ERROR (sw->ctx, "DYAD_MOD: KVS sweep stopped early");
+    }
+    if (sw->removed > 0ul) {
+        DYAD_LOG_INFO (sw->ctx, "DYAD_MOD: swept %zu expired records from the KVS", sw->removed);
+    }
+}
+
+/* Keep up to DYAD_SWEEP_INFLIGHT lookups outstanding, records before
+ * directories so that the lists stay short, and move on to the next shard
+ * once the current one is drained and its last batch committed. */
+static void sweep_step (dyad_sweep_t *sw)
+{
+    flux_future_t *f = NULL;
+    char *key = NULL;
+
+    if (!sw->active) {
+        return;
+    }
+    for (;;) {
+        while (!sw->failed && sw->num_inflight < DYAD_SWEEP_INFLIGHT
+               && (sw->keys.n > 0ul || sw->dirs.n > 0ul)) {
+            if ((key = list_pop (&sw->keys)) != NULL) {
+                f = flux_kvs_lookup ((flux_t *)sw->ctx->h, sw->ns, 0, key);
+                if (f != NULL && flux_future_then (f, -1.0, sweep_record_cb, sw) < 0) {
+                    flux_future_destroy (f);
+                    f = NULL;
+                }
+            } else {
+                key = list_pop (&sw->dirs);
+                f = flux_kvs_lookup ((flux_t *)sw->ctx->h, sw->ns, FLUX_KVS_READDIR, key);
+                if (f != NULL && flux_future_then (f, -1.0, sweep_dir_cb, sw) < 0) {
+                    flux_future_destroy (f);
+                    f = NULL;
+                }
+            }
+            free (key);
+            if (f == NULL) {
+                sw->failed = true;
+                break;
+            }
+            sweep_track (sw, f);
+        }
+        if (sw->num_inflight > 0ul) {
+            return;
+        }
+        if (sw->failed) {
+            break;
+        }
+        if (sw->pending > 0ul) {
+            sweep_commit (sw);
+            continue;
+        }
+        if (++sw->shard >= sw->num_shards) {
+            break;
+        }
+        sweep_set_shard (sw);
+        if (list_push (&sw->dirs, ".") < 0) {
+            sw->failed = true;
+            break;
+        }
+    }
+    sweep_finish (sw);
+}
+
+dyad_rc_t dyad_sweep_create (const dyad_ctx_t *ctx, dyad_sweep_t **sw)
+{
+    dyad_sweep_t *s = (dyad_sweep_t *)calloc (1ul, sizeof (dyad_sweep_t));
+
+    if (s == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: cannot allocate the KVS sweeper");
+        return DYAD_RC_SYSFAIL;
+    }
+    s->ctx = ctx;
+    s->num_shards = (ctx->kvs_shards <= 1u) ? 1u : ctx->kvs_shards;
+    *sw = s;
+    return DYAD_RC_OK;
+}
+
+bool dyad_sweep_busy (const dyad_sweep_t *sw)
+{
+    return sw->active;
+}
+
+dyad_rc_t dyad_sweep_kvs_start (dyad_sweep_t *sw, int64_t now)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_rc_t rc = DYAD_RC_OK;
+
+    if (sw->active) {
+        rc = DYAD_RC_SYSFAIL;
+        goto sweep_start_done;
+    }
+    sw->now = now;
+    sw->shard = 0u;
+    sw->removed = 0ul;
+    sw->failed = false;
+    sweep_set_shard (sw);
+    if (list_push (&sw->dirs, ".") < 0) {
+        rc = DYAD_RC_SYSFAIL;
+        goto sweep_start_done;
+    }
+    sw->active = true;
+    sweep_step (sw);
+sweep_start_done:;
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
+void dyad_sweep_destroy (dyad_sweep_t *sw)
+{
+    if (sw == NULL) {
+        return;
+    }
+    for (size_t i = 0ul; i < DYAD_SWEEP_INFLIGHT; i++) {
+        flux_future_destroy (sw->inflight[i]);
+    }
+    list_clear (&sw->dirs);
+    list_clear (&sw->keys);
+    free (sw->dirs.items);
+    free (sw->keys.items);
+    flux_kvs_txn_destroy (sw->txn);
+    free (sw);
+}
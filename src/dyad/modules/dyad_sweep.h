@@ -0,0 +1,54 @@
+#ifndef DYAD_MODULES_DYAD_SWEEP_H
+#define DYAD_MODULES_DYAD_SWEEP_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+
+extern "C" {
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+// Largest number of keys removed in one KVS transaction by the sweeper
+#define DYAD_SWEEP_BATCH 4096u
+// Largest number of KVS requests the sweeper keeps outstanding at a time
+#define DYAD_SWEEP_INFLIGHT 64u
+
+/**
+ * Sweeper of DYAD's KVS namespace (every shard of it). A pass unlinks the
+ * records whose "expires" time is before the time it was started at. It never
+ * blocks the reactor: directories and records are looked up asynchronously,
+ * with at most DYAD_SWEEP_INFLIGHT requests outstanding, and the removals are
+ * committed in batches of up to DYAD_SWEEP_BATCH keys. The pass logs how many
+ * records it removed when it is done.
+ */
+typedef struct dyad_sweep dyad_sweep_t;
+
+dyad_rc_t dyad_sweep_create (const dyad_ctx_t *ctx, dyad_sweep_t **sw);
+
+// Whether a pass is still under way
+bool dyad_sweep_busy (const dyad_sweep_t *sw);
+
+// Start a pass for the time `now'. The previous one must have finished.
+dyad_rc_t dyad_sweep_kvs_start (dyad_sweep_t *sw, int64_t now);
+
+// Abandon the pass under way, if any, and free the sweeper
+void dyad_sweep_destroy (dyad_sweep_t *sw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_MODULES_DYAD_SWEEP_H */
@@ -0,0 +1,376 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  // _GNU_SOURCE
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_logging.h>
+#include <dyad/common/dyad_profiler.h>
+#include <dyad/core/dyad_core.h>
+#include <dyad/modules/dyad_watch.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <flux/core.h>
+#include <ftw.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Most file descriptors nftw () keeps open while adding watches
+#define DYAD_WATCH_FDS 64
+#define DYAD_WATCH_DIR_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR)
+
+// Files handed to the publishing thread together
+struct watch_batch {
+    struct watch_batch *next;
+    char **paths;
+    size_t num_paths;
+};
+
+struct dyad_watch {
+    dyad_ctx_t *ctx;
+    int fd;                     // inotify instance
+    flux_watcher_t *fd_w;       // reads the events of fd
+    flux_watcher_t *timer;      // flushes a batch that is not full
+    double period;
+    char **dirs;                // path of each watched directory by descriptor
+    size_t num_dirs;
+    char *pending[DYAD_WATCH_BATCH];
+    size_t num_pending;
+    bool queue_files;           // whether a walk also queues the files it finds
+    // Publishing waits on the KVS or on other brokers, so it is done by a
+    // thread with its own copy of the context and handle, off the reactor
+    dyad_ctx_t pub_ctx;
+    pthread_t thread;
+    bool started;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct watch_batch *head;
+    struct watch_batch *tail;
+    bool stop;
+};
+
+// nftw () takes no callback argument
+static __thread dyad_watch_t *watch_walk = NULL;
+
+static void watch_batch_free (struct watch_batch *b)
+{
+    for (size_t i = 0ul; i < b->num_paths; i++) {
+        free (b->paths[i]);
+    }
+    free (b->paths);
+    free (b);
+}
+
+static void *watch_main (void *arg)
+{
+    dyad_watch_t *w = (dyad_watch_t *)arg;
+    struct watch_batch *b = NULL;
+
+    for (;;) {
+        pthread_mutex_lock (&w->lock);
+        while (w->head == NULL && !w->stop) {
+            pthread_cond_wait (&w->wake, &w->lock);
+        }
+        // The queue is emptied before stopping, so that no file is lost
+        if ((b = w->head) == NULL) {
+            pthread_mutex_unlock (&w->lock);
+            break;
+        }
+        if ((w->head = b->next) == NULL) {
+            w->tail = NULL;
+        }
+        pthread_mutex_unlock (&w->lock);
+
+        DYAD_LOG_INFO (&w->pub_ctx, "DYAD_MOD: publishing %zu watched files", b->num_paths);
+        if (DYAD_IS_ERROR (dyad_produce_multi (&w->pub_ctx,
+                                               (const char *const *)b->paths,
+                                               b->num_paths))) {
+            DYAD_LOG_ERROR (&w->pub_ctx,
+                            "DYAD_MOD: cannot publish %zu watched files",
+                            b->num_paths);
+        }
+        watch_batch_free (b);
+    }
+    return NULL;
+}
+
+/* Hand the pending files over to the publishing thread */
+static dyad_rc_t watch_flush (dyad_watch_t *w)
+{
+    struct watch_batch *b = NULL;
+
+    flux_watcher_stop (w->timer);
+    if (w->num_pending == 0ul) {
+        return DYAD_RC_OK;
+    }
+    if ((b = (struct watch_batch *)calloc (1ul, sizeof (struct watch_batch))) == NULL
+        || (b->paths = (char **)malloc (w->num_pending * sizeof (char *))) == NULL) {
+        DYAD_LOG_ERROR (w->ctx, "DYAD_MOD: cannot publish %zu watched files", w->num_pending);
+        free (b);
+        for (size_t i = 0ul; i < w->num_pending; i++) {
+            free (w->pending[i]);
+            w->pending[i] = NULL;
+        }
+        w->num_pending = 0ul;
+        return DYAD_RC_SYSFAIL;
+    }
+    memcpy (b->paths, w->pending, w->num_pending * sizeof (char *));
+    b->num_paths = w->num_pending;
+    memset (w->pending, 0, w->num_pending * sizeof (char *));
+    w->num_pending = 0ul;
+    pthread_mutex_lock (&w->lock);
+    if (w->tail != NULL) {
+        w->tail->next = b;
+    } else {
+        w->head = b;
+    }
+    w->tail = b;
+    pthread_cond_signal (&w->wake);
+    pthread_mutex_unlock (&w->lock);
+    return DYAD_RC_OK;
+}
+
+static void watch_queue (dyad_watch_t *w, const char *path)
+{
+    if ((w->pending[w->num_pending] = strdup (path)) == NULL) {
+        DYAD_LOG_ERROR (w->ctx, "DYAD_MOD: cannot queue %s for publishing", path);
+        return;
+    }
+    if (++w->num_pending == DYAD_WATCH_BATCH) {
+        watch_flush (w);
+    } else if (w->num_pending == 1ul) {
+        flux_timer_watcher_reset (w->timer, w->period, 0.0);
+        flux_watcher_start (w->timer);
+    }
+}
+
+static int watch_add_dir (dyad_watch_t *w, const char *path)
+{
+    char **dirs = NULL;
+    int wd = inotify_add_watch (w->fd, path, DYAD_WATCH_DIR_MASK);
+
+    if (wd < 0) {
+        DYAD_LOG_ERROR (w->ctx, "DYAD_MOD: cannot watch %s: %s", path, strerror (errno));
+        return -1;
+    }
+    if ((size_t)wd >= w->num_dirs) {
+        dirs = (char **)realloc (w->dirs, ((size_t)wd + 1ul) * 2ul * sizeof (char *));
+        if (dirs == NULL) {
+            return -1;
+        }
+        memset (dirs + w->num_dirs, 0, (((size_t)wd + 1ul) * 2ul - w->num_dirs) * sizeof (char *));
+        w->dirs = dirs;
+        w->num_dirs = ((size_t)wd + 1ul) * 2ul;
+    }
+    free (w->dirs[wd]);
+    w->dirs[wd] = strdup (path);
+    return (w->dirs[wd] == NULL) ? -1 : 0;
+}
+
+/* Whether some process has `path' open for writing. A read lease cannot be
+ * taken on such a file. Where leases are not available, the file is taken as
+ * complete. */
+static bool watch_open_for_write (const char *path)
+{
+    int fd = open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    bool busy = false;
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fcntl (fd, F_SETLEASE, F_RDLCK) == 0) {
+        fcntl (fd, F_SETLEASE, F_UNLCK);
+    } else {
+        busy = (errno == EAGAIN);
+    }
+    close (fd);
+    return busy;
+}
+
+static int watch_visit (const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+    if (typeflag == FTW_D) {
+        watch_add_dir (watch_walk, fpath);
+    } else if (typeflag == FTW_F && S_ISREG (sb->st_mode) && watch_walk->queue_files
+               && !watch_open_for_write (fpath)) {
+        watch_queue (watch_walk, fpath);
+    }
+    return 0;
+}
+
+/* Watch the tree under `root'. A directory moved or created under a watched
+ * one may already hold files by the time its watch is added, so those are
+ * queued too, except the ones still being written. As the watch of their
+ * directory is in place by then, those are queued once closed. */
+static int watch_add_tree (dyad_watch_t *w, const char *root, bool queue_files)
+{
+    int ret = 0;
+    w->queue_files = queue_files;
+    watch_walk = w;
+    ret = nftw (root, watch_visit, DYAD_WATCH_FDS, FTW_PHYS);
+    watch_walk = NULL;
+    return ret;
+}
+
+static void watch_event_cb (flux_reactor_t *r, flux_watcher_t *fw, int revents, void *arg)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_watch_t *w = (dyad_watch_t *)arg;
+    char buf[64 * 1024] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    char path[PATH_MAX + 1] = {'\0'};
+    const struct inotify_event *ev = NULL;
+    ssize_t len = 0l;
+
+    while ((len = read (w->fd, buf, sizeof (buf))) > 0) {
+        for (char *p = buf; p < buf + len; p += sizeof (struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                DYAD_LOG_ERROR (w->ctx, "DYAD_MOD: inotify queue overflowed, events were lost");
+                continue;
+            }
+            if (ev->wd < 0 || (size_t)ev->wd >= w->num_dirs || w->dirs[ev->wd] == NULL) {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                free (w->dirs[ev->wd]);
+                w->dirs[ev->wd] = NULL;
+                continue;
+            }
+            if (ev->len == 0u) {
+                continue;
+            }
+            snprintf (path, sizeof (path), "%s/%s", w->dirs[ev->wd], ev->name);
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    watch_add_tree (w, path, true);
+                }
+            } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                watch_queue (w, path);
+            }
+        }
+    }
+    if (len < 0 && errno != EAGAIN) {
+        DYAD_LOG_ERROR (w->ctx, "DYAD_MOD: cannot read inotify events: %s", strerror (errno));
+    }
+    DYAD_C_FUNCTION_END ();
+}
+
+static void watch_timer_cb (flux_reactor_t *r, flux_watcher_t *tw, int revents, void *arg)
+{
+    watch_flush ((dyad_watch_t *)arg);
+}
+
+dyad_rc_t dyad_watch_create (dyad_ctx_t *ctx, double period, dyad_watch_t **watch)
+{
+    DYAD_C_FUNCTION_START ();
+    dyad_rc_t rc = DYAD_RC_OK;
+    flux_reactor_t *r = flux_get_reactor ((flux_t *)ctx->h);
+    dyad_watch_t *w = NULL;
+
+    *watch = NULL;
+    if (ctx->prod_managed_path == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: watching needs a producer-managed path");
+        rc = DYAD_RC_BADMANAGEDPATH;
+        goto watch_create_done;
+    }
+    if ((w = (dyad_watch_t *)calloc (1ul, sizeof (dyad_watch_t))) == NULL) {
+        rc = DYAD_RC_SYSFAIL;
+        goto watch_create_done;
+    }
+    w->ctx = ctx;
+    w->fd = -1;
+    w->period = (period > 0.0) ? period : DYAD_WATCH_PERIOD_DEFAULT;
+    pthread_mutex_init (&w->lock, NULL);
+    pthread_cond_init (&w->wake, NULL);
+    w->pub_ctx = *ctx;
+    // Nothing runs the reactor of the thread's handle
+    w->pub_ctx.async_publish = false;
+    if ((w->pub_ctx.h = flux_open (NULL, 0)) == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: cannot open a Flux handle for the watch thread");
+        rc = DYAD_RC_FLUXFAIL;
+        goto watch_create_done;
+    }
+    if (pthread_create (&w->thread, NULL, watch_main, w) != 0) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: cannot start the watch thread");
+        rc = DYAD_RC_SYSFAIL;
+        goto watch_create_done;
+    }
+    w->started = true;
+    if ((w->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: inotify_init1 failed: %s", strerror (errno));
+        rc = DYAD_RC_SYSFAIL;
+        goto watch_create_done;
+    }
+    w->fd_w = flux_fd_watcher_create (r, w->fd, FLUX_POLLIN, watch_event_cb, w);
+    w->timer = flux_timer_watcher_create (r, w->period, 0.0, watch_timer_cb, w);
+    if (w->fd_w == NULL || w->timer == NULL) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: cannot create the watchers of %s", ctx->prod_managed_path);
+        rc = DYAD_RC_FLUXFAIL;
+        goto watch_create_done;
+    }
+    if (watch_add_tree (w, ctx->prod_managed_path, false) != 0) {
+        DYAD_LOG_ERROR (ctx, "DYAD_MOD: cannot walk %s", ctx->prod_managed_path);
+        rc = DYAD_RC_BADFIO;
+        goto watch_create_done;
+    }
+    flux_watcher_start (w->fd_w);
+    DYAD_LOG_INFO (ctx, "DYAD_MOD: watching %s for produced files", ctx->prod_managed_path);
+
+watch_create_done:;
+    if (DYAD_IS_ERROR (rc)) {
+        dyad_watch_destroy (w);
+    } else {
+        *watch = w;
+    }
+    DYAD_C_FUNCTION_END ();
+    return rc;
+}
+
+void dyad_watch_destroy (dyad_watch_t *watch)
+{
+    struct watch_batch *b = NULL;
+
+    if (watch == NULL) {
+        return;
+    }
+    if (watch->timer != NULL) {
+        watch_flush (watch);
+    }
+    pthread_mutex_lock (&watch->lock);
+    watch->stop = true;
+    pthread_cond_broadcast (&watch->wake);
+    pthread_mutex_unlock (&watch->lock);
+    if (watch->started) {
+        pthread_join (watch->thread, NULL);
+    }
+    // Left over only if the thread could not start
+    while ((b = watch->head) != NULL) {
+        watch->head = b->next;
+        watch_batch_free (b);
+    }
+    if (watch->pub_ctx.h != NULL) {
+        flux_close ((flux_t *)watch->pub_ctx.h);
+    }
+    pthread_cond_destroy (&watch->wake);
+    pthread_mutex_destroy (&watch->lock);
+    flux_watcher_destroy (watch->fd_w);
+    flux_watcher_destroy (watch->timer);
+    if (watch->fd >= 0) {
+        close (watch->fd);
+    }
+    for (size_t i = 0ul; i < watch->num_dirs; i++) {
+        free (watch->dirs[i]);
+    }
+    free (watch->dirs);
+    free (watch);
+}
@@ -0,0 +1,41 @@
+#ifndef DYAD_MODULES_DYAD_WATCH_H
+#define DYAD_MODULES_DYAD_WATCH_H
+
+#if defined(DYAD_HAS_CONFIG)
+#include <dyad/dyad_config.hpp>
+#else
+#error "no config"
+#endif
+
+#include <dyad/common/dyad_rc.h>
+#include <dyad/common/dyad_structures.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest number of files published together by the watcher
+#define DYAD_WATCH_BATCH 4096u
+// Default time, in seconds, a closed file waits for others to join its batch
+#define DYAD_WATCH_PERIOD_DEFAULT 0.01
+
+typedef struct dyad_watch dyad_watch_t;
+
+/**
+ * Watch the producer-managed directory of `ctx', including the directories
+ * created under it later, and publish the files closed after writing
+ * (IN_CLOSE_WRITE) or moved in (IN_MOVED_TO). Files closed within `period'
+ * seconds of each other are published together, up to DYAD_WATCH_BATCH, by
+ * a thread of the watcher rather than from the reactor. This lets producers
+ * run without the LD_PRELOAD wrapper.
+ */
+dyad_rc_t dyad_watch_create (dyad_ctx_t *ctx, double period, dyad_watch_t **watch);
+
+// Publish the pending files and stop watching
+void dyad_watch_destroy (dyad_watch_t *watch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYAD_MODULES_DYAD_WATCH_H */
@@ -23,6 +23,7 @@
 
 #include <dyad/utils/utils.h>
 
+#include <dyad/common/dyad_dtl.h>
 #include <dyad/common/dyad_logging.h>
 #include <dyad/common/dyad_profiler.h>
 #include <dyad/utils/murmur3.h>
@@ -32,6 +33,7 @@
 #include <sys/stat.h>   // open
 #include <sys/types.h>  // open
 #include <sys/file.h>
+#include <sys/syscall.h>  // SYS_openat
 #include <unistd.h>     // readlink
 
 #if defined(__cplusplus)
@@ -348,6 +350,11 @@ int mkpath (const char* dir, const mode_t m)
     return mkdir (dir, m);
 }
 
+int dyad_open_raw (const char* path, int oflag, mode_t mode)
+{
+    return (int)syscall (SYS_openat, AT_FDCWD, path, oflag | O_CLOEXEC, mode);
+}
+
 int mkdir_as_needed (const char* path, const mode_t m)
 {
     if (path == NULL || strlen (path) == 0ul) {
@@ -460,26 +467,6 @@ bool is_fd_dir (int fd)
     return false;
 }
 
-#if DYAD_SPIN_WAIT
-bool get_stat (const char* path, unsigned int max_retry, long ns_sleep)
-{
-    struct stat sb;
-    unsigned int num_retry = 0u;
-    struct timespec tim, tim2;
-    tim.tv_sec = 0;
-    tim.tv_nsec = ns_sleep;
-
-    while ((stat (path, &sb) != 0) && (num_retry < max_retry)) {
-        nanosleep (&tim, &tim2);
-        num_retry++;
-    }
-    if (num_retry == max_retry) {
-        return false;
-    }
-    return true;
-}
-#endif  // DYAD_SPIN_WAIT
-
 ssize_t get_file_size (int fd)
 {
     const ssize_t file_size = lseek (fd, 0, SEEK_END);
@@ -495,6 +482,45 @@ ssize_t get_file_size (int fd)
     return file_size;
 }
 
+int dyad_dtl_multi_unpack (const char* __restrict__ packed,
+                           size_t packed_len,
+                           size_t num_files,
+                           const char** __restrict__ upaths,
+                           const char** __restrict__ data,
+                           int64_t* __restrict__ data_lens)
+{
+    uint64_t count = 0u;
+    struct dyad_dtl_multi_entry entry;
+    size_t pos = sizeof (count);
+    size_t data_len = 0ul;
+
+    if (packed == NULL || packed_len < sizeof (count)) {
+        return -1;
+    }
+    memcpy (&count, packed, sizeof (count));
+    if (count != (uint64_t)num_files
+        || (packed_len - pos) / sizeof (entry) < num_files) {
+        return -1;
+    }
+    pos += num_files * sizeof (entry);
+    for (size_t i = 0ul; i < num_files; i++) {
+        // The entries may not be aligned within the transfer buffer
+        memcpy (&entry, packed + sizeof (count) + i * sizeof (entry), sizeof (entry));
+        data_len = (entry.data_len > 0) ? (size_t)entry.data_len : 0ul;
+        if (entry.upath_len == 0u || entry.upath_len > packed_len - pos
+            || data_len > packed_len - pos - entry.upath_len
+            || packed[pos + entry.upath_len - 1u] != '\0') {
+            return -1;
+        }
+        upaths[i] = packed + pos;
+        pos += entry.upath_len;
+        data[i] = packed + pos;
+        data_lens[i] = (entry.data_len < 0) ? -1 : (int64_t)data_len;
+        pos += data_len;
+    }
+    return 0;
+}
+
 dyad_rc_t dyad_excl_flock (const dyad_ctx_t* __restrict__ ctx, int fd,
                            struct flock* __restrict__ lock)
 {
@@ -77,6 +77,11 @@ bool cmp_canonical_path_prefix (const dyad_ctx_t* __restrict__ ctx,
 
 int mkdir_as_needed (const char* path, const mode_t m);
 
+/// Open `path' with the system call itself, bypassing any interposed open (),
+/// such as the one of the DYAD wrapper, so that threads of DYAD reading the
+/// files they publish do not depend on the state of the wrapper
+int dyad_open_raw (const char* path, int oflag, mode_t mode);
+
 /// Obtain path from the file descriptor
 int get_path (const int fd, const size_t max_size, char* path);
 
@@ -86,13 +91,21 @@ bool is_path_dir (const char* path);
 /// Check if the file identified by the file descriptor is a directory
 bool is_fd_dir (int fd);
 
-#if DYAD_SPIN_WAIT
-/// Try access file info
-bool get_stat (const char* path, unsigned int max_retry, long ns_sleep);
-#endif  // DYAD_SPIN_WAIT
-
 ssize_t get_file_size (int fd);
 
+/**
+ * Index the packed buffer of a multi-file transfer holding `num_files' files
+ * (see struct dyad_dtl_multi_entry). On success, upaths[i] and data[i] point
+ * into `packed' and data_lens[i] is the size of file i, or -1 if the producer
+ * could not read it. Returns 0, or -1 if the buffer is malformed or truncated.
+ */
+int dyad_dtl_multi_unpack (const char* __restrict__ packed,
+                           size_t packed_len,
+                           size_t num_files,
+                           const char** __restrict__ upaths,
+                           const char** __restrict__ data,
+                           int64_t* __restrict__ data_lens);
+
 dyad_rc_t dyad_excl_flock (const dyad_ctx_t* __restrict__ ctx, int fd,
                            struct flock* __restrict__ lock);
 dyad_rc_t dyad_shared_flock (const dyad_ctx_t* __restrict__ ctx, int fd,
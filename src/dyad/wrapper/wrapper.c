@@ -46,6 +46,7 @@ using namespace std;  // std::clock ()
 #include <dyad/common/dyad_profiler.h>
 #include <dyad/core/dyad_core.h>
 #include <dyad/core/dyad_ctx.h>
+#include <dyad/core/dyad_publish.h>
 #include <dyad/utils/utils.h>
 #include <fcntl.h>
 #include <libgen.h>  // dirname
@@ -102,6 +103,9 @@ void dyad_wrapper_init (void)
     DYAD_C_FUNCTION_START ();
     dyad_ctx_init (DYAD_COMM_RECV, NULL);
     ctx = ctx_mutable = dyad_ctx_get ();
+    if (ctx != NULL && ctx->initialized && (ctx->publish_thread || dyad_group_sync (ctx))) {
+        dyad_publish_start (ctx_mutable);
+    }
     DYAD_LOG_INFO (ctx, "DYAD Wrapper Initialized");
     DYAD_C_FUNCTION_END ();
 }
@@ -158,7 +162,8 @@ DYAD_DLL_EXPORTED int open (const char *path, int oflag, ...)
         DPRINTF (ctx, "DYAD_SYNC: failed open sync (\"%s\").", path);
         goto real_call;
     }
-    IPRINTF (ctx, "DYAD_SYNC: exists open sync (\"%s\").", path);
+    IPRINTF (ctx, "DYAD_SYNC: exists open sync (\"%s\") from %s.", path,
+             dyad_source_name[ctx->last_source]);
 
 real_call:;
     int ret = (func_ptr (path, oflag, mode));
@@ -215,7 +220,8 @@ DYAD_DLL_EXPORTED FILE *fopen (const char *path, const char *mode)
         DPRINTF (ctx, "DYAD_SYNC: failed fopen sync (\"%s\").\n", path);
         goto real_call;
     }
-    IPRINTF (ctx, "DYAD_SYNC: exits fopen sync (\"%s\").\n", path);
+    IPRINTF (ctx, "DYAD_SYNC: exits fopen sync (\"%s\") from %s.\n", path,
+             dyad_source_name[ctx->last_source]);
 
 real_call:;
     FILE *fh = (func_ptr (path, mode));
@@ -302,7 +308,9 @@ real_call:;  // semicolon here to avoid the error
     }
 
     if (to_sync && wronly == 1) {
-        if (ctx->fsync_write) {
+        // In group commit, the publisher thread flushes the file, if it
+        // could be started
+        if (ctx->fsync_write && !(dyad_group_sync (ctx) && ctx->publisher != NULL)) {
             fsync (fd);
 
 #if DYAD_SYNC_DIR
@@ -317,7 +325,7 @@ real_call:;  // semicolon here to avoid the error
             DPRINTF (ctx, "Failed close (\"%s\").: %s\n", path, strerror (errno));
         }
         IPRINTF (ctx, "DYAD_SYNC: enters close sync (\"%s\").\n", path);
-        if (DYAD_IS_ERROR (dyad_produce (ctx_mutable, path))) {
+        if (DYAD_IS_ERROR (dyad_publish_enqueue (ctx_mutable, path))) {
             DPRINTF (ctx, "DYAD_SYNC: failed close sync (\"%s\").\n", path);
         }
         IPRINTF (ctx, "DYAD_SYNC: exits close sync (\"%s\").\n", path);
@@ -388,7 +396,9 @@ real_call:;
     }
 
     if (to_sync && wronly == 1) {
-        if (ctx->fsync_write) {
+        // In group commit, fclose () flushes the stream and the publisher
+        // thread, if it could be started, flushes the file
+        if (ctx->fsync_write && !(dyad_group_sync (ctx) && ctx->publisher != NULL)) {
             fflush (fp);
             fsync (fd);
 #if DYAD_SYNC_DIR
@@ -403,7 +413,7 @@ real_call:;
             DPRINTF (ctx, "Failed fclose (\"%s\").\n", path);
         }
         IPRINTF (ctx, "DYAD_SYNC: enters fclose sync (\"%s\").\n", path);
-        if (DYAD_IS_ERROR (dyad_produce (ctx_mutable, path))) {
+        if (DYAD_IS_ERROR (dyad_publish_enqueue (ctx_mutable, path))) {
             DPRINTF (ctx, "DYAD_SYNC: failed fclose sync (\"%s\").\n", path);
         }
         IPRINTF (ctx, "DYAD_SYNC: exits fclose sync (\"%s\").\n", path);
@@ -414,6 +424,45 @@ real_call:;
     return rc;
 }
 
+/**
+ * Fetch a set of files before the application opens them, grouping the files
+ * of each producer into a single transfer (see dyad_consume_multi ()). The
+ * opens that follow find the files in place. An application preloading the
+ * wrapper declares this function itself, or looks it up with dlsym ().
+ *
+ * @param[in] paths      the files to fetch
+ * @param[in] num_paths  the number of entries in paths
+ *
+ * @return 0 if every file in the consumer-managed path was fetched, -1 with
+ *         errno set to EIO if any of them failed, or to EINVAL if any file is
+ *         outside of the consumer-managed path
+ */
+DYAD_DLL_EXPORTED int dyad_wrapper_prefetch (const char *const *paths, size_t num_paths)
+{
+    DYAD_C_FUNCTION_START ();
+    DYAD_C_FUNCTION_UPDATE_INT ("num_paths", num_paths);
+    dyad_rc_t rc = DYAD_RC_OK;
+    int ret = 0;
+
+    if (!(ctx && ctx->h) || !ctx->reenter) {
+        IPRINTF (ctx, "DYAD_SYNC: prefetch not applicable.\n");
+        goto prefetch_done;
+    }
+    rc = dyad_consume_multi (ctx_mutable, paths, num_paths, NULL);
+    if (rc == DYAD_RC_UNTRACKED) {
+        errno = EINVAL;
+        ret = -1;
+    } else if (DYAD_IS_ERROR (rc)) {
+        DPRINTF (ctx, "DYAD_SYNC: failed to prefetch %zu files.\n", num_paths);
+        errno = EIO;
+        ret = -1;
+    }
+
+prefetch_done:;
+    DYAD_C_FUNCTION_END ();
+    return ret;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,9 +1,12 @@
 #include <dyad/common/dyad_logging.h>
 #include <dyad/core/dyad_core.h>
 #include <dyad/core/dyad_ctx.h>
+#include <dyad/dtl/dyad_dtl_api.h>
 #include <fcntl.h>
 
 #include <cstddef>
+#include <cstring>
+#include <thread>
 
 int create_files_per_broker() {
   char filename[4096], first_file[4096];
@@ -213,4 +216,137 @@ TEST_CASE("LocalNodeDataBandwidth", "[files= " + std::to_string(args.number_of_f
   REQUIRE(rc >= 0);
   REQUIRE(clean_directories() == 0);
   REQUIRE(posttest() == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("TcpDtlLocalhost", "[module=tcp_dtl]"
+                             "[method=send_file,recv_file]") {
+  size_t file_len = 1024 * 1024 + 7;
+  std::string src_path = "/tmp/dyad_tcp_src_" + std::to_string(getpid());
+  std::string dst_path = "/tmp/dyad_tcp_dst_" + std::to_string(getpid());
+  dyad_ctx_t producer = {};
+  dyad_ctx_t consumer = {};
+  producer.h = info.flux_handle;
+  producer.pid = getpid();
+  consumer.h = info.flux_handle;
+  consumer.pid = getpid();
+  REQUIRE(dyad_dtl_init(&consumer, DYAD_DTL_TCP, DYAD_COMM_RECV, false) ==
+          DYAD_RC_OK);
+  REQUIRE(dyad_dtl_init(&producer, DYAD_DTL_TCP, DYAD_COMM_SEND, false) ==
+          DYAD_RC_OK);
+  // Sizes that are not a multiple of the pipe buffer take a partial splice
+  std::string data(file_len, '\0');
+  for (size_t i = 0; i < file_len; ++i) data[i] = (char)('a' + i % 26);
+  int src_fd = open(src_path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+  REQUIRE(src_fd >= 0);
+  REQUIRE(write(src_fd, data.data(), file_len) == (ssize_t)file_len);
+  REQUIRE(lseek(src_fd, 0, SEEK_SET) == 0);
+  int dst_fd = open(dst_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+  REQUIRE(dst_fd >= 0);
+  SECTION("Test file round trip") {
+    json_t* payload = NULL;
+    REQUIRE(consumer.dtl_handle->rpc_pack(&consumer, "tcp_dtl_test",
+                                          info.broker_idx,
+                                          &payload) == DYAD_RC_OK);
+    char* payload_str = json_dumps(payload, JSON_COMPACT);
+    flux_msg_t* msg = flux_request_encode(DYAD_DTL_RPC_NAME, payload_str);
+    REQUIRE(msg != NULL);
+    char* upath = NULL;
+    REQUIRE(producer.dtl_handle->rpc_unpack(&producer, msg, &upath) ==
+            DYAD_RC_OK);
+    REQUIRE(std::string(upath) == "tcp_dtl_test");
+    REQUIRE(producer.dtl_handle->establish_connection(&producer) ==
+            DYAD_RC_OK);
+    // Returns once queued, so the consumer is not needed to get here
+    REQUIRE(producer.dtl_handle->send_file(&producer, src_fd, file_len) ==
+            DYAD_RC_OK);
+    producer.dtl_handle->close_connection(&producer);
+    size_t recv_len = 0;
+    REQUIRE(consumer.dtl_handle->recv_file(&consumer, dst_fd, &recv_len) ==
+            DYAD_RC_OK);
+    consumer.dtl_handle->close_connection(&consumer);
+    REQUIRE(recv_len == file_len);
+    std::string copy(file_len, '\0');
+    int check_fd = open(dst_path.c_str(), O_RDONLY);
+    REQUIRE(check_fd >= 0);
+    REQUIRE(read(check_fd, &copy[0], file_len) == (ssize_t)file_len);
+    close(check_fd);
+    REQUIRE(copy == data);
+    flux_msg_destroy(msg);
+    free(payload_str);
+    json_decref(payload);
+  }
+  close(src_fd);
+  close(dst_fd);
+  unlink(src_path.c_str());
+  unlink(dst_path.c_str());
+  REQUIRE(dyad_dtl_finalize(&producer) == DYAD_RC_OK);
+  REQUIRE(dyad_dtl_finalize(&consumer) == DYAD_RC_OK);
+}
+
+#ifdef DYAD_ENABLE_FABRIC_DTL
+TEST_CASE("FabricDtlLocalhost", "[module=fabric_dtl]"
+                                "[method=send,recv]") {
+  size_t data_len = 64 * 1024 + 3;
+  dyad_ctx_t producer = {};
+  dyad_ctx_t consumer = {};
+  // The producer waits for its send to complete, so it needs its own handle
+  producer.h = flux_open(NULL, 0);
+  REQUIRE(producer.h != NULL);
+  producer.pid = getpid();
+  consumer.h = info.flux_handle;
+  consumer.pid = getpid();
+  REQUIRE(dyad_dtl_init(&consumer, DYAD_DTL_FABRIC, DYAD_COMM_RECV, false) ==
+          DYAD_RC_OK);
+  REQUIRE(dyad_dtl_init(&producer, DYAD_DTL_FABRIC, DYAD_COMM_SEND, false) ==
+          DYAD_RC_OK);
+  std::string data(data_len, '\0');
+  for (size_t i = 0; i < data_len; ++i) data[i] = (char)('a' + i % 26);
+  SECTION("Test buffer round trip") {
+    for (int round = 0; round < 2; ++round) {
+      json_t* payload = NULL;
+      // Posts the receive that the producer's send matches
+      REQUIRE(consumer.dtl_handle->rpc_pack(&consumer, "fabric_dtl_test",
+                                            info.broker_idx,
+                                            &payload) == DYAD_RC_OK);
+      char* payload_str = json_dumps(payload, JSON_COMPACT);
+      flux_msg_t* msg = flux_request_encode(DYAD_DTL_RPC_NAME, payload_str);
+      REQUIRE(msg != NULL);
+      char* upath = NULL;
+      REQUIRE(producer.dtl_handle->rpc_unpack(&producer, msg, &upath) ==
+              DYAD_RC_OK);
+      REQUIRE(std::string(upath) == "fabric_dtl_test");
+      dyad_rc_t send_rc = DYAD_RC_OK;
+      std::thread sender([&producer, &data, &send_rc]() {
+        void* buf = NULL;
+        send_rc = producer.dtl_handle->establish_connection(&producer);
+        if (!DYAD_IS_ERROR(send_rc)) {
+          send_rc = producer.dtl_handle->get_buffer(&producer, data.size(),
+                                                    &buf);
+        }
+        if (!DYAD_IS_ERROR(send_rc)) {
+          memcpy(buf, data.data(), data.size());
+          send_rc = producer.dtl_handle->send(&producer, buf, data.size());
+          producer.dtl_handle->return_buffer(&producer, &buf);
+        }
+        producer.dtl_handle->close_connection(&producer);
+      });
+      void* recv_buf = NULL;
+      size_t recv_len = 0;
+      dyad_rc_t recv_rc =
+          consumer.dtl_handle->recv(&consumer, &recv_buf, &recv_len);
+      sender.join();
+      REQUIRE(send_rc == DYAD_RC_OK);
+      REQUIRE(recv_rc == DYAD_RC_OK);
+      REQUIRE(recv_len == data_len);
+      REQUIRE(std::string((const char*)recv_buf, recv_len) == data);
+      consumer.dtl_handle->close_connection(&consumer);
+      flux_msg_destroy(msg);
+      free(payload_str);
+      json_decref(payload);
+    }
+  }
+  REQUIRE(dyad_dtl_finalize(&producer) == DYAD_RC_OK);
+  REQUIRE(dyad_dtl_finalize(&consumer) == DYAD_RC_OK);
+  flux_close(producer.h);
+}
+#endif  // DYAD_ENABLE_FABRIC_DTL
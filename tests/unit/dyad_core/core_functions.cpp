@@ -1,5 +1,19 @@
 
+#include <dyad/common/dyad_dtl.h>
+#include <dyad/core/dyad_cache.h>
 #include <dyad/core/dyad_core.h>
+#include <dyad/core/dyad_md_api.h>
+#include <dyad/modules/dyad_gc.h>
+#include <dyad/utils/utils.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
 /**
  * Test cases
  */
@@ -68,4 +82,345 @@ TEST_CASE("gen_path_key",
     int result = gen_path_key(str, path_key, sizeof(path_key), 3, 5);
     REQUIRE(result == -1);
   }
-}
\ No newline at end of file
+}
+namespace dyad::test {
+/* Pack files the way the DYAD module does (see struct dyad_dtl_multi_entry).
+ * A negative length marks a file the producer could not read. */
+std::string pack_multi(const std::vector<std::pair<std::string, std::string>>& files,
+                       const std::vector<int64_t>& data_lens) {
+  std::string packed;
+  uint64_t count = files.size();
+  packed.append(reinterpret_cast<const char*>(&count), sizeof(count));
+  for (size_t i = 0; i < files.size(); i++) {
+    struct dyad_dtl_multi_entry entry = {files[i].first.size() + 1, data_lens[i]};
+    packed.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+  }
+  for (size_t i = 0; i < files.size(); i++) {
+    packed.append(files[i].first.c_str(), files[i].first.size() + 1);
+    if (data_lens[i] > 0) {
+      packed.append(files[i].second);
+    }
+  }
+  return packed;
+}
+}  // namespace dyad::test
+
+TEST_CASE("dyad_dtl_multi_unpack",
+          "[module=dyad_utils]"
+          "[method=dyad_dtl_multi_unpack]") {
+  const std::vector<std::pair<std::string, std::string>> files = {
+      {"a/one.dat", "0123456789"}, {"b/two.dat", ""}, {"three.dat", "xyz"}};
+  const char* upaths[3] = {nullptr};
+  const char* data[3] = {nullptr};
+  int64_t data_lens[3] = {0};
+  SECTION("should_index_every_file_in_request_order") {
+    std::string packed = dyad::test::pack_multi(files, {10, 0, 3});
+    REQUIRE(dyad_dtl_multi_unpack(packed.data(), packed.size(), 3, upaths,
+                                  data, data_lens) == 0);
+    for (size_t i = 0; i < files.size(); i++) {
+      REQUIRE(files[i].first == upaths[i]);
+      REQUIRE(data_lens[i] == (int64_t)files[i].second.size());
+      REQUIRE(files[i].second == std::string(data[i], data_lens[i]));
+    }
+  }
+  SECTION("should_report_unreadable_files_and_keep_the_others") {
+    std::string packed = dyad::test::pack_multi(files, {10, -1, 3});
+    REQUIRE(dyad_dtl_multi_unpack(packed.data(), packed.size(), 3, upaths,
+                                  data, data_lens) == 0);
+    REQUIRE(data_lens[0] == 10);
+    REQUIRE(data_lens[1] == -1);
+    REQUIRE(data_lens[2] == 3);
+    REQUIRE(std::string(data[2], data_lens[2]) == "xyz");
+  }
+  SECTION("should_reject_a_count_other_than_requested") {
+    std::string packed = dyad::test::pack_multi(files, {10, 0, 3});
+    REQUIRE(dyad_dtl_multi_unpack(packed.data(), packed.size(), 2, upaths,
+                                  data, data_lens) == -1);
+  }
+  SECTION("should_reject_a_truncated_buffer") {
+    std::string packed = dyad::test::pack_multi(files, {10, 0, 3});
+    for (size_t len = 0; len < packed.size(); len++) {
+      REQUIRE(dyad_dtl_multi_unpack(packed.data(), len, 3, upaths, data,
+                                    data_lens) == -1);
+    }
+  }
+  SECTION("should_reject_a_upath_without_terminating_nul") {
+    std::string packed = dyad::test::pack_multi(files, {10, 0, 3});
+    const size_t first_upath =
+        sizeof(uint64_t) + 3 * sizeof(struct dyad_dtl_multi_entry);
+    packed[first_upath + files[0].first.size()] = '!';
+    REQUIRE(dyad_dtl_multi_unpack(packed.data(), packed.size(), 3, upaths,
+                                  data, data_lens) == -1);
+  }
+}
+
+namespace dyad::test {
+std::string make_temp_dir() {
+  char dir[] = "/tmp/dyad_unit_XXXXXX";
+  return (mkdtemp(dir) != NULL) ? std::string(dir) : std::string();
+}
+
+void write_file(const std::string& path, const std::string& data) {
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+  if (fd >= 0) {
+    ssize_t n = write(fd, data.data(), data.size());
+    (void)n;
+    close(fd);
+  }
+}
+
+void remove_dir(const std::string& dir) {
+  std::string cmd = "rm -rf " + dir;
+  int status = system(cmd.c_str());
+  (void)status;
+}
+
+bool exists(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+}  // namespace dyad::test
+
+TEST_CASE("dyad_record",
+          "[module=dyad_core]"
+          "[method=dyad_pack_record,dyad_unpack_record]") {
+  std::string dir = dyad::test::make_temp_dir();
+  REQUIRE(!dir.empty());
+  dyad::test::write_file(dir + "/small.dat", "0123456789");
+  dyad::test::write_file(dir + "/large.dat", std::string(100, 'x'));
+  dyad_ctx_t ctx = dyad_ctx_default;
+  ctx.prod_managed_path = &dir[0];
+  ctx.rank = 7u;
+  ctx.inline_threshold = 64u;
+  char fpath[] = "small.dat";
+  dyad_metadata_t mdata = {};
+  mdata.fpath = fpath;
+  json_t* record = NULL;
+  SECTION("should_round_trip_an_inlined_file") {
+    REQUIRE(dyad_pack_record(&ctx, "small.dat", 3ul, true, &record) ==
+            DYAD_RC_OK);
+    REQUIRE(dyad_unpack_record(&ctx, record, &mdata) == DYAD_RC_OK);
+    REQUIRE(mdata.owner_rank == 7u);
+    REQUIRE(mdata.file_size == 10ul);
+    REQUIRE(mdata.version == 3ul);
+    REQUIRE(mdata.inline_data != NULL);
+    REQUIRE(std::string(mdata.inline_data, mdata.inline_len) == "0123456789");
+  }
+  SECTION("should_not_inline_without_data") {
+    REQUIRE(dyad_pack_record(&ctx, "small.dat", 0ul, false, &record) ==
+            DYAD_RC_OK);
+    REQUIRE(dyad_unpack_record(&ctx, record, &mdata) == DYAD_RC_OK);
+    REQUIRE(mdata.file_size == 10ul);
+    REQUIRE(mdata.version == 0ul);
+    REQUIRE(mdata.inline_data == NULL);
+  }
+  SECTION("should_not_inline_files_over_the_threshold") {
+    REQUIRE(dyad_pack_record(&ctx, "large.dat", 0ul, true, &record) ==
+            DYAD_RC_OK);
+    REQUIRE(dyad_unpack_record(&ctx, record, &mdata) == DYAD_RC_OK);
+    REQUIRE(mdata.file_size == 100ul);
+    REQUIRE(mdata.inline_data == NULL);
+  }
+  SECTION("should_publish_the_owner_only_of_missing_files") {
+    REQUIRE(dyad_pack_record(&ctx, "missing.dat", 0ul, true, &record) ==
+            DYAD_RC_OK);
+    REQUIRE(dyad_unpack_record(&ctx, record, &mdata) == DYAD_RC_OK);
+    REQUIRE(mdata.owner_rank == 7u);
+    REQUIRE(mdata.file_size == 0ul);
+  }
+  SECTION("should_read_records_of_older_producers") {
+    record = json_integer(5);
+    REQUIRE(dyad_unpack_record(&ctx, record, &mdata) == DYAD_RC_OK);
+    REQUIRE(mdata.owner_rank == 5u);
+    REQUIRE(mdata.inline_data == NULL);
+  }
+  SECTION("should_trust_only_the_owner_of_newer_formats") {
+    record = json_pack("{s:i, s:i, s:I, s:s}", "format",
+                       DYAD_RECORD_FORMAT + 1, "rank", 4, "size",
+                       (json_int_t)10, "data", "MDEyMzQ1Njc4OQ==");
+    REQUIRE(dyad_unpack_record(&ctx, record, &mdata) == DYAD_RC_OK);
+    REQUIRE(mdata.owner_rank == 4u);
+    REQUIRE(mdata.file_size == 0ul);
+    REQUIRE(mdata.inline_data == NULL);
+  }
+  SECTION("should_reject_a_record_without_owner") {
+    record = json_pack("{s:i}", "format", DYAD_RECORD_FORMAT);
+    REQUIRE(dyad_unpack_record(&ctx, record, &mdata) == DYAD_RC_BADMETADATA);
+  }
+  json_decref(record);
+  free(mdata.inline_data);
+  dyad::test::remove_dir(dir);
+}
+
+TEST_CASE("dyad_placement_match",
+          "[module=dyad_core]"
+          "[method=dyad_placement_match]") {
+  uint32_t rank = 99u;
+  SECTION("should_extract_the_owner_rank") {
+    REQUIRE(dyad_placement_match("out/rank%r/*", "out/rank12/a.dat", &rank));
+    REQUIRE(rank == 12u);
+  }
+  SECTION("should_match_the_rank_after_a_wildcard") {
+    REQUIRE(dyad_placement_match("*_%r.dat", "dir/x_3.dat", &rank));
+    REQUIRE(rank == 3u);
+  }
+  SECTION("should_backtrack_over_the_digits_of_the_rank") {
+    REQUIRE(dyad_placement_match("%r1.dat", "121.dat", &rank));
+    REQUIRE(rank == 12u);
+    REQUIRE(dyad_placement_match("%r_%r.dat", "3_14.dat", &rank));
+    REQUIRE(rank == 3u);
+    REQUIRE(dyad_placement_match("r%r_%r", "r12_345", &rank));
+    REQUIRE(rank == 12u);
+    REQUIRE(dyad_placement_match("%r%r", "12", &rank));
+    REQUIRE(rank == 1u);
+  }
+  SECTION("should_match_patterns_without_a_rank") {
+    REQUIRE(dyad_placement_match("a/*.dat", "a/b.dat", &rank));
+    REQUIRE(rank == 99u);
+  }
+  SECTION("should_reject_other_paths") {
+    REQUIRE_FALSE(dyad_placement_match("out/rank%r/*", "in/rank1/a", &rank));
+    REQUIRE_FALSE(dyad_placement_match("rank%r", "rankx", &rank));
+    REQUIRE_FALSE(dyad_placement_match("rank%r", "rank", &rank));
+    REQUIRE_FALSE(dyad_placement_match("a/*.dat", "a/b.txt", &rank));
+    REQUIRE(rank == 99u);
+  }
+  SECTION("should_reject_ranks_out_of_range") {
+    REQUIRE_FALSE(dyad_placement_match("r%r", "r4294967296", &rank));
+  }
+}
+
+TEST_CASE("dyad_md_kvs_shard_of",
+          "[module=dyad_core]"
+          "[method=dyad_md_kvs_shard_of]") {
+  SECTION("should_use_one_namespace_without_shards") {
+    REQUIRE(dyad_md_kvs_shard_of("a/b/c", 0u) == 0u);
+    REQUIRE(dyad_md_kvs_shard_of("a/b/c", 1u) == 0u);
+  }
+  SECTION("should_spread_keys_over_every_shard") {
+    const uint32_t num_shards = 8u;
+    std::vector<size_t> counts(num_shards, 0ul);
+    for (int i = 0; i < 1024; i++) {
+      std::string key = "key_" + std::to_string(i);
+      uint32_t shard = dyad_md_kvs_shard_of(key.c_str(), num_shards);
+      REQUIRE(shard < num_shards);
+      REQUIRE(dyad_md_kvs_shard_of(key.c_str(), num_shards) == shard);
+      counts[shard]++;
+    }
+    for (uint32_t shard = 0u; shard < num_shards; shard++) {
+      REQUIRE(counts[shard] > 0ul);
+    }
+  }
+}
+
+TEST_CASE("dyad_cache_admit",
+          "[module=dyad_core]"
+          "[method=dyad_cache_admit]") {
+  std::string dir = dyad::test::make_temp_dir();
+  REQUIRE(!dir.empty());
+  dyad_ctx_t ctx = dyad_ctx_default;
+  ctx.cons_managed_path = &dir[0];
+  ctx.cache_bytes = 1000ul;
+  ctx.cache_used = 0;
+  const char mark = '1';
+  // f0 was read least recently, f4 most recently, all past the grace period
+  for (int i = 0; i < 5; i++) {
+    std::string path = dir + "/f" + std::to_string(i);
+    dyad::test::write_file(path, std::string(300, 'x'));
+    if (setxattr(path.c_str(), DYAD_CACHED_XATTR, &mark, sizeof(mark), 0) != 0) {
+      WARN("No user extended attributes in " << dir << ", skipping");
+      dyad::test::remove_dir(dir);
+      return;
+    }
+    const struct timespec times[2] = {{1000000 + i, 0}, {1000000 + i, 0}};
+    REQUIRE(utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+  }
+  SECTION("should_keep_files_within_the_budget") {
+    ctx.cache_bytes = 2000ul;
+    REQUIRE(dyad_cache_admit(&ctx, 1500ul) == DYAD_RC_OK);
+    for (int i = 0; i < 5; i++) {
+      REQUIRE(dyad::test::exists(dir + "/f" + std::to_string(i)));
+    }
+  }
+  SECTION("should_evict_the_least_recently_read_files") {
+    // 1500 bytes are over the budget, so files go until 90% of it is left
+    REQUIRE(dyad_cache_admit(&ctx, 1500ul) == DYAD_RC_OK);
+    REQUIRE_FALSE(dyad::test::exists(dir + "/f0"));
+    REQUIRE_FALSE(dyad::test::exists(dir + "/f1"));
+    REQUIRE(dyad::test::exists(dir + "/f2"));
+    REQUIRE(dyad::test::exists(dir + "/f3"));
+    REQUIRE(dyad::test::exists(dir + "/f4"));
+    REQUIRE(ctx.cache_used == 900);
+  }
+  SECTION("should_leave_copies_in_progress_alone") {
+    dyad::test::write_file(dir + "/f5.dyad.1.1", std::string(5000, 'x'));
+    REQUIRE(dyad_cache_admit(&ctx, 1500ul) == DYAD_RC_OK);
+    REQUIRE(dyad::test::exists(dir + "/f5.dyad.1.1"));
+    REQUIRE(ctx.cache_used == 900);
+  }
+  SECTION("should_leave_files_dyad_did_not_fetch_alone") {
+    std::string other = dir + "/other";
+    dyad::test::write_file(other, std::string(5000, 'x'));
+    const struct timespec times[2] = {{1, 0}, {1, 0}};
+    REQUIRE(utimensat(AT_FDCWD, other.c_str(), times, 0) == 0);
+    REQUIRE(dyad_cache_admit(&ctx, 1500ul) == DYAD_RC_OK);
+    REQUIRE(dyad::test::exists(other));
+    REQUIRE(ctx.cache_used == 900);
+  }
+  SECTION("should_keep_files_used_within_the_grace_period") {
+    const struct timespec now[2] = {{0, UTIME_NOW}, {0, UTIME_NOW}};
+    REQUIRE(utimensat(AT_FDCWD, (dir + "/f0").c_str(), now, 0) == 0);
+    REQUIRE(dyad_cache_admit(&ctx, 1500ul) == DYAD_RC_OK);
+    REQUIRE(dyad::test::exists(dir + "/f0"));
+    REQUIRE_FALSE(dyad::test::exists(dir + "/f1"));
+    REQUIRE_FALSE(dyad::test::exists(dir + "/f2"));
+    REQUIRE(dyad::test::exists(dir + "/f3"));
+  }
+  dyad::test::remove_dir(dir);
+}
+
+TEST_CASE("dyad_gc_count",
+          "[module=dyad_gc]"
+          "[method=dyad_gc_count]") {
+  std::string dir = dyad::test::make_temp_dir();
+  REQUIRE(!dir.empty());
+  dyad_ctx_t ctx = dyad_ctx_default;
+  std::string counted = dir + "/counted.dat";
+  std::string kept = dir + "/kept.dat";
+  uint32_t readers = 2u;
+  dyad::test::write_file(counted, "data");
+  dyad::test::write_file(kept, "data");
+  if (setxattr(counted.c_str(), DYAD_READERS_XATTR, &readers, sizeof(readers),
+               0) != 0) {
+    WARN("No user extended attributes in " << dir << ", skipping");
+    dyad::test::remove_dir(dir);
+    return;
+  }
+  dyad_gc_h gc = NULL;
+  REQUIRE(dyad_gc_init(&ctx, &gc) == DYAD_RC_OK);
+  SECTION("should_report_the_last_expected_reader") {
+    REQUIRE_FALSE(dyad_gc_count(&ctx, gc, "counted.dat", counted.c_str(), "a"));
+    REQUIRE(dyad_gc_count(&ctx, gc, "counted.dat", counted.c_str(), "b"));
+    // Forgotten once reported, so counting starts over
+    REQUIRE_FALSE(dyad_gc_count(&ctx, gc, "counted.dat", counted.c_str(), "a"));
+  }
+  SECTION("should_count_each_reader_once") {
+    for (int i = 0; i < 4; i++) {
+      REQUIRE_FALSE(
+          dyad_gc_count(&ctx, gc, "counted.dat", counted.c_str(), "a"));
+    }
+    REQUIRE(dyad_gc_count(&ctx, gc, "counted.dat", counted.c_str(), "b"));
+  }
+  SECTION("should_not_count_files_without_readers") {
+    for (int i = 0; i < 4; i++) {
+      REQUIRE_FALSE(dyad_gc_count(&ctx, gc, "kept.dat", kept.c_str(), "a"));
+    }
+  }
+  SECTION("should_not_count_unknown_readers") {
+    REQUIRE_FALSE(dyad_gc_count(&ctx, gc, "counted.dat", counted.c_str(), NULL));
+    REQUIRE_FALSE(dyad_gc_count(&ctx, gc, "counted.dat", counted.c_str(), "a"));
+  }
+  dyad_gc_finalize(&gc);
+  REQUIRE(gc == NULL);
+  dyad::test::remove_dir(dir);
+}